@@ -88,6 +88,8 @@ int io_js_eval_buffer (JSContext*,const void*,int,const char*,int);
 void io_js_add_helpers(JSContext*);
 void io_js_dump_error (JSContext*);
 int io_js_enqueue_task (JSContext*,JSJobFunc*,int argc,JSValueConst*);
+bool io_js_encoding_append_value (JSContext*,io_encoding_t*,JSValueConst);
+int io_js_encoding_append_json (JSContext*,io_encoding_t*,JSValueConst,JSValueConst,JSValueConst);
 void io_js_do_tasks (JSRuntime*);
 
 #ifdef IMPLEMENT_JS_IO
@@ -98,6 +100,55 @@ void io_js_do_tasks (JSRuntime*);
 //-----------------------------------------------------------------------------
 #include <io_device.h>
 
+//
+// append the string value of a js value to an encoding, ASCII strings
+// are appended directly from the string's own characters
+//
+bool
+io_js_encoding_append_value (
+	JSContext *ctx,io_encoding_t *encoding,JSValueConst value
+) {
+	const char *str;
+	size_t len;
+
+	str = JS_ToCStringBorrow (ctx,&len,value);
+	if (str) {
+		io_encoding_append_string (encoding,str,len);
+	} else {
+		str = JS_ToCStringLen (ctx,&len,value);
+		if (!str) {
+			return false;
+		}
+		io_encoding_append_string (encoding,str,len);
+		JS_FreeCString (ctx,str);
+	}
+	return true;
+}
+
+static int
+io_js_encoding_write_json (
+	JSContext *ctx,void *opaque,const uint8_t *buf,size_t len
+) {
+	io_encoding_append_string ((io_encoding_t*) opaque,(const char*) buf,len);
+	return 0;
+}
+
+//
+// append the JSON text of a js value to an encoding, the engine's JSON
+// writer outputs UTF-8 directly so no JS string is created
+//
+// returns -1 on exception and 0 if the value has no JSON representation
+//
+int
+io_js_encoding_append_json (
+	JSContext *ctx,io_encoding_t *encoding,JSValueConst value,
+	JSValueConst replacer,JSValueConst space
+) {
+	return JS_JSONStringifyWrite (
+		ctx,io_js_encoding_write_json,encoding,value,replacer,space
+	);
+}
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -111,21 +162,15 @@ io_quickjs_print (JSContext *ctx, JSValueConst this_val,int argc, JSValueConst *
 	io_encoding_t *print = io_socket_new_message (log);
 
 	if (print) {
-		const char *str;
 		int i;
 
 		for (i = 0; i < argc; i++) {
 			if (i != 0) {
 				io_encoding_append_byte (print,' ');
 			}
-				
-			str = JS_ToCString(ctx, argv[i]);
-			if (!str) {
+			if (!io_js_encoding_append_value (ctx,print,argv[i])) {
 				goto exception;
 			}
-			
-			io_encoding_append_string (print,str,strlen(str));
-			JS_FreeCString(ctx, str);
 		}
 	
 		io_socket_send_message (log,print);
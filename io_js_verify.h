@@ -136,6 +136,255 @@ TEST_BEGIN(test_quickjs_eval_1) {
 }
 TEST_END
 
+TEST_BEGIN(test_quickjs_string_rope_1) {
+	memory_info_t bminfo_begin,bminfo_end;
+	JSRuntime *rt;
+	JSContext *ctx;
+	const char *begin = ""
+		"var s = '', t = [];"
+		"for (var i = 0; i < 4000; i++) {"
+		"	s += 'chunk ' + i + ';';"
+		"	t.push('chunk ' + i + ';');"
+		"}"
+		"t = t.join('');"
+		"VERIFY("
+		"		s.length == t.length"
+		"	&&	s == t"
+		"	&&	s[t.length - 1] == ';'"
+		"	&&	s.indexOf('chunk 3999') == t.indexOf('chunk 3999')"
+		");"
+	;
+
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_begin);
+
+	rt = JS_NewRuntime(TEST_IO);
+	ctx = JS_NewContextRaw(rt);
+
+	JS_SetGCThreshold (rt,-1);
+	
+	JS_AddIntrinsicBaseObjects (ctx);
+	JS_AddIntrinsicEval (ctx);
+	io_js_add_global_test_functions (ctx);
+
+	test_quickjs_eval_1_result = 0;
+	io_js_eval_buffer (ctx,begin,strlen(begin),"<test>",0);
+	VERIFY (test_quickjs_eval_1_result == 1,NULL);
+
+	JS_FreeContext(ctx);
+	JS_FreeRuntime(rt);
+
+	io_log_flush(TEST_IO);
+	
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_end);
+	VERIFY(bminfo_end.used_bytes == bminfo_begin.used_bytes,NULL);
+}
+TEST_END
+
+TEST_BEGIN(test_quickjs_string_slice_1) {
+	memory_info_t bminfo_begin,bminfo_cycle,bminfo_end;
+	JSRuntime *rt;
+	JSContext *ctx;
+	const char *begin = ""
+		"var keep = [];"
+		"function parse (n) {"
+		"	for (var i = keep.length; i < n; i++) {"
+		"		var line = ('line ' + i + ';').repeat(512);"
+		"		keep.push(line.substring(10,50));"
+		"	}"
+		"}"
+		"parse (10);"
+	;
+	const char *cycle = "parse (100);";
+
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_begin);
+
+	rt = JS_NewRuntime(TEST_IO);
+	ctx = JS_NewContextRaw(rt);
+
+	JS_SetGCThreshold (rt,-1);
+	
+	JS_AddIntrinsicBaseObjects (ctx);
+	JS_AddIntrinsicEval (ctx);
+
+	io_js_eval_buffer (ctx,begin,strlen(begin),"<test>",0);
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_cycle);
+
+	// a short substring does not keep its line alive
+	io_js_eval_buffer (ctx,cycle,strlen(cycle),"<test>",0);
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_end);
+	VERIFY(bminfo_end.used_bytes - bminfo_cycle.used_bytes < 90 * 4096 / 8,NULL);
+
+	JS_FreeContext(ctx);
+	JS_FreeRuntime(rt);
+
+	io_log_flush(TEST_IO);
+	
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_end);
+	VERIFY(bminfo_end.used_bytes == bminfo_begin.used_bytes,NULL);
+}
+TEST_END
+
+TEST_BEGIN(test_quickjs_json_stringify_1) {
+	memory_info_t bminfo_begin,bminfo_end;
+	JSRuntime *rt;
+	JSContext *ctx;
+	const char *begin = ""
+		"var a = [], o = {};"
+		"for (var i = 0; i < 10000; i++) {"
+		"	a = [a];"
+		"	o = {o:o};"
+		"}"
+		"var s = JSON.stringify(a), t = JSON.stringify(o);"
+		"var c = [a], circular = false;"
+		"a.push(c);"
+		"try {JSON.stringify(c);} catch (e) {circular = e instanceof TypeError;}"
+		"VERIFY("
+		"		s.length == 20002 && s.lastIndexOf('[') == 10000"
+		"	&&	t.length == 60002 && t.indexOf('{}') == 50000"
+		"	&&	circular"
+		");"
+	;
+
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_begin);
+
+	rt = JS_NewRuntime(TEST_IO);
+	ctx = JS_NewContextRaw(rt);
+
+	JS_SetGCThreshold (rt,-1);
+	
+	JS_AddIntrinsicBaseObjects (ctx);
+	JS_AddIntrinsicJSON (ctx);
+	JS_AddIntrinsicEval (ctx);
+	io_js_add_global_test_functions (ctx);
+
+	test_quickjs_eval_1_result = 0;
+	io_js_eval_buffer (ctx,begin,strlen(begin),"<test>",0);
+	VERIFY (test_quickjs_eval_1_result == 1,NULL);
+
+	JS_FreeContext(ctx);
+	JS_FreeRuntime(rt);
+
+	io_log_flush(TEST_IO);
+	
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_end);
+	VERIFY(bminfo_end.used_bytes == bminfo_begin.used_bytes,NULL);
+}
+TEST_END
+
+TEST_BEGIN(test_quickjs_object_free_1) {
+	memory_info_t bminfo_begin,bminfo_cycle,bminfo_end;
+	JSRuntime *rt;
+	JSContext *ctx;
+	const char *begin = ""
+		"function cycle (n) {"
+		"	var a = [];"
+		"	for (var i = 0; i < n; i++) {"
+		"		a.push ("
+		"			{},{x:i},{x:i,y:i},{a:1,b:2,c:3,d:4,e:5,f:6,g:7,h:8,i:9},"
+		"			[i],function () {return i;}"
+		"		);"
+		"	}"
+		"}"
+		"cycle (1000);"
+	;
+	const char *cycle = "cycle (10000);";
+
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_begin);
+
+	rt = JS_NewRuntime(TEST_IO);
+	ctx = JS_NewContextRaw(rt);
+
+	JS_SetGCThreshold (rt,-1);
+	
+	JS_AddIntrinsicBaseObjects (ctx);
+	JS_AddIntrinsicEval (ctx);
+
+	io_js_eval_buffer (ctx,begin,strlen(begin),"<test>",0);
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_cycle);
+
+	// the memory of objects of all sizes is returned once they are freed
+	io_js_eval_buffer (ctx,cycle,strlen(cycle),"<test>",0);
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_end);
+	VERIFY(bminfo_end.used_bytes == bminfo_cycle.used_bytes,NULL);
+
+	JS_FreeContext(ctx);
+	JS_FreeRuntime(rt);
+
+	io_log_flush(TEST_IO);
+	
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_end);
+	VERIFY(bminfo_end.used_bytes == bminfo_begin.used_bytes,NULL);
+}
+TEST_END
+
+TEST_BEGIN(test_quickjs_cbor_1) {
+	memory_info_t bminfo_begin,bminfo_end;
+	JSRuntime *rt;
+	JSContext *ctx;
+	const char *begin = ""
+		"var m = {id:1,name:'node',t:-20.5,ok:true,v:[1,null,1e300]};"
+		"var b = cbor.encode(m);"
+		"var h = Array.from(new Uint8Array(cbor.encode([100,-1000,1.5])));"
+		"var tags = new Uint8Array(200001);"
+		"tags.fill(0xc6); tags[200000] = 1;"
+		"var z = cbor.decode(cbor.encode({'a\\0b':1,'a':2}));"
+		"var truncated = false;"
+		"var d = cbor.decode(cbor.encode({at:new Date(1363896240500)})).at;"
+		"var u = new Uint8Array([0,1,2,3]);"
+		"var v = Array.from(new Uint8Array(cbor.encode([u.subarray(1,3),new DataView(u.buffer,3)])));"
+		"var j = cbor.decode(cbor.encode([{toJSON:function(k) {return k + '!';}}]));"
+		"var p = Array.from(new Uint8Array(cbor.encode([new Number(2),new String('x'),new Boolean(true)])));"
+		"var f = Array.from(new Uint8Array(cbor.encode([-0,Infinity,-Infinity,NaN,5.960464477539063e-8,0.00006103515625])));"
+		"var refused = [function () {},Symbol(),{f:function () {}}].filter(function (x) {"
+		"	try {cbor.encode(x); return false;} catch (e) {return e instanceof TypeError;}"
+		"});"
+		"try {cbor.decode(tags.subarray(0,200000));} catch (e) {truncated = e instanceof SyntaxError;}"
+		"VERIFY("
+		"		b instanceof ArrayBuffer"
+		"	&&	JSON.stringify(cbor.decode(b)) == JSON.stringify(m)"
+		"	&&	h.join() == '131,24,100,57,3,231,249,62,0'"
+		"	&&	cbor.decode(new Uint8Array([0xc1,0xd8,0x40,0x02])) == 2"
+		"	&&	cbor.decode(tags) == 1"
+		"	&&	truncated"
+		"	&&	z['a\\0b'] === 1 && z.a === 2"
+		"	&&	d instanceof Date && d.getTime() == 1363896240500"
+		"	&&	v.join() == '130,66,1,2,65,3'"
+		"	&&	j[0] == '0!'"
+		"	&&	p.join() == '131,2,97,120,245'"
+		"	&&	f.join() == '134,249,128,0,249,124,0,249,252,0,249,126,0,249,0,1,249,4,0'"
+		"	&&	refused.length == 3"
+		");"
+	;
+
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_begin);
+
+	rt = JS_NewRuntime(TEST_IO);
+	ctx = JS_NewContextRaw(rt);
+
+	JS_SetGCThreshold (rt,-1);
+	
+	JS_AddIntrinsicBaseObjects (ctx);
+	JS_AddIntrinsicDate (ctx);
+	JS_AddIntrinsicJSON (ctx);
+	JS_AddIntrinsicTypedArrays (ctx);
+	JS_AddIntrinsicEval (ctx);
+	io_js_cbor_module (ctx);
+	io_js_add_global_test_functions (ctx);
+
+	test_quickjs_eval_1_result = 0;
+	io_js_eval_buffer (ctx,begin,strlen(begin),"<test>",0);
+	VERIFY (test_quickjs_eval_1_result == 1,NULL);
+
+	JS_FreeContext(ctx);
+	JS_FreeRuntime(rt);
+
+	io_log_flush(TEST_IO);
+	
+	io_byte_memory_get_info (io_get_byte_memory(TEST_IO),&bminfo_end);
+	VERIFY(bminfo_end.used_bytes == bminfo_begin.used_bytes,NULL);
+}
+TEST_END
+
 UNIT_SETUP(setup_quickjs_unit_test) {
 	io_value_memory_get_info (io_get_short_term_value_memory (TEST_IO),TEST_MEMORY_INFO);
 	io_byte_memory_get_info (io_get_byte_memory (TEST_IO),TEST_MEMORY_INFO + 1);
@@ -157,6 +406,11 @@ quickjs_unit_test (V_unit_test_t *unit) {
 	static V_test_t const tests[] = {
 		test_quickjs_create_1,
 		test_quickjs_eval_1,
+		test_quickjs_string_rope_1,
+		test_quickjs_string_slice_1,
+		test_quickjs_json_stringify_1,
+		test_quickjs_object_free_1,
+		test_quickjs_cbor_1,
 		0
 	};
 	unit->name = "quickjs";
@@ -0,0 +1,70 @@
+/*
+ *
+ * cbor module benchmark
+ *
+ * compares cbor.encode/cbor.decode with JSON.stringify/JSON.parse on
+ * typical node messages, run with the cbor module and print available
+ *
+ */
+"use strict";
+
+function telemetry (n) {
+	var records = [];
+	for (var i = 0; i < n; i++) {
+		records.push ({
+			id: i,
+			node: "node-" + (i % 16),
+			time: 1600000000 + i,
+			temperature: 20.5 + (i % 10) / 4,
+			humidity: i % 100,
+			ok: (i & 1) == 0,
+			readings: [i,i + 1,i + 2,i + 3],
+		});
+	}
+	return records;
+}
+
+function config () {
+	return {
+		name: "gateway",
+		version: [1,4,2],
+		network: {address: "10.0.0.12",mask: 24,mtu: 1280,ipv6: true},
+		sockets: [
+			{name: "console",speed: 115200,enabled: true},
+			{name: "radio",channel: 26,power: -3.5,enabled: false},
+		],
+		description: "a longer text field with some words in it",
+	};
+}
+
+function measure (name,payload,count) {
+	var text = JSON.stringify (payload);
+	var binary = cbor.encode (payload);
+	var t0,i;
+
+	t0 = Date.now ();
+	for (i = 0; i < count; i++) JSON.stringify (payload);
+	var stringify = Date.now () - t0;
+
+	t0 = Date.now ();
+	for (i = 0; i < count; i++) cbor.encode (payload);
+	var encode = Date.now () - t0;
+
+	t0 = Date.now ();
+	for (i = 0; i < count; i++) JSON.parse (text);
+	var parse = Date.now () - t0;
+
+	t0 = Date.now ();
+	for (i = 0; i < count; i++) cbor.decode (binary);
+	var decode = Date.now () - t0;
+
+	print (
+		name + ": json " + text.length + " bytes, cbor " + binary.byteLength
+		+ " bytes; stringify " + stringify + " ms, encode " + encode
+		+ " ms; parse " + parse + " ms, decode " + decode + " ms"
+	);
+}
+
+measure ("config",config (),20000);
+measure ("telemetry x10",telemetry (10),5000);
+measure ("telemetry x1000",telemetry (1000),50);
@@ -0,0 +1,1185 @@
+/*
+ *
+ * cbor module
+ *
+ * binary encoding of js values (RFC 8949)
+ *
+ * LICENSE
+ * =======
+ * See end of file for license terms.
+ *
+ */
+#ifndef io_js_cbor_module_H_
+#define io_js_cbor_module_H_
+#include <io_js.h>
+#include <math.h>
+
+void io_js_cbor_module (JSContext*);
+bool io_js_cbor_append_value (JSContext*,io_encoding_t*,JSValueConst);
+JSValue io_js_cbor_decode (JSContext*,const uint8_t*,size_t);
+
+#ifdef IMPLEMENT_JS_IO
+//-----------------------------------------------------------------------------
+//
+// implementation
+//
+//-----------------------------------------------------------------------------
+
+#define CBOR_MAX_DEPTH				256
+#define CBOR_KEY_CACHE_SIZE		32		// power of two
+#define CBOR_KEY_CACHE_LENGTH		23		// longest key held in the cache
+#define CBOR_BUFFER_SIZE			256		// initial size of the encoder buffer
+#define CBOR_ATOM_NULL				0		// no atom, as returned on error
+#define CBOR_TAG_EPOCH				1		// date as seconds since the epoch
+
+enum {
+	CBOR_UNSIGNED = 0,
+	CBOR_NEGATIVE,
+	CBOR_BYTES,
+	CBOR_TEXT,
+	CBOR_ARRAY,
+	CBOR_MAP,
+	CBOR_TAG,
+	CBOR_SIMPLE,
+};
+
+#define CBOR_INDEFINITE				31
+#define CBOR_BREAK					0xff
+
+#define CBOR_FALSE					0xf4
+#define CBOR_TRUE						0xf5
+#define CBOR_NULL						0xf6
+#define CBOR_UNDEFINED				0xf7
+#define CBOR_HALF						0xf9
+#define CBOR_FLOAT					0xfa
+#define CBOR_DOUBLE					0xfb
+
+//
+// map keys are the same for many maps so their text is remembered
+//
+typedef struct {
+	JSAtom atom;
+	uint8_t length;
+	char key[CBOR_KEY_CACHE_LENGTH];
+} io_js_cbor_key_t;
+
+static uint32_t
+io_js_cbor_key_hash (const char *key,size_t length) {
+	uint32_t h = 2166136261u;
+	while (length--) {
+		h = (h ^ (uint8_t) *key++) * 16777619u;
+	}
+	return h;
+}
+
+static void
+io_js_cbor_free_keys (JSContext *ctx,io_js_cbor_key_t *keys) {
+	if (keys) {
+		int i;
+		for (i = 0; i < CBOR_KEY_CACHE_SIZE; i++) {
+			if (keys[i].atom != CBOR_ATOM_NULL) {
+				JS_FreeAtom (ctx,keys[i].atom);
+			}
+		}
+		js_free (ctx,keys);
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// encoder
+//
+//-----------------------------------------------------------------------------
+
+typedef struct {
+	JSContext *ctx;
+	uint8_t *buffer;
+	size_t length;
+	size_t size;
+	io_js_cbor_key_t *keys;			// indexed by atom
+	JSAtom atoms[2];					// interned on first object
+	int depth;
+} io_js_cbor_encoder_t;
+
+enum {
+	CBOR_ATOM_LENGTH = 0,
+	CBOR_ATOM_TO_JSON,
+};
+
+static void
+io_js_cbor_encoder_init (JSContext *ctx,io_js_cbor_encoder_t *this) {
+	this->ctx = ctx;
+	this->buffer = NULL;
+	this->length = 0;
+	this->size = 0;
+	this->keys = NULL;
+	this->atoms[CBOR_ATOM_LENGTH] = CBOR_ATOM_NULL;
+	this->atoms[CBOR_ATOM_TO_JSON] = CBOR_ATOM_NULL;
+	this->depth = 0;
+}
+
+static void
+io_js_cbor_encoder_free (io_js_cbor_encoder_t *this) {
+	io_js_cbor_free_keys (this->ctx,this->keys);
+	JS_FreeAtomList (this->ctx,this->atoms,SIZEOF(this->atoms));
+	js_free (this->ctx,this->buffer);
+}
+
+static bool
+io_js_cbor_reserve (io_js_cbor_encoder_t *this,size_t size) {
+	if (this->length + size > this->size) {
+		size_t new_size;
+		uint8_t *buffer;
+
+		new_size = this->size * 2;
+		if (new_size < CBOR_BUFFER_SIZE) {
+			new_size = CBOR_BUFFER_SIZE;
+		}
+		if (new_size < this->length + size) {
+			new_size = this->length + size;
+		}
+		buffer = js_realloc (this->ctx,this->buffer,new_size);
+		if (!buffer) {
+			return false;
+		}
+		this->buffer = buffer;
+		this->size = new_size;
+	}
+	return true;
+}
+
+static bool
+io_js_cbor_put_byte (io_js_cbor_encoder_t *this,uint8_t byte) {
+	if (io_js_cbor_reserve (this,1)) {
+		this->buffer[this->length++] = byte;
+		return true;
+	} else {
+		return false;
+	}
+}
+
+static bool
+io_js_cbor_put_bytes (io_js_cbor_encoder_t *this,const void *bytes,size_t size) {
+	if (io_js_cbor_reserve (this,size)) {
+		memcpy (this->buffer + this->length,bytes,size);
+		this->length += size;
+		return true;
+	} else {
+		return false;
+	}
+}
+
+static bool
+io_js_cbor_put_big_endian (
+	io_js_cbor_encoder_t *this,uint8_t first,uint64_t value,int n
+) {
+	uint8_t *b;
+	int i;
+
+	if (!io_js_cbor_reserve (this,n + 1)) {
+		return false;
+	}
+	b = this->buffer + this->length;
+	b[0] = first;
+	for (i = n; i > 0; i--) {
+		b[i] = value;
+		value >>= 8;
+	}
+	this->length += n + 1;
+	return true;
+}
+
+//
+// write a major type with its argument in the shortest form
+//
+static bool
+io_js_cbor_put_head (io_js_cbor_encoder_t *this,int major,uint64_t value) {
+	major <<= 5;
+	if (value < 24) {
+		return io_js_cbor_put_byte (this,major | value);
+	} else if (value <= 0xff) {
+		return io_js_cbor_put_big_endian (this,major | 24,value,1);
+	} else if (value <= 0xffff) {
+		return io_js_cbor_put_big_endian (this,major | 25,value,2);
+	} else if (value <= 0xffffffff) {
+		return io_js_cbor_put_big_endian (this,major | 26,value,4);
+	} else {
+		return io_js_cbor_put_big_endian (this,major | 27,value,8);
+	}
+}
+
+//
+// the half precision bits of d, or -1 if d is not exactly a half
+// precision float, d is not NaN
+//
+static int32_t
+io_js_cbor_half (double d) {
+	union {float f; uint32_t u;} u32;
+	uint32_t sign,mantissa;
+	int exponent,shift;
+
+	if ((double) (float) d != d) {
+		return -1;
+	}
+	u32.f = d;
+	sign = (u32.u >> 16) & 0x8000;
+	exponent = (int) ((u32.u >> 23) & 0xff) - 127;
+	mantissa = u32.u & 0x7fffff;
+	if (exponent == 128) {
+		// infinity
+		return sign | 0x7c00;
+	} else if (exponent == -127) {
+		// zero, single precision subnormals are too small for half
+		return mantissa ? -1 : sign;
+	} else if (exponent >= -14 && exponent <= 15) {
+		if (mantissa & 0x1fff) {
+			return -1;
+		}
+		return sign | ((exponent + 15) << 10) | (mantissa >> 13);
+	} else if (exponent >= -24 && exponent < -14) {
+		// half precision subnormal
+		mantissa |= 0x800000;
+		shift = -1 - exponent;
+		if (mantissa & ((1u << shift) - 1)) {
+			return -1;
+		}
+		return sign | (mantissa >> shift);
+	} else {
+		return -1;
+	}
+}
+
+//
+// integral numbers are written as integers and other numbers in the
+// shortest float format that holds them exactly
+//
+static bool
+io_js_cbor_put_number (io_js_cbor_encoder_t *this,double d) {
+	union {double d; uint64_t u;} u64;
+	union {float f; uint32_t u;} u32;
+	int32_t half;
+
+	if (
+			d >= -9007199254740992.0
+		&&	d <= 9007199254740992.0
+		&&	d == (double) (int64_t) d
+		&&	!(d == 0 && signbit (d))
+	) {
+		int64_t i = (int64_t) d;
+		if (i >= 0) {
+			return io_js_cbor_put_head (this,CBOR_UNSIGNED,i);
+		} else {
+			return io_js_cbor_put_head (this,CBOR_NEGATIVE,-1 - i);
+		}
+	} else if (isnan (d)) {
+		return io_js_cbor_put_big_endian (this,CBOR_HALF,0x7e00,2);
+	} else if ((half = io_js_cbor_half (d)) >= 0) {
+		return io_js_cbor_put_big_endian (this,CBOR_HALF,half,2);
+	} else if ((double) (float) d == d) {
+		u32.f = d;
+		return io_js_cbor_put_big_endian (this,CBOR_FLOAT,u32.u,4);
+	} else {
+		u64.d = d;
+		return io_js_cbor_put_big_endian (this,CBOR_DOUBLE,u64.u,8);
+	}
+}
+
+static bool
+io_js_cbor_put_text (io_js_cbor_encoder_t *this,const char *str,size_t len) {
+	return (
+			io_js_cbor_put_head (this,CBOR_TEXT,len)
+		&&	io_js_cbor_put_bytes (this,str,len)
+	);
+}
+
+static bool
+io_js_cbor_put_string (io_js_cbor_encoder_t *this,JSValueConst value) {
+	const char *str;
+	size_t len;
+	bool ok;
+
+	str = JS_ToCStringBorrow (this->ctx,&len,value);
+	if (str) {
+		return io_js_cbor_put_text (this,str,len);
+	}
+	str = JS_ToCStringLen (this->ctx,&len,value);
+	if (!str) {
+		return false;
+	}
+	ok = io_js_cbor_put_text (this,str,len);
+	JS_FreeCString (this->ctx,str);
+	return ok;
+}
+
+static bool
+io_js_cbor_put_key (io_js_cbor_encoder_t *this,JSAtom atom) {
+	io_js_cbor_key_t *entry;
+	const char *str;
+	JSValue name;
+	size_t len;
+	bool ok;
+
+	if (!this->keys) {
+		this->keys = js_mallocz (
+			this->ctx,sizeof(io_js_cbor_key_t) * CBOR_KEY_CACHE_SIZE
+		);
+		if (!this->keys) {
+			return false;
+		}
+	}
+	entry = this->keys + (((atom * 0x9e3779b1u) >> 16) & (CBOR_KEY_CACHE_SIZE - 1));
+	if (entry->atom == atom && atom != CBOR_ATOM_NULL) {
+		return io_js_cbor_put_text (this,entry->key,entry->length);
+	}
+
+	// names may hold U+0000 so the length is taken from the string
+	name = JS_AtomToValue (this->ctx,atom);
+	if (JS_IsException (name)) {
+		return false;
+	}
+	str = JS_ToCStringLen (this->ctx,&len,name);
+	JS_FreeValue (this->ctx,name);
+	if (!str) {
+		return false;
+	}
+	if (len <= CBOR_KEY_CACHE_LENGTH) {
+		if (entry->atom != CBOR_ATOM_NULL) {
+			JS_FreeAtom (this->ctx,entry->atom);
+		}
+		entry->atom = JS_DupAtom (this->ctx,atom);
+		entry->length = len;
+		memcpy (entry->key,str,len);
+	}
+	ok = io_js_cbor_put_text (this,str,len);
+	JS_FreeCString (this->ctx,str);
+	return ok;
+}
+
+static bool
+io_js_cbor_type_error (io_js_cbor_encoder_t *this,const char *what) {
+	JS_ThrowTypeError (this->ctx,"%s cannot be encoded as CBOR",what);
+	return false;
+}
+
+static bool io_js_cbor_put_value (io_js_cbor_encoder_t*,JSValueConst,JSAtom);
+
+static bool
+io_js_cbor_put_array (io_js_cbor_encoder_t *this,JSValueConst value) {
+	JSContext *ctx = this->ctx;
+	JSValue length,element;
+	uint32_t i,n;
+
+	length = JS_GetProperty (ctx,value,this->atoms[CBOR_ATOM_LENGTH]);
+	if (JS_ToUint32 (ctx,&n,length)) {
+		JS_FreeValue (ctx,length);
+		return false;
+	}
+	JS_FreeValue (ctx,length);
+
+	if (!io_js_cbor_put_head (this,CBOR_ARRAY,n)) {
+		return false;
+	}
+	for (i = 0; i < n; i++) {
+		JSAtom index;
+		bool ok;
+		element = JS_GetPropertyUint32 (ctx,value,i);
+		if (JS_IsException (element)) {
+			return false;
+		}
+		// the index is only an integer atom unless toJSON needs it
+		index = JS_NewAtomUInt32 (ctx,i);
+		ok = (
+				index != CBOR_ATOM_NULL
+			&&	io_js_cbor_put_value (this,element,index)
+		);
+		JS_FreeAtom (ctx,index);
+		JS_FreeValue (ctx,element);
+		if (!ok) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool
+io_js_cbor_put_map (io_js_cbor_encoder_t *this,JSValueConst value) {
+	JSContext *ctx = this->ctx;
+	JSPropertyEnum *tab;
+	uint32_t i,n;
+	bool ok = true;
+
+	if (
+		JS_GetOwnPropertyNames (
+			ctx,&tab,&n,value,JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY
+		)
+	) {
+		return false;
+	}
+
+	ok = io_js_cbor_put_head (this,CBOR_MAP,n);
+	for (i = 0; i < n && ok; i++) {
+		JSValue v = JS_GetProperty (ctx,value,tab[i].atom);
+		ok = (
+				!JS_IsException (v)
+			&&	io_js_cbor_put_key (this,tab[i].atom)
+			&&	io_js_cbor_put_value (this,v,tab[i].atom)
+		);
+		JS_FreeValue (ctx,v);
+	}
+
+	for (i = 0; i < n; i++) {
+		JS_FreeAtom (ctx,tab[i].atom);
+	}
+	js_free (ctx,tab);
+	return ok;
+}
+
+//
+// bytes is NULL if they could not be got
+//
+static bool
+io_js_cbor_put_byte_string (
+	io_js_cbor_encoder_t *this,const uint8_t *bytes,size_t size
+) {
+	return (
+			bytes != NULL
+		&&	io_js_cbor_put_head (this,CBOR_BYTES,size)
+		&&	io_js_cbor_put_bytes (this,bytes,size)
+	);
+}
+
+//
+// number, string, boolean and bigint objects are written as their
+// primitive value, dates as epoch times, array buffers and their views
+// as byte strings, arrays as arrays and other objects as maps. values
+// with no CBOR form throw rather than being lost.
+//
+static bool
+io_js_cbor_put_object_content (io_js_cbor_encoder_t *this,JSValueConst value) {
+	JSContext *ctx = this->ctx;
+	const uint8_t *bytes;
+	JSValue primitive;
+	size_t size;
+	double d;
+	bool ok;
+	int r;
+
+	primitive = JS_GetPrimitiveObjectValue (ctx,value);
+	if (JS_IsException (primitive)) {
+		return false;
+	} else if (!JS_IsUninitialized (primitive)) {
+		ok = io_js_cbor_put_value (this,primitive,CBOR_ATOM_NULL);
+		JS_FreeValue (ctx,primitive);
+		return ok;
+	}
+	if (JS_IsFunction (ctx,value)) {
+		return io_js_cbor_type_error (this,"a function");
+	}
+	if (JS_IsDate (ctx,value)) {
+		return (
+				JS_GetDateValue (ctx,&d,value) == 0
+			&&	io_js_cbor_put_head (this,CBOR_TAG,CBOR_TAG_EPOCH)
+			&&	io_js_cbor_put_number (this,d / 1000)
+		);
+	}
+	if (JS_IsArrayBuffer (ctx,value)) {
+		bytes = JS_GetArrayBuffer (ctx,&size,value);
+		return io_js_cbor_put_byte_string (this,bytes,size);
+	}
+	if (JS_IsArrayBufferView (ctx,value)) {
+		bytes = JS_GetArrayBufferView (ctx,&size,value);
+		return io_js_cbor_put_byte_string (this,bytes,size);
+	}
+	if (JS_IsMap (ctx,value) || JS_IsSet (ctx,value)) {
+		return io_js_cbor_type_error (this,"a Map or Set");
+	}
+	r = JS_IsArray (ctx,value);
+	if (r < 0) {
+		return false;
+	} else if (r) {
+		return io_js_cbor_put_array (this,value);
+	} else {
+		return io_js_cbor_put_map (this,value);
+	}
+}
+
+//
+// toJSON is called as by JSON.stringify with the property key, except
+// on dates which have their own CBOR form
+//
+static bool
+io_js_cbor_put_object (
+	io_js_cbor_encoder_t *this,JSValueConst value,JSAtom key
+) {
+	JSContext *ctx = this->ctx;
+	JSValue to_json;
+	bool ok;
+
+	if (++this->depth > CBOR_MAX_DEPTH) {
+		JS_ThrowRangeError (ctx,"CBOR nesting too deep");
+		return false;
+	}
+	if (this->atoms[CBOR_ATOM_LENGTH] == CBOR_ATOM_NULL) {
+		static const char *const names[] = {"length","toJSON"};
+		if (JS_NewAtomList (ctx,this->atoms,names,SIZEOF(names)) < 0) {
+			this->depth--;
+			return false;
+		}
+	}
+
+	if (JS_IsDate (ctx,value)) {
+		ok = io_js_cbor_put_object_content (this,value);
+	} else {
+		to_json = JS_GetProperty (ctx,value,this->atoms[CBOR_ATOM_TO_JSON]);
+		if (JS_IsException (to_json)) {
+			ok = false;
+		} else if (JS_IsFunction (ctx,to_json)) {
+			JSValue name,result;
+			if (key == CBOR_ATOM_NULL) {
+				name = JS_NewStringLen (ctx,"",0);
+			} else {
+				name = JS_AtomToString (ctx,key);
+			}
+			if (JS_IsException (name)) {
+				result = JS_EXCEPTION;
+			} else {
+				result = JS_Call (ctx,to_json,value,1,(JSValueConst*) &name);
+				JS_FreeValue (ctx,name);
+			}
+			if (JS_IsException (result)) {
+				ok = false;
+			} else if (JS_IsObject (result)) {
+				ok = io_js_cbor_put_object_content (this,result);
+			} else {
+				ok = io_js_cbor_put_value (this,result,key);
+			}
+			JS_FreeValue (ctx,result);
+		} else {
+			ok = io_js_cbor_put_object_content (this,value);
+		}
+		JS_FreeValue (ctx,to_json);
+	}
+	this->depth--;
+	return ok;
+}
+
+//
+// key is the property key of the value, CBOR_ATOM_NULL at the top level
+//
+static bool
+io_js_cbor_put_value (io_js_cbor_encoder_t *this,JSValueConst value,JSAtom key) {
+	int tag = JS_VALUE_GET_TAG (value);
+
+	switch (tag) {
+		case JS_TAG_INT: {
+			int32_t i = JS_VALUE_GET_INT (value);
+			if (i >= 0) {
+				return io_js_cbor_put_head (this,CBOR_UNSIGNED,i);
+			} else {
+				return io_js_cbor_put_head (this,CBOR_NEGATIVE,-1 - (int64_t) i);
+			}
+		}
+		case JS_TAG_BOOL:
+			return io_js_cbor_put_byte (
+				this,JS_VALUE_GET_BOOL (value) ? CBOR_TRUE : CBOR_FALSE
+			);
+		case JS_TAG_NULL:
+			return io_js_cbor_put_byte (this,CBOR_NULL);
+		case JS_TAG_UNDEFINED:
+			return io_js_cbor_put_byte (this,CBOR_UNDEFINED);
+		case JS_TAG_STRING:
+		case JS_TAG_STRING_ROPE:
+			return io_js_cbor_put_string (this,value);
+		case JS_TAG_OBJECT:
+			return io_js_cbor_put_object (this,value,key);
+		default:
+			if (JS_TAG_IS_FLOAT64 (tag)) {
+				return io_js_cbor_put_number (this,JS_VALUE_GET_FLOAT64 (value));
+			} else if (JS_IsSymbol (value)) {
+				return io_js_cbor_type_error (this,"a symbol");
+			} else if (JS_IsBigInt (this->ctx,value)) {
+				return io_js_cbor_type_error (this,"a BigInt");
+			} else {
+				return io_js_cbor_type_error (this,"the value");
+			}
+	}
+}
+
+//
+// append the CBOR encoding of a js value to an io encoding, the whole
+// item is encoded before it is appended so nothing is appended if the
+// value cannot be encoded
+//
+bool
+io_js_cbor_append_value (
+	JSContext *ctx,io_encoding_t *encoding,JSValueConst value
+) {
+	io_js_cbor_encoder_t encoder;
+	bool ok;
+
+	io_js_cbor_encoder_init (ctx,&encoder);
+	ok = io_js_cbor_put_value (&encoder,value,CBOR_ATOM_NULL);
+	if (ok && encoder.length > 0) {
+		io_encoding_append_string (
+			encoding,(const char*) encoder.buffer,encoder.length
+		);
+	}
+	io_js_cbor_encoder_free (&encoder);
+	return ok;
+}
+
+static void
+io_js_cbor_free_array_buffer (JSRuntime *rt,void *opaque,void *ptr) {
+	js_free_rt (rt,ptr);
+}
+
+//
+// cbor.encode (value) returns an ArrayBuffer
+//
+static JSValue
+io_js_cbor_encode_function (
+	JSContext *ctx,JSValueConst this_value,int argc,JSValueConst *argv
+) {
+	io_js_cbor_encoder_t encoder;
+	JSValue result;
+
+	io_js_cbor_encoder_init (ctx,&encoder);
+	if (io_js_cbor_put_value (&encoder,argv[0],CBOR_ATOM_NULL)) {
+		// the array buffer takes the encoder's buffer
+		result = JS_NewArrayBuffer (
+			ctx,encoder.buffer,encoder.length,
+			io_js_cbor_free_array_buffer,NULL,false
+		);
+		if (!JS_IsException (result)) {
+			encoder.buffer = NULL;
+		}
+	} else {
+		result = JS_EXCEPTION;
+	}
+	io_js_cbor_encoder_free (&encoder);
+	return result;
+}
+
+//-----------------------------------------------------------------------------
+//
+// decoder
+//
+//-----------------------------------------------------------------------------
+
+typedef struct {
+	JSContext *ctx;
+	const uint8_t *cursor;
+	const uint8_t *end;
+	io_js_cbor_key_t *keys;			// indexed by key text
+	int depth;
+} io_js_cbor_decoder_t;
+
+static JSValue
+io_js_cbor_error (io_js_cbor_decoder_t *this) {
+	if (this->cursor >= this->end) {
+		return JS_ThrowSyntaxError (this->ctx,"unexpected end of CBOR data");
+	} else {
+		return JS_ThrowSyntaxError (this->ctx,"invalid CBOR data");
+	}
+}
+
+//
+// read the initial byte of a data item and its argument, info is
+// CBOR_INDEFINITE for indefinite lengths and the break code
+//
+static bool
+io_js_cbor_get_head (
+	io_js_cbor_decoder_t *this,int *major,int *info,uint64_t *value
+) {
+	int n;
+
+	if (this->cursor >= this->end) {
+		return false;
+	}
+	*major = *this->cursor >> 5;
+	*info = *this->cursor++ & 0x1f;
+	if (*info < 24) {
+		*value = *info;
+		return true;
+	} else if (*info == CBOR_INDEFINITE) {
+		*value = 0;
+		return (
+				*major == CBOR_SIMPLE
+			||	(*major >= CBOR_BYTES && *major <= CBOR_MAP)
+		);
+	} else if (*info > 27) {
+		return false;
+	}
+	n = 1 << (*info - 24);
+	if (this->end - this->cursor < n) {
+		return false;
+	}
+	*value = 0;
+	while (n--) {
+		*value = (*value << 8) | *this->cursor++;
+	}
+	return true;
+}
+
+static double
+io_js_cbor_half_to_double (uint32_t half) {
+	int exponent = (half >> 10) & 0x1f;
+	double mantissa = half & 0x3ff;
+	double d;
+
+	if (exponent == 0) {
+		d = ldexp (mantissa,-24);
+	} else if (exponent == 0x1f) {
+		d = (mantissa == 0) ? INFINITY : NAN;
+	} else {
+		d = ldexp (mantissa + 1024,exponent - 25);
+	}
+	return (half & 0x8000) ? -d : d;
+}
+
+//
+// the chunks of an indefinite length byte or text string are joined
+//
+static bool
+io_js_cbor_get_chunks (
+	io_js_cbor_decoder_t *this,int major,uint8_t **bytes,size_t *length
+) {
+	uint8_t *buffer = NULL;
+	size_t size = 0;
+
+	for (;;) {
+		int chunk_major,info;
+		uint64_t value;
+		uint8_t *b;
+
+		if (this->cursor < this->end && *this->cursor == CBOR_BREAK) {
+			this->cursor++;
+			break;
+		}
+		if (
+				!io_js_cbor_get_head (this,&chunk_major,&info,&value)
+			||	chunk_major != major
+			||	info == CBOR_INDEFINITE
+			||	value > (uint64_t) (this->end - this->cursor)
+		) {
+			io_js_cbor_error (this);
+			js_free (this->ctx,buffer);
+			return false;
+		}
+		b = js_realloc (this->ctx,buffer,size + value + 1);
+		if (!b) {
+			js_free (this->ctx,buffer);
+			return false;
+		}
+		buffer = b;
+		memcpy (buffer + size,this->cursor,value);
+		size += value;
+		this->cursor += value;
+	}
+	*bytes = buffer;
+	*length = size;
+	return true;
+}
+
+static JSValue
+io_js_cbor_new_bytes (
+	io_js_cbor_decoder_t *this,int major,const uint8_t *bytes,size_t length
+) {
+	if (major == CBOR_BYTES) {
+		return JS_NewArrayBufferCopy (this->ctx,bytes,length);
+	} else {
+		return JS_NewStringLen (this->ctx,(const char*) bytes,length);
+	}
+}
+
+static JSAtom
+io_js_cbor_get_key_atom (io_js_cbor_decoder_t *this,const char *key,size_t len) {
+	io_js_cbor_key_t *entry;
+
+	if (len > CBOR_KEY_CACHE_LENGTH) {
+		return JS_NewAtomLen (this->ctx,key,len);
+	}
+	if (!this->keys) {
+		this->keys = js_mallocz (
+			this->ctx,sizeof(io_js_cbor_key_t) * CBOR_KEY_CACHE_SIZE
+		);
+		if (!this->keys) {
+			return CBOR_ATOM_NULL;
+		}
+	}
+	entry = this->keys + (io_js_cbor_key_hash (key,len) & (CBOR_KEY_CACHE_SIZE - 1));
+	if (
+			entry->atom == CBOR_ATOM_NULL
+		||	entry->length != len
+		||	memcmp (entry->key,key,len) != 0
+	) {
+		JSAtom atom = JS_NewAtomLen (this->ctx,key,len);
+		if (atom == CBOR_ATOM_NULL) {
+			return CBOR_ATOM_NULL;
+		}
+		if (entry->atom != CBOR_ATOM_NULL) {
+			JS_FreeAtom (this->ctx,entry->atom);
+		}
+		entry->atom = atom;
+		entry->length = len;
+		memcpy (entry->key,key,len);
+	}
+	return JS_DupAtom (this->ctx,entry->atom);
+}
+
+static JSValue io_js_cbor_get_value (io_js_cbor_decoder_t*);
+
+//
+// keys which are not text are converted to property keys as by
+// a js object literal
+//
+static JSAtom
+io_js_cbor_get_key (io_js_cbor_decoder_t *this) {
+	const uint8_t *b = this->cursor;
+	JSValue key;
+	JSAtom atom;
+
+	if (b < this->end && (b[0] >> 5) == CBOR_TEXT && (b[0] & 0x1f) < 24) {
+		size_t len = b[0] & 0x1f;
+		if ((size_t) (this->end - b) > len) {
+			this->cursor += len + 1;
+			return io_js_cbor_get_key_atom (this,(const char*) b + 1,len);
+		}
+	}
+	key = io_js_cbor_get_value (this);
+	if (JS_IsException (key)) {
+		return CBOR_ATOM_NULL;
+	}
+	atom = JS_ValueToAtom (this->ctx,key);
+	JS_FreeValue (this->ctx,key);
+	return atom;
+}
+
+static bool
+io_js_cbor_at_break (io_js_cbor_decoder_t *this) {
+	if (this->cursor < this->end && *this->cursor == CBOR_BREAK) {
+		this->cursor++;
+		return true;
+	}
+	return false;
+}
+
+static JSValue
+io_js_cbor_get_array (io_js_cbor_decoder_t *this,int info,uint64_t length) {
+	JSContext *ctx = this->ctx;
+	JSValue array,element;
+	uint32_t i;
+
+	// every element takes at least one byte
+	if (info != CBOR_INDEFINITE && length > (uint64_t) (this->end - this->cursor)) {
+		return io_js_cbor_error (this);
+	}
+	array = JS_NewArray (ctx);
+	if (JS_IsException (array)) {
+		return array;
+	}
+	for (i = 0; ; i++) {
+		if (info == CBOR_INDEFINITE) {
+			if (io_js_cbor_at_break (this)) {
+				break;
+			}
+		} else if (i == length) {
+			break;
+		}
+		element = io_js_cbor_get_value (this);
+		if (
+				JS_IsException (element)
+			||	JS_DefinePropertyValueUint32 (
+					ctx,array,i,element,JS_PROP_C_W_E
+				) < 0
+		) {
+			JS_FreeValue (ctx,array);
+			return JS_EXCEPTION;
+		}
+	}
+	return array;
+}
+
+//
+// maps of the same keys in the same order are given the same shape by
+// the engine, so only the key atoms need to be cached here
+//
+static JSValue
+io_js_cbor_get_map (io_js_cbor_decoder_t *this,int info,uint64_t length) {
+	JSContext *ctx = this->ctx;
+	JSValue object,value;
+	JSAtom atom;
+	uint64_t i;
+
+	// every entry takes at least two bytes
+	if (info != CBOR_INDEFINITE && length > (uint64_t) (this->end - this->cursor) / 2) {
+		return io_js_cbor_error (this);
+	}
+	object = JS_NewObject (ctx);
+	if (JS_IsException (object)) {
+		return object;
+	}
+	for (i = 0; ; i++) {
+		if (info == CBOR_INDEFINITE) {
+			if (io_js_cbor_at_break (this)) {
+				break;
+			}
+		} else if (i == length) {
+			break;
+		}
+		atom = io_js_cbor_get_key (this);
+		if (atom == CBOR_ATOM_NULL) {
+			goto exception;
+		}
+		value = io_js_cbor_get_value (this);
+		if (JS_IsException (value)) {
+			JS_FreeAtom (ctx,atom);
+			goto exception;
+		}
+		if (JS_DefinePropertyValue (ctx,object,atom,value,JS_PROP_C_W_E) < 0) {
+			JS_FreeAtom (ctx,atom);
+			goto exception;
+		}
+		JS_FreeAtom (ctx,atom);
+	}
+	return object;
+
+exception:
+	JS_FreeValue (ctx,object);
+	return JS_EXCEPTION;
+}
+
+static JSValue
+io_js_cbor_get_item (
+	io_js_cbor_decoder_t *this,int major,int info,uint64_t value
+) {
+	JSContext *ctx = this->ctx;
+	JSValue result;
+
+	switch (major) {
+		case CBOR_UNSIGNED:
+			if (value <= 9007199254740992ull) {
+				return JS_NewInt64 (ctx,value);
+			} else {
+				return JS_NewFloat64 (ctx,(double) value);
+			}
+
+		case CBOR_NEGATIVE:
+			if (value < 9007199254740992ull) {
+				return JS_NewInt64 (ctx,-1 - (int64_t) value);
+			} else {
+				return JS_NewFloat64 (ctx,-1.0 - (double) value);
+			}
+
+		case CBOR_BYTES:
+		case CBOR_TEXT:
+			if (info == CBOR_INDEFINITE) {
+				uint8_t *bytes;
+				size_t length;
+				if (!io_js_cbor_get_chunks (this,major,&bytes,&length)) {
+					return JS_EXCEPTION;
+				}
+				result = io_js_cbor_new_bytes (this,major,bytes,length);
+				js_free (ctx,bytes);
+				return result;
+			}
+			if (value > (uint64_t) (this->end - this->cursor)) {
+				this->cursor = this->end;
+				return io_js_cbor_error (this);
+			}
+			result = io_js_cbor_new_bytes (this,major,this->cursor,value);
+			this->cursor += value;
+			return result;
+
+		case CBOR_ARRAY:
+		case CBOR_MAP:
+			if (++this->depth > CBOR_MAX_DEPTH) {
+				return JS_ThrowRangeError (ctx,"CBOR nesting too deep");
+			}
+			if (major == CBOR_ARRAY) {
+				result = io_js_cbor_get_array (this,info,value);
+			} else {
+				result = io_js_cbor_get_map (this,info,value);
+			}
+			this->depth--;
+			return result;
+
+		default:
+			switch (info) {
+				case 20:
+					return JS_FALSE;
+				case 21:
+					return JS_TRUE;
+				case 22:
+					return JS_NULL;
+				case 25:
+					return JS_NewFloat64 (ctx,io_js_cbor_half_to_double (value));
+				case 26: {
+					union {float f; uint32_t u;} u32;
+					u32.u = value;
+					return JS_NewFloat64 (ctx,u32.f);
+				}
+				case 27: {
+					union {double d; uint64_t u;} u64;
+					u64.u = value;
+					return JS_NewFloat64 (ctx,u64.d);
+				}
+				case CBOR_INDEFINITE:
+					// break outside of an indefinite length item
+					this->cursor--;
+					return io_js_cbor_error (this);
+				default:
+					return JS_UNDEFINED;
+			}
+	}
+}
+
+//
+// tags are skipped without recursion so that a long run of them cannot
+// exhaust the stack, only an epoch time (tag 1) is interpreted
+//
+static JSValue
+io_js_cbor_get_value (io_js_cbor_decoder_t *this) {
+	int major,info;
+	uint64_t value;
+	bool epoch = false;
+	JSValue result;
+
+	if (!io_js_cbor_get_head (this,&major,&info,&value)) {
+		return io_js_cbor_error (this);
+	}
+	while (major == CBOR_TAG) {
+		epoch = (value == CBOR_TAG_EPOCH);
+		if (!io_js_cbor_get_head (this,&major,&info,&value)) {
+			return io_js_cbor_error (this);
+		}
+	}
+
+	result = io_js_cbor_get_item (this,major,info,value);
+	if (epoch && JS_IsNumber (result)) {
+		double seconds;
+		JS_ToFloat64 (this->ctx,&seconds,result);
+		result = JS_NewDate (this->ctx,round (seconds * 1000));
+	}
+	return result;
+}
+
+//
+// decode exactly one CBOR data item
+//
+JSValue
+io_js_cbor_decode (JSContext *ctx,const uint8_t *bytes,size_t size) {
+	io_js_cbor_decoder_t decoder = {
+		.ctx = ctx,
+		.cursor = bytes,
+		.end = bytes + size,
+		.keys = NULL,
+		.depth = 0,
+	};
+	JSValue result;
+
+	result = io_js_cbor_get_value (&decoder);
+	if (!JS_IsException (result) && decoder.cursor != decoder.end) {
+		JS_FreeValue (ctx,result);
+		result = JS_ThrowSyntaxError (ctx,"unexpected data after CBOR item");
+	}
+	io_js_cbor_free_keys (ctx,decoder.keys);
+	return result;
+}
+
+//
+// cbor.decode (buffer), buffer is an ArrayBuffer, a typed array or a DataView
+//
+static JSValue
+io_js_cbor_decode_function (
+	JSContext *ctx,JSValueConst this_value,int argc,JSValueConst *argv
+) {
+	const uint8_t *bytes;
+	size_t size;
+
+	if (JS_IsArrayBuffer (ctx,argv[0])) {
+		bytes = JS_GetArrayBuffer (ctx,&size,argv[0]);
+	} else {
+		bytes = JS_GetArrayBufferView (ctx,&size,argv[0]);
+	}
+	if (bytes) {
+		return io_js_cbor_decode (ctx,bytes,size);
+	} else {
+		return JS_EXCEPTION;
+	}
+}
+
+static const JSCFunctionListEntry io_js_cbor_funcs[] = {
+	JS_CFUNC_DEF("encode",			1,io_js_cbor_encode_function),
+	JS_CFUNC_DEF("decode",			1,io_js_cbor_decode_function),
+};
+
+static int
+io_js_cbor_initialise (JSContext *ctx, JSModuleDef *m) {
+	return JS_SetModuleExportList (
+		ctx, m, io_js_cbor_funcs,SIZEOF(io_js_cbor_funcs)
+	);
+}
+
+static JSModuleDef*
+io_js_init_module_cbor (JSContext *ctx,const char *module_name) {
+	JSModuleDef *m = JS_NewCModule(ctx, module_name, io_js_cbor_initialise);
+	if (m) {
+		JS_AddModuleExportList(ctx, m, io_js_cbor_funcs, SIZEOF(io_js_cbor_funcs));
+	}
+	return m;
+}
+
+void
+io_js_cbor_module (JSContext *ctx) {
+	const char *str = (
+		"import * as cbor from 'cbor';\n"
+		"globalThis.cbor = cbor;\n"
+	);
+	io_js_init_module_cbor (ctx,"cbor");
+	io_js_eval_buffer (ctx, str, strlen(str),"<cbor>",JS_EVAL_TYPE_MODULE);
+}
+
+#endif /* IMPLEMENT_JS_IO */
+#endif
+/*
+------------------------------------------------------------------------------
+This software is available under 2 licenses -- choose whichever you prefer.
+------------------------------------------------------------------------------
+ALTERNATIVE A - MIT License
+Copyright (c) 2020 Gregor Bruce
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+------------------------------------------------------------------------------
+ALTERNATIVE B - Public Domain (www.unlicense.org)
+This is free and unencumbered software released into the public domain.
+Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+software, either in source code form or as a compiled binary, for any purpose,
+commercial or non-commercial, and by any means.
+In jurisdictions that recognize copyright laws, the author or authors of this
+software dedicate any and all copyright interest in the software to the public
+domain. We make this dedication for the benefit of the public at large and to
+the detriment of our heirs and successors. We intend this dedication to be an
+overt act of relinquishment in perpetuity of all present and future rights to
+this software under copyright law.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+------------------------------------------------------------------------------
+*/
@@ -127,14 +127,10 @@ js_io_socket_print (
 				int i;
 
 				for(i = 0; i < argc; i++) {
-					const char *str;
 					if (i != 0) {
 						io_encoding_append_byte (encoding,' ');
 					}
-					if ((str = JS_ToCString(ctx, argv[i])) != NULL) {
-						io_encoding_append_string (encoding,str,strlen(str));
-						JS_FreeCString(ctx, str);
-					} else {
+					if (!io_js_encoding_append_value (ctx,encoding,argv[i])) {
 						unreference_io_encoding (encoding);
 						return JS_EXCEPTION;
 					}
@@ -166,11 +162,7 @@ js_io_socket_put (
 				int i;
 
 				for(i = 0; i < argc; i++) {
-					const char *str;
-					if ((str = JS_ToCString(ctx, argv[i])) != NULL) {
-						io_encoding_append_string (encoding,str,strlen(str));
-						JS_FreeCString(ctx, str);
-					} else {
+					if (!io_js_encoding_append_value (ctx,encoding,argv[i])) {
 						unreference_io_encoding (encoding);
 						return JS_EXCEPTION;
 					}
@@ -187,6 +179,53 @@ js_io_socket_put (
 	return JS_UNDEFINED;
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * js_io_socket_send_json --
+ *
+ * e.g. socket.sendJSON({id:1,value:2.5});
+ *
+ * Same text as JSON.stringify(value,replacer,space) written straight
+ * into the outgoing message.
+ *
+ *-----------------------------------------------------------------------------
+ */
+static JSValue
+js_io_socket_send_json (
+	JSContext *ctx, JSValueConst this_value,int argc, JSValueConst *argv
+) {
+	io_js_io_socket_t *js_io_socket = JS_GetOpaque2(ctx,this_value,js_io_socket_class_id);
+	if (js_io_socket) {
+		io_socket_t *socket = io_get_socket (JS_GetIO(ctx),js_io_socket->handle);
+
+		if (socket) {
+			io_encoding_t *encoding = io_socket_new_message (socket);
+			if (encoding) {
+				int result = io_js_encoding_append_json (
+					ctx,encoding,argv[0],
+					(argc > 1) ? argv[1] : JS_UNDEFINED,
+					(argc > 2) ? argv[2] : JS_UNDEFINED
+				);
+				if (result < 0) {
+					unreference_io_encoding (encoding);
+					return JS_EXCEPTION;
+				} else if (result == 0) {
+					unreference_io_encoding (encoding);
+					return JS_FALSE;
+				}
+				if (io_socket_send_message (socket,encoding)) {
+					return JS_TRUE;
+				} else {
+					return JS_FALSE;
+				}
+			}
+		}
+	}
+
+	return JS_UNDEFINED;
+}
+
 static JSValue
 js_io_socket_send (
 	JSContext *ctx, JSValueConst this_value,int argc, JSValueConst *argv
@@ -264,6 +303,7 @@ static const JSCFunctionListEntry js_io_socket_functions[] = {
 	JS_CFUNC_DEF("print",			1,js_io_socket_print),
 	JS_CFUNC_DEF("put",			1,js_io_socket_put),
 	JS_CFUNC_DEF("send",				1,js_io_socket_send),
+	JS_CFUNC_DEF("sendJSON",		1,js_io_socket_send_json),
 	JS_CFUNC_DEF("open",				0,js_io_socket_open),
 	JS_CGETSET_DEF("on_receive"	 ,js_io_socket_get_receive,js_io_socket_set_receive),
 };
@@ -86,9 +86,26 @@ io_js_io_byte_memory_total (JSContext *ctx,JSValueConst this_value) {
 	return JS_NewStringLen(ctx,buffer,len);
 }
 
+//
+// number of blocks the js runtime has allocated since it started, the
+// difference between two reads counts the allocations of the code run
+// in between
+//
+static JSValue 
+io_js_io_js_malloc_count (JSContext *ctx,JSValueConst this_value) {
+	JSMemoryUsage usage;
+	char buffer[64];
+	JS_ComputeMemoryUsage (JS_GetRuntime (ctx),&usage);
+	uint32_t len = stbsp_snprintf (
+		buffer,sizeof(buffer),"%llu",(unsigned long long) usage.malloc_total_count
+	);
+	return JS_NewStringLen(ctx,buffer,len);
+}
+
 const JSCFunctionListEntry io_js_io_functions[] = {
 	JS_CGETSET_DEF("byte_memory_used"	,io_js_io_byte_memory_used,NULL),
 	JS_CGETSET_DEF("byte_memory_total"	,io_js_io_byte_memory_total,NULL),
+	JS_CGETSET_DEF("js_malloc_count"	,io_js_io_js_malloc_count,NULL),
 };
 
 void
@@ -243,6 +243,218 @@ io_js_eval_string (
 	}
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * JSONParser --
+ *
+ * incremental JSON parser, e.g.
+ *
+ *		let parser = new std.JSONParser ((value) => {...});
+ *		socket.on_receive = (chunk) => parser.push (chunk);
+ *
+ * the callback is called with each complete top-level value
+ *
+ *-----------------------------------------------------------------------------
+ */
+typedef struct {
+	JSJSONParser *parser;
+	JSValue on_value;
+	bool busy;
+} io_js_json_parser_t;
+
+static JSClassID io_js_json_parser_class_id = 0;
+
+static void
+io_js_json_parser_finalizer (JSRuntime *rt, JSValue val) {
+	io_js_json_parser_t *this = JS_GetOpaque (val,io_js_json_parser_class_id);
+	if (this) {
+		JS_FreeJSONParser (this->parser);
+		JS_FreeValueRT (rt,this->on_value);
+		js_free_rt (rt,this);
+	}
+}
+
+static void
+io_js_json_parser_mark (JSRuntime *rt, JSValueConst val,JS_MarkFunc *mark_func) {
+	io_js_json_parser_t *this = JS_GetOpaque (val,io_js_json_parser_class_id);
+	if (this) {
+		JS_MarkValue (rt,this->on_value,mark_func);
+		if (this->parser) {
+			JS_MarkJSONParser (rt,this->parser,mark_func);
+		}
+	}
+}
+
+static JSClassDef io_js_json_parser_class = {
+    "JSONParser",
+    .finalizer = io_js_json_parser_finalizer,
+    .gc_mark = io_js_json_parser_mark,
+};
+
+static int
+io_js_json_parser_on_value (JSContext *ctx,JSValue value,void *opaque) {
+	io_js_json_parser_t *this = opaque;
+	JSValue result;
+
+	result = JS_Call (ctx,this->on_value,JS_UNDEFINED,1,(JSValueConst*) &value);
+	JS_FreeValue (ctx,value);
+	if (JS_IsException (result)) {
+		return -1;
+	}
+	JS_FreeValue (ctx,result);
+	return 0;
+}
+
+static JSValue
+io_js_json_parser_constructor (
+	JSContext *ctx,JSValueConst new_target,int argc,JSValueConst *argv
+) {
+	io_js_json_parser_t *this;
+	JSValue proto,obj;
+
+	if (!JS_IsFunction (ctx,argv[0])) {
+		return JS_ThrowTypeError (ctx,"not a function");
+	}
+
+	proto = JS_GetPropertyStr (ctx,new_target,"prototype");
+	if (JS_IsException (proto)) {
+		return proto;
+	}
+	obj = JS_NewObjectProtoClass (ctx,proto,io_js_json_parser_class_id);
+	JS_FreeValue (ctx,proto);
+	if (JS_IsException (obj)) {
+		return obj;
+	}
+
+	this = js_mallocz (ctx,sizeof(io_js_json_parser_t));
+	if (!this) {
+		JS_FreeValue (ctx,obj);
+		return JS_EXCEPTION;
+	}
+	this->on_value = JS_DupValue (ctx,argv[0]);
+	this->parser = JS_NewJSONParser (ctx,io_js_json_parser_on_value,this);
+	JS_SetOpaque (obj,this);
+	if (!this->parser) {
+		JS_FreeValue (ctx,obj);
+		return JS_EXCEPTION;
+	}
+
+	return obj;
+}
+
+//
+// parser.push (chunk), chunk is a string or an ArrayBuffer
+//
+static JSValue
+io_js_json_parser_push (
+	JSContext *ctx,JSValueConst this_value,int argc,JSValueConst *argv
+) {
+	io_js_json_parser_t *this = JS_GetOpaque2 (
+		ctx,this_value,io_js_json_parser_class_id
+	);
+	if (this) {
+		const char *str;
+		size_t len;
+		int r;
+
+		if (this->busy) {
+			return JS_ThrowTypeError (ctx,"parser is busy");
+		}
+		this->busy = true;
+		if (JS_IsString (argv[0])) {
+			str = JS_ToCStringLen (ctx,&len,argv[0]);
+			if (str) {
+				r = JS_JSONParserFeed (this->parser,str,len);
+				JS_FreeCString (ctx,str);
+			} else {
+				r = -1;
+			}
+		} else {
+			const uint8_t *bytes = JS_GetArrayBuffer (ctx,&len,argv[0]);
+			if (bytes) {
+				r = JS_JSONParserFeed (this->parser,(const char*) bytes,len);
+			} else {
+				r = -1;
+			}
+		}
+		this->busy = false;
+		return (r < 0) ? JS_EXCEPTION : JS_UNDEFINED;
+	} else {
+		return JS_EXCEPTION;
+	}
+}
+
+//
+// parser.end (), completes a trailing top-level number
+//
+static JSValue
+io_js_json_parser_end (
+	JSContext *ctx,JSValueConst this_value,int argc,JSValueConst *argv
+) {
+	io_js_json_parser_t *this = JS_GetOpaque2 (
+		ctx,this_value,io_js_json_parser_class_id
+	);
+	if (this) {
+		int r;
+		if (this->busy) {
+			return JS_ThrowTypeError (ctx,"parser is busy");
+		}
+		this->busy = true;
+		r = JS_JSONParserEnd (this->parser);
+		this->busy = false;
+		return (r < 0) ? JS_EXCEPTION : JS_UNDEFINED;
+	} else {
+		return JS_EXCEPTION;
+	}
+}
+
+static JSValue
+io_js_json_parser_reset (
+	JSContext *ctx,JSValueConst this_value,int argc,JSValueConst *argv
+) {
+	io_js_json_parser_t *this = JS_GetOpaque2 (
+		ctx,this_value,io_js_json_parser_class_id
+	);
+	if (this) {
+		if (this->busy) {
+			return JS_ThrowTypeError (ctx,"parser is busy");
+		}
+		JS_ResetJSONParser (this->parser);
+		return JS_UNDEFINED;
+	} else {
+		return JS_EXCEPTION;
+	}
+}
+
+static const JSCFunctionListEntry io_js_json_parser_functions[] = {
+	JS_CFUNC_DEF("push",				1,io_js_json_parser_push),
+	JS_CFUNC_DEF("end",				0,io_js_json_parser_end),
+	JS_CFUNC_DEF("reset",			0,io_js_json_parser_reset),
+};
+
+static JSValue
+io_js_std_json_parser_class (JSContext *ctx) {
+	JSValue prototype,constructor;
+
+	JS_NewClassID (&io_js_json_parser_class_id);
+	JS_NewClass (
+		JS_GetRuntime(ctx),io_js_json_parser_class_id,&io_js_json_parser_class
+	);
+
+	prototype = JS_NewObject (ctx);
+	JS_SetPropertyFunctionList (
+		ctx,prototype,io_js_json_parser_functions,SIZEOF(io_js_json_parser_functions)
+	);
+	constructor = JS_NewCFunction2 (
+		ctx,io_js_json_parser_constructor,"JSONParser",1,JS_CFUNC_constructor,0
+	);
+	JS_SetConstructor (ctx,constructor,prototype);
+	JS_SetClassProto (ctx,io_js_json_parser_class_id,prototype);
+
+	return constructor;
+}
+
 const JSCFunctionListEntry io_js_std_funcs[] = {
 	JS_CFUNC_DEF("setTimeout",		2,io_js_setTimeout),
 	JS_CFUNC_DEF("clearTimeout",	1,io_js_clearTimeout),
@@ -264,6 +476,7 @@ io_js_std_initialise (JSContext *ctx, JSModuleDef *m) {
 	JS_NewClass (JS_GetRuntime(ctx), io_js_timer_class_id, &io_js_timer_class);
 
 	JS_SetModuleExport(ctx, m, "global", JS_GetGlobalObject(ctx));
+	JS_SetModuleExport(ctx, m, "JSONParser", io_js_std_json_parser_class (ctx));
 
 	return JS_SetModuleExportList (
 		ctx, m, io_js_std_funcs,SIZEOF(io_js_std_funcs)
@@ -276,6 +489,7 @@ io_js_init_module_std (JSContext *ctx,const char *module_name) {
 	if (m) {
 		JS_AddModuleExportList(ctx, m, io_js_std_funcs, SIZEOF(io_js_std_funcs));
 		JS_AddModuleExport(ctx, m, "global");
+		JS_AddModuleExport(ctx, m, "JSONParser");
 		//JS_AddModuleExport(ctx, m, "Error");
 	}
 	
@@ -0,0 +1,89 @@
+/*
+ * async/await micro benchmark
+ *
+ * measures the cost of 'await' on a plain value, a resolved promise, a
+ * thenable and a pending promise, both as throughput and as latency in
+ * job queue ticks, and the cost of many short async calls (one await
+ * each, as in a socket handler). The shell must run the pending jobs.
+ * Run with a shell providing print. When the shell provides the io
+ * namespace, the runtime allocations (io.js_malloc_count) made during
+ * each test are reported too, including those of the tick counter.
+ */
+"use strict";
+
+var N = 100000;
+
+var malloc_count = (typeof io == "object" && io && "js_malloc_count" in io) ?
+    function () { return +io.js_malloc_count; } : null;
+
+function report(name, n, t0, ticks, m0) {
+    var ms = Date.now() - t0;
+    var line = name + ": " + n + " awaits in " + ms + " ms, " +
+        (ms ? Math.round(n / ms) : n) + " per ms, " + ticks + " job ticks";
+    if (malloc_count) {
+        var m = malloc_count() - m0;
+        line += ", " + m + " allocations (" +
+            (Math.round(m / n * 10) / 10) + " per await)";
+    }
+    print(line);
+}
+
+/* count the job queue ticks elapsed until the promise returned by 'f'
+   is settled */
+function measure(name, n, f) {
+    var ticks = 0, done = false, t0, m0;
+
+    function tick() {
+        if (!done) {
+            ticks++;
+            Promise.resolve().then(tick);
+        }
+    }
+    m0 = malloc_count ? malloc_count() : 0;
+    Promise.resolve().then(tick);
+    t0 = Date.now();
+    return f().then(function () {
+        done = true;
+        report(name, n, t0, ticks, m0);
+    });
+}
+
+async function await_value() {
+    for(var i = 0; i < N; i++)
+        await i;
+}
+
+async function await_resolved() {
+    var p = Promise.resolve(1);
+    for(var i = 0; i < N; i++)
+        await p;
+}
+
+async function await_thenable() {
+    var t = { then: function (resolve) { resolve(1); } };
+    for(var i = 0; i < N / 10; i++)
+        await t;
+}
+
+async function await_pending() {
+    for(var i = 0; i < N / 10; i++)
+        await new Promise(function (resolve) { Promise.resolve().then(resolve); });
+}
+
+async function handler(v) {
+    var r = await v;
+    return r + 1;
+}
+
+function many_calls() {
+    var tab = [], i;
+    for(i = 0; i < N; i++)
+        tab.push(handler(i));
+    return Promise.all(tab);
+}
+
+measure("await value", N, await_value)
+    .then(function () { return measure("await resolved promise", N, await_resolved); })
+    .then(function () { return measure("await thenable", N / 10, await_thenable); })
+    .then(function () { return measure("await pending promise", N / 10, await_pending); })
+    .then(function () { return measure("async calls", N, many_calls); });
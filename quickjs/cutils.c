@@ -292,6 +292,138 @@ int unicode_from_utf8(const uint8_t *p, int max_len, const uint8_t **pp)
     return c;
 }
 
+/* Word at a time scanning of character buffers. The inner loops only
+   do aligned loads, so they never read past the page holding the
+   last byte of the buffer. */
+typedef uintptr_t __attribute__((__may_alias__)) str_word_t;
+
+#define STR_WORD_ONES     ((uintptr_t)-1 / 0xff)   /* 0x0101...01 */
+#define STR_WORD_HIGHS    (STR_WORD_ONES * 0x80)   /* 0x8080...80 */
+#define STR_WORD16_ONES   ((uintptr_t)-1 / 0xffff) /* 0x0001...0001 */
+#define STR_WORD16_HIGHS  (STR_WORD16_ONES * 0x8000)
+
+static inline BOOL str_word_aligned(const void *p)
+{
+    return ((uintptr_t)p & (sizeof(str_word_t) - 1)) == 0;
+}
+
+/* return the number of leading bytes < 0x80 of buf[0..len) */
+size_t ascii_prefix_len(const uint8_t *buf, size_t len)
+{
+    const uint8_t *p = buf, *p_end = buf + len;
+
+    while (p < p_end && !str_word_aligned(p)) {
+        if (*p >= 0x80)
+            return p - buf;
+        p++;
+    }
+    while ((size_t)(p_end - p) >= sizeof(str_word_t)) {
+        if (*(const str_word_t *)p & STR_WORD_HIGHS)
+            break;
+        p += sizeof(str_word_t);
+    }
+    while (p < p_end && *p < 0x80)
+        p++;
+    return p - buf;
+}
+
+/* return the number of leading code units < 0x80 of buf[0..len) */
+size_t ascii_prefix_len16(const uint16_t *buf, size_t len)
+{
+    const uint16_t *p = buf, *p_end = buf + len;
+
+    while (p < p_end && !str_word_aligned(p)) {
+        if (*p >= 0x80)
+            return p - buf;
+        p++;
+    }
+    while ((size_t)(p_end - p) >= sizeof(str_word_t) / 2) {
+        if (*(const str_word_t *)p & (STR_WORD16_ONES * 0xff80))
+            break;
+        p += sizeof(str_word_t) / 2;
+    }
+    while (p < p_end && *p < 0x80)
+        p++;
+    return p - buf;
+}
+
+/* return the number of bytes >= 0x80 in buf[0..len) */
+size_t count_non_ascii(const uint8_t *buf, size_t len)
+{
+    const uint8_t *p = buf, *p_end = buf + len;
+    uintptr_t w;
+    size_t count = 0;
+
+    while (p < p_end && !str_word_aligned(p))
+        count += *p++ >> 7;
+    while ((size_t)(p_end - p) >= sizeof(str_word_t)) {
+        /* one per byte, then sum the bytes in the top byte */
+        w = (*(const str_word_t *)p & STR_WORD_HIGHS) >> 7;
+        count += (w * STR_WORD_ONES) >> ((sizeof(w) - 1) * 8);
+        p += sizeof(str_word_t);
+    }
+    while (p < p_end)
+        count += *p++ >> 7;
+    return count;
+}
+
+/* Convert Latin-1 characters to UTF-8. 'dst' must have room for len
+   bytes plus one per character >= 0x80. Return the number of bytes
+   written. */
+size_t latin1_to_utf8(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    uint8_t *q = dst;
+    size_t pos, n;
+    int c;
+
+    pos = 0;
+    while (pos < len) {
+        n = ascii_prefix_len(src + pos, len - pos);
+        memcpy(q, src + pos, n);
+        q += n;
+        pos += n;
+        /* short runs of non-ASCII characters are common */
+        while (pos < len && (c = src[pos]) >= 0x80) {
+            *q++ = (c >> 6) | 0xc0;
+            *q++ = (c & 0x3f) | 0x80;
+            pos++;
+        }
+    }
+    return q - dst;
+}
+
+/* return a pointer to the first 'c' in buf[0..len) or NULL */
+const uint16_t *memchr16(const uint16_t *buf, uint16_t c, size_t len)
+{
+    const uint16_t *p = buf, *p_end = buf + len;
+    uintptr_t w, pattern;
+    int i;
+
+    while (p < p_end && !str_word_aligned(p)) {
+        if (*p == c)
+            return p;
+        p++;
+    }
+    pattern = STR_WORD16_ONES * c;
+    while ((size_t)(p_end - p) >= sizeof(str_word_t) / 2) {
+        w = *(const str_word_t *)p ^ pattern;
+        /* exact test for a zero 16 bit lane */
+        if ((w - STR_WORD16_ONES) & ~w & STR_WORD16_HIGHS) {
+            for(i = 0; i < sizeof(str_word_t) / 2; i++) {
+                if (p[i] == c)
+                    return p + i;
+            }
+        }
+        p += sizeof(str_word_t) / 2;
+    }
+    while (p < p_end) {
+        if (*p == c)
+            return p;
+        p++;
+    }
+    return NULL;
+}
+
 #if 0
 
 #if defined(EMSCRIPTEN) || defined(__ANDROID__)
@@ -339,6 +339,12 @@ static inline BOOL dbuf_error(DynBuf *s) {
 int unicode_to_utf8(uint8_t *buf, unsigned int c);
 int unicode_from_utf8(const uint8_t *p, int max_len, const uint8_t **pp);
 
+size_t ascii_prefix_len(const uint8_t *buf, size_t len);
+size_t ascii_prefix_len16(const uint16_t *buf, size_t len);
+size_t count_non_ascii(const uint8_t *buf, size_t len);
+size_t latin1_to_utf8(uint8_t *dst, const uint8_t *src, size_t len);
+const uint16_t *memchr16(const uint16_t *buf, uint16_t c, size_t len);
+
 static inline int from_hex(int c)
 {
     if (c >= '0' && c <= '9')
@@ -103,8 +103,24 @@ static const REOpCode reopcode_info[REOP_COUNT] = {
 #define RE_HEADER_FLAGS         0
 #define RE_HEADER_CAPTURE_COUNT 1
 #define RE_HEADER_STACK_SIZE    2
+#define RE_HEADER_PREFILTER     7 /* RE_PREFILTER_x */
+#define RE_HEADER_PREFIX_LEN    8 /* number of chars in the literal prefix */
+#define RE_HEADER_PREFILTER_DATA 9 /* u16 prefix chars or first char bitmap */
 
-#define RE_HEADER_LEN 7
+#define RE_PREFILTER_DATA_LEN 32
+#define RE_PREFIX_LEN_MAX (RE_PREFILTER_DATA_LEN / 2)
+
+#define RE_HEADER_LEN (RE_HEADER_PREFILTER_DATA + RE_PREFILTER_DATA_LEN)
+
+/* length of the loop iterating thru the start positions */
+#define RE_SEARCH_LOOP_LEN 11
+
+typedef enum {
+    RE_PREFILTER_NONE,
+    RE_PREFILTER_PREFIX, /* the match starts with a literal prefix */
+    RE_PREFILTER_CHAR_SET, /* the first char of the match is in a set */
+    RE_PREFILTER_CHAR_SET_WIDE, /* same but any char >= 256 may start it */
+} REPrefilterEnum;
 
 static inline int is_digit(int c) {
     return c >= '0' && c <= '9';
@@ -1021,6 +1037,69 @@ static int re_check_advance(const uint8_t *bc_buf, int bc_buf_len)
     return ret;
 }
 
+/* return TRUE if the atom in 'bc_buf' may match without advancing.
+   The loops are structured so that the backward jumps can be
+   ignored. */
+static BOOL re_may_match_empty(REParseState *s, const uint8_t *bc_buf,
+                               int bc_buf_len)
+{
+    int pos, opcode, len, target;
+    uint8_t *reach;
+    BOOL ret;
+    
+    reach = lre_realloc(s->mem_opaque, NULL, bc_buf_len + 1);
+    if (!reach)
+        return TRUE;
+    memset(reach, 0, bc_buf_len + 1);
+    reach[0] = 1;
+    for(pos = 0; pos < bc_buf_len; pos += len) {
+        opcode = bc_buf[pos];
+        len = reopcode_info[opcode].size;
+        if (opcode == REOP_range)
+            len += get_u16(bc_buf + pos + 1) * 4;
+        else if (opcode == REOP_range32)
+            len += get_u16(bc_buf + pos + 1) * 8;
+        else if (opcode == REOP_simple_greedy_quant)
+            len += get_u32(bc_buf + pos + 1);
+        if (!reach[pos])
+            continue;
+        switch(opcode) {
+        case REOP_char:
+        case REOP_char32:
+        case REOP_dot:
+        case REOP_any:
+        case REOP_range:
+        case REOP_range32:
+        case REOP_match:
+            break;
+        case REOP_simple_greedy_quant:
+            if (get_u32(bc_buf + pos + 5) == 0)
+                reach[pos + len] = 1;
+            break;
+        case REOP_split_goto_first:
+        case REOP_split_next_first:
+        case REOP_loop:
+        case REOP_bne_char_pos:
+            reach[pos + len] = 1;
+            /* fall thru */
+        case REOP_goto:
+        case REOP_lookahead:
+        case REOP_negative_lookahead:
+            /* the lookahead body is skipped */
+            target = pos + 5 + (int)get_u32(bc_buf + pos + 1);
+            if (target > pos)
+                reach[target] = 1;
+            break;
+        default:
+            reach[pos + len] = 1;
+            break;
+        }
+    }
+    ret = reach[bc_buf_len];
+    lre_realloc(s->mem_opaque, reach, 0);
+    return ret;
+}
+
 /* return -1 if a simple quantifier cannot be used. Otherwise return
    the number of characters in the atom. */
 static int re_is_simple_quantifier(const uint8_t *bc_buf, int bc_buf_len)
@@ -1570,7 +1649,9 @@ static int re_parse_term(REParseState *s, BOOL is_backward_dir)
                 }
                 
                 add_zero_advance_check = (re_check_advance(s->byte_code.buf + last_atom_start,
-                                                           s->byte_code.size - last_atom_start) == 0);
+                                                           s->byte_code.size - last_atom_start) == 0 &&
+                                          re_may_match_empty(s, s->byte_code.buf + last_atom_start,
+                                                             s->byte_code.size - last_atom_start));
             } else {
                 add_zero_advance_check = FALSE;
             }
@@ -1780,6 +1861,305 @@ static int re_compute_stack_size(const uint8_t *bc_buf, int bc_buf_len)
     return stack_size_max;
 }
 
+/* Regexps without back references, lookarounds or counted loops can
+   be run as a Thompson NFA, i.e. all the threads in lock step. The
+   backtracking engine is tried first with a budget proportional to
+   the input length. If it is exhausted, the match is restarted with
+   the NFA so that the execution time stays linear. */
+#define RE_LINEAR_PROG_MAX 16384 /* max length of the expanded bytecode */
+#define RE_LINEAR_CAPTURE_MAX 65536 /* max number of threads * captures */
+#define RE_BACKTRACK_BUDGET_PER_CHAR 32
+
+/* Expand the simple greedy quantifiers of 'bc_buf' to splits and
+   gotos. If 'out' is NULL, only compute the length and fill
+   'pos_map' (if not NULL) with the new position of each opcode,
+   otherwise output the bytecode using 'pos_map' to relocate the
+   jumps. Return -1 if the linear engine cannot be used. The number
+   of opcodes which can hold a thread is returned in
+   '*pthread_count'. */
+static int re_linear_expand(uint8_t *out, int *pos_map, int *pthread_count,
+                            const uint8_t *bc_buf, int bc_buf_len)
+{
+    int pos, opcode, len, out_pos, thread_count, body_len, exit_pos, i;
+    uint32_t val, quant_min, quant_max, char_count, opt_count;
+    int64_t size;
+    
+    pos = 0;
+    out_pos = 0;
+    thread_count = 0;
+    while (pos < bc_buf_len) {
+        opcode = bc_buf[pos];
+        len = reopcode_info[opcode].size;
+        if (pos_map)
+            pos_map[pos] = out_pos;
+        switch(opcode) {
+        case REOP_range:
+            val = get_u16(bc_buf + pos + 1);
+            len += val * 4;
+            goto simple_char;
+        case REOP_range32:
+            val = get_u16(bc_buf + pos + 1);
+            len += val * 8;
+            goto simple_char;
+        case REOP_char:
+        case REOP_char32:
+        case REOP_dot:
+        case REOP_any:
+        case REOP_match:
+        simple_char:
+            thread_count++;
+            goto copy;
+        case REOP_line_start:
+        case REOP_line_end:
+        case REOP_save_start:
+        case REOP_save_end:
+        case REOP_save_reset:
+        case REOP_word_boundary:
+        case REOP_not_word_boundary:
+        copy:
+            if (out)
+                memcpy(out + out_pos, bc_buf + pos, len);
+            out_pos += len;
+            break;
+        case REOP_goto:
+        case REOP_split_goto_first:
+        case REOP_split_next_first:
+            if (out) {
+                val = get_u32(bc_buf + pos + 1);
+                out[out_pos] = opcode;
+                put_u32(out + out_pos + 1,
+                        pos_map[pos + 5 + (int)val] - (out_pos + 5));
+            }
+            out_pos += 5;
+            break;
+        case REOP_simple_greedy_quant:
+            /* the atom is followed by REOP_match */
+            body_len = get_u32(bc_buf + pos + 1) - 1;
+            quant_min = get_u32(bc_buf + pos + 5);
+            quant_max = get_u32(bc_buf + pos + 9);
+            char_count = get_u32(bc_buf + pos + 13);
+            if (quant_max == INT32_MAX)
+                opt_count = 1;
+            else
+                opt_count = quant_max - quant_min;
+            size = (int64_t)quant_min * body_len +
+                (int64_t)opt_count * (body_len + 5);
+            if (quant_max == INT32_MAX)
+                size += 5;
+            if (out_pos + size > RE_LINEAR_PROG_MAX)
+                return -1;
+            if (out) {
+                const uint8_t *body = bc_buf + pos + 17;
+                for(i = 0; i < quant_min; i++) {
+                    memcpy(out + out_pos, body, body_len);
+                    out_pos += body_len;
+                }
+                if (quant_max == INT32_MAX) {
+                    out[out_pos] = REOP_split_next_first;
+                    put_u32(out + out_pos + 1, body_len + 5);
+                    memcpy(out + out_pos + 5, body, body_len);
+                    out[out_pos + 5 + body_len] = REOP_goto;
+                    put_u32(out + out_pos + 6 + body_len, -(body_len + 10));
+                    out_pos += body_len + 10;
+                } else {
+                    exit_pos = out_pos + opt_count * (body_len + 5);
+                    for(i = 0; i < opt_count; i++) {
+                        out[out_pos] = REOP_split_next_first;
+                        put_u32(out + out_pos + 1, exit_pos - (out_pos + 5));
+                        memcpy(out + out_pos + 5, body, body_len);
+                        out_pos += body_len + 5;
+                    }
+                }
+            } else {
+                out_pos += size;
+            }
+            thread_count += char_count * (quant_min + opt_count);
+            len += body_len + 1;
+            break;
+        default:
+            return -1;
+        }
+        pos += len;
+    }
+    if (pos_map)
+        pos_map[pos] = out_pos;
+    *pthread_count = thread_count;
+    return out_pos;
+}
+
+static void re_prefilter_add_range(REParseState *s, uint32_t *bitmap,
+                                   BOOL *pwide, uint32_t low, uint32_t high)
+{
+    uint32_t c;
+    
+    if (s->ignore_case) {
+        /* the ranges contain canonicalized chars */
+        for(c = 0; c < 256; c++) {
+            uint32_t c1 = lre_canonicalize(c, s->is_utf16);
+            if (c1 >= low && c1 <= high)
+                bitmap[c >> 5] |= 1U << (c & 31);
+        }
+        *pwide = TRUE;
+    } else {
+        for(c = low; c <= min_uint32(high, 255); c++)
+            bitmap[c >> 5] |= 1U << (c & 31);
+        if (high >= 256)
+            *pwide = TRUE;
+    }
+}
+
+/* Find a literal prefix or the set of the possible first chars of a
+   match, so that lre_exec() only runs the regexp at the positions
+   where it may match. */
+static void re_compute_prefilter(REParseState *s, BOOL is_sticky)
+{
+    uint8_t *header = s->byte_code.buf;
+    const uint8_t *bc_buf;
+    int bc_buf_len, pos, opcode, len, target, n, i;
+    uint32_t bitmap[8], low, high;
+    uint8_t *reach;
+    BOOL wide;
+    
+    bc_buf = header + RE_HEADER_LEN;
+    bc_buf_len = s->byte_code.size - RE_HEADER_LEN;
+    if (!is_sticky) {
+        bc_buf += RE_SEARCH_LOOP_LEN;
+        bc_buf_len -= RE_SEARCH_LOOP_LEN;
+    }
+
+    /* literal prefix */
+    if (!s->ignore_case) {
+        pos = 0;
+        n = 0;
+        while (pos < bc_buf_len && n < RE_PREFIX_LEN_MAX) {
+            opcode = bc_buf[pos];
+            if (opcode == REOP_char) {
+                put_u16(header + RE_HEADER_PREFILTER_DATA + 2 * n,
+                        get_u16(bc_buf + pos + 1));
+                n++;
+            } else if (opcode != REOP_save_start &&
+                       opcode != REOP_save_end) {
+                break;
+            }
+            pos += reopcode_info[opcode].size;
+        }
+        if (n > 0) {
+            header[RE_HEADER_PREFILTER] = RE_PREFILTER_PREFIX;
+            header[RE_HEADER_PREFIX_LEN] = n;
+            return;
+        }
+    }
+    
+    /* set of the first chars */
+    reach = lre_realloc(s->mem_opaque, NULL, bc_buf_len + 1);
+    if (!reach)
+        return;
+    memset(reach, 0, bc_buf_len + 1);
+    reach[0] = 1;
+    memset(bitmap, 0, sizeof(bitmap));
+    wide = FALSE;
+    for(pos = 0; pos < bc_buf_len; pos += len) {
+        opcode = bc_buf[pos];
+        len = reopcode_info[opcode].size;
+        if (opcode == REOP_range)
+            len += get_u16(bc_buf + pos + 1) * 4;
+        else if (opcode == REOP_range32)
+            len += get_u16(bc_buf + pos + 1) * 8;
+        if (!reach[pos])
+            continue;
+        switch(opcode) {
+        case REOP_char:
+            low = get_u16(bc_buf + pos + 1);
+            re_prefilter_add_range(s, bitmap, &wide, low, low);
+            break;
+        case REOP_char32:
+            wide = TRUE;
+            break;
+        case REOP_range:
+            n = get_u16(bc_buf + pos + 1);
+            for(i = 0; i < n; i++) {
+                low = get_u16(bc_buf + pos + 3 + i * 4);
+                high = get_u16(bc_buf + pos + 3 + i * 4 + 2);
+                if (high == 0xffff && i == n - 1)
+                    high = 0x10ffff;
+                re_prefilter_add_range(s, bitmap, &wide, low, high);
+            }
+            break;
+        case REOP_range32:
+            n = get_u16(bc_buf + pos + 1);
+            for(i = 0; i < n; i++) {
+                low = get_u32(bc_buf + pos + 3 + i * 8);
+                high = get_u32(bc_buf + pos + 3 + i * 8 + 4);
+                re_prefilter_add_range(s, bitmap, &wide, low, high);
+            }
+            break;
+        case REOP_simple_greedy_quant:
+            /* the atom is examined by the loop. It contains at least
+               one char so its final REOP_match is never reached. */
+            reach[pos + len] = 1;
+            if (get_u32(bc_buf + pos + 5) == 0)
+                reach[pos + len + get_u32(bc_buf + pos + 1)] = 1;
+            break;
+        case REOP_split_goto_first:
+        case REOP_split_next_first:
+        case REOP_loop:
+        case REOP_bne_char_pos:
+            reach[pos + len] = 1;
+            /* fall thru */
+        case REOP_goto:
+        case REOP_lookahead:
+        case REOP_negative_lookahead:
+            /* the lookahead body is skipped */
+            target = pos + 5 + (int)get_u32(bc_buf + pos + 1);
+            if (target > pos)
+                reach[target] = 1;
+            break;
+        case REOP_dot:
+        case REOP_any:
+        case REOP_back_reference:
+        case REOP_backward_back_reference:
+        case REOP_prev:
+        case REOP_match:
+            /* any char or the empty string may match */
+            goto done;
+        default:
+            reach[pos + len] = 1;
+            break;
+        }
+    }
+    if (wide) {
+        for(i = 0; i < 8; i++) {
+            if (bitmap[i] != 0xffffffff)
+                break;
+        }
+        if (i == 8)
+            goto done;
+    } else {
+        /* a single first char is searched as a prefix */
+        n = -1;
+        for(i = 0; i < 8; i++) {
+            if (bitmap[i] != 0) {
+                if (n >= 0 || (bitmap[i] & (bitmap[i] - 1)) != 0) {
+                    n = -1;
+                    break;
+                }
+                n = i * 32 + ctz32(bitmap[i]);
+            }
+        }
+        if (n >= 0) {
+            put_u16(header + RE_HEADER_PREFILTER_DATA, n);
+            header[RE_HEADER_PREFILTER] = RE_PREFILTER_PREFIX;
+            header[RE_HEADER_PREFIX_LEN] = 1;
+            goto done;
+        }
+    }
+    header[RE_HEADER_PREFILTER] = RE_PREFILTER_CHAR_SET + wide;
+    for(i = 0; i < 8; i++)
+        put_u32(header + RE_HEADER_PREFILTER_DATA + i * 4, bitmap[i]);
+ done:
+    lre_realloc(s->mem_opaque, reach, 0);
+}
+
 /* 'buf' must be a zero terminated UTF-8 string of length buf_len.
    Return NULL if error and allocate an error message in *perror_msg,
    otherwise the compiled bytecode and its length in plen.
@@ -1789,7 +2169,7 @@ uint8_t *lre_compile(int *plen, char *error_msg, int error_msg_size,
                      void *opaque)
 {
     REParseState s_s, *s = &s_s;
-    int stack_size;
+    int stack_size, len, thread_count;
     BOOL is_sticky;
     
     memset(s, 0, sizeof(*s));
@@ -1813,6 +2193,9 @@ uint8_t *lre_compile(int *plen, char *error_msg, int error_msg_size,
     dbuf_putc(&s->byte_code, 0); /* second element is the number of captures */
     dbuf_putc(&s->byte_code, 0); /* stack size */
     dbuf_put_u32(&s->byte_code, 0); /* bytecode length */
+    /* prefilter, filled by re_compute_prefilter() */
+    while (s->byte_code.size < RE_HEADER_LEN)
+        dbuf_putc(&s->byte_code, 0);
     
     if (!is_sticky) {
         /* iterate thru all positions (about the same as .*?( ... ) )
@@ -1821,7 +2204,7 @@ uint8_t *lre_compile(int *plen, char *error_msg, int error_msg_size,
            implementation */
         re_emit_op_u32(s, REOP_split_goto_first, 1 + 5);
         re_emit_op(s, REOP_any);
-        re_emit_op_u32(s, REOP_goto, -(5 + 1 + 5));
+        re_emit_op_u32(s, REOP_goto, -RE_SEARCH_LOOP_LEN);
     }
     re_emit_op_u8(s, REOP_save_start, 0);
 
@@ -1858,6 +2241,15 @@ uint8_t *lre_compile(int *plen, char *error_msg, int error_msg_size,
     s->byte_code.buf[RE_HEADER_STACK_SIZE] = stack_size;
     put_u32(s->byte_code.buf + 3, s->byte_code.size - RE_HEADER_LEN);
 
+    len = re_linear_expand(NULL, NULL, &thread_count,
+                           s->byte_code.buf + RE_HEADER_LEN,
+                           s->byte_code.size - RE_HEADER_LEN);
+    if (len >= 0 && len <= RE_LINEAR_PROG_MAX &&
+        (int64_t)thread_count * s->capture_count <= RE_LINEAR_CAPTURE_MAX) {
+        s->byte_code.buf[RE_HEADER_FLAGS] |= LRE_FLAG_LINEAR;
+    }
+    re_compute_prefilter(s, is_sticky);
+
     /* add the named groups if needed */
     if (s->group_names.size > (s->capture_count - 1)) {
         dbuf_put(&s->byte_code, s->group_names.buf, s->group_names.size);
@@ -2011,6 +2403,9 @@ typedef struct {
     uint8_t *state_stack;
     size_t state_stack_size;
     size_t state_stack_len;
+    /* number of backtracks before falling back to the linear engine
+       (0 = unlimited) */
+    size_t backtrack_budget;
 } REExecContext;
 
 static int push_state(REExecContext *s,
@@ -2051,7 +2446,8 @@ static int push_state(REExecContext *s,
     return 0;
 }
 
-/* return 1 if match, 0 if not match or -1 if error. */
+/* return 1 if match, 0 if not match, -1 if error or -2 if the
+   backtrack budget is exhausted. */
 static intptr_t lre_exec_backtrack(REExecContext *s, uint8_t **capture,
                                    StackInt *stack, int stack_len,
                                    const uint8_t *pc, const uint8_t *cptr,
@@ -2088,6 +2484,9 @@ static intptr_t lre_exec_backtrack(REExecContext *s, uint8_t **capture,
                                          (s->state_stack_len - 1) * s->state_size);
                     if (rs->type == RE_EXEC_STATE_SPLIT) {
                         if (!ret) {
+                            if (unlikely(s->backtrack_budget != 0 &&
+                                         --s->backtrack_budget == 0))
+                                return -2;
                         pop_state:
                             memcpy(capture, rs->buf,
                                    sizeof(capture[0]) * 2 * s->capture_count);
@@ -2103,6 +2502,9 @@ static intptr_t lre_exec_backtrack(REExecContext *s, uint8_t **capture,
                     } else if (rs->type == RE_EXEC_STATE_GREEDY_QUANT) {
                         if (!ret) {
                             uint32_t char_count, i;
+                            if (unlikely(s->backtrack_budget != 0 &&
+                                         --s->backtrack_budget == 0))
+                                return -2;
                             memcpy(capture, rs->buf,
                                    sizeof(capture[0]) * 2 * s->capture_count);
                             stack_len = rs->stack_len;
@@ -2459,6 +2861,420 @@ static intptr_t lre_exec_backtrack(REExecContext *s, uint8_t **capture,
     }
 }
 
+typedef struct {
+    int pc; /* -1 to restore a capture */
+    int idx;
+    uint8_t *ptr;
+} RELinearStackEntry;
+
+typedef struct {
+    int count;
+    int *pc;
+    uint8_t **capture;
+} RELinearList;
+
+typedef struct {
+    REExecContext *s;
+    const uint8_t *prog;
+    int capture_size; /* number of capture pointers per thread */
+    int gen; /* current step */
+    int *mark; /* step in which each opcode was last visited */
+    uint8_t **capture; /* capture of the thread being expanded */
+    RELinearStackEntry *stack;
+    int stack_len;
+    int stack_size;
+} RELinearContext;
+
+static int re_linear_push(RELinearContext *ls, int pc, int idx, uint8_t *ptr)
+{
+    RELinearStackEntry *e;
+    
+    if (unlikely(ls->stack_len >= ls->stack_size)) {
+        int new_size;
+        new_size = max_int(16, ls->stack_size * 3 / 2);
+        e = lre_realloc(ls->s->opaque, ls->stack, new_size * sizeof(e[0]));
+        if (!e)
+            return -1;
+        ls->stack = e;
+        ls->stack_size = new_size;
+    }
+    e = &ls->stack[ls->stack_len++];
+    e->pc = pc;
+    e->idx = idx;
+    e->ptr = ptr;
+    return 0;
+}
+
+/* add to 'l' in priority order the threads reachable from 'pc'
+   without consuming a character */
+static int re_linear_add(RELinearContext *ls, RELinearList *l, int pc,
+                         const uint8_t *cptr)
+{
+    REExecContext *s = ls->s;
+    const uint8_t *prog = ls->prog;
+    int cbuf_type, opcode, i, last;
+    uint32_t val, c;
+    RELinearStackEntry *e;
+    const uint8_t *cbuf_end;
+
+    cbuf_type = s->cbuf_type;
+    cbuf_end = s->cbuf_end;
+    if (re_linear_push(ls, pc, 0, NULL))
+        return -1;
+    while (ls->stack_len > 0) {
+        e = &ls->stack[--ls->stack_len];
+        if (e->pc < 0) {
+            ls->capture[e->idx] = e->ptr;
+            continue;
+        }
+        pc = e->pc;
+        for(;;) {
+            if (ls->mark[pc] == ls->gen)
+                break;
+            ls->mark[pc] = ls->gen;
+            opcode = prog[pc];
+            switch(opcode) {
+            case REOP_goto:
+                pc += 5 + (int)get_u32(prog + pc + 1);
+                continue;
+            case REOP_split_goto_first:
+            case REOP_split_next_first:
+                val = get_u32(prog + pc + 1);
+                pc += 5;
+                if (opcode == REOP_split_next_first) {
+                    if (re_linear_push(ls, pc + (int)val, 0, NULL))
+                        return -1;
+                } else {
+                    if (re_linear_push(ls, pc, 0, NULL))
+                        return -1;
+                    pc += (int)val;
+                }
+                continue;
+            case REOP_save_start:
+            case REOP_save_end:
+                i = 2 * prog[pc + 1] + opcode - REOP_save_start;
+                if (re_linear_push(ls, -1, i, ls->capture[i]))
+                    return -1;
+                ls->capture[i] = (uint8_t *)cptr;
+                pc += 2;
+                continue;
+            case REOP_save_reset:
+                last = 2 * prog[pc + 2] + 1;
+                for(i = 2 * prog[pc + 1]; i <= last; i++) {
+                    if (re_linear_push(ls, -1, i, ls->capture[i]))
+                        return -1;
+                    ls->capture[i] = NULL;
+                }
+                pc += 3;
+                continue;
+            case REOP_line_start:
+                if (cptr != s->cbuf) {
+                    if (!s->multi_line)
+                        break;
+                    PEEK_PREV_CHAR(c, cptr, s->cbuf);
+                    if (!is_line_terminator(c))
+                        break;
+                }
+                pc++;
+                continue;
+            case REOP_line_end:
+                if (cptr != cbuf_end) {
+                    if (!s->multi_line)
+                        break;
+                    PEEK_CHAR(c, cptr, cbuf_end);
+                    if (!is_line_terminator(c))
+                        break;
+                }
+                pc++;
+                continue;
+            case REOP_word_boundary:
+            case REOP_not_word_boundary:
+                {
+                    BOOL v1, v2;
+                    if (cptr == s->cbuf) {
+                        v1 = FALSE;
+                    } else {
+                        PEEK_PREV_CHAR(c, cptr, s->cbuf);
+                        v1 = is_word_char(c);
+                    }
+                    if (cptr >= cbuf_end) {
+                        v2 = FALSE;
+                    } else {
+                        PEEK_CHAR(c, cptr, cbuf_end);
+                        v2 = is_word_char(c);
+                    }
+                    if (v1 ^ v2 ^ (REOP_not_word_boundary - opcode))
+                        break;
+                }
+                pc++;
+                continue;
+            default:
+                /* character test or match */
+                i = l->count++;
+                l->pc[i] = pc;
+                memcpy(l->capture + i * ls->capture_size, ls->capture,
+                       ls->capture_size * sizeof(ls->capture[0]));
+                break;
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+/* return the length of the opcode at 'pc' if it accepts the
+   character 'c' ('cc' once canonicalized), 0 otherwise */
+static int re_linear_test_char(const uint8_t *pc, uint32_t c, uint32_t cc)
+{
+    int n;
+    uint32_t low, high, idx_min, idx_max, idx;
+
+    switch(pc[0]) {
+    case REOP_char:
+        return (get_u16(pc + 1) == cc) ? 3 : 0;
+    case REOP_char32:
+        return (get_u32(pc + 1) == cc) ? 5 : 0;
+    case REOP_dot:
+        return !is_line_terminator(c);
+    case REOP_any:
+        return 1;
+    case REOP_range:
+        n = get_u16(pc + 1);
+        pc += 3;
+        if (cc < get_u16(pc))
+            return 0;
+        idx_min = 0;
+        idx_max = n - 1;
+        high = get_u16(pc + idx_max * 4 + 2);
+        /* 0xffff in for last value means +infinity */
+        if (unlikely(cc >= 0xffff) && high == 0xffff)
+            return 3 + 4 * n;
+        if (cc > high)
+            return 0;
+        while (idx_min <= idx_max) {
+            idx = (idx_min + idx_max) / 2;
+            low = get_u16(pc + idx * 4);
+            high = get_u16(pc + idx * 4 + 2);
+            if (cc < low)
+                idx_max = idx - 1;
+            else if (cc > high)
+                idx_min = idx + 1;
+            else
+                return 3 + 4 * n;
+        }
+        return 0;
+    case REOP_range32:
+        n = get_u16(pc + 1);
+        pc += 3;
+        if (cc < get_u32(pc))
+            return 0;
+        idx_min = 0;
+        idx_max = n - 1;
+        if (cc > get_u32(pc + idx_max * 8 + 4))
+            return 0;
+        while (idx_min <= idx_max) {
+            idx = (idx_min + idx_max) / 2;
+            low = get_u32(pc + idx * 8);
+            high = get_u32(pc + idx * 8 + 4);
+            if (cc < low)
+                idx_max = idx - 1;
+            else if (cc > high)
+                idx_min = idx + 1;
+            else
+                return 3 + 8 * n;
+        }
+        return 0;
+    default:
+        abort();
+    }
+}
+
+/* leftmost first match with all the threads in lock step. Return 1
+   if match, 0 if not match or -1 if error. */
+static int lre_exec_linear(REExecContext *s, uint8_t **capture,
+                           const uint8_t *bc_buf, int bc_buf_len,
+                           const uint8_t *cptr)
+{
+    RELinearContext ls_s, *ls = &ls_s;
+    RELinearList list[2], *clist, *nlist, *tmp;
+    int *pos_map, prog_len, thread_count, cbuf_type, i, len, ret;
+    uint8_t *prog, **cap;
+    const uint8_t *cptr1, *cbuf_end;
+    uint32_t c, cc;
+    BOOL has_char;
+
+    cbuf_type = s->cbuf_type;
+    cbuf_end = s->cbuf_end;
+    memset(ls, 0, sizeof(*ls));
+    memset(list, 0, sizeof(list));
+    prog = NULL;
+    ret = -1;
+    
+    pos_map = lre_realloc(s->opaque, NULL, (bc_buf_len + 1) * sizeof(int));
+    if (!pos_map)
+        return -1;
+    prog_len = re_linear_expand(NULL, pos_map, &thread_count,
+                                bc_buf, bc_buf_len);
+    prog = lre_realloc(s->opaque, NULL, prog_len);
+    if (!prog)
+        goto done;
+    re_linear_expand(prog, pos_map, &thread_count, bc_buf, bc_buf_len);
+    
+    ls->s = s;
+    ls->prog = prog;
+    ls->capture_size = 2 * s->capture_count;
+    ls->mark = lre_realloc(s->opaque, NULL, prog_len * sizeof(int));
+    ls->capture = lre_realloc(s->opaque, NULL,
+                              ls->capture_size * sizeof(capture[0]));
+    if (!ls->mark || !ls->capture)
+        goto done;
+    for(i = 0; i < prog_len; i++)
+        ls->mark[i] = -1;
+    for(i = 0; i < 2; i++) {
+        list[i].pc = lre_realloc(s->opaque, NULL, thread_count * sizeof(int));
+        list[i].capture = lre_realloc(s->opaque, NULL, thread_count *
+                                      ls->capture_size * sizeof(capture[0]));
+        if (!list[i].pc || !list[i].capture)
+            goto done;
+    }
+    clist = &list[0];
+    nlist = &list[1];
+
+    for(i = 0; i < ls->capture_size; i++)
+        ls->capture[i] = NULL;
+    if (re_linear_add(ls, clist, 0, cptr))
+        goto done;
+    ret = 0;
+    while (clist->count != 0) {
+        cptr1 = cptr;
+        has_char = (cptr < cbuf_end);
+        c = cc = 0;
+        if (has_char) {
+            GET_CHAR(c, cptr1, cbuf_end);
+            cc = c;
+            if (s->ignore_case)
+                cc = lre_canonicalize(c, s->is_utf16);
+        }
+        ls->gen++;
+        nlist->count = 0;
+        for(i = 0; i < clist->count; i++) {
+            cap = clist->capture + i * ls->capture_size;
+            if (prog[clist->pc[i]] == REOP_match) {
+                /* the lower priority threads are discarded */
+                memcpy(capture, cap, ls->capture_size * sizeof(capture[0]));
+                ret = 1;
+                break;
+            }
+            if (!has_char)
+                continue;
+            len = re_linear_test_char(prog + clist->pc[i], c, cc);
+            if (len) {
+                memcpy(ls->capture, cap, ls->capture_size * sizeof(capture[0]));
+                if (re_linear_add(ls, nlist, clist->pc[i] + len, cptr1)) {
+                    ret = -1;
+                    goto done;
+                }
+            }
+        }
+        tmp = clist;
+        clist = nlist;
+        nlist = tmp;
+        cptr = cptr1;
+    }
+ done:
+    for(i = 0; i < 2; i++) {
+        lre_realloc(s->opaque, list[i].pc, 0);
+        lre_realloc(s->opaque, list[i].capture, 0);
+    }
+    lre_realloc(s->opaque, ls->stack, 0);
+    lre_realloc(s->opaque, ls->capture, 0);
+    lre_realloc(s->opaque, ls->mark, 0);
+    lre_realloc(s->opaque, prog, 0);
+    lre_realloc(s->opaque, pos_map, 0);
+    return ret;
+}
+
+/* return the first position >= cindex where the regexp may match
+   according to its prefilter or -1 if none */
+static int lre_prefilter_search(const uint8_t *bc_buf, const uint8_t *cbuf,
+                                int cindex, int clen, int cbuf_type)
+{
+    const uint8_t *data = bc_buf + RE_HEADER_PREFILTER_DATA;
+    int type, n, i, j;
+    uint32_t c, c0;
+    
+    type = bc_buf[RE_HEADER_PREFILTER];
+    if (type == RE_PREFILTER_PREFIX) {
+        n = bc_buf[RE_HEADER_PREFIX_LEN];
+        c0 = get_u16(data);
+        if (cbuf_type == 0) {
+            const uint8_t *p;
+            for(i = 0; i < n; i++) {
+                if (get_u16(data + 2 * i) >= 256)
+                    return -1;
+            }
+            for(;;) {
+                if (clen - cindex < n)
+                    return -1;
+                p = memchr(cbuf + cindex, c0, clen - n + 1 - cindex);
+                if (!p)
+                    return -1;
+                cindex = p - cbuf;
+                for(j = 1; j < n; j++) {
+                    if (cbuf[cindex + j] != get_u16(data + 2 * j))
+                        break;
+                }
+                if (j == n)
+                    return cindex;
+                cindex++;
+            }
+        } else {
+            const uint16_t *cbuf16 = (const uint16_t *)cbuf;
+            for(i = cindex; i <= clen - n; i++) {
+                if (cbuf16[i] != c0)
+                    continue;
+                for(j = 1; j < n; j++) {
+                    if (cbuf16[i + j] != get_u16(data + 2 * j))
+                        break;
+                }
+                if (j == n &&
+                    !(cbuf_type == 2 && i > cindex &&
+                      cbuf16[i] >= 0xdc00 && cbuf16[i] < 0xe000 &&
+                      cbuf16[i - 1] >= 0xd800 && cbuf16[i - 1] < 0xdc00))
+                    return i;
+            }
+            return -1;
+        }
+    } else {
+        BOOL wide = (type == RE_PREFILTER_CHAR_SET_WIDE);
+        if (cbuf_type == 0) {
+            for(i = cindex; i < clen; i++) {
+                c = cbuf[i];
+                if ((get_u32(data + (c >> 5) * 4) >> (c & 31)) & 1)
+                    return i;
+            }
+        } else {
+            const uint16_t *cbuf16 = (const uint16_t *)cbuf;
+            for(i = cindex; i < clen; i++) {
+                c = cbuf16[i];
+                if (c >= 256) {
+                    if (!wide)
+                        continue;
+                    /* skip the second half of a surrogate pair */
+                    if (cbuf_type == 2 && i > cindex &&
+                        c >= 0xdc00 && c < 0xe000 &&
+                        cbuf16[i - 1] >= 0xd800 && cbuf16[i - 1] < 0xdc00)
+                        continue;
+                    return i;
+                }
+                if ((get_u32(data + (c >> 5) * 4) >> (c & 31)) & 1)
+                    return i;
+            }
+        }
+        return -1;
+    }
+}
+
 /* Return 1 if match, 0 if not match or -1 if error. cindex is the
    starting position of the match and must be such as 0 <= cindex <=
    clen. */
@@ -2469,6 +3285,8 @@ int lre_exec(uint8_t **capture,
     REExecContext s_s, *s = &s_s;
     int re_flags, i, alloca_size, ret;
     StackInt *stack_buf;
+    const uint8_t *pc;
+    BOOL has_prefilter;
     
     re_flags = bc_buf[RE_HEADER_FLAGS];
     s->multi_line = (re_flags & LRE_FLAG_MULTILINE) != 0;
@@ -2483,23 +3301,81 @@ int lre_exec(uint8_t **capture,
         s->cbuf_type = 2;
     s->opaque = opaque;
 
+    pc = bc_buf + RE_HEADER_LEN;
+    has_prefilter = (bc_buf[RE_HEADER_PREFILTER] != RE_PREFILTER_NONE);
+    if (has_prefilter) {
+        if (re_flags & LRE_FLAG_STICKY) {
+            /* the match can only start at cindex */
+            if (lre_prefilter_search(bc_buf, cbuf, cindex, clen,
+                                     s->cbuf_type) != cindex)
+                return 0;
+            has_prefilter = FALSE;
+        } else {
+            /* the start positions are iterated here instead of in
+               the bytecode */
+            pc += RE_SEARCH_LOOP_LEN;
+        }
+    }
+
     s->state_size = sizeof(REExecState) +
         s->capture_count * sizeof(capture[0]) * 2 +
         s->stack_size_max * sizeof(stack_buf[0]);
     s->state_stack = NULL;
     s->state_stack_len = 0;
     s->state_stack_size = 0;
+    s->backtrack_budget = 0;
+    if (re_flags & LRE_FLAG_LINEAR) {
+        s->backtrack_budget = ((size_t)(clen - cindex) + 8) *
+            RE_BACKTRACK_BUDGET_PER_CHAR;
+    }
     
-    for(i = 0; i < s->capture_count * 2; i++)
-        capture[i] = NULL;
     alloca_size = s->stack_size_max * sizeof(stack_buf[0]);
     stack_buf = alloca(alloca_size);
-    ret = lre_exec_backtrack(s, capture, stack_buf, 0, bc_buf + RE_HEADER_LEN,
-                             cbuf + (cindex << cbuf_type), FALSE);
+    for(;;) {
+        if (has_prefilter) {
+            cindex = lre_prefilter_search(bc_buf, cbuf, cindex, clen,
+                                          s->cbuf_type);
+            if (cindex < 0) {
+                ret = 0;
+                break;
+            }
+        }
+        for(i = 0; i < s->capture_count * 2; i++)
+            capture[i] = NULL;
+        ret = lre_exec_backtrack(s, capture, stack_buf, 0, pc,
+                                 cbuf + (cindex << cbuf_type), FALSE);
+        if (ret != 0 || !has_prefilter)
+            break;
+        /* next char as in the search loop */
+        cindex++;
+        if (s->cbuf_type == 2 && cindex < clen) {
+            const uint16_t *cbuf16 = (const uint16_t *)cbuf;
+            if (cbuf16[cindex - 1] >= 0xd800 && cbuf16[cindex - 1] < 0xdc00 &&
+                cbuf16[cindex] >= 0xdc00 && cbuf16[cindex] < 0xe000)
+                cindex++;
+        }
+    }
     lre_realloc(s->opaque, s->state_stack, 0);
+    if (ret == -2) {
+        ret = lre_exec_linear(s, capture, bc_buf + RE_HEADER_LEN,
+                              get_u32(bc_buf + 3),
+                              cbuf + (cindex << cbuf_type));
+    }
     return ret;
 }
 
+/* Return the first position >= cindex where a match may start or -1
+   if there is none. */
+int lre_find_start(const uint8_t *bc_buf, const uint8_t *cbuf,
+                   int cindex, int clen, int cbuf_type)
+{
+    if (bc_buf[RE_HEADER_PREFILTER] == RE_PREFILTER_NONE)
+        return cindex;
+    if (cbuf_type == 1 && (bc_buf[RE_HEADER_FLAGS] & LRE_FLAG_UTF16))
+        cbuf_type = 2;
+    return lre_prefilter_search(bc_buf, cbuf, cindex, clen, cbuf_type);
+}
+
 int lre_get_capture_count(const uint8_t *bc_buf)
 {
     return bc_buf[RE_HEADER_CAPTURE_COUNT];
@@ -2510,6 +3386,17 @@ int lre_get_flags(const uint8_t *bc_buf)
     return bc_buf[RE_HEADER_FLAGS];
 }
 
+/* Return NULL if no group names. Otherwise, return a pointer to
+   'capture_count - 1' zero terminated UTF-8 strings. */
+const char *lre_get_groupnames(const uint8_t *bc_buf)
+{
+    uint32_t re_bytecode_len;
+    if ((lre_get_flags(bc_buf) & LRE_FLAG_NAMED_GROUPS) == 0)
+        return NULL;
+    re_bytecode_len = get_u32(bc_buf + 3);
+    return (const char *)(bc_buf + RE_HEADER_LEN + re_bytecode_len);
+}
+
 #ifdef TEST
 
 BOOL lre_check_stack_overflow(void *opaque, size_t alloca_size)
@@ -0,0 +1,66 @@
+/*
+ * Map/Set micro benchmark
+ *
+ * measures set/get/has/delete at 1k, 100k and 1M entries with int and
+ * string keys. Run with a shell providing print.
+ */
+"use strict";
+
+function measure(name, n, make_key, rounds) {
+    var keys = [], m = new Map(), s = new Set(), t0, i, r, sum;
+    var set_ms, get_ms, has_ms, delete_ms, add_ms;
+
+    for(i = 0; i < n; i++)
+        keys.push(make_key(i));
+
+    t0 = Date.now();
+    for(r = 0; r < rounds; r++) {
+        for(i = 0; i < n; i++)
+            m.set(keys[i], i);
+    }
+    set_ms = Date.now() - t0;
+
+    t0 = Date.now();
+    sum = 0;
+    for(r = 0; r < rounds; r++) {
+        for(i = 0; i < n; i++)
+            sum += m.get(keys[i]);
+    }
+    get_ms = Date.now() - t0;
+
+    t0 = Date.now();
+    for(r = 0; r < rounds; r++) {
+        for(i = 0; i < n; i++)
+            s.add(keys[i]);
+    }
+    add_ms = Date.now() - t0;
+
+    t0 = Date.now();
+    for(r = 0; r < rounds; r++) {
+        for(i = 0; i < n; i++)
+            s.has(keys[i]);
+    }
+    has_ms = Date.now() - t0;
+
+    t0 = Date.now();
+    for(i = 0; i < n; i++)
+        m.delete(keys[i]);
+    delete_ms = Date.now() - t0;
+
+    print(name + " " + n + ": Map.set " + set_ms + " ms, Map.get " +
+          get_ms + " ms, Set.add " + add_ms + " ms, Set.has " + has_ms +
+          " ms, Map.delete " + delete_ms + " ms");
+}
+
+function int_key(i) {
+    return (i * 7919) & 0xffffff;
+}
+
+function string_key(i) {
+    return "dev-" + i;
+}
+
+[ [ 1000, 100 ], [ 100000, 1 ], [ 1000000, 1 ] ].forEach(function (e) {
+    measure("int", e[0], int_key, e[1]);
+    measure("string", e[0], string_key, e[1]);
+});
@@ -0,0 +1,64 @@
+/*
+ * Promise and short lived object micro benchmark
+ *
+ * measures the allocation throughput of promise chains, Promise.all,
+ * thenable resolution, iterator result objects and closures. The
+ * promise cases complete in the job queue, so the shell must run the
+ * pending jobs. Run with a shell providing print.
+ */
+"use strict";
+
+var N = 100000;
+
+function report(name, n, t0) {
+    var ms = Date.now() - t0;
+    print(name + ": " + n + " in " + ms + " ms, " +
+          (ms ? Math.round(n / ms) : n) + " per ms");
+}
+
+function bench_chain() {
+    var t0 = Date.now(), p = Promise.resolve(0), i;
+    for(i = 0; i < N; i++)
+        p = p.then(function (v) { return v + 1; });
+    return p.then(function (v) {
+        report("then chain", v, t0);
+    });
+}
+
+function bench_all() {
+    var t0 = Date.now(), tab = [], i;
+    for(i = 0; i < N; i++)
+        tab.push(Promise.resolve(i));
+    return Promise.all(tab).then(function (r) {
+        report("Promise.all", r.length, t0);
+    });
+}
+
+function bench_thenable() {
+    var t0 = Date.now(), count = 0, i, p = Promise.resolve();
+    for(i = 0; i < N / 10; i++) {
+        p = p.then(function () {
+            count++;
+            return new Promise(function (resolve) { resolve(count); });
+        });
+    }
+    return p.then(function () {
+        report("nested promises", count, t0);
+    });
+}
+
+function bench_objects() {
+    var t0 = Date.now(), i, sum = 0, r, f;
+    for(i = 0; i < N * 10; i++) {
+        r = { value: i, done: false };
+        f = function () { return r.value; };
+        sum += f();
+    }
+    report("result objects and closures", N * 10, t0);
+    return Promise.resolve(sum);
+}
+
+bench_objects();
+bench_chain()
+    .then(bench_all)
+    .then(bench_thenable);
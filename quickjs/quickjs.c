@@ -66,6 +66,10 @@
 #define CONFIG_ATOMICS
 #endif
 
+/* define to allocate the objects from per runtime chunks instead of
+   calling the memory allocator for each object */
+//#define CONFIG_OBJECT_NURSERY
+
 /* dump object free */
 //#define DUMP_FREE
 //#define DUMP_CLOSURE
@@ -190,6 +194,8 @@ typedef enum JSErrorEnum {
 #define JS_MAX_LOCAL_VARS 65536
 #define JS_STACK_SIZE_MAX 65536
 #define JS_STRING_LEN_MAX ((1 << 30) - 1)
+#define JS_REGEXP_CACHE_HASH_SIZE 64 /* must be a power of two */
+#define JS_ASYNC_FUNC_CACHE_MAX 32 /* freed async function states kept for reuse */
 
 #define __exception __attribute__((warn_unused_result))
 
@@ -225,6 +231,43 @@ typedef struct {
 } JSNumericOperations;
 #endif
 
+/* The compiled regexps are shared between the RegExp objects of a
+   runtime. The bytecode is immutable so it can be referenced by any
+   number of objects. */
+typedef struct JSRegExpCacheEntry {
+    struct list_head link; /* rt->regexp_cache_list */
+    struct JSRegExpCacheEntry *hash_next;
+    uint32_t hash;
+    int re_flags;
+    JSString *pattern;
+    JSString *bytecode;
+    size_t size;
+} JSRegExpCacheEntry;
+
+#ifdef CONFIG_OBJECT_NURSERY
+/* The objects are bump allocated from chunks and recycled through
+   free lists indexed by their number of inline property slots, so that
+   short lived objects cost O(1) to allocate and free. Objects never
+   move: a chunk is released as soon as none of its objects is alive,
+   except the chunk being filled which is reset instead so that
+   allocating and freeing at a chunk boundary does not call the memory
+   allocator each time. */
+#define JS_NURSERY_CHUNK_SIZE (16 * 1024)
+#define JS_NURSERY_CLASS_COUNT 9 /* JS_PROP_INLINE_MAX + 1 */
+
+typedef struct JSNurseryChunk {
+    struct list_head link;
+    uint32_t live_count; /* number of allocated objects */
+    uint32_t used_size; /* set when the chunk is no longer being filled */
+} JSNurseryChunk;
+
+/* precedes each object */
+typedef struct JSNurseryHeader {
+    uint32_t chunk_offset;
+    uint32_t size_class; /* number of inline property slots */
+} JSNurseryHeader;
+#endif
+
 struct JSRuntime {
     io_t *io;
     JSMallocFunctions mf;
@@ -283,6 +326,28 @@ struct JSRuntime {
     int shape_hash_size;
     int shape_hash_count; /* number of hashed shapes */
     JSShape **shape_hash;
+
+    /* compiled regexps by pattern and flags */
+    JSRegExpCacheEntry *regexp_cache_hash[JS_REGEXP_CACHE_HASH_SIZE];
+    struct list_head regexp_cache_list; /* LRU order, most recent first */
+    int regexp_cache_count;
+    size_t regexp_cache_size;
+    size_t regexp_cache_max_size;
+    int64_t regexp_cache_hits;
+    int64_t regexp_cache_misses;
+    /* JSAsyncFunctionData of terminated calls, linked by header.link */
+    struct list_head async_func_cache;
+    int async_func_cache_count;
+#ifdef CONFIG_OBJECT_NURSERY
+    struct list_head nursery_chunks; /* list of JSNurseryChunk.link */
+    JSNurseryChunk *nursery_chunk; /* chunk being filled */
+    uint8_t *nursery_ptr;
+    uint8_t *nursery_end;
+    struct list_head nursery_free[JS_NURSERY_CLASS_COUNT];
+    int nursery_chunk_count;
+    int64_t nursery_alloc_count;
+    int64_t nursery_reuse_count;
+#endif
 #ifdef CONFIG_BIGNUM
     bf_context_t bf_ctx;
     JSNumericOperations bigint_ops;
@@ -468,7 +533,7 @@ typedef enum {
     JS_ATOM_KIND_PRIVATE,
 } JSAtomKindEnum;
 
-#define JS_ATOM_HASH_MASK  ((1 << 30) - 1)
+#define JS_ATOM_HASH_MASK  ((1 << 29) - 1)
 
 struct JSString {
     JSRefCountHeader header; /* must come first, 32-bit */
@@ -477,7 +542,10 @@ struct JSString {
     /* for JS_ATOM_TYPE_SYMBOL: hash = 0, atom_type = 3,
        for JS_ATOM_TYPE_PRIVATE: hash = 1, atom_type = 3
        XXX: could change encoding to have one more bit in hash */
-    uint32_t hash : 30;
+    uint32_t hash : 29;
+    /* 8 bit string known to only contain ASCII characters. Set
+       lazily by JS_ToCStringLen2(), so 0 means unknown. */
+    uint8_t is_ascii : 1;
     uint8_t atom_type : 2; /* != 0 if atom, JS_ATOM_TYPE_x */
     uint32_t hash_next; /* atom_index for JS_ATOM_TYPE_SYMBOL */
 #ifdef DUMP_LEAKS
@@ -489,6 +557,81 @@ struct JSString {
     } u;
 };
 
+/* Lazy string (JS_TAG_STRING_ROPE): either the concatenation of two
+   strings or a slice of a flat string. The characters are only copied
+   to 'flat' when they are needed. */
+typedef struct JSStringRope {
+    JSRefCountHeader header; /* must come first, 32-bit */
+    uint32_t len : 31;
+    uint8_t is_wide_char : 1;
+    uint8_t depth; /* 0 for slices and once flattened */
+    uint8_t is_slice;
+    uint32_t start; /* slice: position in 'left' */
+    JSString *flat; /* != NULL once flattened */
+    JSValue left; /* JS_TAG_STRING or JS_TAG_STRING_ROPE. slice: parent */
+    JSValue right; /* slice: JS_UNDEFINED */
+} JSStringRope;
+
+/* shorter concatenations are done by copying */
+#define JS_STRING_ROPE_MIN_LEN 256
+/* the rope is rebalanced when it gets deeper */
+#define JS_STRING_ROPE_MAX_DEPTH 48
+/* substrings of fewer bytes are copied: the slice would not be
+   smaller than the copy */
+#define JS_STRING_SLICE_MIN_SIZE sizeof(JSStringRope)
+/* substrings this many times smaller than their parent are copied so
+   that they do not keep it alive */
+#define JS_STRING_SLICE_PIN_RATIO 8
+
+/* enumerate the leaves of a rope from left to right without
+   allocating memory */
+typedef struct JSStringRopeIter {
+    int stack_len;
+    JSValueConst leaf; /* current leaf */
+    uint32_t start; /* characters of the leaf in the returned string */
+    uint32_t len;
+    JSValueConst stack[JS_STRING_ROPE_MAX_DEPTH + 2];
+} JSStringRopeIter;
+
+static void js_string_rope_iter_init(JSStringRopeIter *it, JSValueConst val)
+{
+    it->stack[0] = val;
+    it->stack_len = 1;
+}
+
+/* return NULL at the end */
+static JSString *js_string_rope_iter_next(JSStringRopeIter *it)
+{
+    JSValueConst val;
+    JSStringRope *r;
+    JSString *p;
+
+    while (it->stack_len > 0) {
+        val = it->stack[--it->stack_len];
+        it->leaf = val;
+        if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING) {
+            p = JS_VALUE_GET_STRING(val);
+            it->start = 0;
+            it->len = p->len;
+            return p;
+        }
+        r = JS_VALUE_GET_PTR(val);
+        if (r->flat) {
+            it->start = 0;
+            it->len = r->len;
+            return r->flat;
+        }
+        if (r->is_slice) {
+            it->start = r->start;
+            it->len = r->len;
+            return JS_VALUE_GET_STRING(r->left);
+        }
+        it->stack[it->stack_len++] = r->right;
+        it->stack[it->stack_len++] = r->left;
+    }
+    return NULL;
+}
+
 typedef struct JSClosureVar {
     uint8_t is_local : 1;
     uint8_t is_arg : 1;
@@ -611,6 +754,7 @@ typedef struct JSForInIterator {
     BOOL is_array;
     uint32_t array_length;
     uint32_t idx;
+    struct JSShapeEnumCache *enum_cache; /* keys of a non exotic object */
 } JSForInIterator;
 
 typedef struct JSRegExp {
@@ -656,6 +800,9 @@ typedef struct JSAsyncFunctionState {
 typedef struct JSAsyncFunctionData {
     JSGCObjectHeader header; /* must come first */
     JSValue resolving_funcs[2];
+    /* resolve and reject functions shared by all the 'await' of the
+       call. JS_UNDEFINED until the first 'await'. */
+    JSValue await_funcs[2];
     BOOL is_active; /* true if the async function state is valid */
     JSAsyncFunctionState func_state;
 } JSAsyncFunctionData;
@@ -806,6 +953,9 @@ typedef struct JSProperty {
 
 #define JS_PROP_INITIAL_SIZE 2
 #define JS_PROP_INITIAL_HASH_SIZE 4 /* must be a power of two */
+/* maximum number of property slots allocated in the same memory block
+   as a JS_CLASS_OBJECT object */
+#define JS_PROP_INLINE_MAX 8
 #define JS_ARRAY_INITIAL_SIZE 2
 
 typedef struct JSShapeProperty {
@@ -831,8 +981,41 @@ struct JSShape {
     int prop_count;
     JSShape *shape_hash_next; /* in JSRuntime.shape_hash[h] list */
     JSObject *proto;
+    /* enumerable string keys, NULL if not computed. Cleared whenever
+       the shape is modified in place */
+    struct JSShapeEnumCache *enum_cache;
     JSShapeProperty prop[0]; /* prop_size elements */
 };
+
+/* ordered enumerable string keys of the objects using a shape, as
+   returned by JS_GetOwnPropertyNamesInternal(). The for-in iterators
+   keep a reference to it so that it outlives a shape modification. */
+typedef struct JSShapeEnumCache {
+    int ref_count;
+    uint32_t count;
+    JSAtom atoms[0];
+} JSShapeEnumCache;
+/* element storage of the fast arrays. The packed kinds hold unboxed
+   numbers. The kind of an Array only widens, on the first store of a
+   value that the current kind cannot represent. Arguments objects are
+   always generic. The elements of an Array may start after the
+   beginning of their allocation (u.array.offset) so that shift() and
+   unshift() do not move them. u.array.u1.size is the capacity counted
+   from the first element. */
+typedef enum {
+    JS_ARRAY_KIND_INT32,   /* u.array.u.int32_ptr: JS_TAG_INT values */
+    JS_ARRAY_KIND_FLOAT64, /* u.array.u.double_ptr: any number */
+    JS_ARRAY_KIND_GENERIC, /* u.array.u.values */
+} JSArrayKindEnum;
+
+static const uint8_t js_array_kind_size[JS_ARRAY_KIND_GENERIC + 1] = {
+    sizeof(int32_t), sizeof(double), sizeof(JSValue),
+};
+
+#define JS_ARRAY_OFFSET_MAX ((1 << 24) - 1)
+/* fast array allocations (in elements) which are never shrunk */
+#define JS_ARRAY_SHRINK_MIN 64
+
 struct JSObject {
     union {
         JSGCObjectHeader header;
@@ -855,7 +1038,7 @@ struct JSObject {
     JSShape *shape; /* prototype and property names + flag */
     JSProperty *prop; /* array of properties */
     /* byte offsets: 24/40 */
-    struct JSMapRecord *first_weak_ref; /* XXX: use a bit and an external hash table? */
+    struct JSMapWeakRef *first_weak_ref; /* XXX: use a bit and an external hash table? */
     /* byte offsets: 28/48 */
     union {
         void *opaque;
@@ -913,9 +1096,19 @@ struct JSObject {
                 double *double_ptr;     /* JS_CLASS_FLOAT64_ARRAY */
             } u;
             uint32_t count; /* <= 2^31-1. 0 for a detached typed array */
-        } array;    /* 12/20 bytes */
+            /* JS_CLASS_ARRAY, JS_CLASS_ARGUMENTS */
+            uint32_t kind : 8; /* JSArrayKindEnum */
+            /* number of free elements before u.ptr in the allocation,
+               left by shift() and reserved by unshift() */
+            uint32_t offset : 24;
+        } array;    /* 16/24 bytes */
         JSRegExp regexp;    /* JS_CLASS_REGEXP: 8/16 bytes */
         JSValue object_data;    /* for JS_SetObjectData(): 8/16/16 bytes */
+        struct { /* JS_CLASS_OBJECT */
+            /* number of property slots following the object header,
+               0 if 'prop' is allocated separately */
+            uint32_t inline_prop_size;
+        } object;
     } u;
     /* byte sizes: 40/48/72 */
 };
@@ -1060,15 +1253,20 @@ static void js_operator_set_mark(JSRuntime *rt, JSValueConst val,
                                  JS_MarkFunc *mark_func);
 #endif
 static JSValue JS_ToStringFree(JSContext *ctx, JSValue val);
+static JSValue JS_ToStringCheckObject(JSContext *ctx, JSValueConst val);
 static int JS_ToBoolFree(JSContext *ctx, JSValue val);
 static int JS_ToInt32Free(JSContext *ctx, int32_t *pres, JSValue val);
 static int JS_ToFloat64Free(JSContext *ctx, double *pres, JSValue val);
 static int JS_ToUint8ClampFree(JSContext *ctx, int32_t *pres, JSValue val);
 static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
                                  JSValueConst flags);
+static void js_regexp_cache_evict(JSRuntime *rt, size_t max_size);
 static JSValue js_regexp_constructor_internal(JSContext *ctx, JSValueConst ctor,
                                               JSValue pattern, JSValue bc);
 static void gc_decref(JSRuntime *rt);
+#ifdef CONFIG_OBJECT_NURSERY
+static void js_nursery_free_all(JSRuntime *rt);
+#endif
 static int JS_NewClass1(JSRuntime *rt, JSClassID class_id,
                         const JSClassDef *class_def, JSAtom name);
 
@@ -1131,6 +1329,9 @@ static int JS_CreateProperty(JSContext *ctx, JSObject *p,
                              JSValueConst getter, JSValueConst setter,
                              int flags);
 static int js_string_memcmp(const JSString *p1, const JSString *p2, int len);
+static JSString *js_string_rope_get_flat(JSContext *ctx, JSValueConst val);
+static int js_resize_array(JSContext *ctx, void **parray, int elem_size,
+                           int *psize, int *pcount, int new_count);
 static void reset_weak_ref(JSRuntime *rt, JSObject *p);
 static BOOL typed_array_is_detached(JSContext *ctx, JSObject *p);
 static uint32_t typed_array_get_length(JSContext *ctx, JSObject *p);
@@ -1162,6 +1363,12 @@ static __exception int perform_promise_then(JSContext *ctx,
                                             JSValueConst *cap_resolving_funcs);
 static JSValue js_promise_resolve(JSContext *ctx, JSValueConst this_val,
                                   int argc, JSValueConst *argv, int magic);
+static JSValue js_new_promise(JSContext *ctx, JSValueConst new_target,
+                              JSValue *resolving_funcs);
+static JSValue promise_reaction_job(JSContext *ctx, int argc,
+                                    JSValueConst *argv);
+static JSValue js_promise_resolve_thenable_job(JSContext *ctx,
+                                               int argc, JSValueConst *argv);
 static int js_string_compare(JSContext *ctx,
                              const JSString *p1, const JSString *p2);
 static JSValue JS_ToNumber(JSContext *ctx, JSValueConst val);
@@ -1532,6 +1739,9 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
 {
     JSRuntime *rt;
     JSMallocState ms;
+#ifdef CONFIG_OBJECT_NURSERY
+    int i;
+#endif
 
     memset(&ms, 0, sizeof(ms));
     ms.opaque = opaque;
@@ -1566,6 +1776,14 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
     init_list_head(&rt->string_list);
 #endif
     init_list_head(&rt->job_list);
+    init_list_head(&rt->regexp_cache_list);
+    rt->regexp_cache_max_size = JS_DEFAULT_REGEXP_CACHE_SIZE;
+    init_list_head(&rt->async_func_cache);
+#ifdef CONFIG_OBJECT_NURSERY
+    init_list_head(&rt->nursery_chunks);
+    for(i = 0; i < JS_NURSERY_CLASS_COUNT; i++)
+        init_list_head(&rt->nursery_free[i]);
+#endif
 
     if (JS_InitAtoms(rt))
         goto fail;
@@ -1624,16 +1842,31 @@ static inline size_t js_def_malloc_usable_size(void *ptr)
 
 static void *js_def_malloc(JSMallocState *s, size_t size)
 {
-	return io_byte_memory_allocate (io_get_byte_memory(s->opaque),size);
+	void *ptr = io_byte_memory_allocate (io_get_byte_memory(s->opaque),size);
+	if (ptr) {
+		s->malloc_count++;
+		s->malloc_total_count++;
+	}
+	return ptr;
 }
 
 static void js_def_free(JSMallocState *s, void *ptr)
 {
-	io_byte_memory_free (io_get_byte_memory(s->opaque),ptr);
+	if (ptr) {
+		s->malloc_count--;
+		io_byte_memory_free (io_get_byte_memory(s->opaque),ptr);
+	}
 }
 
 static void *js_def_realloc(JSMallocState *s, void *ptr, size_t size)
 {
+	if (!ptr) {
+		return size ? js_def_malloc (s,size) : NULL;
+	}
+	if (size == 0) {
+		js_def_free (s,ptr);
+		return NULL;
+	}
 	return io_byte_memory_reallocate (io_get_byte_memory(s->opaque),ptr,size);
 }
 
@@ -1762,6 +1995,7 @@ static JSString *js_alloc_string_rt(JSRuntime *rt, int max_len, int is_wide_char
     str->is_wide_char = is_wide_char;
     str->len = max_len;
     str->atom_type = 0;
+    str->is_ascii = 0;
     str->hash = 0;          /* optional but costless */
     str->hash_next = 0;     /* optional */
 #ifdef DUMP_LEAKS
@@ -1817,6 +2051,8 @@ void JS_FreeRuntime(JSRuntime *rt)
     }
     init_list_head(&rt->job_list);
 
+    js_regexp_cache_evict(rt, 0);
+
     JS_RunGC(rt);
 
 #ifdef DUMP_LEAKS
@@ -1859,6 +2095,13 @@ void JS_FreeRuntime(JSRuntime *rt)
     }
 #endif
     assert(list_empty(&rt->gc_obj_list));
+#ifdef CONFIG_OBJECT_NURSERY
+    js_nursery_free_all(rt);
+#endif
+    list_for_each_safe(el, el1, &rt->async_func_cache) {
+        js_free_rt(rt, list_entry(el, JSGCObjectHeader, link));
+    }
+    init_list_head(&rt->async_func_cache);
 
     /* free the classes */
     for(i = 0; i < rt->class_count; i++) {
@@ -2225,6 +2468,12 @@ void JS_SetMaxStackSize(JSRuntime *rt, size_t stack_size)
     rt->stack_size = stack_size;
 }
 
+void JS_SetRegExpCacheSize(JSRuntime *rt, size_t max_size)
+{
+    rt->regexp_cache_max_size = max_size;
+    js_regexp_cache_evict(rt, max_size);
+}
+
 static inline BOOL is_strict_mode(JSContext *ctx)
 {
     JSStackFrame *sf = ctx->rt->current_stack_frame;
@@ -2347,6 +2596,67 @@ static uint32_t hash_string(const JSString *str, uint32_t h)
     return h;
 }
 
+/* Atom table hash: consumes four characters per step. 8 bit and 16
+   bit strings with the same contents must hash identically because
+   __JS_NewAtom() compares them with js_string_memcmp(). */
+#define ATOM_HASH_MUL 0x9e3779b1
+
+static inline uint32_t atom_hash_step(uint32_t h, uint32_t w)
+{
+    return ((h << 5) | (h >> 27)) ^ w;
+}
+
+static inline uint32_t atom_hash_final(uint32_t h, size_t len)
+{
+    h ^= (uint32_t)len;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint32_t atom_hash_string8(const uint8_t *str, size_t len, uint32_t h)
+{
+    size_t i;
+    uint32_t w;
+
+    for(i = 0; i + 4 <= len; i += 4) {
+        w = str[i] | (str[i + 1] << 8) | (str[i + 2] << 16) |
+            ((uint32_t)str[i + 3] << 24);
+        h = atom_hash_step(h, w) * ATOM_HASH_MUL;
+    }
+    for(; i < len; i++)
+        h = atom_hash_step(h, str[i]) * ATOM_HASH_MUL;
+    return atom_hash_final(h, len);
+}
+
+static uint32_t atom_hash_string16(const uint16_t *str, size_t len, uint32_t h)
+{
+    size_t i;
+    uint32_t w;
+
+    /* wide characters overlap in the packed word, which is harmless:
+       only latin1 contents need to match the 8 bit hash */
+    for(i = 0; i + 4 <= len; i += 4) {
+        w = (uint32_t)str[i] | ((uint32_t)str[i + 1] << 8) |
+            ((uint32_t)str[i + 2] << 16) | ((uint32_t)str[i + 3] << 24);
+        h = atom_hash_step(h, w) * ATOM_HASH_MUL;
+    }
+    for(; i < len; i++)
+        h = atom_hash_step(h, str[i]) * ATOM_HASH_MUL;
+    return atom_hash_final(h, len);
+}
+
+static uint32_t atom_hash_string(const JSString *str, uint32_t h)
+{
+    if (str->is_wide_char)
+        return atom_hash_string16(str->u.str16, str->len, h);
+    else
+        return atom_hash_string8(str->u.str8, str->len, h);
+}
+
 static __maybe_unused void JS_DumpString(JSRuntime *rt,
                                                   const JSString *p)
 {
@@ -2570,7 +2880,7 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
         }
         /* try and locate an already registered atom */
         len = str->len;
-        h = hash_string(str, atom_type);
+        h = atom_hash_string(str, atom_type);
         h &= JS_ATOM_HASH_MASK;
         h1 = h & (rt->atom_hash_size - 1);
         i = rt->atom_hash[h1];
@@ -2655,6 +2965,7 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
                 goto fail;
             p->header.ref_count = 1;
             p->is_wide_char = str->is_wide_char;
+            p->is_ascii = str->is_ascii;
             p->len = str->len;
 #ifdef DUMP_LEAKS
             list_add_tail(&p->link, &rt->string_list);
@@ -2669,6 +2980,7 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
             return JS_ATOM_NULL;
         p->header.ref_count = 1;
         p->is_wide_char = 1;    /* Hack to represent NULL as a JSString */
+        p->is_ascii = 0;
         p->len = 0;
 #ifdef DUMP_LEAKS
         list_add_tail(&p->link, &rt->string_list);
@@ -2723,7 +3035,7 @@ static JSAtom __JS_FindAtom(JSRuntime *rt, const char *str, size_t len,
     uint32_t h, h1, i;
     JSAtomStruct *p;
 
-    h = hash_string8((const uint8_t *)str, len, JS_ATOM_TYPE_STRING);
+    h = atom_hash_string8((const uint8_t *)str, len, JS_ATOM_TYPE_STRING);
     h &= JS_ATOM_HASH_MASK;
     h1 = h & (rt->atom_hash_size - 1);
     i = rt->atom_hash[h1];
@@ -2831,6 +3143,24 @@ JSAtom JS_NewAtom(JSContext *ctx, const char *str)
     return JS_NewAtomLen(ctx, str, strlen(str));
 }
 
+/* Intern 'count' names at once so that bindings can cache the atoms
+   instead of hashing the same C strings on every property access.
+   Return -1 if error, in which case no atom is kept. */
+int JS_NewAtomList(JSContext *ctx, JSAtom *atoms, const char * const *names,
+                   int count)
+{
+    int i;
+
+    for(i = 0; i < count; i++) {
+        atoms[i] = JS_NewAtom(ctx, names[i]);
+        if (atoms[i] == JS_ATOM_NULL) {
+            JS_FreeAtomList(ctx, atoms, i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
 JSAtom JS_NewAtomUInt32(JSContext *ctx, uint32_t n)
 {
     if (n <= JS_ATOM_MAX_INT) {
@@ -3116,6 +3446,16 @@ void JS_FreeAtomRT(JSRuntime *rt, JSAtom v)
         __JS_FreeAtom(rt, v);
 }
 
+void JS_FreeAtomList(JSContext *ctx, JSAtom *atoms, int count)
+{
+    int i;
+
+    for(i = 0; i < count; i++) {
+        JS_FreeAtom(ctx, atoms[i]);
+        atoms[i] = JS_ATOM_NULL;
+    }
+}
+
 /* return TRUE if 'v' is a symbol with a string description */
 static BOOL JS_AtomSymbolHasDescription(JSContext *ctx, JSAtom v)
 {
@@ -3641,6 +3981,15 @@ static int string_buffer_concat_value(StringBuffer *s, JSValueConst v)
         /* prevent exception overload */
         return -1;
     }
+    if (JS_VALUE_GET_TAG(v) == JS_TAG_STRING_ROPE) {
+        JSStringRopeIter it;
+        js_string_rope_iter_init(&it, v);
+        while ((p = js_string_rope_iter_next(&it)) != NULL) {
+            if (string_buffer_concat(s, p, it.start, it.start + it.len))
+                return -1;
+        }
+        return 0;
+    }
     if (unlikely(JS_VALUE_GET_TAG(v) != JS_TAG_STRING)) {
         v1 = JS_ToString(s->ctx, v);
         if (JS_IsException(v1))
@@ -3664,6 +4013,11 @@ static int string_buffer_concat_value_free(StringBuffer *s, JSValue v)
         JS_FreeValue(s->ctx, v);
         return -1;
     }
+    if (JS_VALUE_GET_TAG(v) == JS_TAG_STRING_ROPE) {
+        res = string_buffer_concat_value(s, v);
+        JS_FreeValue(s->ctx, v);
+        return res;
+    }
     if (unlikely(JS_VALUE_GET_TAG(v) != JS_TAG_STRING)) {
         v = JS_ToStringFree(s->ctx, v);
         if (JS_IsException(v))
@@ -3731,22 +4085,43 @@ JSValue JS_NewStringLen(JSContext *ctx, const char *buf, size_t buf_len)
     
     p_start = (const uint8_t *)buf;
     p_end = p_start + buf_len;
-    p = p_start;
-    while (p < p_end && *p < 128)
-        p++;
+    p = p_start + ascii_prefix_len(p_start, buf_len);
     len1 = p - p_start;
     if (len1 > JS_STRING_LEN_MAX)
         return JS_ThrowInternalError(ctx, "string too long");
     if (p == p_end) {
         /* ASCII string */
-        return js_new_string8(ctx, (const uint8_t *)buf, buf_len);
+        JSValue val = js_new_string8(ctx, (const uint8_t *)buf, buf_len);
+        if (!JS_IsException(val))
+            JS_VALUE_GET_STRING(val)->is_ascii = 1;
+        return val;
     } else {
         if (string_buffer_init(ctx, b, buf_len))
             goto fail;
         string_buffer_write8(b, p_start, len1);
         while (p < p_end) {
             if (*p < 128) {
-                string_buffer_putc8(b, *p++);
+                /* short ASCII runs between multibyte sequences are copied
+                   one by one, only the long ones are scanned by words */
+                for (len1 = 0; len1 < 8 && p < p_end && *p < 128; len1++)
+                    string_buffer_putc8(b, *p++);
+                if (len1 == 8) {
+                    len1 = ascii_prefix_len(p, p_end - p);
+                    string_buffer_write8(b, p, len1);
+                    p += len1;
+                }
+            } else if (*p >= 0xc2 && *p < 0xe0 && p_end - p >= 2 &&
+                       (p[1] & 0xc0) == 0x80) {
+                /* two byte sequence, decoded inline as the common case */
+                string_buffer_putc16(b, ((p[0] & 0x1f) << 6) | (p[1] & 0x3f));
+                p += 2;
+            } else if ((*p & 0xf0) == 0xe0 && p_end - p >= 3 &&
+                       (p[1] & 0xc0) == 0x80 && (p[2] & 0xc0) == 0x80 &&
+                       (*p != 0xe0 || p[1] >= 0xa0)) {
+                /* three byte sequence, not overlong */
+                string_buffer_putc16(b, ((p[0] & 0x0f) << 12) |
+                                     ((p[1] & 0x3f) << 6) | (p[2] & 0x3f));
+                p += 3;
             } else {
                 /* parse utf-8 sequence, return 0xFFFFFFFF for error */
                 c = unicode_from_utf8(p, p_end - p, &p_next);
@@ -3858,9 +4233,11 @@ const char *JS_ToCStringLen2(JSContext *ctx, size_t *plen, JSValueConst val1, BO
            than testing each byte, hence this method is faster for ASCII
            strings, which is the most common case.
          */
-        count = 0;
-        for (pos = 0; pos < len; pos++) {
-            count += src[pos] >> 7;
+        if (str->is_ascii) {
+            count = 0;
+        } else {
+            count = count_non_ascii(src, len);
+            str->is_ascii = (count == 0);
         }
         if (count == 0) {
             if (plen)
@@ -3871,15 +4248,7 @@ const char *JS_ToCStringLen2(JSContext *ctx, size_t *plen, JSValueConst val1, BO
         if (!str_new)
             goto fail;
         q = str_new->u.str8;
-        for (pos = 0; pos < len; pos++) {
-            c = src[pos];
-            if (c < 0x80) {
-                *q++ = c;
-            } else {
-                *q++ = (c >> 6) | 0xc0;
-                *q++ = (c & 0x3f) | 0x80;
-            }
-        }
+        q += latin1_to_utf8(q, src, len);
     } else {
         const uint16_t *src = str->u.str16;
         /* Allocate 3 bytes per 16 bit code point. Surrogate pairs may
@@ -3894,8 +4263,15 @@ const char *JS_ToCStringLen2(JSContext *ctx, size_t *plen, JSValueConst val1, BO
             c = src[pos++];
             if (c < 0x80) {
                 *q++ = c;
+            } else if (c < 0x800) {
+                *q++ = (c >> 6) | 0xc0;
+                *q++ = (c & 0x3f) | 0x80;
+            } else if (c < 0xd800 || c >= 0xe000) {
+                *q++ = (c >> 12) | 0xe0;
+                *q++ = ((c >> 6) & 0x3f) | 0x80;
+                *q++ = (c & 0x3f) | 0x80;
             } else {
-                if (c >= 0xd800 && c < 0xdc00) {
+                if (c < 0xdc00) {
                     if (pos < len && !cesu8) {
                         c1 = src[pos];
                         if (c1 >= 0xdc00 && c1 < 0xe000) {
@@ -3928,6 +4304,38 @@ const char *JS_ToCStringLen2(JSContext *ctx, size_t *plen, JSValueConst val1, BO
     return NULL;
 }
 
+/* Return the characters of 'val' if it is a string holding only
+   ASCII characters, NULL otherwise. No reference is taken and no
+   exception is raised: the pointer is null terminated and valid as
+   long as 'val' is alive. */
+const char *JS_ToCStringBorrow(JSContext *ctx, size_t *plen, JSValueConst val)
+{
+    JSString *str;
+
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE) {
+        /* flattening can only fail on memory allocation */
+        str = js_string_rope_get_flat(ctx, val);
+        if (!str) {
+            JS_FreeValue(ctx, JS_GetException(ctx));
+            return NULL;
+        }
+    } else if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING) {
+        str = JS_VALUE_GET_STRING(val);
+    } else {
+        return NULL;
+    }
+    if (str->is_wide_char)
+        return NULL;
+    if (!str->is_ascii) {
+        if (count_non_ascii(str->u.str8, str->len) != 0)
+            return NULL;
+        str->is_ascii = 1;
+    }
+    if (plen)
+        *plen = str->len;
+    return (const char *)str->u.str8;
+}
+
 void JS_FreeCString(JSContext *ctx, const char *ptr)
 {
     JSString *p;
@@ -3951,8 +4359,16 @@ static int memcmp16_8(const uint16_t *src1, const uint8_t *src2, int len)
 
 static int memcmp16(const uint16_t *src1, const uint16_t *src2, int len)
 {
-    int c, i;
-    for(i = 0; i < len; i++) {
+    int c, i, n;
+    /* the library memcmp() compares whole words; it only gives the
+       byte order, so the first different code unit is searched again
+       in the block where they differ */
+    for(i = 0; i < len; i += n) {
+        n = min_int(len - i, 256);
+        if (memcmp(src1 + i, src2 + i, n * sizeof(uint16_t)) != 0)
+            break;
+    }
+    for(; i < len; i++) {
         c = src1[i] - src2[i];
         if (c != 0)
             return c;
@@ -4034,6 +4450,433 @@ static JSValue JS_ConcatString1(JSContext *ctx,
     return JS_MKPTR(JS_TAG_STRING, p);
 }
 
+static inline BOOL tag_is_string(uint32_t tag)
+{
+    return tag == JS_TAG_STRING || tag == JS_TAG_STRING_ROPE;
+}
+
+/* 'val' must be a string or a string rope */
+static inline uint32_t js_string_value_len(JSValueConst val)
+{
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING)
+        return JS_VALUE_GET_STRING(val)->len;
+    else
+        return ((JSStringRope *)JS_VALUE_GET_PTR(val))->len;
+}
+
+static inline int js_string_value_is_wide_char(JSValueConst val)
+{
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING)
+        return JS_VALUE_GET_STRING(val)->is_wide_char;
+    else
+        return ((JSStringRope *)JS_VALUE_GET_PTR(val))->is_wide_char;
+}
+
+static inline int js_string_value_depth(JSValueConst val)
+{
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING)
+        return 0;
+    else
+        return ((JSStringRope *)JS_VALUE_GET_PTR(val))->depth;
+}
+
+static void js_free_string_rope(JSRuntime *rt, JSStringRope *r)
+{
+    if (r->flat) {
+        JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, r->flat));
+    } else {
+        JS_FreeValueRT(rt, r->left);
+        JS_FreeValueRT(rt, r->right);
+    }
+    js_free_rt(rt, r);
+}
+
+/* Return the characters of the rope 'val'. The flat string is kept
+   in the rope so the returned pointer is valid as long as 'val' is
+   alive. Return NULL in case of exception. */
+static JSString *js_string_rope_get_flat(JSContext *ctx, JSValueConst val)
+{
+    JSStringRope *r = JS_VALUE_GET_PTR(val);
+    JSStringRopeIter it;
+    JSString *p, *p1;
+    uint32_t pos;
+    int is_ascii;
+
+    if (r->flat)
+        return r->flat;
+    p = js_alloc_string(ctx, r->len, r->is_wide_char);
+    if (!p)
+        return NULL;
+    pos = 0;
+    is_ascii = 1;
+    js_string_rope_iter_init(&it, val);
+    while ((p1 = js_string_rope_iter_next(&it)) != NULL) {
+        if (p->is_wide_char)
+            copy_str16(p->u.str16 + pos, p1, it.start, it.len);
+        else
+            memcpy(p->u.str8 + pos, p1->u.str8 + it.start, it.len);
+        is_ascii &= p1->is_ascii;
+        pos += it.len;
+    }
+    if (!p->is_wide_char) {
+        p->u.str8[pos] = '\0';
+        p->is_ascii = is_ascii;
+    }
+    JS_FreeValue(ctx, r->left);
+    JS_FreeValue(ctx, r->right);
+    r->left = JS_UNDEFINED;
+    r->right = JS_UNDEFINED;
+    r->flat = p;
+    r->depth = 0;
+    return p;
+}
+
+/* A flattened rope is replaced by its flat string. */
+static JSValue js_string_rope_simplify(JSContext *ctx, JSValue val)
+{
+    JSStringRope *r;
+    JSValue ret;
+
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE) {
+        r = JS_VALUE_GET_PTR(val);
+        if (r->flat) {
+            ret = JS_DupValue(ctx, JS_MKPTR(JS_TAG_STRING, r->flat));
+            JS_FreeValue(ctx, val);
+            return ret;
+        }
+    }
+    return val;
+}
+
+/* return a string referencing the characters [start, start + len) of
+   'p' */
+static JSValue js_new_string_slice(JSContext *ctx, JSString *p,
+                                   uint32_t start, uint32_t len)
+{
+    JSStringRope *r;
+
+    r = js_malloc(ctx, sizeof(*r));
+    if (!r)
+        return JS_EXCEPTION;
+    r->header.ref_count = 1;
+    r->len = len;
+    r->is_wide_char = p->is_wide_char;
+    r->depth = 0;
+    r->is_slice = 1;
+    r->start = start;
+    r->flat = NULL;
+    r->left = JS_DupValue(ctx, JS_MKPTR(JS_TAG_STRING, p));
+    r->right = JS_UNDEFINED;
+    return JS_MKPTR(JS_TAG_STRING_ROPE, r);
+}
+
+/* same as js_sub_string() but a substring which is a large part of
+   'p' shares its characters. Short substrings, substrings much
+   smaller than 'p' and Latin-1 substrings of a wide string (which
+   are narrowed) are copied. */
+static JSValue js_sub_string_slice(JSContext *ctx, JSString *p,
+                                   int start, int end)
+{
+    int len = end - start, i;
+    uint16_t c;
+
+    if (len == p->len ||
+        (len << p->is_wide_char) < JS_STRING_SLICE_MIN_SIZE ||
+        p->len / JS_STRING_SLICE_PIN_RATIO >= len)
+        return js_sub_string(ctx, p, start, end);
+    if (p->is_wide_char) {
+        c = 0;
+        for(i = start; i < end; i++)
+            c |= p->u.str16[i];
+        if (c <= 0xff)
+            return js_sub_string(ctx, p, start, end);
+    }
+    return js_new_string_slice(ctx, p, start, len);
+}
+
+/* Same as JS_ToStringCheckObject() but a slice is not materialized:
+   its parent is returned and the characters of the slice are
+   [*pstart, *pstart + *plen). */
+static JSValue js_string_get_view(JSContext *ctx, JSValueConst val,
+                                  uint32_t *pstart, uint32_t *plen)
+{
+    JSStringRope *r;
+    JSValue str;
+
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE) {
+        r = JS_VALUE_GET_PTR(val);
+        if (r->is_slice && !r->flat) {
+            *pstart = r->start;
+            *plen = r->len;
+            return JS_DupValue(ctx, r->left);
+        }
+    }
+    str = JS_ToStringCheckObject(ctx, val);
+    if (!JS_IsException(str)) {
+        *pstart = 0;
+        *plen = JS_VALUE_GET_STRING(str)->len;
+    }
+    return str;
+}
+
+static int js_string_memcmp_pos(const JSString *p1, int pos1,
+                                const JSString *p2, int pos2, int len)
+{
+    int res;
+
+    if (likely(!p1->is_wide_char)) {
+        if (likely(!p2->is_wide_char))
+            res = memcmp(p1->u.str8 + pos1, p2->u.str8 + pos2, len);
+        else
+            res = -memcmp16_8(p2->u.str16 + pos2, p1->u.str8 + pos1, len);
+    } else {
+        if (!p2->is_wide_char)
+            res = memcmp16_8(p1->u.str16 + pos1, p2->u.str8 + pos2, len);
+        else
+            res = memcmp16(p1->u.str16 + pos1, p2->u.str16 + pos2, len);
+    }
+    return res;
+}
+
+/* Compare two strings or string ropes without flattening
+   them. Return < 0, 0 or > 0 */
+static int js_string_value_compare(JSContext *ctx,
+                                   JSValueConst op1, JSValueConst op2)
+{
+    JSStringRopeIter it1, it2;
+    JSString *p1, *p2;
+    uint32_t len1, len2, pos1, pos2, l;
+    int res;
+
+    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING &&
+        JS_VALUE_GET_TAG(op2) == JS_TAG_STRING) {
+        return js_string_compare(ctx, JS_VALUE_GET_STRING(op1),
+                                 JS_VALUE_GET_STRING(op2));
+    }
+    len1 = js_string_value_len(op1);
+    len2 = js_string_value_len(op2);
+    js_string_rope_iter_init(&it1, op1);
+    js_string_rope_iter_init(&it2, op2);
+    p1 = js_string_rope_iter_next(&it1);
+    p2 = js_string_rope_iter_next(&it2);
+    pos1 = pos2 = 0;
+    while (p1 != NULL && p2 != NULL) {
+        l = min_uint32(it1.len - pos1, it2.len - pos2);
+        res = js_string_memcmp_pos(p1, it1.start + pos1,
+                                   p2, it2.start + pos2, l);
+        if (res != 0)
+            return res;
+        pos1 += l;
+        pos2 += l;
+        if (pos1 == it1.len) {
+            p1 = js_string_rope_iter_next(&it1);
+            pos1 = 0;
+        }
+        if (pos2 == it2.len) {
+            p2 = js_string_rope_iter_next(&it2);
+            pos2 = 0;
+        }
+    }
+    if (len1 == len2)
+        return 0;
+    else if (len1 < len2)
+        return -1;
+    else
+        return 1;
+}
+
+static JSValue js_new_string_rope(JSContext *ctx, JSValue op1, JSValue op2)
+{
+    JSStringRope *r;
+
+    r = js_malloc(ctx, sizeof(*r));
+    if (!r) {
+        JS_FreeValue(ctx, op1);
+        JS_FreeValue(ctx, op2);
+        return JS_EXCEPTION;
+    }
+    r->header.ref_count = 1;
+    r->len = js_string_value_len(op1) + js_string_value_len(op2);
+    r->is_wide_char = js_string_value_is_wide_char(op1) |
+        js_string_value_is_wide_char(op2);
+    r->depth = max_int(js_string_value_depth(op1),
+                       js_string_value_depth(op2)) + 1;
+    r->is_slice = 0;
+    r->start = 0;
+    r->flat = NULL;
+    r->left = op1;
+    r->right = op2;
+    return JS_MKPTR(JS_TAG_STRING_ROPE, r);
+}
+
+static JSValue js_string_rope_build(JSContext *ctx, JSValueConst *leaves,
+                                    int count)
+{
+    JSValue left, right;
+    int n;
+
+    if (count == 1)
+        return JS_DupValue(ctx, leaves[0]);
+    n = count >> 1;
+    left = js_string_rope_build(ctx, leaves, n);
+    if (JS_IsException(left))
+        return left;
+    right = js_string_rope_build(ctx, leaves + n, count - n);
+    if (JS_IsException(right)) {
+        JS_FreeValue(ctx, left);
+        return right;
+    }
+    return js_new_string_rope(ctx, left, right);
+}
+
+/* rebuild a balanced rope with the same leaves */
+static JSValue js_string_rope_rebalance(JSContext *ctx, JSValue val)
+{
+    JSStringRopeIter it;
+    JSValueConst *leaves;
+    JSValue ret;
+    int count;
+
+    count = 0;
+    js_string_rope_iter_init(&it, val);
+    while (js_string_rope_iter_next(&it) != NULL)
+        count++;
+    leaves = js_malloc(ctx, sizeof(leaves[0]) * count);
+    if (!leaves) {
+        JS_FreeValue(ctx, val);
+        return JS_EXCEPTION;
+    }
+    count = 0;
+    js_string_rope_iter_init(&it, val);
+    while (js_string_rope_iter_next(&it) != NULL)
+        leaves[count++] = it.leaf;
+    ret = js_string_rope_build(ctx, leaves, count);
+    js_free(ctx, leaves);
+    JS_FreeValue(ctx, val);
+    return ret;
+}
+
+static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2);
+
+/* op1 and op2 are strings or string ropes which are not empty */
+static JSValue js_concat_string_rope(JSContext *ctx, JSValue op1, JSValue op2)
+{
+    JSStringRope *r;
+    JSValue left, right;
+    uint32_t len1, len2;
+
+    len1 = js_string_value_len(op1);
+    len2 = js_string_value_len(op2);
+    if (len1 + len2 > JS_STRING_LEN_MAX) {
+        JS_FreeValue(ctx, op1);
+        JS_FreeValue(ctx, op2);
+        return JS_ThrowInternalError(ctx, "string too long");
+    }
+    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING_ROPE &&
+        JS_VALUE_GET_TAG(op2) == JS_TAG_STRING &&
+        len2 < JS_STRING_ROPE_MIN_LEN) {
+        /* merge short strings appended to the rope into its last
+           leaf so that the leaves stay reasonably large */
+        r = JS_VALUE_GET_PTR(op1);
+        if (JS_VALUE_GET_TAG(r->right) == JS_TAG_STRING &&
+            JS_VALUE_GET_STRING(r->right)->len + len2 < JS_STRING_ROPE_MIN_LEN) {
+            if (r->header.ref_count == 1) {
+                /* nobody else can see the rope: modify it in place */
+                right = JS_ConcatString(ctx, r->right, op2);
+                if (JS_IsException(right)) {
+                    r->right = JS_UNDEFINED;
+                    JS_FreeValue(ctx, op1);
+                    return JS_EXCEPTION;
+                }
+                r->right = right;
+                r->len += len2;
+                r->is_wide_char |= JS_VALUE_GET_STRING(right)->is_wide_char;
+                return op1;
+            }
+            left = JS_DupValue(ctx, r->left);
+            right = JS_ConcatString(ctx, JS_DupValue(ctx, r->right), op2);
+            JS_FreeValue(ctx, op1);
+            if (JS_IsException(right)) {
+                JS_FreeValue(ctx, left);
+                return JS_EXCEPTION;
+            }
+            return js_new_string_rope(ctx, left, right);
+        }
+    }
+    /* A string appended (resp. prepended) to a rope whose right
+       (resp. left) subtree is shallower than the other one is added to
+       that subtree. Repeated appends then fill the rope like a binary
+       counter, so that its depth stays logarithmic without rebuilding
+       it. */
+    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING_ROPE) {
+        r = JS_VALUE_GET_PTR(op1);
+        if (!r->is_slice && !r->flat &&
+            js_string_value_depth(r->right) < js_string_value_depth(r->left) &&
+            js_string_value_depth(op2) < js_string_value_depth(r->left)) {
+            if (r->header.ref_count == 1) {
+                right = r->right;
+                r->right = JS_UNDEFINED;
+                right = js_concat_string_rope(ctx, right, op2);
+                if (JS_IsException(right)) {
+                    JS_FreeValue(ctx, op1);
+                    return JS_EXCEPTION;
+                }
+                r->right = right;
+                r->len += len2;
+                r->is_wide_char |= js_string_value_is_wide_char(right);
+                r->depth = max_int(js_string_value_depth(r->left),
+                                   js_string_value_depth(right)) + 1;
+                return op1;
+            }
+            left = JS_DupValue(ctx, r->left);
+            right = js_concat_string_rope(ctx, JS_DupValue(ctx, r->right), op2);
+            JS_FreeValue(ctx, op1);
+            if (JS_IsException(right)) {
+                JS_FreeValue(ctx, left);
+                return JS_EXCEPTION;
+            }
+            return js_new_string_rope(ctx, left, right);
+        }
+    }
+    if (JS_VALUE_GET_TAG(op2) == JS_TAG_STRING_ROPE) {
+        r = JS_VALUE_GET_PTR(op2);
+        if (!r->is_slice && !r->flat &&
+            js_string_value_depth(r->left) < js_string_value_depth(r->right) &&
+            js_string_value_depth(op1) < js_string_value_depth(r->right)) {
+            if (r->header.ref_count == 1) {
+                left = r->left;
+                r->left = JS_UNDEFINED;
+                left = js_concat_string_rope(ctx, op1, left);
+                if (JS_IsException(left)) {
+                    JS_FreeValue(ctx, op2);
+                    return JS_EXCEPTION;
+                }
+                r->left = left;
+                r->len += len1;
+                r->is_wide_char |= js_string_value_is_wide_char(left);
+                r->depth = max_int(js_string_value_depth(left),
+                                   js_string_value_depth(r->right)) + 1;
+                return op2;
+            }
+            right = JS_DupValue(ctx, r->right);
+            left = js_concat_string_rope(ctx, op1, JS_DupValue(ctx, r->left));
+            JS_FreeValue(ctx, op2);
+            if (JS_IsException(left)) {
+                JS_FreeValue(ctx, right);
+                return JS_EXCEPTION;
+            }
+            return js_new_string_rope(ctx, left, right);
+        }
+    }
+    op1 = js_new_string_rope(ctx, op1, op2);
+    if (JS_IsException(op1))
+        return op1;
+    r = JS_VALUE_GET_PTR(op1);
+    if (r->depth > JS_STRING_ROPE_MAX_DEPTH)
+        op1 = js_string_rope_rebalance(ctx, op1);
+    return op1;
+}
+
 /* op1 and op2 are converted to strings. For convience, op1 or op2 =
    JS_EXCEPTION are accepted and return JS_EXCEPTION.  */
 static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
@@ -4041,27 +4884,57 @@ static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
     JSValue ret;
     JSString *p1, *p2;
 
-    if (unlikely(JS_VALUE_GET_TAG(op1) != JS_TAG_STRING)) {
+    if (unlikely(!tag_is_string(JS_VALUE_GET_TAG(op1)))) {
         op1 = JS_ToStringFree(ctx, op1);
         if (JS_IsException(op1)) {
             JS_FreeValue(ctx, op2);
             return JS_EXCEPTION;
         }
     }
-    if (unlikely(JS_VALUE_GET_TAG(op2) != JS_TAG_STRING)) {
+    if (unlikely(!tag_is_string(JS_VALUE_GET_TAG(op2)))) {
         op2 = JS_ToStringFree(ctx, op2);
         if (JS_IsException(op2)) {
             JS_FreeValue(ctx, op1);
             return JS_EXCEPTION;
         }
     }
+    op1 = js_string_rope_simplify(ctx, op1);
+    if (JS_IsException(op1)) {
+        JS_FreeValue(ctx, op2);
+        return JS_EXCEPTION;
+    }
+    op2 = js_string_rope_simplify(ctx, op2);
+    if (JS_IsException(op2)) {
+        JS_FreeValue(ctx, op1);
+        return JS_EXCEPTION;
+    }
+    if (js_string_value_len(op2) == 0) {
+        JS_FreeValue(ctx, op2);
+        return op1;
+    }
+    if (js_string_value_len(op1) == 0) {
+        JS_FreeValue(ctx, op1);
+        return op2;
+    }
+    if (js_string_value_len(op1) + js_string_value_len(op2) >=
+        JS_STRING_ROPE_MIN_LEN) {
+        return js_concat_string_rope(ctx, op1, op2);
+    }
+    if (JS_VALUE_GET_TAG(op1) != JS_TAG_STRING ||
+        JS_VALUE_GET_TAG(op2) != JS_TAG_STRING) {
+        /* short concatenation with a slice */
+        StringBuffer b_s, *b = &b_s;
+        string_buffer_init2(ctx, b, js_string_value_len(op1) +
+                            js_string_value_len(op2),
+                            js_string_value_is_wide_char(op1) |
+                            js_string_value_is_wide_char(op2));
+        string_buffer_concat_value_free(b, op1);
+        string_buffer_concat_value_free(b, op2);
+        return string_buffer_end(b);
+    }
     p1 = JS_VALUE_GET_STRING(op1);
     p2 = JS_VALUE_GET_STRING(op2);
 
-    /* XXX: could also check if p1 is empty */
-    if (p2->len == 0) {
-        goto ret_op1;
-    }
     if (p1->header.ref_count == 1 && p1->is_wide_char == p2->is_wide_char
     &&  js_malloc_usable_size(ctx, p1) >= sizeof(*p1) + ((p1->len + p2->len) << p2->is_wide_char) + 1 - p1->is_wide_char) {
         /* Concatenate in place in available space at the end of p1 */
@@ -4072,8 +4945,8 @@ static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
             memcpy(p1->u.str8 + p1->len, p2->u.str8, p2->len);
             p1->len += p2->len;
             p1->u.str8[p1->len] = '\0';
+            p1->is_ascii &= p2->is_ascii;
         }
-    ret_op1:
         JS_FreeValue(ctx, op2);
         return op1;
     }
@@ -4219,6 +5092,7 @@ static no_inline JSShape *js_new_shape2(JSContext *ctx, JSObject *proto,
     sh->hash = shape_initial_hash(proto);
     sh->is_hashed = TRUE;
     sh->has_small_array_index = FALSE;
+    sh->enum_cache = NULL;
     js_shape_hash_link(ctx->rt, sh);
     return sh;
 }
@@ -4250,6 +5124,7 @@ static JSShape *js_clone_shape(JSContext *ctx, JSShape *sh1)
     sh->header.ref_count = 1;
     add_gc_object(ctx->rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
     sh->is_hashed = FALSE;
+    sh->enum_cache = NULL;
     if (sh->proto) {
         JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, sh->proto));
     }
@@ -4265,6 +5140,26 @@ static JSShape *js_dup_shape(JSShape *sh)
     return sh;
 }
 
+static void js_free_enum_cache(JSRuntime *rt, JSShapeEnumCache *ec)
+{
+    uint32_t i;
+
+    if (ec && --ec->ref_count == 0) {
+        for(i = 0; i < ec->count; i++)
+            JS_FreeAtomRT(rt, ec->atoms[i]);
+        js_free_rt(rt, ec);
+    }
+}
+
+/* must be called before the properties of 'sh' are modified in place */
+static inline void js_shape_clear_enum_cache(JSRuntime *rt, JSShape *sh)
+{
+    if (sh->enum_cache) {
+        js_free_enum_cache(rt, sh->enum_cache);
+        sh->enum_cache = NULL;
+    }
+}
+
 static void js_free_shape0(JSRuntime *rt, JSShape *sh)
 {
     uint32_t i;
@@ -4276,6 +5171,7 @@ static void js_free_shape0(JSRuntime *rt, JSShape *sh)
     if (sh->proto != NULL) {
         JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_OBJECT, sh->proto));
     }
+    js_free_enum_cache(rt, sh->enum_cache);
     pr = get_shape_prop(sh);
     for(i = 0; i < sh->prop_count; i++) {
         JS_FreeAtomRT(rt, pr->atom);
@@ -4298,6 +5194,42 @@ static void js_free_shape_null(JSRuntime *rt, JSShape *sh)
         js_free_shape(rt, sh);
 }
 
+static inline JSProperty *js_object_inline_prop(JSObject *p)
+{
+    return (JSProperty *)(p + 1);
+}
+
+static inline BOOL js_object_has_inline_prop(JSObject *p)
+{
+    return (p->class_id == JS_CLASS_OBJECT &&
+            p->u.object.inline_prop_size != 0);
+}
+
+/* resize the property array of 'p' so that it holds 'new_size'
+   properties. 'count' is the number of properties in use. The inline
+   slots are kept while they are large enough. */
+static int js_resize_object_prop(JSContext *ctx, JSObject *p,
+                                 uint32_t count, uint32_t new_size)
+{
+    JSProperty *new_prop;
+
+    if (js_object_has_inline_prop(p)) {
+        if (new_size <= p->u.object.inline_prop_size)
+            return 0;
+        new_prop = js_malloc(ctx, sizeof(new_prop[0]) * new_size);
+        if (unlikely(!new_prop))
+            return -1;
+        memcpy(new_prop, p->prop, sizeof(new_prop[0]) * count);
+        p->u.object.inline_prop_size = 0;
+    } else {
+        new_prop = js_realloc(ctx, p->prop, sizeof(new_prop[0]) * new_size);
+        if (unlikely(!new_prop))
+            return -1;
+    }
+    p->prop = new_prop;
+    return 0;
+}
+
 /* make space to hold at least 'count' properties */
 static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
                                        JSObject *p, uint32_t count)
@@ -4313,11 +5245,8 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
     /* Reallocate prop array first to avoid crash or size inconsistency
        in case of memory allocation failure */
     if (p) {
-        JSProperty *new_prop;
-        new_prop = js_realloc(ctx, p->prop, sizeof(new_prop[0]) * new_size);
-        if (unlikely(!new_prop))
+        if (js_resize_object_prop(ctx, p, sh->prop_count, new_size))
             return -1;
-        p->prop = new_prop;
     }
     new_hash_size = sh->prop_hash_mask + 1;
     while (new_hash_size < new_size)
@@ -4374,6 +5303,7 @@ static int add_shape_property(JSContext *ctx, JSShape **psh,
     uint32_t hash_mask, new_shape_hash = 0;
     intptr_t h;
 
+    js_shape_clear_enum_cache(rt, sh);
     /* update the shape hash */
     if (sh->is_hashed) {
         js_shape_hash_unlink(rt, sh);
@@ -4506,12 +5436,163 @@ static __maybe_unused void JS_DumpShapes(JSRuntime *rt)
     qjsrt_printf(rt,"}\n");
 }
 
-static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID class_id)
+#ifdef CONFIG_OBJECT_NURSERY
+static inline JSNurseryHeader *js_nursery_header(JSObject *p)
+{
+    return (JSNurseryHeader *)p - 1;
+}
+
+static inline JSNurseryChunk *js_nursery_chunk(JSObject *p)
+{
+    JSNurseryHeader *h = js_nursery_header(p);
+    return (JSNurseryChunk *)((uint8_t *)h - h->chunk_offset);
+}
+
+static no_inline int js_nursery_new_chunk(JSRuntime *rt)
+{
+    JSNurseryChunk *c;
+
+    c = js_malloc_rt(rt, JS_NURSERY_CHUNK_SIZE);
+    if (!c)
+        return -1;
+    if (rt->nursery_chunk) {
+        rt->nursery_chunk->used_size =
+            rt->nursery_ptr - (uint8_t *)rt->nursery_chunk;
+    }
+    c->live_count = 0;
+    c->used_size = 0;
+    list_add(&c->link, &rt->nursery_chunks);
+    rt->nursery_chunk = c;
+    rt->nursery_chunk_count++;
+    rt->nursery_ptr = (uint8_t *)(c + 1);
+    rt->nursery_end = (uint8_t *)c + JS_NURSERY_CHUNK_SIZE;
+    return 0;
+}
+
+/* allocate an object followed by 'size_class' property slots */
+static JSObject *js_nursery_alloc(JSRuntime *rt, int size_class)
+{
+    struct list_head *el;
+    JSNurseryHeader *h;
+    size_t size;
+
+    el = rt->nursery_free[size_class].next;
+    if (el != &rt->nursery_free[size_class]) {
+        list_del(el);
+        js_nursery_chunk((JSObject *)el)->live_count++;
+        rt->nursery_reuse_count++;
+        return (JSObject *)el;
+    }
+    size = sizeof(JSNurseryHeader) + sizeof(JSObject) +
+        sizeof(JSProperty) * size_class;
+    if (unlikely(rt->nursery_end - rt->nursery_ptr < size)) {
+        if (js_nursery_new_chunk(rt))
+            return NULL;
+    }
+    h = (JSNurseryHeader *)rt->nursery_ptr;
+    h->chunk_offset = rt->nursery_ptr - (uint8_t *)rt->nursery_chunk;
+    h->size_class = size_class;
+    rt->nursery_ptr += size;
+    rt->nursery_chunk->live_count++;
+    rt->nursery_alloc_count++;
+    return (JSObject *)(h + 1);
+}
+
+/* remove the objects of a chunk without live objects from the free
+   lists */
+static void js_nursery_unlink_chunk(JSRuntime *rt, JSNurseryChunk *c,
+                                    uint8_t *end)
+{
+    JSNurseryHeader *h;
+    uint8_t *ptr;
+
+    for(ptr = (uint8_t *)(c + 1); ptr < end;) {
+        h = (JSNurseryHeader *)ptr;
+        list_del((struct list_head *)(h + 1));
+        ptr += sizeof(JSNurseryHeader) + sizeof(JSObject) +
+            sizeof(JSProperty) * h->size_class;
+    }
+}
+
+static no_inline void js_nursery_release_chunk(JSRuntime *rt,
+                                               JSNurseryChunk *c)
+{
+    if (c == rt->nursery_chunk) {
+        /* keep the chunk being filled and restart at its beginning */
+        js_nursery_unlink_chunk(rt, c, rt->nursery_ptr);
+        rt->nursery_ptr = (uint8_t *)(c + 1);
+    } else {
+        js_nursery_unlink_chunk(rt, c, (uint8_t *)c + c->used_size);
+        list_del(&c->link);
+        js_free_rt(rt, c);
+        rt->nursery_chunk_count--;
+    }
+}
+
+static void js_nursery_free(JSRuntime *rt, JSObject *p)
+{
+    JSNurseryHeader *h = js_nursery_header(p);
+    JSNurseryChunk *c = js_nursery_chunk(p);
+
+    list_add((struct list_head *)p, &rt->nursery_free[h->size_class]);
+    if (--c->live_count == 0)
+        js_nursery_release_chunk(rt, c);
+}
+
+static void js_nursery_free_all(JSRuntime *rt)
+{
+    struct list_head *el, *el1;
+    JSNurseryChunk *c;
+
+    list_for_each_safe(el, el1, &rt->nursery_chunks) {
+        c = list_entry(el, JSNurseryChunk, link);
+        assert(c->live_count == 0);
+        js_free_rt(rt, c);
+    }
+    init_list_head(&rt->nursery_chunks);
+    rt->nursery_chunk = NULL;
+}
+#endif
+
+static JSObject *js_alloc_object(JSContext *ctx, int inline_prop_size)
+{
+#ifdef CONFIG_OBJECT_NURSERY
+    JSObject *p = js_nursery_alloc(ctx->rt, inline_prop_size);
+    if (unlikely(!p))
+        JS_ThrowOutOfMemory(ctx);
+    return p;
+#else
+    return js_malloc(ctx, sizeof(JSObject) +
+                     sizeof(JSProperty) * inline_prop_size);
+#endif
+}
+
+static void js_free_object(JSRuntime *rt, JSObject *p)
+{
+#ifdef CONFIG_OBJECT_NURSERY
+    js_nursery_free(rt, p);
+#else
+    js_free_rt(rt, p);
+#endif
+}
+
+/* 'prop_size_hint' is the expected number of properties of a
+   JS_CLASS_OBJECT object. For such objects, the first properties are
+   stored in the same memory block as the object. */
+static JSValue JS_NewObjectFromShape2(JSContext *ctx, JSShape *sh,
+                                      JSClassID class_id, int prop_size_hint)
 {
     JSObject *p;
+    uint32_t inline_prop_size;
 
-    js_trigger_gc(ctx->rt, sizeof(JSObject));
-    p = js_malloc(ctx, sizeof(JSObject));
+    inline_prop_size = 0;
+    if (class_id == JS_CLASS_OBJECT && sh->prop_size <= JS_PROP_INLINE_MAX) {
+        inline_prop_size = max_int(sh->prop_size,
+                                   min_int(prop_size_hint, JS_PROP_INLINE_MAX));
+    }
+    js_trigger_gc(ctx->rt, sizeof(JSObject) +
+                  sizeof(JSProperty) * inline_prop_size);
+    p = js_alloc_object(ctx, inline_prop_size);
     if (unlikely(!p))
         goto fail;
     p->class_id = class_id;
@@ -4526,12 +5607,17 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
     p->first_weak_ref = NULL;
     p->u.opaque = NULL;
     p->shape = sh;
-    p->prop = js_malloc(ctx, sizeof(JSProperty) * sh->prop_size);
-    if (unlikely(!p->prop)) {
-        js_free(ctx, p);
-    fail:
-        js_free_shape(ctx->rt, sh);
-        return JS_EXCEPTION;
+    if (inline_prop_size != 0) {
+        p->u.object.inline_prop_size = inline_prop_size;
+        p->prop = js_object_inline_prop(p);
+    } else {
+        p->prop = js_malloc(ctx, sizeof(JSProperty) * sh->prop_size);
+        if (unlikely(!p->prop)) {
+            js_free_object(ctx->rt, p);
+        fail:
+            js_free_shape(ctx->rt, sh);
+            return JS_EXCEPTION;
+        }
     }
 
     switch(class_id) {
@@ -4545,6 +5631,8 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
             p->u.array.u.values = NULL;
             p->u.array.count = 0;
             p->u.array.u1.size = 0;
+            p->u.array.kind = JS_ARRAY_KIND_INT32;
+            p->u.array.offset = 0;
             /* the length property is always the first one */
             if (likely(sh == ctx->array_shape)) {
                 pr = &p->prop[0];
@@ -4566,6 +5654,8 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
         p->fast_array = 1;
         p->u.array.u.ptr = NULL;
         p->u.array.count = 0;
+        p->u.array.kind = JS_ARRAY_KIND_GENERIC;
+        p->u.array.offset = 0;
         break;
     case JS_CLASS_DATAVIEW:
         p->u.array.u.ptr = NULL;
@@ -4600,6 +5690,11 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
     return JS_MKPTR(JS_TAG_OBJECT, p);
 }
 
+static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID class_id)
+{
+    return JS_NewObjectFromShape2(ctx, sh, class_id, 0);
+}
+
 static JSObject *get_proto_obj(JSValueConst proto_val)
 {
     if (JS_VALUE_GET_TAG(proto_val) != JS_TAG_OBJECT)
@@ -4609,8 +5704,8 @@ static JSObject *get_proto_obj(JSValueConst proto_val)
 }
 
 /* WARNING: proto must be an object or JS_NULL */
-JSValue JS_NewObjectProtoClass(JSContext *ctx, JSValueConst proto_val,
-                               JSClassID class_id)
+static JSValue JS_NewObjectProtoClass2(JSContext *ctx, JSValueConst proto_val,
+                                       JSClassID class_id, int prop_size_hint)
 {
     JSShape *sh;
     JSObject *proto;
@@ -4624,7 +5719,14 @@ JSValue JS_NewObjectProtoClass(JSContext *ctx, JSValueConst proto_val,
         if (!sh)
             return JS_EXCEPTION;
     }
-    return JS_NewObjectFromShape(ctx, sh, class_id);
+    return JS_NewObjectFromShape2(ctx, sh, class_id, prop_size_hint);
+}
+
+/* WARNING: proto must be an object or JS_NULL */
+JSValue JS_NewObjectProtoClass(JSContext *ctx, JSValueConst proto_val,
+                               JSClassID class_id)
+{
+    return JS_NewObjectProtoClass2(ctx, proto_val, class_id, 0);
 }
 
 #if 0
@@ -4702,6 +5804,14 @@ JSValue JS_NewObject(JSContext *ctx)
     return JS_NewObjectProtoClass(ctx, ctx->class_proto[JS_CLASS_OBJECT], JS_CLASS_OBJECT);
 }
 
+/* create an object which is expected to receive 'prop_count'
+   properties */
+static JSValue js_new_object_size(JSContext *ctx, int prop_count)
+{
+    return JS_NewObjectProtoClass2(ctx, ctx->class_proto[JS_CLASS_OBJECT],
+                                   JS_CLASS_OBJECT, prop_count);
+}
+
 static void js_function_set_properties(JSContext *ctx, JSValueConst func_obj,
                                        JSAtom name, int len)
 {
@@ -5019,15 +6129,25 @@ static void free_var_ref(JSRuntime *rt, JSVarRef *var_ref)
     }
 }
 
+/* return the allocation holding the elements of a fast Array or
+   Arguments object */
+static inline void *js_array_get_base(JSObject *p)
+{
+    return (uint8_t *)p->u.array.u.ptr -
+        (size_t)p->u.array.offset * js_array_kind_size[p->u.array.kind];
+}
+
 static void js_array_finalizer(JSRuntime *rt, JSValue val)
 {
     JSObject *p = JS_VALUE_GET_OBJ(val);
     int i;
 
-    for(i = 0; i < p->u.array.count; i++) {
-        JS_FreeValueRT(rt, p->u.array.u.values[i]);
+    if (p->u.array.kind == JS_ARRAY_KIND_GENERIC) {
+        for(i = 0; i < p->u.array.count; i++) {
+            JS_FreeValueRT(rt, p->u.array.u.values[i]);
+        }
     }
-    js_free_rt(rt, p->u.array.u.values);
+    js_free_rt(rt, js_array_get_base(p));
 }
 
 static void js_array_mark(JSRuntime *rt, JSValueConst val,
@@ -5036,6 +6156,8 @@ static void js_array_mark(JSRuntime *rt, JSValueConst val,
     JSObject *p = JS_VALUE_GET_OBJ(val);
     int i;
 
+    if (p->u.array.kind != JS_ARRAY_KIND_GENERIC)
+        return;
     for(i = 0; i < p->u.array.count; i++) {
         JS_MarkValue(rt, p->u.array.u.values[i], mark_func);
     }
@@ -5154,6 +6276,7 @@ static void js_for_in_iterator_finalizer(JSRuntime *rt, JSValue val)
     JSObject *p = JS_VALUE_GET_OBJ(val);
     JSForInIterator *it = p->u.for_in_iterator;
     JS_FreeValueRT(rt, it->obj);
+    js_free_enum_cache(rt, it->enum_cache);
     js_free_rt(rt, it);
 }
 
@@ -5181,7 +6304,8 @@ static void free_object(JSRuntime *rt, JSObject *p)
         free_property(rt, &p->prop[i], pr->flags);
         pr++;
     }
-    js_free_rt(rt, p->prop);
+    if (!js_object_has_inline_prop(p))
+        js_free_rt(rt, p->prop);
     /* as an optimization we destroy the shape immediately without
        putting it in gc_zero_ref_count_list */
     js_free_shape(rt, sh);
@@ -5208,7 +6332,7 @@ static void free_object(JSRuntime *rt, JSObject *p)
     if (rt->gc_phase == JS_GC_PHASE_REMOVE_CYCLES && p->header.ref_count != 0) {
         list_add_tail(&p->header.link, &rt->gc_zero_ref_count_list);
     } else {
-        js_free_rt(rt, p);
+        js_free_object(rt, p);
     }
 }
 
@@ -5274,6 +6398,9 @@ void __JS_FreeValueRT(JSRuntime *rt, JSValue v)
             }
         }
         break;
+    case JS_TAG_STRING_ROPE:
+        js_free_string_rope(rt, JS_VALUE_GET_PTR(v));
+        break;
     case JS_TAG_OBJECT:
     case JS_TAG_FUNCTION_BYTECODE:
         {
@@ -5427,6 +6554,8 @@ static void mark_children(JSRuntime *rt, JSGCObjectHeader *gp,
                 async_func_mark(rt, &s->func_state, mark_func);
             JS_MarkValue(rt, s->resolving_funcs[0], mark_func);
             JS_MarkValue(rt, s->resolving_funcs[1], mark_func);
+            JS_MarkValue(rt, s->await_funcs[0], mark_func);
+            JS_MarkValue(rt, s->await_funcs[1], mark_func);
         }
         break;
     case JS_GC_OBJ_TYPE_SHAPE:
@@ -5560,7 +6689,10 @@ static void gc_free_cycles(JSRuntime *rt)
         p = list_entry(el, JSGCObjectHeader, link);
         assert(p->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT ||
                p->gc_obj_type == JS_GC_OBJ_TYPE_FUNCTION_BYTECODE);
-        js_free_rt(rt, p);
+        if (p->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT)
+            js_free_object(rt, (JSObject *)p);
+        else
+            js_free_rt(rt, p);
     }
 
     init_list_head(&rt->gc_zero_ref_count_list);
@@ -5577,6 +6709,7 @@ void JS_RunGC(JSRuntime *rt)
 
     /* free the GC objects in a cycle */
     gc_free_cycles(rt);
+
 }
 
 /* Return false if not an object or if the object has already been
@@ -5661,6 +6794,16 @@ static void compute_value_size(JSValueConst val, JSMemoryUsage_helper *hp)
     case JS_TAG_STRING:
         compute_jsstring_size(JS_VALUE_GET_STRING(val), hp);
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSStringRopeIter it;
+            JSString *p;
+            hp->str_size += sizeof(JSStringRope);
+            js_string_rope_iter_init(&it, val);
+            while ((p = js_string_rope_iter_next(&it)) != NULL)
+                compute_jsstring_size(p, hp);
+        }
+        break;
 #ifdef CONFIG_BIGNUM
     case JS_TAG_BIG_INT:
     case JS_TAG_BIG_FLOAT:
@@ -5679,12 +6822,26 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
 
     memset(s, 0, sizeof(*s));
     s->malloc_count = rt->malloc_state.malloc_count;
+    s->malloc_total_count = rt->malloc_state.malloc_total_count;
     s->malloc_size = rt->malloc_state.malloc_size;
     s->malloc_limit = rt->malloc_state.malloc_limit;
 
     s->memory_used_count = 2; /* rt + rt->class_array */
     s->memory_used_size = sizeof(JSRuntime) + sizeof(JSValue) * rt->class_count;
 
+    s->regexp_cache_count = rt->regexp_cache_count;
+    s->regexp_cache_size = rt->regexp_cache_size;
+    s->regexp_cache_hits = rt->regexp_cache_hits;
+    s->regexp_cache_misses = rt->regexp_cache_misses;
+    s->memory_used_count += rt->regexp_cache_count;
+    s->memory_used_size += rt->regexp_cache_count * sizeof(JSRegExpCacheEntry);
+#ifdef CONFIG_OBJECT_NURSERY
+    s->nursery_chunk_count = rt->nursery_chunk_count;
+    s->nursery_size = (int64_t)rt->nursery_chunk_count * JS_NURSERY_CHUNK_SIZE;
+    s->nursery_alloc_count = rt->nursery_alloc_count;
+    s->nursery_reuse_count = rt->nursery_reuse_count;
+#endif
+
     list_for_each(el, &rt->context_list) {
         JSContext *ctx = list_entry(el, JSContext, link);
         JSShape *sh = ctx->array_shape;
@@ -5775,13 +6932,15 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
             s->array_count++;
             if (p->fast_array) {
                 s->fast_array_count++;
-                if (p->u.array.u.values) {
+                if (p->u.array.u.ptr) {
                     s->memory_used_count++;
                     s->memory_used_size += p->u.array.count *
-                        sizeof(*p->u.array.u.values);
+                        js_array_kind_size[p->u.array.kind];
                     s->fast_array_elements += p->u.array.count;
-                    for (i = 0; i < p->u.array.count; i++) {
-                        compute_value_size(p->u.array.u.values[i], hp);
+                    if (p->u.array.kind == JS_ARRAY_KIND_GENERIC) {
+                        for (i = 0; i < p->u.array.count; i++) {
+                            compute_value_size(p->u.array.u.values[i], hp);
+                        }
                     }
                 }
             }
@@ -5945,6 +7104,21 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
                              1 - p->is_wide_char);
         }
     }
+    /* hash chain statistics: probe_total / hash_count is the average
+       number of probes of a successful lookup */
+    s->atom_hash_size = rt->atom_hash_size;
+    for(i = 0; i < rt->atom_hash_size; i++) {
+        uint32_t j = rt->atom_hash[i];
+        int64_t depth = 0;
+        while (j != 0) {
+            depth++;
+            s->atom_hash_count++;
+            s->atom_probe_total += depth;
+            j = rt->atom_array[j]->hash_next;
+        }
+        if (depth > s->atom_probe_max)
+            s->atom_probe_max = depth;
+    }
     s->str_count = round(mem.str_count);
     s->str_size = round(mem.str_size);
     s->js_func_count = mem.js_func_count;
@@ -6038,11 +7212,22 @@ void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt)
                 MALLOC_OVERHEAD, ((double)(s->malloc_size - s->memory_used_size) /
                                   s->memory_used_count));
     }
+    if (s->malloc_total_count) {
+        fprintf(fp, "%-20s %8"PRId64"\n",
+                "allocations", s->malloc_total_count);
+    }
     if (s->atom_count) {
         fprintf(fp, "%-20s %8"PRId64" %8"PRId64"  (%0.1f per atom)\n",
                 "atoms", s->atom_count, s->atom_size,
                 (double)s->atom_size / s->atom_count);
     }
+    if (s->atom_hash_count) {
+        fprintf(fp, "%-20s %8"PRId64" %8"PRId64"  (%0.2f load, %0.2f average probes, %"PRId64" max)\n",
+                "atom hash", s->atom_hash_count, s->atom_hash_size,
+                (double)s->atom_hash_count / s->atom_hash_size,
+                (double)s->atom_probe_total / s->atom_hash_count,
+                s->atom_probe_max);
+    }
     if (s->str_count) {
         fprintf(fp, "%-20s %8"PRId64" %8"PRId64"  (%0.1f per string)\n",
                 "strings", s->str_count, s->str_size,
@@ -6089,6 +7274,16 @@ void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt)
         fprintf(fp, "%-20s %8"PRId64" %8"PRId64"\n",
                 "binary objects", s->binary_object_count, s->binary_object_size);
     }
+    if (s->regexp_cache_hits || s->regexp_cache_misses) {
+        fprintf(fp, "%-20s %8"PRId64" %8"PRId64"  (%"PRId64" hits, %"PRId64" misses)\n",
+                "regexp cache", s->regexp_cache_count, s->regexp_cache_size,
+                s->regexp_cache_hits, s->regexp_cache_misses);
+    }
+    if (s->nursery_chunk_count) {
+        fprintf(fp, "%-20s %8"PRId64" %8"PRId64"  (%"PRId64" new, %"PRId64" reused objects)\n",
+                "object nursery", s->nursery_chunk_count, s->nursery_size,
+                s->nursery_alloc_count, s->nursery_reuse_count);
+    }
 }
 #endif // CONFIG_QUICKJS_HAS_STDIO
 
@@ -6233,7 +7428,7 @@ static const char *get_func_name(JSContext *ctx, JSValueConst func)
     if ((prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL)
         return NULL;
     val = pr->u.value;
-    if (JS_VALUE_GET_TAG(val) != JS_TAG_STRING)
+    if (!JS_IsString(val))
         return NULL;
     return JS_ToCString(ctx, val);
 }
@@ -6614,6 +7809,7 @@ JSValueConst JS_GetPrototype(JSContext *ctx, JSValueConst val)
         val = ctx->class_proto[JS_CLASS_BOOLEAN];
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = ctx->class_proto[JS_CLASS_STRING];
         break;
     case JS_TAG_SYMBOL:
@@ -6766,12 +7962,37 @@ JSValue JS_GetPropertyInternal(JSContext *ctx, JSValueConst obj,
         case JS_TAG_EXCEPTION:
             return JS_EXCEPTION;
         case JS_TAG_STRING:
+        case JS_TAG_STRING_ROPE:
             {
-                JSString *p1 = JS_VALUE_GET_STRING(obj);
+                JSString *p1;
+                uint32_t start, len;
+                if (tag == JS_TAG_STRING_ROPE) {
+                    JSStringRope *r = JS_VALUE_GET_PTR(obj);
+                    if (prop == JS_ATOM_length)
+                        return JS_NewInt32(ctx, r->len);
+                    if (!__JS_AtomIsTaggedInt(prop))
+                        break;
+                    if (r->is_slice && !r->flat) {
+                        p1 = JS_VALUE_GET_STRING(r->left);
+                        start = r->start;
+                    } else {
+                        /* indexed access: the rope is flattened */
+                        p1 = js_string_rope_get_flat(ctx, obj);
+                        if (!p1)
+                            return JS_EXCEPTION;
+                        start = 0;
+                    }
+                    len = r->len;
+                } else {
+                    p1 = JS_VALUE_GET_STRING(obj);
+                    start = 0;
+                    len = p1->len;
+                }
                 if (__JS_AtomIsTaggedInt(prop)) {
                     uint32_t idx, ch;
                     idx = __JS_AtomToUInt32(prop);
-                    if (idx < p1->len) {
+                    if (idx < len) {
+                        idx += start;
                         if (p1->is_wide_char)
                             ch = p1->u.str16[idx];
                         else
@@ -6779,7 +8000,7 @@ JSValue JS_GetPropertyInternal(JSContext *ctx, JSValueConst obj,
                         return js_new_string_char(ctx, ch);
                     }
                 } else if (prop == JS_ATOM_length) {
-                    return JS_NewInt32(ctx, p1->len);
+                    return JS_NewInt32(ctx, len);
                 }
             }
             break;
@@ -7298,6 +8519,35 @@ static int __exception JS_GetOwnPropertyNamesInternal(JSContext *ctx,
     return 0;
 }
 
+/* return the enumerable string keys of the non exotic object 'p'. They
+   are computed once per shape. Return NULL if exception. */
+static JSShapeEnumCache *js_get_enum_cache(JSContext *ctx, JSObject *p)
+{
+    JSShape *sh = p->shape;
+    JSShapeEnumCache *ec;
+    JSPropertyEnum *tab_atom;
+    uint32_t i, len;
+
+    ec = sh->enum_cache;
+    if (likely(ec != NULL))
+        return ec;
+    if (JS_GetOwnPropertyNamesInternal(ctx, &tab_atom, &len, p,
+                                       JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY))
+        return NULL;
+    ec = js_malloc(ctx, sizeof(*ec) + sizeof(ec->atoms[0]) * len);
+    if (!ec) {
+        js_free_prop_enum(ctx, tab_atom, len);
+        return NULL;
+    }
+    ec->ref_count = 1;
+    ec->count = len;
+    for(i = 0; i < len; i++)
+        ec->atoms[i] = tab_atom[i].atom;
+    js_free(ctx, tab_atom);
+    sh->enum_cache = ec;
+    return ec;
+}
+
 int JS_GetOwnPropertyNames(JSContext *ctx, JSPropertyEnum **ptab,
                            uint32_t *plen, JSValueConst obj, int flags)
 {
@@ -7513,6 +8763,206 @@ JSAtom JS_ValueToAtom(JSContext *ctx, JSValueConst val)
     return atom;
 }
 
+/* return the element 'idx' < p->u.array.count of a fast Array or
+   Arguments object */
+static inline JSValue js_get_fast_array_element(JSContext *ctx, JSObject *p,
+                                                uint32_t idx)
+{
+    switch(p->u.array.kind) {
+    case JS_ARRAY_KIND_INT32:
+        return JS_NewInt32(ctx, p->u.array.u.int32_ptr[idx]);
+    case JS_ARRAY_KIND_FLOAT64:
+        return JS_NewFloat64(ctx, p->u.array.u.double_ptr[idx]);
+    default:
+        return JS_DupValue(ctx, p->u.array.u.values[idx]);
+    }
+}
+
+static inline int js_array_value_kind(JSValueConst val)
+{
+    uint32_t tag = JS_VALUE_GET_TAG(val);
+    if (tag == JS_TAG_INT)
+        return JS_ARRAY_KIND_INT32;
+    else if (JS_TAG_IS_FLOAT64(tag))
+        return JS_ARRAY_KIND_FLOAT64;
+    else
+        return JS_ARRAY_KIND_GENERIC;
+}
+
+/* store 'val' in the slot 'idx' of the fast Array 'p'. The slot must
+   not hold a reference and the element kind must accept 'val'. */
+static inline void js_put_fast_array_slot(JSObject *p, uint32_t idx,
+                                          JSValue val)
+{
+    switch(p->u.array.kind) {
+    case JS_ARRAY_KIND_INT32:
+        p->u.array.u.int32_ptr[idx] = JS_VALUE_GET_INT(val);
+        break;
+    case JS_ARRAY_KIND_FLOAT64:
+        if (JS_VALUE_GET_TAG(val) == JS_TAG_INT)
+            p->u.array.u.double_ptr[idx] = JS_VALUE_GET_INT(val);
+        else
+            p->u.array.u.double_ptr[idx] = JS_VALUE_GET_FLOAT64(val);
+        break;
+    default:
+        p->u.array.u.values[idx] = val;
+        break;
+    }
+}
+
+/* widen the element kind of the fast Array 'p' to 'kind'. The
+   capacity is kept. Return -1 if memory allocation error. */
+static no_inline __exception int js_array_set_kind(JSContext *ctx,
+                                                   JSObject *p, int kind)
+{
+    uint32_t i, len;
+    void *tab;
+
+    len = p->u.array.count;
+    if (len == 0) {
+        js_free(ctx, js_array_get_base(p));
+        p->u.array.u.ptr = NULL;
+        p->u.array.u1.size = 0;
+        p->u.array.offset = 0;
+        p->u.array.kind = kind;
+        return 0;
+    }
+    tab = js_malloc(ctx, (size_t)p->u.array.u1.size * js_array_kind_size[kind]);
+    if (!tab)
+        return -1;
+    if (kind == JS_ARRAY_KIND_FLOAT64) {
+        double *dtab = tab;
+        for(i = 0; i < len; i++)
+            dtab[i] = p->u.array.u.int32_ptr[i];
+    } else {
+        JSValue *vtab = tab;
+        for(i = 0; i < len; i++)
+            vtab[i] = js_get_fast_array_element(ctx, p, i);
+    }
+    js_free(ctx, js_array_get_base(p));
+    p->u.array.u.ptr = tab;
+    p->u.array.offset = 0;
+    p->u.array.kind = kind;
+    return 0;
+}
+
+/* make room for at least 'new_len' elements in the fast Array
+   'p'. The space left by shift() is reused if it is large enough,
+   otherwise the capacity grows geometrically. Return -1 if memory
+   allocation error. */
+static no_inline __exception int js_array_grow(JSContext *ctx, JSObject *p,
+                                               uint32_t new_len)
+{
+    uint32_t offset, count, new_size;
+    size_t slack, elem_size;
+    uint8_t *base;
+
+    offset = p->u.array.offset;
+    count = p->u.array.count;
+    elem_size = js_array_kind_size[p->u.array.kind];
+    base = js_array_get_base(p);
+    new_size = offset + p->u.array.u1.size;
+    if (offset >= count / 2 && new_len <= new_size) {
+        memmove(base, p->u.array.u.ptr, (size_t)count * elem_size);
+    } else {
+        /* XXX: potential arithmetic overflow */
+        new_size = max_int(new_len, new_size * 3 / 2);
+        base = js_realloc2(ctx, base, elem_size * new_size, &slack);
+        if (!base)
+            return -1;
+        new_size += slack / elem_size;
+        if (offset != 0)
+            memmove(base, base + offset * elem_size, (size_t)count * elem_size);
+    }
+    p->u.array.u.ptr = base;
+    p->u.array.u1.size = new_size;
+    p->u.array.offset = 0;
+    return 0;
+}
+
+/* make room for 'n' elements before the first element of the fast
+   Array 'p'. Free space is also left after the reserved elements so
+   that a sequence of unshift() has a constant amortized cost. Return
+   -1 if memory allocation error or if the storage would be too
+   large. */
+static no_inline __exception int js_array_reserve_front(JSContext *ctx,
+                                                        JSObject *p,
+                                                        uint32_t n)
+{
+    uint32_t count, new_size, new_offset;
+    uint64_t size64;
+    size_t elem_size;
+    uint8_t *base;
+
+    count = p->u.array.count;
+    elem_size = js_array_kind_size[p->u.array.kind];
+    size64 = ((uint64_t)count + n) * 3 / 2 + 8;
+    if (size64 > UINT32_MAX || size64 > SIZE_MAX / elem_size) {
+        JS_ThrowRangeError(ctx, "invalid array length");
+        return -1;
+    }
+    new_size = size64;
+    new_offset = min_uint32(n + (new_size - count - n) / 2,
+                            JS_ARRAY_OFFSET_MAX);
+    base = js_malloc(ctx, elem_size * new_size);
+    if (!base)
+        return -1;
+    /* the storage of an empty array may be NULL */
+    if (count) {
+        memcpy(base + new_offset * elem_size, p->u.array.u.ptr,
+               (size_t)count * elem_size);
+    }
+    js_free(ctx, js_array_get_base(p));
+    p->u.array.u.ptr = base + new_offset * elem_size;
+    p->u.array.u1.size = new_size - new_offset;
+    p->u.array.offset = new_offset;
+    return 0;
+}
+
+/* give the storage of the fast Array 'p' back when less than a
+   quarter of it is used. Cannot fail. */
+static void js_array_shrink(JSContext *ctx, JSObject *p)
+{
+    uint32_t count, size, new_size;
+    size_t elem_size;
+    uint8_t *base, *new_base;
+
+    count = p->u.array.count;
+    size = p->u.array.offset + p->u.array.u1.size;
+    if (likely(size <= JS_ARRAY_SHRINK_MIN || count >= size / 4))
+        return;
+    elem_size = js_array_kind_size[p->u.array.kind];
+    base = js_array_get_base(p);
+    memmove(base, p->u.array.u.ptr, (size_t)count * elem_size);
+    new_size = max_uint32(count * 2, JS_ARRAY_SHRINK_MIN / 2);
+    new_base = js_realloc_rt(ctx->rt, base, elem_size * new_size);
+    if (new_base) {
+        base = new_base;
+        size = new_size;
+    }
+    p->u.array.u.ptr = base;
+    p->u.array.u1.size = size;
+    p->u.array.offset = 0;
+}
+
+/* set the element 'idx' < p->u.array.count of the fast Array 'p' */
+static inline int js_set_fast_array_element(JSContext *ctx, JSObject *p,
+                                            uint32_t idx, JSValue val)
+{
+    int kind = js_array_value_kind(val);
+    if (unlikely(kind > p->u.array.kind)) {
+        if (js_array_set_kind(ctx, p, kind)) {
+            JS_FreeValue(ctx, val);
+            return -1;
+        }
+    }
+    if (p->u.array.kind == JS_ARRAY_KIND_GENERIC)
+        set_value(ctx, &p->u.array.u.values[idx], val);
+    else
+        js_put_fast_array_slot(p, idx, val);
+    return 0;
+}
+
 static JSValue JS_GetPropertyValue(JSContext *ctx, JSValueConst this_obj,
                                    JSValue prop)
 {
@@ -7531,6 +8981,7 @@ static JSValue JS_GetPropertyValue(JSContext *ctx, JSValueConst this_obj,
             goto slow_path;
         switch(p->class_id) {
         case JS_CLASS_ARRAY:
+            return js_get_fast_array_element(ctx, p, idx);
         case JS_CLASS_ARGUMENTS:
             return JS_DupValue(ctx, p->u.array.u.values[idx]);
         case JS_CLASS_INT8_ARRAY:
@@ -7657,12 +9108,9 @@ static JSProperty *add_property(JSContext *ctx,
             /* matching shape found: use it */
             /*  the property array may need to be resized */
             if (new_sh->prop_size != sh->prop_size) {
-                JSProperty *new_prop;
-                new_prop = js_realloc(ctx, p->prop, sizeof(p->prop[0]) *
-                                      new_sh->prop_size);
-                if (!new_prop)
+                if (js_resize_object_prop(ctx, p, sh->prop_count,
+                                          new_sh->prop_size))
                     return NULL;
-                p->prop = new_prop;
             }
             p->shape = js_dup_shape(new_sh);
             js_free_shape(ctx->rt, sh);
@@ -7695,6 +9143,9 @@ static no_inline __exception int convert_fast_array_to_array(JSContext *ctx,
     JSValue *tab;
     uint32_t i, len, new_count;
 
+    if (p->u.array.kind != JS_ARRAY_KIND_GENERIC &&
+        js_array_set_kind(ctx, p, JS_ARRAY_KIND_GENERIC))
+        return -1;
     if (js_shape_prepare_update(ctx, p, NULL))
         return -1;
     len = p->u.array.count;
@@ -7713,8 +9164,9 @@ static no_inline __exception int convert_fast_array_to_array(JSContext *ctx,
         pr = add_property(ctx, p, __JS_AtomFromUInt32(i), JS_PROP_C_W_E);
         pr->u.value = *tab++;
     }
-    js_free(ctx, p->u.array.u.values);
+    js_free(ctx, js_array_get_base(p));
     p->u.array.count = 0;
+    p->u.array.offset = 0;
     p->u.array.u.values = NULL; /* fail safe */
     p->u.array.u1.size = 0;
     p->fast_array = 0;
@@ -7778,7 +9230,8 @@ static int delete_property(JSContext *ctx, JSObject *p, JSAtom atom)
                     p->class_id == JS_CLASS_ARGUMENTS) {
                     /* Special case deleting the last element of a fast Array */
                     if (idx == p->u.array.count - 1) {
-                        JS_FreeValue(ctx, p->u.array.u.values[idx]);
+                        if (p->u.array.kind == JS_ARRAY_KIND_GENERIC)
+                            JS_FreeValue(ctx, p->u.array.u.values[idx]);
                         p->u.array.count = idx;
                         return TRUE;
                     }
@@ -7838,10 +9291,13 @@ static int set_array_length(JSContext *ctx, JSObject *p, JSProperty *prop,
     if (likely(p->fast_array)) {
         uint32_t old_len = p->u.array.count;
         if (len < old_len) {
-            for(i = len; i < old_len; i++) {
-                JS_FreeValue(ctx, p->u.array.u.values[i]);
+            if (p->u.array.kind == JS_ARRAY_KIND_GENERIC) {
+                for(i = len; i < old_len; i++) {
+                    JS_FreeValue(ctx, p->u.array.u.values[i]);
+                }
             }
             p->u.array.count = len;
+            js_array_shrink(ctx, p);
         }
         prop->u.value = JS_NewUint32(ctx, len);
     } else {
@@ -7917,6 +9373,7 @@ static int add_fast_array_element(JSContext *ctx, JSObject *p,
                                   JSValue val, int flags)
 {
     uint32_t new_len, array_len;
+    int kind;
     /* extend the array by one */
     /* XXX: convert to slow array if new_len > 2^31-1 elements */
     new_len = p->u.array.count + 1;
@@ -7932,26 +9389,48 @@ static int add_fast_array_element(JSContext *ctx, JSObject *p,
             p->prop[0].u.value = JS_NewInt32(ctx, new_len);
         }
     }
+    kind = js_array_value_kind(val);
+    if (unlikely(kind > p->u.array.kind)) {
+        if (js_array_set_kind(ctx, p, kind)) {
+            JS_FreeValue(ctx, val);
+            return -1;
+        }
+    }
     if (unlikely(new_len > p->u.array.u1.size)) {
-        uint32_t new_size;
-        size_t slack;
-        JSValue *new_array_prop;
-        /* XXX: potential arithmetic overflow */
-        new_size = max_int(new_len, p->u.array.u1.size * 3 / 2);
-        new_array_prop = js_realloc2(ctx, p->u.array.u.values, sizeof(JSValue) * new_size, &slack);
-        if (!new_array_prop) {
+        if (js_array_grow(ctx, p, new_len)) {
             JS_FreeValue(ctx, val);
             return -1;
         }
-        new_size += slack / sizeof(*new_array_prop);
-        p->u.array.u.values = new_array_prop;
-        p->u.array.u1.size = new_size;
     }
-    p->u.array.u.values[new_len - 1] = val;
+    js_put_fast_array_slot(p, new_len - 1, val);
     p->u.array.count = new_len;
     return TRUE;
 }
 
+/* return a generic fast Array of 'len' undefined elements which can
+   be directly stored to */
+static JSValue js_allocate_fast_array(JSContext *ctx, uint32_t len)
+{
+    JSValue arr;
+    JSObject *p;
+    uint32_t i;
+
+    arr = JS_NewArray(ctx);
+    if (JS_IsException(arr) || len == 0)
+        return arr;
+    p = JS_VALUE_GET_OBJ(arr);
+    if (js_array_set_kind(ctx, p, JS_ARRAY_KIND_GENERIC) ||
+        js_array_grow(ctx, p, len)) {
+        JS_FreeValue(ctx, arr);
+        return JS_EXCEPTION;
+    }
+    for(i = 0; i < len; i++)
+        p->u.array.u.values[i] = JS_UNDEFINED;
+    p->u.array.count = len;
+    p->prop[0].u.value = JS_NewUint32(ctx, len);
+    return arr;
+}
+
 static void js_free_desc(JSContext *ctx, JSPropertyDescriptor *desc)
 {
     JS_FreeValue(ctx, desc->getter);
@@ -8266,6 +9745,31 @@ retry:
     return TRUE;
 }
 
+/* return TRUE if the prototype chain of the Array 'p' has no numeric
+   property, so that elements can be added to 'p' without looking for
+   setters */
+static BOOL js_array_proto_is_simple(JSObject *p)
+{
+    JSObject *p1;
+    JSShape *sh1;
+
+    p1 = p->shape->proto;
+    while (p1 != NULL) {
+        sh1 = p1->shape;
+        if (p1->class_id == JS_CLASS_ARRAY) {
+            if (unlikely(!p1->fast_array))
+                return FALSE;
+        } else if (p1->class_id == JS_CLASS_OBJECT) {
+            if (unlikely(sh1->has_small_array_index))
+                return FALSE;
+        } else {
+            return FALSE;
+        }
+        p1 = sh1->proto;
+    }
+    return TRUE;
+}
+
 /* flags can be JS_PROP_THROW or JS_PROP_THROW_STRICT */
 static int JS_SetPropertyValue(JSContext *ctx, JSValueConst this_obj,
                                JSValue prop, JSValue val, int flags)
@@ -8283,32 +9787,16 @@ static int JS_SetPropertyValue(JSContext *ctx, JSValueConst this_obj,
         switch(p->class_id) {
         case JS_CLASS_ARRAY:
             if (unlikely(idx >= (uint32_t)p->u.array.count)) {
-                JSObject *p1;
-                JSShape *sh1;
-
                 /* fast path to add an element to the array */
                 if (idx != (uint32_t)p->u.array.count ||
-                    !p->fast_array || !p->extensible)
+                    !p->fast_array || !p->extensible ||
+                    !js_array_proto_is_simple(p))
                     goto slow_path;
-                /* check if prototype chain has a numeric property */
-                p1 = p->shape->proto;
-                while (p1 != NULL) {
-                    sh1 = p1->shape;
-                    if (p1->class_id == JS_CLASS_ARRAY) {
-                        if (unlikely(!p1->fast_array))
-                            goto slow_path;
-                    } else if (p1->class_id == JS_CLASS_OBJECT) {
-                        if (unlikely(sh1->has_small_array_index))
-                            goto slow_path;
-                    } else {
-                        goto slow_path;
-                    }
-                    p1 = sh1->proto;
-                }
                 /* add element */
                 return add_fast_array_element(ctx, p, val, flags);
             }
-            set_value(ctx, &p->u.array.u.values[idx], val);
+            if (js_set_fast_array_element(ctx, p, idx, val))
+                return -1;
             break;
         case JS_CLASS_ARGUMENTS:
             if (unlikely(idx >= (uint32_t)p->u.array.count))
@@ -8622,6 +10110,7 @@ static int js_shape_prepare_update(JSContext *ctx, JSObject *p,
             sh->is_hashed = FALSE;
         }
     }
+    js_shape_clear_enum_cache(ctx->rt, sh);
     return 0;
 }
 
@@ -8851,7 +10340,9 @@ int JS_DefineProperty(JSContext *ctx, JSValueConst this_obj,
                             goto redo_prop_update;
                     }
                     if (flags & JS_PROP_HAS_VALUE) {
-                        set_value(ctx, &p->u.array.u.values[idx], JS_DupValue(ctx, val));
+                        if (js_set_fast_array_element(ctx, p, idx,
+                                                      JS_DupValue(ctx, val)))
+                            return -1;
                     }
                     return TRUE;
                 }
@@ -9019,7 +10510,6 @@ static BOOL js_object_has_name(JSContext *ctx, JSValueConst obj)
     JSProperty *pr;
     JSShapeProperty *prs;
     JSValueConst val;
-    JSString *p;
     
     prs = find_own_property(&pr, JS_VALUE_GET_OBJ(obj), JS_ATOM_name);
     if (!prs)
@@ -9027,10 +10517,9 @@ static BOOL js_object_has_name(JSContext *ctx, JSValueConst obj)
     if ((prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL)
         return TRUE;
     val = pr->u.value;
-    if (JS_VALUE_GET_TAG(val) != JS_TAG_STRING)
+    if (!JS_IsString(val))
         return TRUE;
-    p = JS_VALUE_GET_STRING(val);
-    return (p->len != 0);
+    return (js_string_value_len(val) != 0);
 }
 
 static int JS_DefineObjectName(JSContext *ctx, JSValueConst obj,
@@ -9540,8 +11029,9 @@ static int JS_ToBoolFree(JSContext *ctx, JSValue val)
     case JS_TAG_EXCEPTION:
         return -1;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
-            BOOL ret = JS_VALUE_GET_STRING(val)->len != 0;
+            BOOL ret = js_string_value_len(val) != 0;
             JS_FreeValue(ctx, val);
             return ret;
         }
@@ -10057,6 +11547,7 @@ static JSValue JS_ToNumberHintFree(JSContext *ctx, JSValue val,
             return JS_EXCEPTION;
         goto redo;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
             const char *str;
             const char *p;
@@ -10461,6 +11952,34 @@ int JS_ToInt64Ext(JSContext *ctx, int64_t *pres, JSValueConst val)
 }
  
 /* return (<0, 0) in case of exception */
+/* ToInt32() of a float64 */
+static inline int32_t js_float64_to_int32(double d)
+{
+    JSFloat64Union u;
+    int32_t ret;
+    int e;
+
+    u.d = d;
+    /* we avoid doing fmod(x, 2^32) */
+    e = (u.u64 >> 52) & 0x7ff;
+    if (likely(e <= (1023 + 30))) {
+        /* fast case */
+        ret = (int32_t)d;
+    } else if (e <= (1023 + 30 + 53)) {
+        uint64_t v;
+        /* remainder modulo 2^32 */
+        v = (u.u64 & (((uint64_t)1 << 52) - 1)) | ((uint64_t)1 << 52);
+        v = v << ((e - 1023) - 52 + 32);
+        ret = v >> 32;
+        /* take the sign into account */
+        if (u.u64 >> 63)
+            ret = -ret;
+    } else {
+        ret = 0; /* also handles NaN and +inf */
+    }
+    return ret;
+}
+
 static int JS_ToInt32Free(JSContext *ctx, int32_t *pres, JSValue val)
 {
     uint32_t tag;
@@ -10476,30 +11995,7 @@ static int JS_ToInt32Free(JSContext *ctx, int32_t *pres, JSValue val)
         ret = JS_VALUE_GET_INT(val);
         break;
     case JS_TAG_FLOAT64:
-        {
-            JSFloat64Union u;
-            double d;
-            int e;
-            d = JS_VALUE_GET_FLOAT64(val);
-            u.d = d;
-            /* we avoid doing fmod(x, 2^32) */
-            e = (u.u64 >> 52) & 0x7ff;
-            if (likely(e <= (1023 + 30))) {
-                /* fast case */
-                ret = (int32_t)d;
-            } else if (e <= (1023 + 30 + 53)) {
-                uint64_t v;
-                /* remainder modulo 2^32 */
-                v = (u.u64 & (((uint64_t)1 << 52) - 1)) | ((uint64_t)1 << 52);
-                v = v << ((e - 1023) - 52 + 32);
-                ret = v >> 32;
-                /* take the sign into account */
-                if (u.u64 >> 63)
-                    ret = -ret;
-            } else {
-                ret = 0; /* also handles NaN and +inf */
-            }
-        }
+        ret = js_float64_to_int32(JS_VALUE_GET_FLOAT64(val));
         break;
 #ifdef CONFIG_BIGNUM
     case JS_TAG_BIG_FLOAT:
@@ -10532,6 +12028,16 @@ static inline int JS_ToUint32Free(JSContext *ctx, uint32_t *pres, JSValue val)
     return JS_ToInt32Free(ctx, (int32_t *)pres, val);
 }
 
+static inline int js_float64_to_uint8_clamp(double d)
+{
+    if (isnan(d) || d < 0)
+        return 0;
+    else if (d > 255)
+        return 255;
+    else
+        return lrint(d);
+}
+
 static int JS_ToUint8ClampFree(JSContext *ctx, int32_t *pres, JSValue val)
 {
     uint32_t tag;
@@ -10551,19 +12057,7 @@ static int JS_ToUint8ClampFree(JSContext *ctx, int32_t *pres, JSValue val)
         res = max_int(0, min_int(255, res));
         break;
     case JS_TAG_FLOAT64:
-        {
-            double d = JS_VALUE_GET_FLOAT64(val);
-            if (isnan(d)) {
-                res = 0;
-            } else {
-                if (d < 0)
-                    res = 0;
-                else if (d > 255)
-                    res = 255;
-                else
-                    res = lrint(d);
-            }
-        }
+        res = js_float64_to_uint8_clamp(JS_VALUE_GET_FLOAT64(val));
         break;
 #ifdef CONFIG_BIGNUM
     case JS_TAG_BIG_FLOAT:
@@ -11131,6 +12625,13 @@ JSValue JS_ToStringInternal(JSContext *ctx, JSValueConst val, BOOL is_ToProperty
     switch(tag) {
     case JS_TAG_STRING:
         return JS_DupValue(ctx, val);
+    case JS_TAG_STRING_ROPE:
+        {
+            JSString *p = js_string_rope_get_flat(ctx, val);
+            if (!p)
+                return JS_EXCEPTION;
+            return JS_DupValue(ctx, JS_MKPTR(JS_TAG_STRING, p));
+        }
     case JS_TAG_INT:
         stbsp_snprintf(buf, sizeof(buf), "%d", JS_VALUE_GET_INT(val));
         str = buf;
@@ -11321,7 +12822,12 @@ static __maybe_unused void JS_DumpObject(JSRuntime *rt, JSObject *p)
             switch (p->class_id) {
             case JS_CLASS_ARRAY:
             case JS_CLASS_ARGUMENTS:
-                JS_DumpValueShort(rt, p->u.array.u.values[i]);
+                if (p->u.array.kind == JS_ARRAY_KIND_INT32)
+                    qjsrt_printf(rt,"%d", p->u.array.u.int32_ptr[i]);
+                else if (p->u.array.kind == JS_ARRAY_KIND_FLOAT64)
+                    qjsrt_printf(rt,"%.14g", p->u.array.u.double_ptr[i]);
+                else
+                    JS_DumpValueShort(rt, p->u.array.u.values[i]);
                 break;
             case JS_CLASS_UINT8C_ARRAY ... JS_CLASS_FLOAT64_ARRAY:
                 {
@@ -11485,6 +12991,9 @@ static __maybe_unused void JS_DumpValueShort(JSRuntime *rt,
             JS_DumpString(rt, p);
         }
         break;
+    case JS_TAG_STRING_ROPE:
+        qjsrt_printf(rt,"[rope %u]", (unsigned int)js_string_value_len(val));
+        break;
     case JS_TAG_FUNCTION_BYTECODE:
         {
             JSFunctionBytecode *b = JS_VALUE_GET_PTR(val);
@@ -11760,6 +13269,7 @@ static bf_t *JS_ToBigIntFree(JSContext *ctx, bf_t *buf, JSValue val)
         JS_FreeValue(ctx, val);
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = JS_StringToBigIntErr(ctx, val);
         if (JS_IsException(val))
             return NULL;
@@ -13044,10 +14554,10 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
         /* try to call an overloaded operator */
         if ((tag1 == JS_TAG_OBJECT &&
              (tag2 != JS_TAG_NULL && tag2 != JS_TAG_UNDEFINED &&
-              tag2 != JS_TAG_STRING)) ||
+              !tag_is_string(tag2))) ||
             (tag2 == JS_TAG_OBJECT &&
              (tag1 != JS_TAG_NULL && tag1 != JS_TAG_UNDEFINED &&
-              tag1 != JS_TAG_STRING))) {
+              !tag_is_string(tag1)))) {
             ret = js_call_binary_op_fallback(ctx, &res, op1, op2, OP_add,
                                              FALSE, HINT_NONE);
             if (ret != 0) {
@@ -13077,7 +14587,7 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
         tag2 = JS_VALUE_GET_NORM_TAG(op2);
     }
 
-    if (tag1 == JS_TAG_STRING || tag2 == JS_TAG_STRING) {
+    if (tag_is_string(tag1) || tag_is_string(tag2)) {
         sp[-2] = JS_ConcatString(ctx, op1, op2);
         if (JS_IsException(sp[-2]))
             goto exception;
@@ -13363,11 +14873,8 @@ static no_inline int js_relational_slow(JSContext *ctx, JSValue *sp,
     tag1 = JS_VALUE_GET_NORM_TAG(op1);
     tag2 = JS_VALUE_GET_NORM_TAG(op2);
 
-    if (tag1 == JS_TAG_STRING && tag2 == JS_TAG_STRING) {
-        JSString *p1, *p2;
-        p1 = JS_VALUE_GET_STRING(op1);
-        p2 = JS_VALUE_GET_STRING(op2);
-        res = js_string_compare(ctx, p1, p2);
+    if (tag_is_string(tag1) && tag_is_string(tag2)) {
+        res = js_string_value_compare(ctx, op1, op2);
         switch(op) {
         case OP_lt:
             res = (res < 0);
@@ -13415,15 +14922,15 @@ static no_inline int js_relational_slow(JSContext *ctx, JSValue *sp,
             break;
         }
     } else {
-        if (((tag1 == JS_TAG_BIG_INT && tag2 == JS_TAG_STRING) ||
-             (tag2 == JS_TAG_BIG_INT && tag1 == JS_TAG_STRING)) &&
+        if (((tag1 == JS_TAG_BIG_INT && tag_is_string(tag2)) ||
+             (tag2 == JS_TAG_BIG_INT && tag_is_string(tag1))) &&
             !is_math_mode(ctx)) {
-            if (tag1 == JS_TAG_STRING) {
+            if (tag_is_string(tag1)) {
                 op1 = JS_StringToBigInt(ctx, op1);
                 if (JS_VALUE_GET_TAG(op1) != JS_TAG_BIG_INT)
                     goto invalid_bigint_string;
             }
-            if (tag2 == JS_TAG_STRING) {
+            if (tag_is_string(tag2)) {
                 op2 = JS_StringToBigInt(ctx, op2);
                 if (JS_VALUE_GET_TAG(op2) != JS_TAG_BIG_INT) {
                 invalid_bigint_string:
@@ -13522,7 +15029,8 @@ static no_inline __exception int js_eq_slow(JSContext *ctx, JSValue *sp,
             if (res < 0)
                 goto exception;
         }
-    } else if (tag1 == tag2) {
+    } else if (tag1 == tag2 ||
+               (tag_is_string(tag1) && tag_is_string(tag2))) {
         if (tag1 == JS_TAG_OBJECT) {
             /* try the fallback operator */
             res = js_call_binary_op_fallback(ctx, &ret, op1, op2,
@@ -13543,17 +15051,17 @@ static no_inline __exception int js_eq_slow(JSContext *ctx, JSValue *sp,
     } else if ((tag1 == JS_TAG_NULL && tag2 == JS_TAG_UNDEFINED) ||
                (tag2 == JS_TAG_NULL && tag1 == JS_TAG_UNDEFINED)) {
         res = TRUE;
-    } else if ((tag1 == JS_TAG_STRING && tag_is_number(tag2)) ||
-               (tag2 == JS_TAG_STRING && tag_is_number(tag1))) {
+    } else if ((tag_is_string(tag1) && tag_is_number(tag2)) ||
+               (tag_is_string(tag2) && tag_is_number(tag1))) {
 
         if ((tag1 == JS_TAG_BIG_INT || tag2 == JS_TAG_BIG_INT) &&
             !is_math_mode(ctx)) {
-            if (tag1 == JS_TAG_STRING) {
+            if (tag_is_string(tag1)) {
                 op1 = JS_StringToBigInt(ctx, op1);
                 if (JS_VALUE_GET_TAG(op1) != JS_TAG_BIG_INT)
                     goto invalid_bigint_string;
             }
-            if (tag2 == JS_TAG_STRING) {
+            if (tag_is_string(tag2)) {
                 op2 = JS_StringToBigInt(ctx, op2);
                 if (JS_VALUE_GET_TAG(op2) != JS_TAG_BIG_INT) {
                 invalid_bigint_string:
@@ -13583,9 +15091,9 @@ static no_inline __exception int js_eq_slow(JSContext *ctx, JSValue *sp,
         op2 = JS_NewInt32(ctx, JS_VALUE_GET_INT(op2));
         goto redo;
     } else if ((tag1 == JS_TAG_OBJECT &&
-                (tag_is_number(tag2) || tag2 == JS_TAG_STRING || tag2 == JS_TAG_SYMBOL)) ||
+                (tag_is_number(tag2) || tag_is_string(tag2) || tag2 == JS_TAG_SYMBOL)) ||
                (tag2 == JS_TAG_OBJECT &&
-                (tag_is_number(tag1) || tag1 == JS_TAG_STRING || tag1 == JS_TAG_SYMBOL))) {
+                (tag_is_number(tag1) || tag_is_string(tag1) || tag1 == JS_TAG_SYMBOL))) {
 
         /* try the fallback operator */
         res = js_call_binary_op_fallback(ctx, &ret, op1, op2,
@@ -13862,7 +15370,7 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
         }
         tag1 = JS_VALUE_GET_TAG(op1);
         tag2 = JS_VALUE_GET_TAG(op2);
-        if (tag1 == JS_TAG_STRING || tag2 == JS_TAG_STRING) {
+        if (tag_is_string(tag1) || tag_is_string(tag2)) {
             sp[-2] = JS_ConcatString(ctx, op1, op2);
             if (JS_IsException(sp[-2]))
                 goto exception;
@@ -13957,12 +15465,8 @@ static no_inline int js_relational_slow(JSContext *ctx, JSValue *sp,
         JS_FreeValue(ctx, op1);
         goto exception;
     }
-    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING &&
-        JS_VALUE_GET_TAG(op2) == JS_TAG_STRING) {
-        JSString *p1, *p2;
-        p1 = JS_VALUE_GET_STRING(op1);
-        p2 = JS_VALUE_GET_STRING(op2);
-        res = js_string_compare(ctx, p1, p2);
+    if (JS_IsString(op1) && JS_IsString(op2)) {
+        res = js_string_value_compare(ctx, op1, op2);
         JS_FreeValue(ctx, op1);
         JS_FreeValue(ctx, op2);
         switch(op) {
@@ -14025,15 +15529,16 @@ static no_inline __exception int js_eq_slow(JSContext *ctx, JSValue *sp,
     tag1 = JS_VALUE_GET_NORM_TAG(op1);
     tag2 = JS_VALUE_GET_NORM_TAG(op2);
     if (tag1 == tag2 ||
+        (tag_is_string(tag1) && tag_is_string(tag2)) ||
         (tag1 == JS_TAG_INT && tag2 == JS_TAG_FLOAT64) ||
         (tag2 == JS_TAG_INT && tag1 == JS_TAG_FLOAT64)) {
         res = js_strict_eq(ctx, op1, op2);
     } else if ((tag1 == JS_TAG_NULL && tag2 == JS_TAG_UNDEFINED) ||
                (tag2 == JS_TAG_NULL && tag1 == JS_TAG_UNDEFINED)) {
         res = TRUE;
-    } else if ((tag1 == JS_TAG_STRING && (tag2 == JS_TAG_INT ||
+    } else if ((tag_is_string(tag1) && (tag2 == JS_TAG_INT ||
                                    tag2 == JS_TAG_FLOAT64)) ||
-        (tag2 == JS_TAG_STRING && (tag1 == JS_TAG_INT ||
+        (tag_is_string(tag2) && (tag1 == JS_TAG_INT ||
                                    tag1 == JS_TAG_FLOAT64))) {
         double d1;
         double d2;
@@ -14051,7 +15556,7 @@ static no_inline __exception int js_eq_slow(JSContext *ctx, JSValue *sp,
         op2 = JS_NewInt32(ctx, JS_VALUE_GET_INT(op2));
         goto redo;
     } else if (tag1 == JS_TAG_OBJECT &&
-               (tag2 == JS_TAG_INT || tag2 == JS_TAG_FLOAT64 || tag2 == JS_TAG_STRING || tag2 == JS_TAG_SYMBOL)) {
+               (tag2 == JS_TAG_INT || tag2 == JS_TAG_FLOAT64 || tag_is_string(tag2) || tag2 == JS_TAG_SYMBOL)) {
         op1 = JS_ToPrimitiveFree(ctx, op1, HINT_NONE);
         if (JS_IsException(op1)) {
             JS_FreeValue(ctx, op2);
@@ -14059,7 +15564,7 @@ static no_inline __exception int js_eq_slow(JSContext *ctx, JSValue *sp,
         }
         goto redo;
     } else if (tag2 == JS_TAG_OBJECT &&
-               (tag1 == JS_TAG_INT || tag1 == JS_TAG_FLOAT64 || tag1 == JS_TAG_STRING || tag1 == JS_TAG_SYMBOL)) {
+               (tag1 == JS_TAG_INT || tag1 == JS_TAG_FLOAT64 || tag_is_string(tag1) || tag1 == JS_TAG_SYMBOL)) {
         op2 = JS_ToPrimitiveFree(ctx, op2, HINT_NONE);
         if (JS_IsException(op2)) {
             JS_FreeValue(ctx, op1);
@@ -14127,15 +15632,13 @@ static BOOL js_strict_eq2(JSContext *ctx, JSValue op1, JSValue op2,
         res = (tag1 == tag2);
         break;
     case JS_TAG_STRING:
-        {
-            JSString *p1, *p2;
-            if (tag1 != tag2) {
-                res = FALSE;
-            } else {
-                p1 = JS_VALUE_GET_STRING(op1);
-                p2 = JS_VALUE_GET_STRING(op2);
-                res = (js_string_compare(ctx, p1, p2) == 0);
-            }
+    case JS_TAG_STRING_ROPE:
+        if (!tag_is_string(tag2)) {
+            res = FALSE;
+        } else if (js_string_value_len(op1) != js_string_value_len(op2)) {
+            res = FALSE;
+        } else {
+            res = (js_string_value_compare(ctx, op1, op2) == 0);
         }
         break;
     case JS_TAG_SYMBOL:
@@ -14379,6 +15882,7 @@ static __exception int js_operator_typeof(JSContext *ctx, JSValue op1)
         atom = JS_ATOM_boolean;
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         atom = JS_ATOM_string;
         break;
     case JS_TAG_OBJECT:
@@ -14613,6 +16117,7 @@ static JSValue build_for_in_iterator(JSContext *ctx, JSValue obj)
     int i;
     JSValue enum_obj;
     JSForInIterator *it;
+    JSShapeEnumCache *ec;
     uint32_t tag, tab_atom_count;
 
     tag = JS_VALUE_GET_TAG(obj);
@@ -14634,6 +16139,7 @@ static JSValue build_for_in_iterator(JSContext *ctx, JSValue obj)
     it->is_array = FALSE;
     it->obj = obj;
     it->idx = 0;
+    it->enum_cache = NULL;
     p = JS_VALUE_GET_OBJ(enum_obj);
     p->u.for_in_iterator = it;
 
@@ -14645,10 +16151,17 @@ static JSValue build_for_in_iterator(JSContext *ctx, JSValue obj)
     /* fast path: assume no enumerable properties in the prototype chain */
     p1 = p->shape->proto;
     while (p1 != NULL) {
-        if (JS_GetOwnPropertyNamesInternal(ctx, &tab_atom, &tab_atom_count, p1,
-                                   JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY))
-            goto fail;
-        js_free_prop_enum(ctx, tab_atom, tab_atom_count);
+        if (!p1->is_exotic) {
+            ec = js_get_enum_cache(ctx, p1);
+            if (!ec)
+                goto fail;
+            tab_atom_count = ec->count;
+        } else {
+            if (JS_GetOwnPropertyNamesInternal(ctx, &tab_atom, &tab_atom_count, p1,
+                                       JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY))
+                goto fail;
+            js_free_prop_enum(ctx, tab_atom, tab_atom_count);
+        }
         if (tab_atom_count != 0) {
             goto slow_path;
         }
@@ -14675,6 +16188,13 @@ static JSValue build_for_in_iterator(JSContext *ctx, JSValue obj)
         /* for fast arrays, we only store the number of elements */
         it->is_array = TRUE;
         it->array_length = p->u.array.count;
+    } else if (!p->is_exotic) {
+        /* the keys are shared with the other objects of the same shape */
+        ec = js_get_enum_cache(ctx, p);
+        if (!ec)
+            goto fail;
+        ec->ref_count++;
+        it->enum_cache = ec;
     } else {
     normal_case:
         if (JS_GetOwnPropertyNamesInternal(ctx, &tab_atom, &tab_atom_count, p,
@@ -14742,6 +16262,14 @@ static __exception int js_for_in_next(JSContext *ctx, JSValue *sp)
                 goto done;
             prop = __JS_AtomFromUInt32(it->idx);
             it->idx++;
+        } else if (it->enum_cache) {
+            JSShapeEnumCache *ec = it->enum_cache;
+            if (it->idx >= ec->count)
+                goto done;
+            prop = ec->atoms[it->idx++];
+            /* no property was deleted if the shape is unchanged */
+            if (JS_VALUE_GET_OBJ(it->obj)->shape->enum_cache == ec)
+                break;
         } else {
             JSShape *sh = p->shape;
             JSShapeProperty *prs;
@@ -14932,13 +16460,39 @@ static int JS_IteratorClose(JSContext *ctx, JSValueConst enum_obj,
     return res;
 }
 
-/* obj -> enum_rec (3 slots) */
+static BOOL js_for_of_array_is_builtin(JSContext *ctx, JSValueConst method);
+static JSValue js_for_of_array_next(JSContext *ctx, JSValue *sp, int *pdone);
+static int js_for_of_array_close(JSContext *ctx, JSValue *sp);
+
+/* obj -> enum_rec (3 slots). If 'array_fast_path' is set and 'obj' is
+   an Array iterated with the built-in iterator, no iterator object is
+   created: the enumeration record is 'array index' where the index is
+   a JS_TAG_INT holding an uint32_t. */
 static __exception int js_for_of_start(JSContext *ctx, JSValue *sp,
-                                       BOOL is_async)
+                                       BOOL is_async, BOOL array_fast_path)
 {
     JSValue op1, obj, method;
     op1 = sp[-1];
-    obj = JS_GetIterator(ctx, op1, is_async);
+    if (array_fast_path && JS_VALUE_GET_TAG(op1) == JS_TAG_OBJECT &&
+        JS_VALUE_GET_OBJ(op1)->class_id == JS_CLASS_ARRAY) {
+        method = JS_GetProperty(ctx, op1, JS_ATOM_Symbol_iterator);
+        if (JS_IsException(method))
+            return -1;
+        if (js_for_of_array_is_builtin(ctx, method)) {
+            JS_FreeValue(ctx, method);
+            sp[0] = JS_MKVAL(JS_TAG_INT, 0);
+            return 0;
+        }
+        if (!JS_IsFunction(ctx, method)) {
+            JS_FreeValue(ctx, method);
+            JS_ThrowTypeError(ctx, "value is not iterable");
+            return -1;
+        }
+        obj = JS_GetIterator2(ctx, op1, method);
+        JS_FreeValue(ctx, method);
+    } else {
+        obj = JS_GetIterator(ctx, op1, is_async);
+    }
     if (JS_IsException(obj))
         return -1;
     JS_FreeValue(ctx, op1);
@@ -14957,7 +16511,10 @@ static __exception int js_for_of_next(JSContext *ctx, JSValue *sp, int offset)
     int done = 1;
 
     if (likely(!JS_IsUndefined(sp[offset]))) {
-        value = JS_IteratorNext(ctx, sp[offset], sp[offset + 1], 0, NULL, &done);
+        if (JS_VALUE_GET_TAG(sp[offset + 1]) == JS_TAG_INT)
+            value = js_for_of_array_next(ctx, sp + offset, &done);
+        else
+            value = JS_IteratorNext(ctx, sp[offset], sp[offset + 1], 0, NULL, &done);
         if (JS_IsException(value))
             done = -1;
         if (done) {
@@ -15063,14 +16620,16 @@ static BOOL js_is_fast_array(JSContext *ctx, JSValueConst obj)
     return FALSE;
 }
 
-/* Access an Array's internal JSValue array if available */
+/* Access an Array's internal JSValue array if available. Arrays of a
+   packed element kind are not handled. */
 static BOOL js_get_fast_array(JSContext *ctx, JSValueConst obj,
                               JSValue **arrpp, uint32_t *countp)
 {
     /* Try and handle fast arrays explicitly */
     if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT) {
         JSObject *p = JS_VALUE_GET_OBJ(obj);
-        if (p->class_id == JS_CLASS_ARRAY && p->fast_array) {
+        if (p->class_id == JS_CLASS_ARRAY && p->fast_array &&
+            p->u.array.kind == JS_ARRAY_KIND_GENERIC) {
             *countp = p->u.array.count;
             *arrpp = p->u.array.u.values;
             return TRUE;
@@ -15083,7 +16642,7 @@ static __exception int js_append_enumerate(JSContext *ctx, JSValue *sp)
 {
     JSValue iterator, enumobj, method, value;
     int pos, is_array_iterator;
-    JSValue *arrp;
+    JSObject *p;
     uint32_t i, count32;
 
     if (JS_VALUE_GET_TAG(sp[-2]) != JS_TAG_INT) {
@@ -15117,14 +16676,17 @@ static __exception int js_append_enumerate(JSContext *ctx, JSValue *sp)
     }
     if (is_array_iterator
     &&  JS_IsCFunction(ctx, method, (JSCFunction *)js_array_iterator_next, 0)
-    &&  js_get_fast_array(ctx, sp[-1], &arrp, &count32)) {
+    &&  js_is_fast_array(ctx, sp[-1])) {
         int64_t len;
         /* Handle fast arrays explicitly */
         if (js_get_length64(ctx, &len, sp[-1]))
             goto exception;
+        p = JS_VALUE_GET_OBJ(sp[-1]);
+        count32 = p->u.array.count;
         for (i = 0; i < count32; i++) {
             if (JS_DefinePropertyValueUint32(ctx, sp[-3], pos++,
-                                             JS_DupValue(ctx, arrp[i]), JS_PROP_C_W_E) < 0)
+                                             js_get_fast_array_element(ctx, p, i),
+                                             JS_PROP_C_W_E) < 0)
                 goto exception;
         }
         if (len > count32) {
@@ -15942,6 +17504,14 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             if (unlikely(JS_IsException(sp[-1])))
                 goto exception;
             BREAK;
+        CASE(OP_object_size):
+            {
+                int prop_count = *pc++;
+                *sp++ = js_new_object_size(ctx, prop_count);
+                if (unlikely(JS_IsException(sp[-1])))
+                    goto exception;
+            }
+            BREAK;
         CASE(OP_special_object):
             {
                 int arg = *pc++;
@@ -16925,7 +18495,8 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             sp += 2;
             BREAK;
         CASE(OP_for_of_start):
-            if (js_for_of_start(ctx, sp, FALSE))
+            /* 'yield *' (followed by OP_drop) uses the iterator object */
+            if (js_for_of_start(ctx, sp, FALSE, *pc != OP_drop))
                 goto exception;
             sp += 1;
             *sp++ = JS_NewCatchOffset(ctx, 0);
@@ -16940,7 +18511,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             }
             BREAK;
         CASE(OP_for_await_of_start):
-            if (js_for_of_start(ctx, sp, TRUE))
+            if (js_for_of_start(ctx, sp, TRUE, FALSE))
                 goto exception;
             sp += 1;
             *sp++ = JS_NewCatchOffset(ctx, 0);
@@ -16959,6 +18530,9 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
         CASE(OP_iterator_close):
             /* iter_obj next catch_offset -> */
             sp--; /* drop the catch offset to avoid getting caught by exception */
+            if (JS_VALUE_GET_TAG(sp[-1]) == JS_TAG_INT &&
+                js_for_of_array_close(ctx, sp - 2))
+                goto exception;
             JS_FreeValue(ctx, sp[-1]); /* drop the next method */
             sp--;
             if (!JS_IsUndefined(sp[-1])) {
@@ -16997,7 +18571,13 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 JSValue ret, method;
                 int ret_flag;
                 sp--; /* remove the catch offset */
-                method = JS_GetProperty(ctx, sp[-2], JS_ATOM_return);
+                if (JS_VALUE_GET_TAG(sp[-1]) == JS_TAG_INT &&
+                    js_for_of_array_close(ctx, sp - 2))
+                    goto exception;
+                if (JS_IsUndefined(sp[-2]))
+                    method = JS_UNDEFINED;
+                else
+                    method = JS_GetProperty(ctx, sp[-2], JS_ATOM_return);
                 if (JS_IsException(method))
                     goto exception;
                 if (JS_IsUndefined(method) || JS_IsNull(method)) {
@@ -17499,7 +19079,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                         goto add_loc_slow;
                     var_buf[idx] = JS_NewInt32(ctx, r);
                     sp--;
-                } else if (JS_VALUE_GET_TAG(ops[0]) == JS_TAG_STRING) {
+                } else if (JS_IsString(ops[0])) {
                     sp--;
                     ops[1] = JS_ToPrimitiveFree(ctx, ops[1], HINT_NONE);
                     if (JS_IsException(ops[1])) {
@@ -18209,9 +19789,12 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 int pos = JS_VALUE_GET_INT(val);
                 if (pos == 0) {
                     /* enumerator: close it with a throw */
+                    if (JS_VALUE_GET_TAG(sp[-1]) == JS_TAG_INT)
+                        js_for_of_array_close(ctx, sp - 2);
                     JS_FreeValue(ctx, sp[-1]); /* drop the next method */
                     sp--;
-                    JS_IteratorClose(ctx, sp[-1], TRUE);
+                    if (!JS_IsUndefined(sp[-1]))
+                        JS_IteratorClose(ctx, sp[-1], TRUE);
                 } else {
                     *sp++ = rt->current_exception;
                     rt->current_exception = JS_NULL;
@@ -18759,10 +20342,19 @@ static JSValue js_generator_function_call(JSContext *ctx, JSValueConst func_obj,
 
 static void js_async_function_terminate(JSRuntime *rt, JSAsyncFunctionData *s)
 {
+    JSValue await_funcs[2];
+
     if (s->is_active) {
         async_func_free(rt, &s->func_state);
         s->is_active = FALSE;
     }
+    /* the await functions reference 's': break the cycle */
+    await_funcs[0] = s->await_funcs[0];
+    await_funcs[1] = s->await_funcs[1];
+    s->await_funcs[0] = JS_UNDEFINED;
+    s->await_funcs[1] = JS_UNDEFINED;
+    JS_FreeValueRT(rt, await_funcs[0]);
+    JS_FreeValueRT(rt, await_funcs[1]);
 }
 
 static void js_async_function_free0(JSRuntime *rt, JSAsyncFunctionData *s)
@@ -18771,7 +20363,12 @@ static void js_async_function_free0(JSRuntime *rt, JSAsyncFunctionData *s)
     JS_FreeValueRT(rt, s->resolving_funcs[0]);
     JS_FreeValueRT(rt, s->resolving_funcs[1]);
     remove_gc_object(&s->header);
-    js_free_rt(rt, s);
+    if (rt->async_func_cache_count < JS_ASYNC_FUNC_CACHE_MAX) {
+        list_add(&s->header.link, &rt->async_func_cache);
+        rt->async_func_cache_count++;
+    } else {
+        js_free_rt(rt, s);
+    }
 }
 
 static void js_async_function_free(JSRuntime *rt, JSAsyncFunctionData *s)
@@ -18823,6 +20420,81 @@ static int js_async_function_resolve_create(JSContext *ctx,
     return 0;
 }
 
+/* same steps as PromiseResolve(%Promise%, value) followed by
+   PerformPromiseThen() but a promise is only created if 'value' is a
+   thenable. Otherwise the reaction job is directly queued. */
+static int js_async_function_await(JSContext *ctx, JSAsyncFunctionData *s,
+                                   JSValueConst value)
+{
+    JSValue promise, then, error, resolving_funcs1[2];
+    JSValueConst args[5];
+    BOOL is_reject;
+    int i, res;
+
+    if (JS_IsUndefined(s->await_funcs[0])) {
+        if (js_async_function_resolve_create(ctx, s, resolving_funcs1))
+            return -1;
+        s->await_funcs[0] = resolving_funcs1[0];
+        s->await_funcs[1] = resolving_funcs1[1];
+    }
+
+    for(i = 0; i < 2; i++)
+        resolving_funcs1[i] = JS_UNDEFINED;
+    if (JS_GetOpaque(value, JS_CLASS_PROMISE)) {
+        promise = js_promise_resolve(ctx, ctx->promise_ctor,
+                                     1, &value, 0);
+        if (JS_IsException(promise))
+            return -1;
+    } else {
+        error = JS_UNDEFINED;
+        is_reject = FALSE;
+        if (JS_IsObject(value)) {
+            then = JS_GetProperty(ctx, value, JS_ATOM_then);
+            if (JS_IsException(then)) {
+                error = JS_GetException(ctx);
+                is_reject = TRUE;
+            } else if (JS_IsFunction(ctx, then)) {
+                /* thenable: resolve a new promise with it */
+                promise = js_new_promise(ctx, JS_UNDEFINED, NULL);
+                if (JS_IsException(promise)) {
+                    JS_FreeValue(ctx, then);
+                    return -1;
+                }
+                args[0] = promise;
+                args[1] = value;
+                args[2] = then;
+                res = JS_EnqueueJob(ctx, js_promise_resolve_thenable_job,
+                                    3, args);
+                JS_FreeValue(ctx, then);
+                if (res) {
+                    JS_FreeValue(ctx, promise);
+                    return -1;
+                }
+                goto then;
+            } else {
+                JS_FreeValue(ctx, then);
+            }
+        }
+        /* the promise would already be settled */
+        args[0] = JS_UNDEFINED;
+        args[1] = JS_UNDEFINED;
+        args[2] = s->await_funcs[is_reject];
+        args[3] = JS_NewBool(ctx, is_reject);
+        args[4] = is_reject ? (JSValueConst)error : value;
+        res = JS_EnqueueJob(ctx, promise_reaction_job, 5, args);
+        JS_FreeValue(ctx, error);
+        return res;
+    }
+ then:
+    /* Note: no need to create 'thrownawayCapability' as in
+       the spec */
+    res = perform_promise_then(ctx, promise,
+                               (JSValueConst *)s->await_funcs,
+                               (JSValueConst *)resolving_funcs1);
+    JS_FreeValue(ctx, promise);
+    return res;
+}
+
 static void js_async_function_resume(JSContext *ctx, JSAsyncFunctionData *s)
 {
     JSValue func_ret, ret2;
@@ -18849,31 +20521,12 @@ static void js_async_function_resume(JSContext *ctx, JSAsyncFunctionData *s)
             JS_FreeValue(ctx, value);
             js_async_function_terminate(ctx->rt, s);
         } else {
-            JSValue promise, resolving_funcs[2], resolving_funcs1[2];
-            int i, res;
+            int res;
 
             /* await */
             JS_FreeValue(ctx, func_ret); /* not used */
-            promise = js_promise_resolve(ctx, ctx->promise_ctor,
-                                         1, (JSValueConst *)&value, 0);
+            res = js_async_function_await(ctx, s, value);
             JS_FreeValue(ctx, value);
-            if (JS_IsException(promise))
-                goto fail;
-            if (js_async_function_resolve_create(ctx, s, resolving_funcs)) {
-                JS_FreeValue(ctx, promise);
-                goto fail;
-            }
-
-            /* Note: no need to create 'thrownawayCapability' as in
-               the spec */
-            for(i = 0; i < 2; i++)
-                resolving_funcs1[i] = JS_UNDEFINED;
-            res = perform_promise_then(ctx, promise,
-                                       (JSValueConst *)resolving_funcs,
-                                       (JSValueConst *)resolving_funcs1);
-            JS_FreeValue(ctx, promise);
-            for(i = 0; i < 2; i++)
-                JS_FreeValue(ctx, resolving_funcs[i]);
             if (res)
                 goto fail;
         }
@@ -18910,17 +20563,28 @@ static JSValue js_async_function_call(JSContext *ctx, JSValueConst func_obj,
                                       JSValueConst this_obj,
                                       int argc, JSValueConst *argv, int flags)
 {
+    JSRuntime *rt = ctx->rt;
     JSValue promise;
     JSAsyncFunctionData *s;
 
-    s = js_mallocz(ctx, sizeof(*s));
-    if (!s)
-        return JS_EXCEPTION;
+    if (!list_empty(&rt->async_func_cache)) {
+        s = list_entry(rt->async_func_cache.next, JSAsyncFunctionData,
+                       header.link);
+        list_del(&s->header.link);
+        rt->async_func_cache_count--;
+        memset(s, 0, sizeof(*s));
+    } else {
+        s = js_mallocz(ctx, sizeof(*s));
+        if (!s)
+            return JS_EXCEPTION;
+    }
     s->header.ref_count = 1;
     add_gc_object(ctx->rt, &s->header, JS_GC_OBJ_TYPE_ASYNC_FUNCTION);
     s->is_active = FALSE;
     s->resolving_funcs[0] = JS_UNDEFINED;
     s->resolving_funcs[1] = JS_UNDEFINED;
+    s->await_funcs[0] = JS_UNDEFINED;
+    s->await_funcs[1] = JS_UNDEFINED;
 
     promise = JS_NewPromiseCapability(ctx, s->resolving_funcs);
     if (JS_IsException(promise))
@@ -21970,13 +23634,16 @@ static __exception int js_parse_object_literal(JSParseState *s)
 {
     JSAtom name = JS_ATOM_NULL;
     const uint8_t *start_ptr;
-    int start_line, prop_type;
+    int start_line, prop_type, prop_count, prop_count_pos;
     BOOL has_proto;
 
     if (next_token(s))
         goto fail;
-    /* XXX: add an initial length that will be patched back */
-    emit_op(s, OP_object);
+    /* the property count is patched back once the literal is parsed */
+    emit_op(s, OP_object_size);
+    prop_count_pos = s->cur_func->byte_code.size;
+    emit_u8(s, 0);
+    prop_count = 0;
     has_proto = FALSE;
     while (s->token.val != '}') {
         /* specific case for getter/setter */
@@ -21999,6 +23666,7 @@ static __exception int js_parse_object_literal(JSParseState *s)
         prop_type = js_parse_property_name(s, &name, TRUE, TRUE, FALSE);
         if (prop_type < 0)
             goto fail;
+        prop_count++;
 
         if (prop_type == PROP_TYPE_VAR) {
             /* shortcut for x: x */
@@ -22074,6 +23742,7 @@ static __exception int js_parse_object_literal(JSParseState *s)
     }
     if (js_parse_expect(s, '}'))
         goto fail;
+    s->cur_func->byte_code.buf[prop_count_pos] = min_int(prop_count, 255);
     return 0;
  fail:
     JS_FreeAtom(s->ctx, name);
@@ -32747,9 +34416,9 @@ typedef enum BCTagEnum {
 } BCTagEnum;
 
 #ifdef CONFIG_BIGNUM
-#define BC_BASE_VERSION 2
+#define BC_BASE_VERSION 4
 #else
-#define BC_BASE_VERSION 1
+#define BC_BASE_VERSION 3
 #endif
 #define BC_BE_VERSION 0x40
 #ifdef WORDS_BIGENDIAN
@@ -33193,6 +34862,15 @@ static int JS_WriteObjectRec(BCWriterState *s, JSValueConst obj)
             JS_WriteString(s, p);
         }
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSString *p = js_string_rope_get_flat(s->ctx, obj);
+            if (!p)
+                goto fail;
+            bc_put_u8(s, BC_TAG_STRING);
+            JS_WriteString(s, p);
+        }
+        break;
     case JS_TAG_FUNCTION_BYTECODE:
         {
             JSFunctionBytecode *b = JS_VALUE_GET_PTR(obj);
@@ -34767,6 +36445,15 @@ static JSValue JS_ToObject(JSContext *ctx, JSValueConst val)
             JS_DefinePropertyValue(ctx, obj, JS_ATOM_length, JS_NewInt32(ctx, p1->len), 0);
         }
         goto set_value;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSValue str = JS_ToString(ctx, val);
+            if (JS_IsException(str))
+                return str;
+            obj = JS_ToObject(ctx, str);
+            JS_FreeValue(ctx, str);
+            return obj;
+        }
     case JS_TAG_BOOL:
         obj = JS_NewObjectClass(ctx, JS_CLASS_BOOLEAN);
         goto set_value;
@@ -35205,10 +36892,35 @@ static JSValue JS_GetOwnPropertyNames2(JSContext *ctx, JSValueConst obj1,
 
     r = JS_UNDEFINED;
     val = JS_UNDEFINED;
+    atoms = NULL;
+    len = 0;
     obj = JS_ToObject(ctx, obj1);
     if (JS_IsException(obj))
         return JS_EXCEPTION;
     p = JS_VALUE_GET_OBJ(obj);
+    if (flags == (JS_GPN_ENUM_ONLY | JS_GPN_STRING_MASK) &&
+        kind == JS_ITERATOR_KIND_KEY && !p->is_exotic) {
+        /* Object.keys(): no user code is run so the keys can be copied
+           from the shape */
+        JSShapeEnumCache *ec;
+        JSValue *tab;
+
+        ec = js_get_enum_cache(ctx, p);
+        if (!ec)
+            goto exception;
+        r = js_allocate_fast_array(ctx, ec->count);
+        if (JS_IsException(r))
+            goto exception;
+        tab = JS_VALUE_GET_OBJ(r)->u.array.u.values;
+        for(i = 0; i < ec->count; i++) {
+            tab[i] = JS_AtomToValue(ctx, ec->atoms[i]);
+            if (JS_IsException(tab[i])) {
+                tab[i] = JS_UNDEFINED;
+                goto exception;
+            }
+        }
+        goto done;
+    }
     if (JS_GetOwnPropertyNamesInternal(ctx, &atoms, &len, p, flags & ~JS_GPN_ENUM_ONLY))
         goto exception;
     r = JS_NewArray(ctx);
@@ -36140,7 +37852,7 @@ static JSValue *build_arg_list(JSContext *ctx, uint32_t *plen,
         p->fast_array &&
         len == p->u.array.count) {
         for(i = 0; i < len; i++) {
-            tab[i] = JS_DupValue(ctx, p->u.array.u.values[i]);
+            tab[i] = js_get_fast_array_element(ctx, p, i);
         }
     } else {
         for(i = 0; i < len; i++) {
@@ -36474,23 +38186,25 @@ static JSValue js_aggregate_error_constructor(JSContext *ctx,
 static JSValue js_aggregate_error_errors(JSContext *ctx, JSValueConst this_val)
 {
     JSObject *p;
-    JSValue r, *arr;
-    uint32_t len, i;
+    JSValue r;
+    uint32_t i;
     
     if (JS_VALUE_GET_TAG(this_val) != JS_TAG_OBJECT)
         goto invalid_type;
     p = JS_VALUE_GET_OBJ(this_val);
     if (p->class_id != JS_CLASS_ERROR)
         goto invalid_type;
-    if (!js_get_fast_array(ctx, p->u.object_data, &arr, &len)) {
+    if (!js_is_fast_array(ctx, p->u.object_data)) {
     invalid_type:
         return JS_ThrowTypeError(ctx, "not an AggregateError");
     }
+    p = JS_VALUE_GET_OBJ(p->u.object_data);
     r = JS_NewArray(ctx);
     if (JS_IsException(r))
         goto exception;
-    for(i = 0; i < len; i++) {
-        if (JS_DefinePropertyValueInt64(ctx, r, i, JS_DupValue(ctx, arr[i]),
+    for(i = 0; i < p->u.array.count; i++) {
+        if (JS_DefinePropertyValueInt64(ctx, r, i,
+                                        js_get_fast_array_element(ctx, p, i),
                                         JS_PROP_C_W_E | JS_PROP_THROW) < 0)
             goto exception;
     }
@@ -36609,7 +38323,7 @@ static JSValue js_array_from(JSContext *ctx, JSValueConst this_val,
         if (JS_IsException(r))
             goto exception;
         stack[0] = JS_DupValue(ctx, items);
-        if (js_for_of_start(ctx, &stack[1], FALSE))
+        if (js_for_of_start(ctx, &stack[1], FALSE, FALSE))
             goto exception;
         for (k = 0;; k++) {
             v = JS_IteratorNext(ctx, stack[0], stack[1], 0, NULL, &done);
@@ -37133,6 +38847,54 @@ static JSValue js_array_fill(JSContext *ctx, JSValueConst this_val,
     return JS_EXCEPTION;
 }
 
+/* search the number 'val' in the elements [from, count) of an Array of
+   a packed element kind. Return the index of the first match or -1. NaN
+   matches itself if 'same_value_zero' is TRUE. */
+static int64_t js_array_packed_search(JSObject *p, int64_t from,
+                                      JSValueConst val, BOOL same_value_zero)
+{
+    uint32_t i, count;
+    double d;
+    int32_t v;
+
+    count = p->u.array.count;
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_INT)
+        d = JS_VALUE_GET_INT(val);
+    else if (JS_TAG_IS_FLOAT64(JS_VALUE_GET_TAG(val)))
+        d = JS_VALUE_GET_FLOAT64(val);
+    else
+        return -1;
+    if (p->u.array.kind == JS_ARRAY_KIND_INT32) {
+        const int32_t *tab = p->u.array.u.int32_ptr;
+        /* also excludes NaN */
+        if (!(d >= INT32_MIN && d <= INT32_MAX))
+            return -1;
+        v = (int32_t)d;
+        if (v != d)
+            return -1;
+        for(i = from; i < count; i++) {
+            if (tab[i] == v)
+                return i;
+        }
+    } else {
+        const double *tab = p->u.array.u.double_ptr;
+        if (isnan(d)) {
+            if (same_value_zero) {
+                for(i = from; i < count; i++) {
+                    if (isnan(tab[i]))
+                        return i;
+                }
+            }
+            return -1;
+        }
+        for(i = from; i < count; i++) {
+            if (tab[i] == d)
+                return i;
+        }
+    }
+    return -1;
+}
+
 static JSValue js_array_includes(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv)
 {
@@ -37161,6 +38923,13 @@ static JSValue js_array_includes(JSContext *ctx, JSValueConst this_val,
                     goto done;
                 }
             }
+        } else if (js_is_fast_array(ctx, obj)) {
+            JSObject *p = JS_VALUE_GET_OBJ(obj);
+            if (js_array_packed_search(p, n, argv[0], TRUE) >= 0) {
+                res = TRUE;
+                goto done;
+            }
+            n = max_int64(n, p->u.array.count);
         }
         for (; n < len; n++) {
             val = JS_GetPropertyInt64(ctx, obj, n);
@@ -37209,6 +38978,12 @@ static JSValue js_array_indexOf(JSContext *ctx, JSValueConst this_val,
                     goto done;
                 }
             }
+        } else if (js_is_fast_array(ctx, obj)) {
+            JSObject *p = JS_VALUE_GET_OBJ(obj);
+            res = js_array_packed_search(p, n, argv[0], FALSE);
+            if (res >= 0)
+                goto done;
+            n = max_int64(n, p->u.array.count);
         }
         for (; n < len; n++) {
             int present = JS_TryGetPropertyInt64(ctx, obj, n, &val);
@@ -37417,8 +39192,6 @@ static JSValue js_array_pop(JSContext *ctx, JSValueConst this_val,
 {
     JSValue obj, res = JS_UNDEFINED;
     int64_t len, newLen;
-    JSValue *arrp;
-    uint32_t count32;
 
     obj = JS_ToObject(ctx, this_val);
     if (js_get_length64(ctx, &len, obj))
@@ -37427,16 +39200,38 @@ static JSValue js_array_pop(JSContext *ctx, JSValueConst this_val,
     if (len > 0) {
         newLen = len - 1;
         /* Special case fast arrays */
-        if (js_get_fast_array(ctx, obj, &arrp, &count32) && count32 == len) {
+        if (js_is_fast_array(ctx, obj) &&
+            JS_VALUE_GET_OBJ(obj)->u.array.count == len) {
             JSObject *p = JS_VALUE_GET_OBJ(obj);
+            uint32_t count32 = p->u.array.count;
+            size_t elem_size = js_array_kind_size[p->u.array.kind];
+            uint8_t *tab = p->u.array.u.ptr;
+            /* the element reference, if any, is moved to 'res' */
             if (shift) {
-                res = arrp[0];
-                memmove(arrp, arrp + 1, (count32 - 1) * sizeof(*arrp));
-                p->u.array.count--;
+                if (p->u.array.kind == JS_ARRAY_KIND_GENERIC)
+                    res = p->u.array.u.values[0];
+                else
+                    res = js_get_fast_array_element(ctx, p, 0);
+                if (unlikely(p->u.array.offset == JS_ARRAY_OFFSET_MAX)) {
+                    uint8_t *base = js_array_get_base(p);
+                    memmove(base, tab, count32 * elem_size);
+                    p->u.array.u1.size += p->u.array.offset;
+                    p->u.array.offset = 0;
+                    tab = base;
+                }
+                /* the slot of the first element is left free in the
+                   allocation */
+                p->u.array.u.ptr = tab + elem_size;
+                p->u.array.u1.size--;
+                p->u.array.offset++;
             } else {
-                res = arrp[count32 - 1];
-                p->u.array.count--;
+                if (p->u.array.kind == JS_ARRAY_KIND_GENERIC)
+                    res = p->u.array.u.values[count32 - 1];
+                else
+                    res = js_get_fast_array_element(ctx, p, count32 - 1);
             }
+            p->u.array.count--;
+            js_array_shrink(ctx, p);
         } else {
             if (shift) {
                 res = JS_GetPropertyInt64(ctx, obj, 0);
@@ -37482,6 +39277,35 @@ static JSValue js_array_push(JSContext *ctx, JSValueConst this_val,
     }
     from = len;
     if (unshift && argc > 0) {
+        if (js_is_fast_array(ctx, obj)) {
+            JSObject *p = JS_VALUE_GET_OBJ(obj);
+            if (p->u.array.count == len && newLen <= INT32_MAX &&
+                p->extensible &&
+                (get_shape_prop(p->shape)->flags & JS_PROP_WRITABLE) &&
+                js_array_proto_is_simple(p)) {
+                int kind = p->u.array.kind;
+                /* the elements are not moved if there is room
+                   before the first one */
+                for(i = 0; i < argc; i++)
+                    kind = max_int(kind, js_array_value_kind(argv[i]));
+                if (kind > p->u.array.kind &&
+                    js_array_set_kind(ctx, p, kind))
+                    goto exception;
+                if (p->u.array.offset < argc &&
+                    js_array_reserve_front(ctx, p, argc))
+                    goto exception;
+                p->u.array.u.ptr = (uint8_t *)p->u.array.u.ptr -
+                    (size_t)argc * js_array_kind_size[kind];
+                p->u.array.offset -= argc;
+                p->u.array.u1.size += argc;
+                p->u.array.count += argc;
+                for(i = 0; i < argc; i++)
+                    js_put_fast_array_slot(p, i, JS_DupValue(ctx, argv[i]));
+                p->prop[0].u.value = JS_NewInt32(ctx, newLen);
+                JS_FreeValue(ctx, obj);
+                return JS_NewInt64(ctx, newLen);
+            }
+        }
         if (JS_CopySubArray(ctx, obj, argc, 0, len, -1))
             goto exception;
         from = 0;
@@ -37528,6 +39352,29 @@ static JSValue js_array_reverse(JSContext *ctx, JSValueConst this_val,
             }
         }
         return obj;
+    } else if (js_is_fast_array(ctx, obj) &&
+               JS_VALUE_GET_OBJ(obj)->u.array.count == len) {
+        JSObject *p = JS_VALUE_GET_OBJ(obj);
+        uint32_t ll, hh;
+
+        if (len > 1) {
+            if (p->u.array.kind == JS_ARRAY_KIND_INT32) {
+                int32_t *tab = p->u.array.u.int32_ptr, v;
+                for (ll = 0, hh = len - 1; ll < hh; ll++, hh--) {
+                    v = tab[ll];
+                    tab[ll] = tab[hh];
+                    tab[hh] = v;
+                }
+            } else {
+                double *tab = p->u.array.u.double_ptr, d;
+                for (ll = 0, hh = len - 1; ll < hh; ll++, hh--) {
+                    d = tab[ll];
+                    tab[ll] = tab[hh];
+                    tab[hh] = d;
+                }
+            }
+        }
+        return obj;
     }
 
     for (l = 0, h = len - 1; l < h; l++, h--) {
@@ -37577,8 +39424,7 @@ static JSValue js_array_slice(JSContext *ctx, JSValueConst this_val,
     JSValue obj, arr, val, len_val;
     int64_t len, start, k, final, n, count, del_count, new_len;
     int kPresent;
-    JSValue *arrp;
-    uint32_t count32, i, item_count;
+    uint32_t i, item_count;
 
     arr = JS_UNDEFINED;
     obj = JS_ToObject(ctx, this_val);
@@ -37628,11 +39474,13 @@ static JSValue js_array_slice(JSContext *ctx, JSValueConst this_val,
        JS_CreateDataPropertyUint32() won't modify obj in case arr is
        an exotic object */
     /* Special case fast arrays */
-    if (js_get_fast_array(ctx, obj, &arrp, &count32) &&
-        js_is_fast_array(ctx, arr)) {
+    if (js_is_fast_array(ctx, obj) && js_is_fast_array(ctx, arr)) {
+        JSObject *p = JS_VALUE_GET_OBJ(obj);
         /* XXX: should share code with fast array constructor */
-        for (; k < final && k < count32; k++, n++) {
-            if (JS_CreateDataPropertyUint32(ctx, arr, n, JS_DupValue(ctx, arrp[k]), JS_PROP_THROW) < 0)
+        for (; k < final && k < p->u.array.count; k++, n++) {
+            if (JS_CreateDataPropertyUint32(ctx, arr, n,
+                                            js_get_fast_array_element(ctx, p, k),
+                                            JS_PROP_THROW) < 0)
                 goto exception;
         }
     }
@@ -37890,6 +39738,203 @@ exception:
     return 0;
 }
 
+/* Sorting of the fast arrays when no user code can run. The sort
+   is done in place on the unboxed elements. */
+
+static void js_TA_sort_unsigned(JSContext *ctx, void *array_ptr, uint32_t len,
+                                int elt_size);
+static void js_TA_sort_default(JSContext *ctx, void *array_ptr, uint32_t len,
+                               int class_id);
+
+static const uint32_t js_array_sort_pow10[10] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+    1000000000,
+};
+
+/* return a key whose unsigned order is the order of the decimal
+   representations of the int32 values: '-' is before the digits, then
+   the digits are compared with the shorter string first if it is a
+   prefix of the other one. */
+static uint64_t js_array_sort_int32_to_key(int32_t v)
+{
+    uint32_t u, d;
+
+    u = v < 0 ? -(uint32_t)v : v;
+    for(d = 1; d < 10 && u >= js_array_sort_pow10[d]; d++)
+        continue;
+    return ((uint64_t)(v >= 0) << 63) |
+        (((uint64_t)u * js_array_sort_pow10[10 - d]) << 4) | d;
+}
+
+static int32_t js_array_sort_key_to_int32(uint64_t key)
+{
+    uint32_t d, u;
+
+    d = key & 15;
+    u = ((key >> 4) & (((uint64_t)1 << 59) - 1)) / js_array_sort_pow10[10 - d];
+    return (key >> 63) ? (int32_t)u : (int32_t)(0 - u);
+}
+
+/* stable sort of doubles without NaN. -0 and +0 are equal. */
+static void js_array_sort_f64(double *tab, double *tmp, uint32_t len)
+{
+    size_t width, lo, mid, hi, i, j, k;
+    double *src, *dst, *t, d;
+
+    /* insertion sort of runs of 16 elements */
+    for(lo = 0; lo < len; lo += 16) {
+        hi = lo + 16 < len ? lo + 16 : len;
+        for(i = lo + 1; i < hi; i++) {
+            d = tab[i];
+            for(j = i; j > lo && d < tab[j - 1]; j--)
+                tab[j] = tab[j - 1];
+            tab[j] = d;
+        }
+    }
+    src = tab;
+    dst = tmp;
+    for(width = 16; width < len; width *= 2) {
+        for(lo = 0; lo < len; lo += 2 * width) {
+            mid = lo + width < len ? lo + width : len;
+            hi = lo + 2 * width < len ? lo + 2 * width : len;
+            i = lo;
+            j = mid;
+            k = lo;
+            while (i < mid && j < hi) {
+                if (src[j] < src[i])
+                    dst[k++] = src[j++];
+                else
+                    dst[k++] = src[i++];
+            }
+            while (i < mid)
+                dst[k++] = src[i++];
+            while (j < hi)
+                dst[k++] = src[j++];
+        }
+        t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != tab)
+        memcpy(tab, src, len * sizeof(tab[0]));
+}
+
+/* return 1 for '(a, b) => a - b', -1 for '(a, b) => b - a' and 0
+   otherwise. The bytecode is matched so that the comparator does not
+   need to be called for numbers. */
+static int js_array_sort_numeric_order(JSValueConst method)
+{
+    JSObject *p;
+    JSFunctionBytecode *b;
+    const uint8_t *pc;
+
+    if (JS_VALUE_GET_TAG(method) != JS_TAG_OBJECT)
+        return 0;
+    p = JS_VALUE_GET_OBJ(method);
+    if (p->class_id != JS_CLASS_BYTECODE_FUNCTION)
+        return 0;
+    b = p->u.func.function_bytecode;
+    pc = b->byte_code_buf;
+    if (b->arg_count != 2 || b->byte_code_len != 4 ||
+        pc[2] != OP_sub || pc[3] != OP_return)
+        return 0;
+    if (pc[0] == OP_get_arg0 && pc[1] == OP_get_arg1)
+        return 1;
+    if (pc[0] == OP_get_arg1 && pc[1] == OP_get_arg0)
+        return -1;
+    return 0;
+}
+
+static int js_array_cmp_string(const void *a, const void *b, void *opaque)
+{
+    return js_string_compare(opaque, JS_VALUE_GET_STRING(*(JSValue *)a),
+                             JS_VALUE_GET_STRING(*(JSValue *)b));
+}
+
+/* Sort the fast array 'p' without holes: default order of int32 or
+   string elements, numeric order of number elements for the
+   comparators recognized by js_array_sort_numeric_order(). Return 1
+   if sorted, 0 if the generic sort must be used and -1 if
+   exception. */
+static int js_array_sort_fast(JSContext *ctx, JSObject *p,
+                              JSValueConst method)
+{
+    uint32_t i, len;
+    int order;
+
+    len = p->u.array.count;
+    if (JS_IsUndefined(method)) {
+        if (p->u.array.kind == JS_ARRAY_KIND_INT32) {
+            int32_t *tab = p->u.array.u.int32_ptr;
+            uint64_t *keys;
+
+            if (len <= 1)
+                return 1;
+            keys = js_malloc(ctx, sizeof(keys[0]) * len);
+            if (!keys)
+                return -1;
+            for(i = 0; i < len; i++)
+                keys[i] = js_array_sort_int32_to_key(tab[i]);
+            js_TA_sort_unsigned(ctx, keys, len, sizeof(keys[0]));
+            for(i = 0; i < len; i++)
+                tab[i] = js_array_sort_key_to_int32(keys[i]);
+            js_free(ctx, keys);
+            return 1;
+        } else if (p->u.array.kind == JS_ARRAY_KIND_GENERIC) {
+            JSValue *tab = p->u.array.u.values;
+            for(i = 0; i < len; i++) {
+                if (JS_VALUE_GET_TAG(tab[i]) != JS_TAG_STRING)
+                    return 0;
+            }
+            /* equal strings cannot be distinguished so the sort need
+               not be stable */
+            rqsort(tab, len, sizeof(tab[0]), js_array_cmp_string, ctx);
+            return 1;
+        }
+        return 0;
+    }
+
+    order = js_array_sort_numeric_order(method);
+    if (order == 0)
+        return 0;
+    if (p->u.array.kind == JS_ARRAY_KIND_INT32) {
+        int32_t *tab = p->u.array.u.int32_ptr, v;
+        js_TA_sort_default(ctx, tab, len, JS_CLASS_INT32_ARRAY);
+        if (order < 0) {
+            for(i = 0; i < len / 2; i++) {
+                v = tab[i];
+                tab[i] = tab[len - 1 - i];
+                tab[len - 1 - i] = v;
+            }
+        }
+        return 1;
+    } else if (p->u.array.kind == JS_ARRAY_KIND_FLOAT64) {
+        double *tab = p->u.array.u.double_ptr, *tmp;
+        /* the comparator is not consistent with NaN */
+        for(i = 0; i < len; i++) {
+            if (isnan(tab[i]))
+                return 0;
+        }
+        tmp = js_malloc(ctx, sizeof(tmp[0]) * max_uint32(len, 1));
+        if (!tmp)
+            return -1;
+        /* the descending order is the ascending order of the opposite
+           values, which keeps the sort stable */
+        if (order < 0) {
+            for(i = 0; i < len; i++)
+                tab[i] = -tab[i];
+        }
+        js_array_sort_f64(tab, tmp, len);
+        if (order < 0) {
+            for(i = 0; i < len; i++)
+                tab[i] = -tab[i];
+        }
+        js_free(ctx, tmp);
+        return 1;
+    }
+    return 0;
+}
+
 static JSValue js_array_sort(JSContext *ctx, JSValueConst this_val,
                              int argc, JSValueConst *argv)
 {
@@ -37909,7 +39954,15 @@ static JSValue js_array_sort(JSContext *ctx, JSValueConst this_val,
     if (js_get_length64(ctx, &len, obj))
         goto exception;
 
-    /* XXX: should special case fast arrays */
+    if (js_is_fast_array(ctx, obj) &&
+        JS_VALUE_GET_OBJ(obj)->u.array.count == len) {
+        int ret = js_array_sort_fast(ctx, JS_VALUE_GET_OBJ(obj), asc.method);
+        if (ret < 0)
+            goto exception;
+        if (ret)
+            return obj;
+    }
+
     for (i = 0; i < len; i++) {
         if (pos >= array_size) {
             size_t new_size, slack;
@@ -38005,17 +40058,15 @@ static void js_array_iterator_mark(JSRuntime *rt, JSValueConst val,
 static JSValue js_create_array(JSContext *ctx, int len, JSValueConst *tab)
 {
     JSValue obj;
+    JSObject *p;
     int i;
 
-    obj = JS_NewArray(ctx);
+    obj = js_allocate_fast_array(ctx, len);
     if (JS_IsException(obj))
         return JS_EXCEPTION;
-    for(i = 0; i < len; i++) {
-        if (JS_CreateDataPropertyUint32(ctx, obj, i, JS_DupValue(ctx, tab[i]), 0) < 0) {
-            JS_FreeValue(ctx, obj);
-            return JS_EXCEPTION;
-        }
-    }
+    p = JS_VALUE_GET_OBJ(obj);
+    for(i = 0; i < len; i++)
+        p->u.array.u.values[i] = JS_DupValue(ctx, tab[i]);
     return obj;
 }
 
@@ -38071,6 +40122,12 @@ static JSValue js_array_iterator_next(JSContext *ctx, JSValueConst this_val,
     if (JS_IsUndefined(it->obj))
         goto done;
     p = JS_VALUE_GET_OBJ(it->obj);
+    if (p->class_id == JS_CLASS_ARRAY && p->fast_array &&
+        it->kind == JS_ITERATOR_KIND_VALUE && it->idx < p->u.array.count) {
+        /* the length of a fast Array is never below its element count */
+        *pdone = FALSE;
+        return js_get_fast_array_element(ctx, p, it->idx++);
+    }
     if (p->class_id >= JS_CLASS_UINT8C_ARRAY &&
         p->class_id <= JS_CLASS_FLOAT64_ARRAY) {
         if (typed_array_is_detached(ctx, p)) {
@@ -38117,6 +40174,89 @@ static JSValue js_array_iterator_next(JSContext *ctx, JSValueConst this_val,
     }
 }
 
+/* TRUE if 'method' is Array.prototype[Symbol.iterator] and
+   %ArrayIteratorPrototype%.next is the built-in data property, so that
+   'for of' can index the Array without creating the iterator object */
+static BOOL js_for_of_array_is_builtin(JSContext *ctx, JSValueConst method)
+{
+    JSObject *p;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+
+    if (!JS_IsCFunction(ctx, method, (JSCFunction *)js_create_array_iterator,
+                        JS_ITERATOR_KIND_VALUE))
+        return FALSE;
+    p = JS_VALUE_GET_OBJ(ctx->class_proto[JS_CLASS_ARRAY_ITERATOR]);
+    prs = find_own_property(&pr, p, JS_ATOM_next);
+    return prs && (prs->flags & JS_PROP_TMASK) == JS_PROP_NORMAL &&
+        JS_IsCFunction(ctx, pr->u.value, (JSCFunction *)js_array_iterator_next, 0);
+}
+
+/* 'array index' -> 'array index' value: same steps as
+   js_array_iterator_next() with the JS_ITERATOR_KIND_VALUE kind */
+static JSValue js_for_of_array_next(JSContext *ctx, JSValue *sp, int *pdone)
+{
+    JSObject *p = JS_VALUE_GET_OBJ(sp[0]);
+    uint32_t len, idx = JS_VALUE_GET_INT(sp[1]);
+    JSValue val;
+
+    *pdone = FALSE;
+    if (likely(p->fast_array && idx < p->u.array.count)) {
+        val = js_get_fast_array_element(ctx, p, idx);
+    } else {
+        if (js_get_length32(ctx, &len, sp[0]))
+            return JS_EXCEPTION;
+        if (idx >= len) {
+            *pdone = TRUE;
+            return JS_UNDEFINED;
+        }
+        val = JS_GetPropertyUint32(ctx, sp[0], idx);
+        if (JS_IsException(val))
+            return val;
+    }
+    sp[1] = JS_MKVAL(JS_TAG_INT, idx + 1);
+    return val;
+}
+
+/* Closing 'array index': the 'return' method is looked up only if it
+   may exist, in which case the iterator object is created and stored
+   in place of the Array. Otherwise the Array is replaced by
+   JS_UNDEFINED. */
+static int js_for_of_array_close(JSContext *ctx, JSValue *sp)
+{
+    JSObject *p;
+    JSProperty *pr;
+    JSValue enum_obj;
+    JSArrayIteratorData *it;
+
+    if (JS_IsUndefined(sp[0]))
+        return 0;
+    p = JS_VALUE_GET_OBJ(ctx->class_proto[JS_CLASS_ARRAY_ITERATOR]);
+    while (p != NULL) {
+        /* exotic objects may run code when looking up 'return' */
+        if (p->is_exotic || find_own_property(&pr, p, JS_ATOM_return))
+            break;
+        p = p->shape->proto;
+    }
+    if (p == NULL) {
+        enum_obj = JS_UNDEFINED;
+    } else {
+        enum_obj = js_create_array_iterator(ctx, sp[0], 0, NULL,
+                                            JS_ITERATOR_KIND_VALUE);
+        if (!JS_IsException(enum_obj)) {
+            it = JS_GetOpaque(enum_obj, JS_CLASS_ARRAY_ITERATOR);
+            it->idx = JS_VALUE_GET_INT(sp[1]);
+        }
+    }
+    JS_FreeValue(ctx, sp[0]);
+    sp[0] = enum_obj;
+    if (JS_IsException(enum_obj)) {
+        sp[0] = JS_UNDEFINED;
+        return -1;
+    }
+    return 0;
+}
+
 static JSValue js_iterator_proto_iterator(JSContext *ctx, JSValueConst this_val,
                                           int argc, JSValueConst *argv)
 {
@@ -38696,6 +40836,8 @@ static JSValue js_thisStringValue(JSContext *ctx, JSValueConst this_val)
 {
     if (JS_VALUE_GET_TAG(this_val) == JS_TAG_STRING)
         return JS_DupValue(ctx, this_val);
+    if (JS_VALUE_GET_TAG(this_val) == JS_TAG_STRING_ROPE)
+        return JS_ToString(ctx, this_val);
 
     if (JS_VALUE_GET_TAG(this_val) == JS_TAG_OBJECT) {
         JSObject *p = JS_VALUE_GET_OBJ(this_val);
@@ -38938,29 +41080,26 @@ static JSValue js_string_concat(JSContext *ctx, JSValueConst this_val,
 
 static int string_cmp(JSString *p1, JSString *p2, int x1, int x2, int len)
 {
-    int i, c1, c2;
-    for (i = 0; i < len; i++) {
-        if ((c1 = string_get(p1, x1 + i)) != (c2 = string_get(p2, x2 + i)))
-            return c1 - c2;
-    }
-    return 0;
+    return js_string_memcmp_pos(p1, x1, p2, x2, len);
 }
 
 static int string_indexof_char(JSString *p, int c, int from)
 {
     /* assuming 0 <= from <= p->len */
-    int i, len = p->len;
+    int len = p->len;
     if (p->is_wide_char) {
-        for (i = from; i < len; i++) {
-            if (p->u.str16[i] == c)
-                return i;
+        const uint16_t *q;
+        if ((c & ~0xffff) == 0) {
+            q = memchr16(p->u.str16 + from, c, len - from);
+            if (q)
+                return q - p->u.str16;
         }
     } else {
+        const uint8_t *q;
         if ((c & ~0xff) == 0) {
-            for (i = from; i < len; i++) {
-                if (p->u.str8[i] == (uint8_t)c)
-                    return i;
-            }
+            q = memchr(p->u.str8 + from, c, len - from);
+            if (q)
+                return q - p->u.str8;
         }
     }
     return -1;
@@ -38982,6 +41121,20 @@ static int string_indexof(JSString *p1, JSString *p2, int from)
     return -1;
 }
 
+static int string_lastindexof(JSString *p1, JSString *p2, int from)
+{
+    /* assuming 0 <= from <= p1->len - p2->len */
+    int c, i, len2 = p2->len;
+    if (len2 == 0)
+        return from;
+    c = string_get(p2, 0);
+    for (i = from; i >= 0; i--) {
+        if (string_get(p1, i) == c && !string_cmp(p1, p2, i + 1, 1, len2 - 1))
+            return i;
+    }
+    return -1;
+}
+
 static int64_t string_advance_index(JSString *p, int64_t index, BOOL unicode)
 {
     if (!unicode || index >= p->len || !p->is_wide_char) {
@@ -38998,7 +41151,7 @@ static JSValue js_string_indexOf(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv, int lastIndexOf)
 {
     JSValue str, v;
-    int i, len, v_len, pos, start, stop, ret, inc;
+    int len, v_len, pos, start, stop, ret;
     JSString *p;
     JSString *p1;
 
@@ -39027,7 +41180,6 @@ static JSValue js_string_indexOf(JSContext *ctx, JSValueConst this_val,
         }
         start = pos;
         stop = 0;
-        inc = -1;
     } else {
         pos = 0;
         if (argc > 1) {
@@ -39036,18 +41188,13 @@ static JSValue js_string_indexOf(JSContext *ctx, JSValueConst this_val,
         }
         start = pos;
         stop = len - v_len;
-        inc = 1;
     }
     ret = -1;
-    if (len >= v_len && inc * (stop - start) >= 0) {
-        for (i = start;; i += inc) {
-            if (!string_cmp(p, p1, i, 0, v_len)) {
-                ret = i;
-                break;
-            }
-            if (i == stop)
-                break;
-        }
+    if (!lastIndexOf) {
+        if (len >= v_len && start <= stop)
+            ret = string_indexof(p, p1, start);
+    } else if (len >= v_len && start >= stop) {
+        ret = string_lastindexof(p, p1, start);
     }
     JS_FreeValue(ctx, str);
     JS_FreeValue(ctx, v);
@@ -39102,7 +41249,10 @@ static JSValue js_string_includes(JSContext *ctx, JSValueConst this_val,
         start = stop = pos;
     }
     ret = 0;
-    if (start >= 0 && start <= stop) {
+    if (magic == 0) {
+        if (start >= 0 && start <= stop)
+            ret = string_indexof(p, p1, start) >= 0;
+    } else if (start >= 0 && start <= stop) {
         for (i = start;; i++) {
             if (!string_cmp(p, p1, i, 0, v_len)) {
                 ret = 1;
@@ -39219,7 +41369,8 @@ static JSValue js_string___GetSubstitution(JSContext *ctx, JSValueConst this_val
     namedCaptures = argv[4];
     rep = argv[5];
 
-    if (!JS_IsString(rep) || !JS_IsString(str))
+    if (JS_VALUE_GET_TAG(rep) != JS_TAG_STRING ||
+        JS_VALUE_GET_TAG(str) != JS_TAG_STRING)
         return JS_ThrowTypeError(ctx, "not a string");
 
     sp = JS_VALUE_GET_STRING(str);
@@ -39484,7 +41635,7 @@ static JSValue js_string_split(JSContext *ctx, JSValueConst this_val,
         e = string_indexof(sp, rp, q);
         if (e < 0)
             break;
-        T = js_sub_string(ctx, sp, p, e);
+        T = js_sub_string_slice(ctx, sp, p, e);
         if (JS_IsException(T))
             goto exception;
         if (JS_CreateDataPropertyUint32(ctx, A, lengthA++, T, 0) < 0)
@@ -39493,7 +41644,7 @@ static JSValue js_string_split(JSContext *ctx, JSValueConst this_val,
             goto done;
     }
 add_tail:
-    T = js_sub_string(ctx, sp, p, s);
+    T = js_sub_string_slice(ctx, sp, p, s);
     if (JS_IsException(T))
         goto exception;
     if (JS_CreateDataPropertyUint32(ctx, A, lengthA++, T,0 ) < 0)
@@ -39515,19 +41666,20 @@ static JSValue js_string_substring(JSContext *ctx, JSValueConst this_val,
 {
     JSValue str, ret;
     int a, b, start, end;
+    uint32_t base, len;
     JSString *p;
 
-    str = JS_ToStringCheckObject(ctx, this_val);
+    str = js_string_get_view(ctx, this_val, &base, &len);
     if (JS_IsException(str))
         return str;
     p = JS_VALUE_GET_STRING(str);
-    if (JS_ToInt32Clamp(ctx, &a, argv[0], 0, p->len, 0)) {
+    if (JS_ToInt32Clamp(ctx, &a, argv[0], 0, len, 0)) {
         JS_FreeValue(ctx, str);
         return JS_EXCEPTION;
     }
-    b = p->len;
+    b = len;
     if (!JS_IsUndefined(argv[1])) {
-        if (JS_ToInt32Clamp(ctx, &b, argv[1], 0, p->len, 0)) {
+        if (JS_ToInt32Clamp(ctx, &b, argv[1], 0, len, 0)) {
             JS_FreeValue(ctx, str);
             return JS_EXCEPTION;
         }
@@ -39539,7 +41691,7 @@ static JSValue js_string_substring(JSContext *ctx, JSValueConst this_val,
         start = b;
         end = a;
     }
-    ret = js_sub_string(ctx, p, start, end);
+    ret = js_sub_string_slice(ctx, p, base + start, base + end);
     JS_FreeValue(ctx, str);
     return ret;
 }
@@ -39549,13 +41701,14 @@ static JSValue js_string_substr(JSContext *ctx, JSValueConst this_val,
 {
     JSValue str, ret;
     int a, len, n;
+    uint32_t base, len1;
     JSString *p;
 
-    str = JS_ToStringCheckObject(ctx, this_val);
+    str = js_string_get_view(ctx, this_val, &base, &len1);
     if (JS_IsException(str))
         return str;
     p = JS_VALUE_GET_STRING(str);
-    len = p->len;
+    len = len1;
     if (JS_ToInt32Clamp(ctx, &a, argv[0], 0, len, len)) {
         JS_FreeValue(ctx, str);
         return JS_EXCEPTION;
@@ -39567,7 +41720,7 @@ static JSValue js_string_substr(JSContext *ctx, JSValueConst this_val,
             return JS_EXCEPTION;
         }
     }
-    ret = js_sub_string(ctx, p, a, a + n);
+    ret = js_sub_string_slice(ctx, p, base + a, base + a + n);
     JS_FreeValue(ctx, str);
     return ret;
 }
@@ -39577,13 +41730,14 @@ static JSValue js_string_slice(JSContext *ctx, JSValueConst this_val,
 {
     JSValue str, ret;
     int len, start, end;
+    uint32_t base, len1;
     JSString *p;
 
-    str = JS_ToStringCheckObject(ctx, this_val);
+    str = js_string_get_view(ctx, this_val, &base, &len1);
     if (JS_IsException(str))
         return str;
     p = JS_VALUE_GET_STRING(str);
-    len = p->len;
+    len = len1;
     if (JS_ToInt32Clamp(ctx, &start, argv[0], 0, len, len)) {
         JS_FreeValue(ctx, str);
         return JS_EXCEPTION;
@@ -39595,7 +41749,7 @@ static JSValue js_string_slice(JSContext *ctx, JSValueConst this_val,
             return JS_EXCEPTION;
         }
     }
-    ret = js_sub_string(ctx, p, start, max_int(end, start));
+    ret = js_sub_string_slice(ctx, p, base + start, base + max_int(end, start));
     JS_FreeValue(ctx, str);
     return ret;
 }
@@ -40608,6 +42762,90 @@ static void js_regexp_finalizer(JSRuntime *rt, JSValue val)
     JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, re->pattern));
 }
 
+static uint32_t js_regexp_cache_hash(JSString *pattern, int re_flags)
+{
+    return hash_string(pattern, re_flags);
+}
+
+static void js_regexp_cache_remove(JSRuntime *rt, JSRegExpCacheEntry *e)
+{
+    JSRegExpCacheEntry **pe;
+
+    pe = &rt->regexp_cache_hash[e->hash & (JS_REGEXP_CACHE_HASH_SIZE - 1)];
+    while (*pe != e)
+        pe = &(*pe)->hash_next;
+    *pe = e->hash_next;
+    list_del(&e->link);
+    rt->regexp_cache_count--;
+    rt->regexp_cache_size -= e->size;
+    JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, e->pattern));
+    JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, e->bytecode));
+    js_free_rt(rt, e);
+}
+
+/* remove the least recently used entries until the cache size is <=
+   max_size */
+static void js_regexp_cache_evict(JSRuntime *rt, size_t max_size)
+{
+    while (rt->regexp_cache_size > max_size) {
+        js_regexp_cache_remove(rt, list_entry(rt->regexp_cache_list.prev,
+                                              JSRegExpCacheEntry, link));
+    }
+}
+
+static JSString *js_regexp_cache_find(JSRuntime *rt, JSString *pattern,
+                                      int re_flags)
+{
+    JSRegExpCacheEntry *e;
+    uint32_t h;
+
+    h = js_regexp_cache_hash(pattern, re_flags);
+    for(e = rt->regexp_cache_hash[h & (JS_REGEXP_CACHE_HASH_SIZE - 1)];
+        e != NULL; e = e->hash_next) {
+        if (e->hash == h && e->re_flags == re_flags &&
+            e->pattern->len == pattern->len &&
+            js_string_memcmp(e->pattern, pattern, pattern->len) == 0) {
+            /* move to the front of the LRU list */
+            list_del(&e->link);
+            list_add(&e->link, &rt->regexp_cache_list);
+            rt->regexp_cache_hits++;
+            return e->bytecode;
+        }
+    }
+    rt->regexp_cache_misses++;
+    return NULL;
+}
+
+static void js_regexp_cache_add(JSRuntime *rt, JSString *pattern,
+                                int re_flags, JSString *bytecode)
+{
+    JSRegExpCacheEntry *e, **pe;
+    size_t size;
+
+    size = sizeof(*e) + 2 * sizeof(JSString) +
+        (pattern->len << pattern->is_wide_char) + bytecode->len;
+    if (size > rt->regexp_cache_max_size)
+        return;
+    js_regexp_cache_evict(rt, rt->regexp_cache_max_size - size);
+    /* the cache is optional: ignore the allocation errors */
+    e = js_malloc_rt(rt, sizeof(*e));
+    if (!e)
+        return;
+    e->hash = js_regexp_cache_hash(pattern, re_flags);
+    e->re_flags = re_flags;
+    e->pattern = pattern;
+    pattern->header.ref_count++;
+    e->bytecode = bytecode;
+    bytecode->header.ref_count++;
+    e->size = size;
+    pe = &rt->regexp_cache_hash[e->hash & (JS_REGEXP_CACHE_HASH_SIZE - 1)];
+    e->hash_next = *pe;
+    *pe = e;
+    list_add(&e->link, &rt->regexp_cache_list);
+    rt->regexp_cache_count++;
+    rt->regexp_cache_size += size;
+}
+
 /* create a string containing the RegExp bytecode */
 static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
                                  JSValueConst flags)
@@ -40619,6 +42857,7 @@ static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
     int re_bytecode_len;
     JSValue ret;
     char error_msg[64];
+    BOOL cacheable;
 
     re_flags = 0;
     if (!JS_IsUndefined(flags)) {
@@ -40659,6 +42898,15 @@ static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
         JS_FreeCString(ctx, str);
     }
 
+    cacheable = (JS_VALUE_GET_TAG(pattern) == JS_TAG_STRING &&
+                 ctx->rt->regexp_cache_max_size != 0);
+    if (cacheable) {
+        JSString *bc = js_regexp_cache_find(ctx->rt, JS_VALUE_GET_STRING(pattern),
+                                            re_flags);
+        if (bc)
+            return JS_DupValue(ctx, JS_MKPTR(JS_TAG_STRING, bc));
+    }
+
     str = JS_ToCStringLen2(ctx, &len, pattern, !(re_flags & LRE_FLAG_UTF16));
     if (!str)
         return JS_EXCEPTION;
@@ -40672,6 +42920,10 @@ static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
 
     ret = js_new_string8(ctx, re_bytecode_buf, re_bytecode_len);
     js_free(ctx, re_bytecode_buf);
+    if (cacheable && !JS_IsException(ret)) {
+        js_regexp_cache_add(ctx->rt, JS_VALUE_GET_STRING(pattern), re_flags,
+                            JS_VALUE_GET_STRING(ret));
+    }
     return ret;
 }
 
@@ -41119,12 +43371,10 @@ static JSValue js_regexp_exec(JSContext *ctx, JSValueConst this_val,
         prop_flags = JS_PROP_C_W_E | JS_PROP_THROW;
         group_name_ptr = NULL;
         if (re_flags & LRE_FLAG_NAMED_GROUPS) {
-            uint32_t re_bytecode_len;
             groups = JS_NewObjectProto(ctx, JS_NULL);
             if (JS_IsException(groups))
                 goto fail;
-            re_bytecode_len = get_u32(re_bytecode + 3);
-            group_name_ptr = (char *)(re_bytecode + 7 + re_bytecode_len);
+            group_name_ptr = lre_get_groupnames(re_bytecode);
         }
 
         for(i = 0; i < capture_count; i++) {
@@ -41136,7 +43386,7 @@ static JSValue js_regexp_exec(JSContext *ctx, JSValueConst this_val,
             } else {
                 start = (capture[2 * i] - str_buf) >> shift;
                 end = (capture[2 * i + 1] - str_buf) >> shift;
-                val = js_sub_string(ctx, str, start, end);
+                val = js_sub_string_slice(ctx, str, start, end);
                 if (JS_IsException(val))
                     goto fail;
             }
@@ -41863,6 +44113,28 @@ exception:
     return JS_EXCEPTION;
 }
 
+/* return the regexp if 'obj' is a RegExp using the builtin exec
+   method without calling any getter, NULL otherwise */
+static JSRegExp *js_get_builtin_exec_regexp(JSContext *ctx, JSValueConst obj)
+{
+    JSObject *p;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+    
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT)
+        return NULL;
+    p = JS_VALUE_GET_OBJ(obj);
+    if (p->class_id != JS_CLASS_REGEXP ||
+        p->shape->proto != JS_VALUE_GET_OBJ(ctx->class_proto[JS_CLASS_REGEXP]) ||
+        find_own_property(&pr, p, JS_ATOM_exec))
+        return NULL;
+    prs = find_own_property(&pr, p->shape->proto, JS_ATOM_exec);
+    if (!prs || (prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL ||
+        !JS_IsCFunction(ctx, pr->u.value, js_regexp_exec, 0))
+        return NULL;
+    return &p->u.regexp;
+}
+
 static JSValue js_regexp_Symbol_split(JSContext *ctx, JSValueConst this_val,
                                        int argc, JSValueConst *argv)
 {
@@ -41871,8 +44143,9 @@ static JSValue js_regexp_Symbol_split(JSContext *ctx, JSValueConst this_val,
     JSValueConst args[2];
     JSValue str, ctor, splitter, A, flags, z, sub;
     JSString *strp;
+    JSRegExp *re;
     uint32_t lim, size, p, q;
-    int unicodeMatching;
+    int unicodeMatching, q1;
     int64_t lengthA, e, numberOfCaptures, i;
 
     if (!JS_IsObject(rx))
@@ -41927,7 +44200,17 @@ static JSValue js_regexp_Symbol_split(JSContext *ctx, JSValueConst this_val,
             goto add_tail;
         goto done;
     }
+    /* with the builtin exec, the positions where the splitter cannot
+       match are skipped */
+    re = js_get_builtin_exec_regexp(ctx, splitter);
     while (q < size) {
+        if (re) {
+            q1 = lre_find_start(re->bytecode->u.str8, strp->u.str8, q, size,
+                                strp->is_wide_char);
+            if (q1 < 0)
+                break;
+            q = q1;
+        }
         if (JS_SetProperty(ctx, splitter, JS_ATOM_lastIndex, JS_NewInt32(ctx, q)) < 0)
             goto exception;
         JS_FreeValue(ctx, z);    
@@ -41944,7 +44227,7 @@ static JSValue js_regexp_Symbol_split(JSContext *ctx, JSValueConst this_val,
             if (e == p) {
                 q = string_advance_index(strp, q, unicodeMatching);
             } else {
-                sub = js_sub_string(ctx, strp, p, q);
+                sub = js_sub_string_slice(ctx, strp, p, q);
                 if (JS_IsException(sub))
                     goto exception;
                 if (JS_SetPropertyInt64(ctx, A, lengthA++, sub) < 0)
@@ -41970,7 +44253,7 @@ static JSValue js_regexp_Symbol_split(JSContext *ctx, JSValueConst this_val,
 add_tail:
     if (p > size)
         p = size;
-    sub = js_sub_string(ctx, strp, p, size);
+    sub = js_sub_string_slice(ctx, strp, p, size);
     if (JS_IsException(sub))
         goto exception;
     if (JS_SetPropertyInt64(ctx, A, lengthA++, sub) < 0)
@@ -42049,134 +44332,585 @@ void JS_AddIntrinsicRegExp(JSContext *ctx)
 
 /* JSON */
 
-/* XXX: this parser is less strict than the JSON standard because we
-   reuse the Javascript tokenizer. It could be improved by adding a
-   specific JSON parse flag. */
-static JSValue json_parse_value(JSParseState *s)
+/* The JSON text is scanned by a dedicated parser: it follows the JSON
+   grammar strictly and builds the values directly. */
+
+#define JSON_KEY_CACHE_SIZE   32 /* must be a power of two */
+#define JSON_SIZE_HINT_DEPTH  8
+
+typedef struct JSONKeyCacheEntry {
+    JSAtom atom; /* JS_ATOM_NULL if the entry is unused */
+    /* last shape transition done when adding 'atom' to an object */
+    JSShape *shape_from;
+    JSShape *shape_to;
+} JSONKeyCacheEntry;
+
+typedef struct JSONParseState {
+    JSContext *ctx;
+    const char *filename;
+    int line_num;
+    const uint8_t *buf_ptr;
+    const uint8_t *buf_end;
+    /* property count of the last object parsed at each depth */
+    uint8_t size_hint[JSON_SIZE_HINT_DEPTH];
+    JSONKeyCacheEntry *key_cache; /* allocated with the first key */
+} JSONParseState;
+
+static void json_parse_init(JSContext *ctx, JSONParseState *s,
+                            const char *buf, size_t buf_len,
+                            const char *filename)
+{
+    memset(s, 0, sizeof(*s));
+    s->ctx = ctx;
+    s->filename = filename;
+    s->line_num = 1;
+    s->buf_ptr = (const uint8_t *)buf;
+    s->buf_end = s->buf_ptr + buf_len;
+}
+
+static void json_key_cache_entry_free(JSRuntime *rt, JSONKeyCacheEntry *ce)
+{
+    if (ce->atom != JS_ATOM_NULL) {
+        JS_FreeAtomRT(rt, ce->atom);
+        ce->atom = JS_ATOM_NULL;
+    }
+    if (ce->shape_from) {
+        js_free_shape(rt, ce->shape_from);
+        js_free_shape(rt, ce->shape_to);
+        ce->shape_from = NULL;
+        ce->shape_to = NULL;
+    }
+}
+
+static void json_parse_free(JSONParseState *s)
+{
+    JSRuntime *rt = s->ctx->rt;
+    int i;
+
+    if (s->key_cache) {
+        for(i = 0; i < JSON_KEY_CACHE_SIZE; i++)
+            json_key_cache_entry_free(rt, &s->key_cache[i]);
+        js_free_rt(rt, s->key_cache);
+        s->key_cache = NULL;
+    }
+}
+
+static int __attribute__((format(printf, 2, 3))) json_parse_error(JSONParseState *s, const char *fmt, ...)
 {
     JSContext *ctx = s->ctx;
-    JSValue val = JS_NULL;
-    BOOL is_neg;
+    va_list ap;
+
+    va_start(ap, fmt);
+    JS_ThrowError2(ctx, JS_SYNTAX_ERROR, fmt, ap, FALSE);
+    va_end(ap);
+    build_backtrace(ctx, ctx->rt->current_exception, s->filename, s->line_num,
+                    0);
+    return -1;
+}
+
+static int json_parse_unexpected(JSONParseState *s, int c)
+{
+    if (c < 0)
+        return json_parse_error(s, "unexpected end of input");
+    else if (c >= 0x20 && c < 0x7f)
+        return json_parse_error(s, "unexpected token: '%c'", c);
+    else
+        return json_parse_error(s, "unexpected character: 0x%02x", c);
+}
+
+/* skip white space, return the next character or -1 at the end */
+static int json_skip_ws(JSONParseState *s)
+{
+    const uint8_t *p = s->buf_ptr;
+    int c;
+
+    for(;;) {
+        if (p >= s->buf_end) {
+            c = -1;
+            break;
+        }
+        c = *p;
+        if (c == '\n') {
+            s->line_num++;
+        } else if (c != ' ' && c != '\t' && c != '\r') {
+            break;
+        }
+        p++;
+    }
+    s->buf_ptr = p;
+    return c;
+}
+
+typedef uintptr_t __attribute__((__may_alias__)) json_word_t;
+
+#define JSON_WORD_ONES   ((uintptr_t)-1 / 0xff)
+#define JSON_WORD_HIGHS  (JSON_WORD_ONES * 0x80)
+
+static inline BOOL json_is_plain_char(int c)
+{
+    return c >= 0x20 && c < 0x80 && c != '\"' && c != '\\';
+}
+
+/* Return the length of the prefix of [p, p_end) which is copied as
+   is to a string: it stops at '"', '\\', control and non-ASCII
+   characters. The characters are tested a word at a time. */
+static size_t json_plain_len(const uint8_t *p, const uint8_t *p_end)
+{
+    const uint8_t *p_start = p;
+    uintptr_t w, t, x;
+
+    while (p < p_end && ((uintptr_t)p & (sizeof(json_word_t) - 1)) != 0) {
+        if (!json_is_plain_char(*p))
+            return p - p_start;
+        p++;
+    }
+    while ((size_t)(p_end - p) >= sizeof(json_word_t)) {
+        w = *(const json_word_t *)p;
+        /* the high bit of a byte is set in 'x' if the byte is
+           '"', '\\', < 0x20 or >= 0x80 (only exact for the first
+           matching byte, which is enough here) */
+        t = w ^ (JSON_WORD_ONES * '\"');
+        x = (t - JSON_WORD_ONES) & ~t;
+        t = w ^ (JSON_WORD_ONES * '\\');
+        x |= (t - JSON_WORD_ONES) & ~t;
+        x |= (w - JSON_WORD_ONES * 0x20) & ~w;
+        x |= w;
+        if (x & JSON_WORD_HIGHS)
+            break;
+        p += sizeof(json_word_t);
+    }
+    while (p < p_end && json_is_plain_char(*p))
+        p++;
+    return p - p_start;
+}
+
+/* 's->buf_ptr' is after the opening quote */
+static JSValue json_parse_string(JSONParseState *s)
+{
+    JSContext *ctx = s->ctx;
+    const uint8_t *p, *p_end, *p_next;
+    StringBuffer b_s, *b = &b_s;
+    JSValue val;
+    size_t len;
+    uint32_t c;
+    int i, h;
+
+    p = s->buf_ptr;
+    p_end = s->buf_end;
+    len = json_plain_len(p, p_end);
+    if (likely(p + len < p_end && p[len] == '\"')) {
+        /* ASCII string without escape sequence */
+        s->buf_ptr = p + len + 1;
+        if (len > JS_STRING_LEN_MAX)
+            return JS_ThrowInternalError(ctx, "string too long");
+        val = js_new_string8(ctx, p, len);
+        if (!JS_IsException(val))
+            JS_VALUE_GET_STRING(val)->is_ascii = 1;
+        return val;
+    }
+    if (string_buffer_init(ctx, b, len + 16))
+        goto fail;
+    for(;;) {
+        if (string_buffer_write8(b, p, len))
+            goto fail;
+        p += len;
+        if (p >= p_end) {
+            json_parse_error(s, "unexpected end of string");
+            goto fail;
+        }
+        c = *p++;
+        if (c == '\"')
+            break;
+        if (c == '\\') {
+            if (p >= p_end) {
+                json_parse_error(s, "unexpected end of string");
+                goto fail;
+            }
+            c = *p++;
+            switch(c) {
+            case 'b':
+                c = '\b';
+                break;
+            case 'f':
+                c = '\f';
+                break;
+            case 'n':
+                c = '\n';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case '\"':
+            case '\\':
+            case '/':
+                break;
+            case 'u':
+                if (p_end - p < 4)
+                    goto bad_escape;
+                c = 0;
+                for(i = 0; i < 4; i++) {
+                    h = from_hex(p[i]);
+                    if (h < 0)
+                        goto bad_escape;
+                    c = (c << 4) | h;
+                }
+                p += 4;
+                break;
+            default:
+            bad_escape:
+                json_parse_error(s, "invalid escape sequence in string");
+                goto fail;
+            }
+        } else if (c >= 0x80) {
+            c = unicode_from_utf8(p - 1, p_end - p + 1, &p_next);
+            if (c > 0x10FFFF) {
+                json_parse_error(s, "invalid UTF-8 sequence");
+                goto fail;
+            }
+            p = p_next;
+        } else if (c < 0x20) {
+            json_parse_error(s, "invalid character in string");
+            goto fail;
+        }
+        if (string_buffer_putc(b, c))
+            goto fail;
+        len = json_plain_len(p, p_end);
+    }
+    s->buf_ptr = p;
+    return string_buffer_end(b);
+ fail:
+    string_buffer_free(b);
+    return JS_EXCEPTION;
+}
+
+/* Return the atom of a property name. 's->buf_ptr' is after the
+   opening quote. '*pcache_idx' is set to the key cache entry holding
+   the atom or to -1. */
+static JSAtom json_parse_key(JSONParseState *s, int *pcache_idx)
+{
+    JSContext *ctx = s->ctx;
+    JSONKeyCacheEntry *ce;
+    const uint8_t *p;
+    JSString *str;
+    JSValue val;
+    JSAtom atom;
+    size_t len, i;
+    uint32_t h;
+
+    *pcache_idx = -1;
+    p = s->buf_ptr;
+    len = json_plain_len(p, s->buf_end);
+    if (unlikely(p + len >= s->buf_end || p[len] != '\"')) {
+        /* escape sequences or non-ASCII characters */
+        val = json_parse_string(s);
+        if (JS_IsException(val))
+            return JS_ATOM_NULL;
+        return JS_NewAtomStr(ctx, JS_VALUE_GET_STRING(val));
+    }
+    s->buf_ptr = p + len + 1;
+    if (unlikely(!s->key_cache)) {
+        s->key_cache = js_mallocz_rt(ctx->rt, sizeof(s->key_cache[0]) *
+                                     JSON_KEY_CACHE_SIZE);
+        if (!s->key_cache)
+            return JS_NewAtomLen(ctx, (const char *)p, len);
+    }
+    h = len;
+    for(i = 0; i < len; i++)
+        h = h * 263 + p[i];
+    h = (h ^ (h >> 11)) & (JSON_KEY_CACHE_SIZE - 1);
+    ce = &s->key_cache[h];
+    if (ce->atom != JS_ATOM_NULL) {
+        /* the text may be gone, so the atom string is compared */
+        str = ctx->rt->atom_array[ce->atom];
+        if (str->len == len && !str->is_wide_char &&
+            !memcmp(str->u.str8, p, len)) {
+            *pcache_idx = h;
+            return JS_DupAtom(ctx, ce->atom);
+        }
+    }
+    atom = JS_NewAtomLen(ctx, (const char *)p, len);
+    if (atom == JS_ATOM_NULL || __JS_AtomIsTaggedInt(atom))
+        return atom;
+    json_key_cache_entry_free(ctx->rt, ce);
+    ce->atom = JS_DupAtom(ctx, atom);
+    *pcache_idx = h;
+    return atom;
+}
+
+/* Define the property 'atom' of the object being built. When the
+   previous object which got the same key had the same shape, the
+   new shape is taken from the key cache, so that records with the
+   same keys share their shapes without any lookup. */
+static int json_define_property(JSONParseState *s, JSValueConst obj,
+                                JSAtom atom, int cache_idx, JSValue val)
+{
+    JSContext *ctx = s->ctx;
+    JSObject *p = JS_VALUE_GET_OBJ(obj);
+    JSONKeyCacheEntry *ce;
+    JSShape *sh, *new_sh;
     int ret;
 
-    switch(s->token.val) {
+    ce = NULL;
+    /* the entry may have been reused by a nested object */
+    if (cache_idx >= 0 && s->key_cache[cache_idx].atom == atom)
+        ce = &s->key_cache[cache_idx];
+    sh = p->shape;
+    if (ce && ce->shape_from == sh) {
+        new_sh = ce->shape_to;
+        if (new_sh->prop_size != sh->prop_size) {
+            if (js_resize_object_prop(ctx, p, sh->prop_count,
+                                      new_sh->prop_size)) {
+                JS_FreeValue(ctx, val);
+                return -1;
+            }
+        }
+        p->shape = js_dup_shape(new_sh);
+        js_free_shape(ctx->rt, sh);
+        p->prop[new_sh->prop_count - 1].u.value = val;
+        return 0;
+    }
+    if (!ce || !sh->is_hashed)
+        return JS_DefinePropertyValue(ctx, obj, atom, val, JS_PROP_C_W_E);
+    /* the reference also prevents the shape from being modified in
+       place */
+    js_dup_shape(sh);
+    ret = JS_DefinePropertyValue(ctx, obj, atom, val, JS_PROP_C_W_E);
+    new_sh = p->shape;
+    if (ret >= 0 && new_sh->is_hashed &&
+        new_sh->prop_count == sh->prop_count + 1) {
+        if (ce->shape_from) {
+            js_free_shape(ctx->rt, ce->shape_from);
+            js_free_shape(ctx->rt, ce->shape_to);
+        }
+        ce->shape_from = sh;
+        ce->shape_to = js_dup_shape(new_sh);
+    } else {
+        js_free_shape(ctx->rt, sh);
+    }
+    return ret;
+}
+
+static JSValue json_parse_number(JSONParseState *s)
+{
+    JSContext *ctx = s->ctx;
+    const uint8_t *p, *p_start, *p_digits, *p_end;
+    BOOL is_neg, is_float;
+    int64_t v;
+    char buf1[64], *buf;
+    size_t len;
+    JSValue val;
+
+    p = p_start = s->buf_ptr;
+    p_end = s->buf_end;
+    is_neg = (*p == '-');
+    p += is_neg;
+    p_digits = p;
+    if (p >= p_end || !re_is_digit(*p))
+        goto invalid;
+    v = 0;
+    if (*p == '0') {
+        p++;
+    } else {
+        while (p < p_end && re_is_digit(*p)) {
+            if (p - p_digits < 15)
+                v = v * 10 + (*p - '0');
+            p++;
+        }
+    }
+    /* larger integers are converted by js_atof() */
+    is_float = (p - p_digits > 15);
+    if (p < p_end && *p == '.') {
+        p++;
+        if (p >= p_end || !re_is_digit(*p))
+            goto invalid;
+        while (p < p_end && re_is_digit(*p))
+            p++;
+        is_float = TRUE;
+    }
+    if (p < p_end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < p_end && (*p == '+' || *p == '-'))
+            p++;
+        if (p >= p_end || !re_is_digit(*p))
+            goto invalid;
+        while (p < p_end && re_is_digit(*p))
+            p++;
+        is_float = TRUE;
+    }
+    s->buf_ptr = p;
+    if (!is_float) {
+        if (!is_neg)
+            return JS_NewInt64(ctx, v);
+        if (v == 0)
+            return __JS_NewFloat64(ctx, -0.0);
+        return JS_NewInt64(ctx, -v);
+    }
+    /* the text is not necessarily null terminated */
+    len = p - p_start;
+    buf = buf1;
+    if (len >= sizeof(buf1)) {
+        buf = js_malloc(ctx, len + 1);
+        if (!buf)
+            return JS_EXCEPTION;
+    }
+    memcpy(buf, p_start, len);
+    buf[len] = '\0';
+    val = js_atof(ctx, buf, NULL, 10, 0);
+    if (buf != buf1)
+        js_free(ctx, buf);
+    return val;
+ invalid:
+    json_parse_error(s, "invalid number");
+    return JS_EXCEPTION;
+}
+
+static BOOL json_match(JSONParseState *s, const char *str, int len)
+{
+    if (s->buf_end - s->buf_ptr < len || memcmp(s->buf_ptr, str, len))
+        return FALSE;
+    s->buf_ptr += len;
+    return TRUE;
+}
+
+static JSValue json_parse_value(JSONParseState *s, int depth)
+{
+    JSContext *ctx = s->ctx;
+    JSValue val = JS_NULL;
+    int c, ret;
+
+    c = json_skip_ws(s);
+    switch(c) {
     case '{':
         {
-            JSValue prop_val, prop_str;
+            JSValue prop_val;
+            JSAtom atom;
+            int cache_idx;
 
-            if (next_token(s))
+            if (js_check_stack_overflow(ctx->rt, 0)) {
+                JS_ThrowStackOverflow(ctx);
                 goto fail;
-            val = JS_NewObject(ctx);
+            }
+            s->buf_ptr++;
+            val = js_new_object_size(ctx, depth < JSON_SIZE_HINT_DEPTH ?
+                                     s->size_hint[depth] : 0);
             if (JS_IsException(val))
                 goto fail;
-            if (s->token.val != '}') {
+            c = json_skip_ws(s);
+            if (c != '}') {
                 for(;;) {
-                    if (s->token.val != TOK_STRING) {
-                        js_parse_error(s, "expecting property name");
+                    if (c != '\"') {
+                        json_parse_error(s, "expecting property name");
                         goto fail;
                     }
-                    prop_str = JS_DupValue(ctx, s->token.u.str.str);
-                    if (next_token(s)) {
-                        JS_FreeValue(ctx, prop_str);
+                    s->buf_ptr++;
+                    atom = json_parse_key(s, &cache_idx);
+                    if (atom == JS_ATOM_NULL)
                         goto fail;
-                    }
-                    if (js_parse_expect(s, ':')) {
-                        JS_FreeValue(ctx, prop_str);
+                    if (json_skip_ws(s) != ':') {
+                        JS_FreeAtom(ctx, atom);
+                        json_parse_error(s, "expecting '%c'", ':');
                         goto fail;
                     }
-                    prop_val = json_parse_value(s);
+                    s->buf_ptr++;
+                    prop_val = json_parse_value(s, depth + 1);
                     if (JS_IsException(prop_val)) {
-                        JS_FreeValue(ctx, prop_str);
+                        JS_FreeAtom(ctx, atom);
                         goto fail;
                     }
-                    ret = JS_DefinePropertyValueValue(ctx, val, prop_str,
-                                                      prop_val, JS_PROP_C_W_E);
+                    ret = json_define_property(s, val, atom, cache_idx,
+                                               prop_val);
+                    JS_FreeAtom(ctx, atom);
                     if (ret < 0)
                         goto fail;
-
-                    if (s->token.val != ',')
+                    c = json_skip_ws(s);
+                    if (c != ',')
                         break;
-                    if (next_token(s))
-                        goto fail;
+                    s->buf_ptr++;
+                    c = json_skip_ws(s);
                 }
             }
-            if (js_parse_expect(s, '}'))
+            if (c != '}') {
+                json_parse_error(s, "expecting '%c'", '}');
                 goto fail;
+            }
+            s->buf_ptr++;
+            if (depth < JSON_SIZE_HINT_DEPTH) {
+                s->size_hint[depth] = min_int(JS_VALUE_GET_OBJ(val)->shape->prop_count,
+                                              UINT8_MAX);
+            }
         }
         break;
     case '[':
         {
             JSValue el;
+            JSObject *p;
             uint32_t idx;
 
-            if (next_token(s))
+            if (js_check_stack_overflow(ctx->rt, 0)) {
+                JS_ThrowStackOverflow(ctx);
                 goto fail;
+            }
+            s->buf_ptr++;
             val = JS_NewArray(ctx);
             if (JS_IsException(val))
                 goto fail;
-            if (s->token.val != ']') {
+            p = JS_VALUE_GET_OBJ(val);
+            c = json_skip_ws(s);
+            if (c != ']') {
                 idx = 0;
                 for(;;) {
-                    el = json_parse_value(s);
+                    el = json_parse_value(s, depth + 1);
                     if (JS_IsException(el))
                         goto fail;
-                    ret = JS_DefinePropertyValueUint32(ctx, val, idx, el, JS_PROP_C_W_E);
+                    if (likely(p->fast_array && idx == p->u.array.count))
+                        ret = add_fast_array_element(ctx, p, el, 0);
+                    else
+                        ret = JS_DefinePropertyValueUint32(ctx, val, idx, el,
+                                                           JS_PROP_C_W_E);
                     if (ret < 0)
                         goto fail;
-                    if (s->token.val != ',')
+                    c = json_skip_ws(s);
+                    if (c != ',')
                         break;
-                    if (next_token(s))
-                        goto fail;
+                    s->buf_ptr++;
                     idx++;
                 }
             }
-            if (js_parse_expect(s, ']'))
+            if (c != ']') {
+                json_parse_error(s, "expecting '%c'", ']');
                 goto fail;
+            }
+            s->buf_ptr++;
         }
         break;
-    case TOK_STRING:
-        val = JS_DupValue(ctx, s->token.u.str.str);
-        if (next_token(s))
-            goto fail;
+    case '\"':
+        s->buf_ptr++;
+        val = json_parse_string(s);
         break;
-    case TOK_NUMBER:
-        is_neg = 0;
-        goto number;
     case '-':
-        if (next_token(s))
-            goto fail;
-        if (s->token.val != TOK_NUMBER) {
-            js_parse_error(s, "number expected");
-            goto fail;
-        }
-        is_neg = 1;
-    number:
-        val = s->token.u.num.val;
-        if (is_neg) {
-            double d;
-            JS_ToFloat64(ctx, &d, val);  /* no exception possible */
-            val = JS_NewFloat64(ctx, -d);
-        }
-        if (next_token(s))
-            goto fail;
+    case '0' ... '9':
+        val = json_parse_number(s);
         break;
-    case TOK_FALSE:
-    case TOK_TRUE:
-        val = JS_NewBool(ctx, s->token.val - TOK_FALSE);
-        if (next_token(s))
-            goto fail;
+    case 't':
+        if (!json_match(s, "true", 4))
+            goto unexpected;
+        val = JS_TRUE;
         break;
-    case TOK_NULL:
-        if (next_token(s))
-            goto fail;
+    case 'f':
+        if (!json_match(s, "false", 5))
+            goto unexpected;
+        val = JS_FALSE;
+        break;
+    case 'n':
+        if (!json_match(s, "null", 4))
+            goto unexpected;
         break;
     default:
-        if (s->token.val == TOK_EOF) {
-            js_parse_error(s, "unexpected end of input");
-        } else {
-            js_parse_error(s, "unexpected token: '%.*s'",
-                           (int)(s->buf_ptr - s->token.ptr), s->token.ptr);
-        }
+    unexpected:
+        json_parse_unexpected(s, c);
         goto fail;
     }
     return val;
@@ -42188,24 +44922,481 @@ static JSValue json_parse_value(JSParseState *s)
 JSValue JS_ParseJSON(JSContext *ctx, const char *buf, size_t buf_len,
                      const char *filename)
 {
-    JSParseState s1, *s = &s1;
+    JSONParseState s1, *s = &s1;
     JSValue val;
+    int c;
+
+    json_parse_init(ctx, s, buf, buf_len, filename);
+    val = json_parse_value(s, 0);
+    if (!JS_IsException(val)) {
+        c = json_skip_ws(s);
+        if (c >= 0) {
+            json_parse_error(s, "unexpected data at the end");
+            JS_FreeValue(ctx, val);
+            val = JS_EXCEPTION;
+        }
+    }
+    json_parse_free(s);
+    return val;
+}
 
-    js_parse_init(ctx, s, buf, buf_len, filename);
+/* Incremental JSON parser: the text is given in chunks of any size and
+   the containers are built on an explicit stack as their members
+   arrive, so only the token crossing a chunk boundary is buffered.
+   Each complete top level value is passed to the 'func' callback;
+   several values may follow each other, optionally separated by white
+   space (e.g. one value per line). */
 
-    if (next_token(s))
-        goto fail;
-    val = json_parse_value(s);
+typedef enum {
+    JSON_STREAM_VALUE,       /* a value */
+    JSON_STREAM_FIRST_VALUE, /* after '[': a value or ']' */
+    JSON_STREAM_FIRST_KEY,   /* after '{': a property name or '}' */
+    JSON_STREAM_KEY,         /* a property name */
+    JSON_STREAM_COLON,       /* ':' */
+    JSON_STREAM_NEXT,        /* ',' or the end of the container */
+} JSONStreamStateEnum;
+
+typedef struct JSONStreamFrame {
+    JSValue obj; /* array or object being built */
+    JSAtom key; /* property name waiting for its value */
+    int key_cache_idx;
+} JSONStreamFrame;
+
+struct JSJSONParser {
+    JSONParseState s; /* the key cache and the current chunk */
+    JSJSONValueFunc *func;
+    void *opaque;
+    uint8_t state; /* JSONStreamStateEnum */
+    uint8_t token_type; /* 0 if none, otherwise first character */
+    BOOL escape; /* the token ends with an unfinished escape */
+    DynBuf token; /* token crossing a chunk boundary */
+    JSONStreamFrame *stack;
+    int stack_len;
+    int stack_size;
+};
+
+JSJSONParser *JS_NewJSONParser(JSContext *ctx, JSJSONValueFunc *func,
+                               void *opaque)
+{
+    JSJSONParser *jp;
+
+    jp = js_mallocz(ctx, sizeof(*jp));
+    if (!jp)
+        return NULL;
+    json_parse_init(ctx, &jp->s, NULL, 0, "<input>");
+    jp->func = func;
+    jp->opaque = opaque;
+    jp->state = JSON_STREAM_VALUE;
+    js_dbuf_init(ctx, &jp->token);
+    return jp;
+}
+
+/* drop the value being parsed */
+void JS_ResetJSONParser(JSJSONParser *jp)
+{
+    JSContext *ctx = jp->s.ctx;
+    JSONStreamFrame *f;
+
+    while (jp->stack_len > 0) {
+        f = &jp->stack[--jp->stack_len];
+        JS_FreeValue(ctx, f->obj);
+        JS_FreeAtom(ctx, f->key);
+    }
+    jp->state = JSON_STREAM_VALUE;
+    jp->token_type = 0;
+    jp->escape = FALSE;
+    jp->token.size = 0;
+}
+
+/* must be called by the gc_mark function of the object holding the
+   parser */
+void JS_MarkJSONParser(JSRuntime *rt, JSJSONParser *jp,
+                       JS_MarkFunc *mark_func)
+{
+    JSONKeyCacheEntry *ce;
+    int i;
+
+    for(i = 0; i < jp->stack_len; i++)
+        JS_MarkValue(rt, jp->stack[i].obj, mark_func);
+    if (jp->s.key_cache) {
+        for(i = 0; i < JSON_KEY_CACHE_SIZE; i++) {
+            ce = &jp->s.key_cache[i];
+            if (ce->shape_from) {
+                mark_func(rt, &ce->shape_from->header);
+                mark_func(rt, &ce->shape_to->header);
+            }
+        }
+    }
+}
+
+void JS_FreeJSONParser(JSJSONParser *jp)
+{
+    JSContext *ctx;
+
+    if (!jp)
+        return;
+    ctx = jp->s.ctx;
+    JS_ResetJSONParser(jp);
+    json_parse_free(&jp->s);
+    dbuf_free(&jp->token);
+    js_free(ctx, jp->stack);
+    js_free(ctx, jp);
+}
+
+/* return a pointer to the closing quote of a string or NULL if it is
+   not in [p, p_end). 'pescape' tells if 'p' follows a backslash. */
+static const uint8_t *json_find_string_end(const uint8_t *p,
+                                           const uint8_t *p_end,
+                                           BOOL *pescape)
+{
+    if (*pescape) {
+        if (p >= p_end)
+            return NULL;
+        p++;
+        *pescape = FALSE;
+    }
+    for(;;) {
+        p += json_plain_len(p, p_end);
+        if (p >= p_end)
+            return NULL;
+        if (*p == '\"')
+            return p;
+        if (*p == '\\') {
+            if (++p >= p_end) {
+                *pescape = TRUE;
+                return NULL;
+            }
+        }
+        p++;
+    }
+}
+
+static BOOL json_is_number_char(int c)
+{
+    return re_is_digit(c) || c == '-' || c == '+' || c == '.' ||
+        c == 'e' || c == 'E';
+}
+
+/* return the end of the number or literal token starting at 'p' */
+static const uint8_t *json_find_token_end(const uint8_t *p,
+                                          const uint8_t *p_end, int type)
+{
+    if (type == '0') {
+        while (p < p_end && json_is_number_char(*p))
+            p++;
+    } else {
+        while (p < p_end && *p >= 'a' && *p <= 'z')
+            p++;
+    }
+    return p;
+}
+
+static int json_stream_push(JSJSONParser *jp, JSValue obj)
+{
+    JSONStreamFrame *f;
+
+    if (js_resize_array(jp->s.ctx, (void **)&jp->stack, sizeof(jp->stack[0]),
+                        &jp->stack_size, &jp->stack_len, jp->stack_len + 1)) {
+        JS_FreeValue(jp->s.ctx, obj);
+        return -1;
+    }
+    f = &jp->stack[jp->stack_len - 1];
+    f->obj = obj;
+    f->key = JS_ATOM_NULL;
+    f->key_cache_idx = -1;
+    return 0;
+}
+
+/* store a complete value in its container or pass it to the callback */
+static int json_stream_add_value(JSJSONParser *jp, JSValue val)
+{
+    JSContext *ctx = jp->s.ctx;
+    JSONStreamFrame *f;
+    JSObject *p;
+    int ret;
+
+    if (jp->stack_len == 0) {
+        jp->state = JSON_STREAM_VALUE;
+        return jp->func(ctx, val, jp->opaque);
+    }
+    f = &jp->stack[jp->stack_len - 1];
+    p = JS_VALUE_GET_OBJ(f->obj);
+    if (p->class_id == JS_CLASS_ARRAY) {
+        if (likely(p->fast_array))
+            ret = add_fast_array_element(ctx, p, val, 0);
+        else
+            ret = JS_DefinePropertyValueInt64(ctx, f->obj, p->u.array.count,
+                                              val, JS_PROP_C_W_E);
+    } else {
+        ret = json_define_property(&jp->s, f->obj, f->key, f->key_cache_idx,
+                                   val);
+        JS_FreeAtom(ctx, f->key);
+        f->key = JS_ATOM_NULL;
+    }
+    if (ret < 0)
+        return -1;
+    jp->state = JSON_STREAM_NEXT;
+    return 0;
+}
+
+static int json_stream_close(JSJSONParser *jp, int c)
+{
+    JSONStreamFrame *f;
+    JSObject *p;
+    JSValue obj;
+    int depth;
+
+    f = &jp->stack[jp->stack_len - 1];
+    p = JS_VALUE_GET_OBJ(f->obj);
+    if ((c == ']') != (p->class_id == JS_CLASS_ARRAY))
+        return json_parse_unexpected(&jp->s, c);
+    jp->s.buf_ptr++;
+    obj = f->obj;
+    depth = --jp->stack_len;
+    if (c == '}' && depth < JSON_SIZE_HINT_DEPTH)
+        jp->s.size_hint[depth] = min_int(p->shape->prop_count, UINT8_MAX);
+    return json_stream_add_value(jp, obj);
+}
+
+/* parse a complete string, number or literal token of type 'type' in
+   [s->buf_ptr, s->buf_end) */
+static int json_stream_token(JSJSONParser *jp, int type)
+{
+    JSONParseState *s = &jp->s;
+    JSONStreamFrame *f;
+    const uint8_t *p;
+    JSValue val;
+    size_t len;
+
+    if (type == '\"') {
+        s->buf_ptr++;
+        if (jp->state == JSON_STREAM_KEY ||
+            jp->state == JSON_STREAM_FIRST_KEY) {
+            f = &jp->stack[jp->stack_len - 1];
+            f->key = json_parse_key(s, &f->key_cache_idx);
+            if (f->key == JS_ATOM_NULL)
+                return -1;
+            jp->state = JSON_STREAM_COLON;
+            return 0;
+        }
+        val = json_parse_string(s);
+    } else if (type == '0') {
+        val = json_parse_number(s);
+    } else {
+        p = s->buf_ptr;
+        len = json_find_token_end(p, s->buf_end, type) - p;
+        if (len == 4 && !memcmp(p, "true", 4)) {
+            val = JS_TRUE;
+        } else if (len == 5 && !memcmp(p, "false", 5)) {
+            val = JS_FALSE;
+        } else if (len == 4 && !memcmp(p, "null", 4)) {
+            val = JS_NULL;
+        } else {
+            return json_parse_unexpected(s, *p);
+        }
+        s->buf_ptr = p + len;
+    }
     if (JS_IsException(val))
+        return -1;
+    return json_stream_add_value(jp, val);
+}
+
+/* parse the token of the previous chunks once its end is found */
+static int json_stream_continue_token(JSJSONParser *jp)
+{
+    JSONParseState *s = &jp->s;
+    const uint8_t *p, *p_end, *chunk_end;
+    int type = jp->token_type;
+    int ret;
+
+    p = s->buf_ptr;
+    chunk_end = s->buf_end;
+    if (type == '\"') {
+        p_end = json_find_string_end(p, chunk_end, &jp->escape);
+        if (p_end)
+            p_end++;
+    } else {
+        p_end = json_find_token_end(p, chunk_end, type);
+        if (p_end == chunk_end)
+            p_end = NULL;
+    }
+    if (dbuf_put(&jp->token, p, (p_end ? p_end : chunk_end) - p))
         goto fail;
-    if (s->token.val != TOK_EOF) {
-        if (js_parse_error(s, "unexpected data at the end"))
-            goto fail;
+    if (!p_end) {
+        s->buf_ptr = chunk_end;
+        return 0;
     }
-    return val;
+    jp->token_type = 0;
+    s->buf_ptr = jp->token.buf;
+    s->buf_end = jp->token.buf + jp->token.size;
+    ret = json_stream_token(jp, type);
+    if (ret == 0 && json_skip_ws(s) >= 0)
+        ret = json_parse_unexpected(s, *s->buf_ptr);
+    jp->token.size = 0;
+    s->buf_ptr = p_end;
+    s->buf_end = chunk_end;
+    return ret;
  fail:
-    free_token(s, &s->token);
-    return JS_EXCEPTION;
+    JS_ThrowOutOfMemory(s->ctx);
+    return -1;
+}
+
+/* start a token: it is parsed in place if it ends in the chunk */
+static int json_stream_start_token(JSJSONParser *jp, int type)
+{
+    JSONParseState *s = &jp->s;
+    const uint8_t *p = s->buf_ptr, *p_end;
+
+    if (type == '\"') {
+        jp->escape = FALSE;
+        p_end = json_find_string_end(p + 1, s->buf_end, &jp->escape);
+    } else {
+        p_end = json_find_token_end(p, s->buf_end, type);
+        if (p_end == s->buf_end)
+            p_end = NULL;
+    }
+    if (p_end)
+        return json_stream_token(jp, type);
+    jp->token_type = type;
+    jp->token.size = 0;
+    if (dbuf_put(&jp->token, p, s->buf_end - p)) {
+        JS_ThrowOutOfMemory(s->ctx);
+        return -1;
+    }
+    s->buf_ptr = s->buf_end;
+    return 0;
+}
+
+static int json_stream_parse(JSJSONParser *jp)
+{
+    JSONParseState *s = &jp->s;
+    JSContext *ctx = s->ctx;
+    JSValue obj;
+    int c, depth;
+
+    if (jp->token_type && json_stream_continue_token(jp))
+        return -1;
+    for(;;) {
+        c = json_skip_ws(s);
+        if (c < 0)
+            break;
+        switch(jp->state) {
+        case JSON_STREAM_FIRST_VALUE:
+            if (c == ']') {
+                if (json_stream_close(jp, c))
+                    return -1;
+                break;
+            }
+            /* fall thru */
+        case JSON_STREAM_VALUE:
+            switch(c) {
+            case '{':
+                depth = jp->stack_len;
+                obj = js_new_object_size(ctx, depth < JSON_SIZE_HINT_DEPTH ?
+                                         s->size_hint[depth] : 0);
+                if (JS_IsException(obj) || json_stream_push(jp, obj))
+                    return -1;
+                s->buf_ptr++;
+                jp->state = JSON_STREAM_FIRST_KEY;
+                break;
+            case '[':
+                obj = JS_NewArray(ctx);
+                if (JS_IsException(obj) || json_stream_push(jp, obj))
+                    return -1;
+                s->buf_ptr++;
+                jp->state = JSON_STREAM_FIRST_VALUE;
+                break;
+            case '\"':
+                if (json_stream_start_token(jp, c))
+                    return -1;
+                break;
+            case '-':
+            case '0' ... '9':
+                if (json_stream_start_token(jp, '0'))
+                    return -1;
+                break;
+            case 't':
+            case 'f':
+            case 'n':
+                if (json_stream_start_token(jp, 'a'))
+                    return -1;
+                break;
+            default:
+                return json_parse_unexpected(s, c);
+            }
+            break;
+        case JSON_STREAM_FIRST_KEY:
+            if (c == '}') {
+                if (json_stream_close(jp, c))
+                    return -1;
+                break;
+            }
+            /* fall thru */
+        case JSON_STREAM_KEY:
+            if (c != '\"')
+                return json_parse_error(s, "expecting property name");
+            if (json_stream_start_token(jp, c))
+                return -1;
+            break;
+        case JSON_STREAM_COLON:
+            if (c != ':')
+                return json_parse_error(s, "expecting '%c'", ':');
+            s->buf_ptr++;
+            jp->state = JSON_STREAM_VALUE;
+            break;
+        case JSON_STREAM_NEXT:
+            if (c == ',') {
+                s->buf_ptr++;
+                if (JS_VALUE_GET_OBJ(jp->stack[jp->stack_len - 1].obj)->class_id == JS_CLASS_ARRAY)
+                    jp->state = JSON_STREAM_VALUE;
+                else
+                    jp->state = JSON_STREAM_KEY;
+            } else if (c == ']' || c == '}') {
+                if (json_stream_close(jp, c))
+                    return -1;
+            } else {
+                return json_parse_unexpected(s, c);
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+/* Parse the next chunk of text. Return -1 if exception, in which case
+   the value being parsed is dropped. */
+int JS_JSONParserFeed(JSJSONParser *jp, const char *buf, size_t len)
+{
+    jp->s.buf_ptr = (const uint8_t *)buf;
+    jp->s.buf_end = jp->s.buf_ptr + len;
+    if (json_stream_parse(jp)) {
+        JS_ResetJSONParser(jp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Signal the end of the text: a pending top level number or literal is
+   completed. Return -1 if a value is incomplete. */
+int JS_JSONParserEnd(JSJSONParser *jp)
+{
+    JSONParseState *s = &jp->s;
+    int type = jp->token_type;
+    int ret;
+
+    ret = 0;
+    if (type == '0' || type == 'a') {
+        jp->token_type = 0;
+        s->buf_ptr = jp->token.buf;
+        s->buf_end = jp->token.buf + jp->token.size;
+        ret = json_stream_token(jp, type);
+        if (ret == 0 && json_skip_ws(s) >= 0)
+            ret = json_parse_unexpected(s, *s->buf_ptr);
+    }
+    if (ret == 0 && (jp->token_type || jp->stack_len > 0))
+        ret = json_parse_error(s, "unexpected end of input");
+    JS_ResetJSONParser(jp);
+    return ret;
 }
 
 static JSValue internalize_json_property(JSContext *ctx, JSValueConst holder,
@@ -42311,13 +45502,61 @@ static JSValue js_json_parse(JSContext *ctx, JSValueConst this_val,
     return obj;
 }
 
+/* the UTF-8 output of JS_JSONStringifyWrite() is passed to the write
+   function in chunks of about this size */
+#define JSON_WRITE_BUF_SIZE 1024
+/* maximum number of object shapes whose keys are cached during a
+   JSON.stringify() call */
+#define JSON_SHAPE_CACHE_MAX 1024
+
+/* quoted keys of the properties of a plain object shape */
+typedef struct JSONShapeKeys {
+    JSShape *sh; /* reference to the shape */
+    /* for each shape property: its quoted name or JS_UNDEFINED if the
+       property is not serialized */
+    JSValue *keys;
+} JSONShapeKeys;
+
+typedef enum {
+    JSON_FRAME_ARRAY,
+    JSON_FRAME_SHAPE, /* plain object serialized with its shape keys */
+    JSON_FRAME_OBJECT,
+} JSONFrameKindEnum;
+
+/* an array or object being serialized. The frames are kept in the
+   JSONStringifyContext instead of the C stack so that the nesting
+   depth is only limited by the memory. */
+typedef struct JSONStringifyFrame {
+    JSValue val;
+    JSValue indent; /* indentation of the closing bracket */
+    JSValue indent1; /* indentation of the members */
+    JSValue tab; /* JSON_FRAME_OBJECT: keys to serialize */
+    JSONShapeKeys *sk; /* JSON_FRAME_SHAPE */
+    int64_t i, len; /* next member and number of members */
+    JSONFrameKindEnum kind;
+    BOOL has_content;
+} JSONStringifyFrame;
+
 typedef struct JSONStringifyContext {
     JSValueConst replacer_func;
-    JSValue stack;
     JSValue property_list;
     JSValue gap;
     JSValue empty;
+    BOOL has_gap;
+    /* objects being serialized, also used to detect cycles */
+    JSONStringifyFrame *stack;
+    int stack_len;
+    int stack_size;
+    /* hash table of JSONShapeKeys indexed by shape address */
+    JSONShapeKeys **shape_keys;
+    int shape_keys_count;
+    int shape_keys_size; /* power of two or 0 */
+    /* output: either a string buffer or UTF-8 chunks passed to
+       write_func */
     StringBuffer *b;
+    DynBuf dbuf;
+    JSJSONWriteFunc *write_func;
+    void *opaque;
 } JSONStringifyContext;
 
 static JSValue JS_ToQuotedStringFree(JSContext *ctx, JSValue val) {
@@ -42326,13 +45565,278 @@ static JSValue JS_ToQuotedStringFree(JSContext *ctx, JSValue val) {
     return r;
 }
 
+static void json_stringify_init(JSContext *ctx, JSONStringifyContext *jsc)
+{
+    jsc->replacer_func = JS_UNDEFINED;
+    jsc->property_list = JS_UNDEFINED;
+    jsc->gap = JS_UNDEFINED;
+    jsc->empty = JS_AtomToString(ctx, JS_ATOM_empty_string);
+    jsc->has_gap = FALSE;
+    jsc->stack = NULL;
+    jsc->stack_len = 0;
+    jsc->stack_size = 0;
+    jsc->shape_keys = NULL;
+    jsc->shape_keys_count = 0;
+    jsc->shape_keys_size = 0;
+    jsc->b = NULL;
+    js_dbuf_init(ctx, &jsc->dbuf);
+    jsc->write_func = NULL;
+    jsc->opaque = NULL;
+}
+
+static void json_stringify_free(JSContext *ctx, JSONStringifyContext *jsc)
+{
+    JSONShapeKeys *sk;
+    int i, j;
+
+    for(i = 0; i < jsc->shape_keys_size; i++) {
+        sk = jsc->shape_keys[i];
+        if (!sk)
+            continue;
+        for(j = 0; j < sk->sh->prop_count; j++)
+            JS_FreeValue(ctx, sk->keys[j]);
+        js_free_shape(ctx->rt, sk->sh);
+        js_free(ctx, sk);
+    }
+    js_free(ctx, jsc->shape_keys);
+    js_free(ctx, jsc->stack);
+    dbuf_free(&jsc->dbuf);
+    JS_FreeValue(ctx, jsc->empty);
+    JS_FreeValue(ctx, jsc->gap);
+    JS_FreeValue(ctx, jsc->property_list);
+}
+
+static int json_flush(JSContext *ctx, JSONStringifyContext *jsc)
+{
+    if (jsc->dbuf.error) {
+        JS_ThrowOutOfMemory(ctx);
+        return -1;
+    }
+    if (jsc->dbuf.size != 0) {
+        if (jsc->write_func(ctx, jsc->opaque, jsc->dbuf.buf, jsc->dbuf.size))
+            return -1;
+        jsc->dbuf.size = 0;
+    }
+    return 0;
+}
+
+/* 'c' must be an ASCII character */
+static int json_putc(JSONStringifyContext *jsc, int c)
+{
+    if (jsc->b)
+        return string_buffer_putc8(jsc->b, c);
+    else
+        return dbuf_putc(&jsc->dbuf, c);
+}
+
+/* 'str' must be ASCII */
+static int json_puts(JSONStringifyContext *jsc, const char *str)
+{
+    if (jsc->b)
+        return string_buffer_puts8(jsc->b, str);
+    else
+        return dbuf_putstr(&jsc->dbuf, str);
+}
+
+static int json_put_chars(JSONStringifyContext *jsc, const JSString *p,
+                          uint32_t start, uint32_t len)
+{
+    DynBuf *s = &jsc->dbuf;
+    const uint16_t *src;
+    uint32_t c, c1, i;
+
+    if (jsc->b)
+        return string_buffer_concat(jsc->b, p, start, start + len);
+    if (!p->is_wide_char) {
+        if (dbuf_realloc(s, s->size + 2 * len))
+            return -1;
+        s->size += latin1_to_utf8(s->buf + s->size, p->u.str8 + start, len);
+        return 0;
+    }
+    /* unpaired surrogates are encoded as in JS_ToCString() */
+    if (dbuf_realloc(s, s->size + 3 * len))
+        return -1;
+    src = p->u.str16 + start;
+    for(i = 0; i < len; i++) {
+        c = src[i];
+        if (c < 0x80) {
+            s->buf[s->size++] = c;
+            continue;
+        }
+        if (c >= 0xd800 && c < 0xdc00 && i + 1 < len) {
+            c1 = src[i + 1];
+            if (c1 >= 0xdc00 && c1 < 0xe000) {
+                c = (((c & 0x3ff) << 10) | (c1 & 0x3ff)) + 0x10000;
+                i++;
+            }
+        }
+        s->size += unicode_to_utf8(s->buf + s->size, c);
+    }
+    return 0;
+}
+
+/* 'val' must be a string or a string rope */
+static int json_put_value(JSONStringifyContext *jsc, JSValueConst val)
+{
+    JSStringRopeIter it;
+    JSString *p;
+
+    js_string_rope_iter_init(&it, val);
+    while ((p = js_string_rope_iter_next(&it)) != NULL) {
+        if (json_put_chars(jsc, p, it.start, it.len))
+            return -1;
+    }
+    return 0;
+}
+
+static int json_put_escape(JSONStringifyContext *jsc, uint32_t c)
+{
+    char buf[8];
+
+    switch(c) {
+    case '\t':
+        c = 't';
+        break;
+    case '\r':
+        c = 'r';
+        break;
+    case '\n':
+        c = 'n';
+        break;
+    case '\b':
+        c = 'b';
+        break;
+    case '\f':
+        c = 'f';
+        break;
+    case '\"':
+    case '\\':
+        break;
+    default:
+        stbsp_snprintf(buf, sizeof(buf), "\\u%04x", c);
+        return json_puts(jsc, buf);
+    }
+    buf[0] = '\\';
+    buf[1] = c;
+    buf[2] = '\0';
+    return json_puts(jsc, buf);
+}
+
+/* same escapes as JS_ToQuotedString() without the quotes. The
+   characters which need no escape are copied in runs. */
+static int json_put_quoted_chars(JSONStringifyContext *jsc, const JSString *p,
+                                 uint32_t start, uint32_t len)
+{
+    uint32_t i, end, run, c, c1;
+
+    end = start + len;
+    i = start;
+    if (!p->is_wide_char) {
+        const uint8_t *str = p->u.str8;
+        while (i < end) {
+            run = i;
+            while (i < end && str[i] >= 32 && str[i] != '\"' && str[i] != '\\')
+                i++;
+            if (i > run && json_put_chars(jsc, p, run, i - run))
+                return -1;
+            if (i < end && json_put_escape(jsc, str[i++]))
+                return -1;
+        }
+    } else {
+        const uint16_t *str = p->u.str16;
+        while (i < end) {
+            run = i;
+            while (i < end) {
+                c = str[i];
+                if (c < 32 || c == '\"' || c == '\\')
+                    break;
+                if (c >= 0xd800 && c < 0xe000) {
+                    if (c >= 0xdc00 || i + 1 >= end)
+                        break;
+                    c1 = str[i + 1];
+                    if (c1 < 0xdc00 || c1 >= 0xe000)
+                        break;
+                    i++;
+                }
+                i++;
+            }
+            if (i > run && json_put_chars(jsc, p, run, i - run))
+                return -1;
+            if (i < end && json_put_escape(jsc, str[i++]))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/* 'val' must be a string or a string rope */
+static int json_put_quoted(JSContext *ctx, JSONStringifyContext *jsc,
+                           JSValueConst val)
+{
+    JSStringRopeIter it;
+    JSString *p;
+
+    if (json_putc(jsc, '\"'))
+        return -1;
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE &&
+        js_string_value_is_wide_char(val)) {
+        /* a surrogate pair may be split between two leaves */
+        p = js_string_rope_get_flat(ctx, val);
+        if (!p)
+            return -1;
+        if (json_put_quoted_chars(jsc, p, 0, p->len))
+            return -1;
+    } else {
+        js_string_rope_iter_init(&it, val);
+        while ((p = js_string_rope_iter_next(&it)) != NULL) {
+            if (json_put_quoted_chars(jsc, p, it.start, it.len))
+                return -1;
+        }
+    }
+    return json_putc(jsc, '\"');
+}
+
+static int json_put_number(JSONStringifyContext *jsc, JSValueConst val)
+{
+    char buf[JS_DTOA_BUF_SIZE];
+    double d;
+
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_INT) {
+        stbsp_snprintf(buf, sizeof(buf), "%d", JS_VALUE_GET_INT(val));
+    } else {
+        d = JS_VALUE_GET_FLOAT64(val);
+        if (!isfinite(d))
+            return json_puts(jsc, "null");
+        js_dtoa1(buf, d, 10, 0, JS_DTOA_VAR_FORMAT);
+    }
+    return json_puts(jsc, buf);
+}
+
+/* Return FALSE if 'toJSON' is known to be absent from 'p' and its
+   prototypes so that the property lookup can be skipped. */
+static BOOL js_json_may_have_to_json(JSObject *p)
+{
+    JSProperty *pr;
+
+    while (p) {
+        if (p->is_exotic && p->class_id != JS_CLASS_ARRAY)
+            return TRUE;
+        if (find_own_property(&pr, p, JS_ATOM_toJSON))
+            return TRUE;
+        p = p->shape->proto;
+    }
+    return FALSE;
+}
+
+/* 'key' is only converted to a string when it is passed to a function */
 static JSValue js_json_check(JSContext *ctx, JSONStringifyContext *jsc,
-                             JSValueConst holder, JSValue val, JSValueConst key)
+                             JSValueConst holder, JSValue val, JSAtom key)
 {
-    JSValue v;
+    JSValue v, key_str;
     JSValueConst args[2];
 
-    if (JS_IsObject(val)
+    if ((JS_IsObject(val) &&
+         js_json_may_have_to_json(JS_VALUE_GET_OBJ(val)))
 #ifdef CONFIG_BIGNUM
     ||  JS_IsBigInt(ctx, val)   /* XXX: probably useless */
 #endif
@@ -42341,7 +45845,13 @@ static JSValue js_json_check(JSContext *ctx, JSONStringifyContext *jsc,
             if (JS_IsException(f))
                 goto exception;
             if (JS_IsFunction(ctx, f)) {
-                v = JS_CallFree(ctx, f, val, 1, &key);
+                key_str = JS_AtomToString(ctx, key);
+                if (JS_IsException(key_str)) {
+                    JS_FreeValue(ctx, f);
+                    goto exception;
+                }
+                v = JS_CallFree(ctx, f, val, 1, (JSValueConst *)&key_str);
+                JS_FreeValue(ctx, key_str);
                 JS_FreeValue(ctx, val);
                 val = v;
                 if (JS_IsException(val))
@@ -42352,9 +45862,13 @@ static JSValue js_json_check(JSContext *ctx, JSONStringifyContext *jsc,
         }
 
     if (!JS_IsUndefined(jsc->replacer_func)) {
-        args[0] = key;
+        key_str = JS_AtomToString(ctx, key);
+        if (JS_IsException(key_str))
+            goto exception;
+        args[0] = key_str;
         args[1] = val;
         v = JS_Call(ctx, jsc->replacer_func, holder, 2, args);
+        JS_FreeValue(ctx, key_str);
         JS_FreeValue(ctx, val);
         val = v;
         if (JS_IsException(val))
@@ -42366,6 +45880,7 @@ static JSValue js_json_check(JSContext *ctx, JSONStringifyContext *jsc,
         if (JS_IsFunction(ctx, val))
             break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
     case JS_TAG_INT:
     case JS_TAG_FLOAT64:
 #ifdef CONFIG_BIGNUM
@@ -42389,21 +45904,154 @@ exception:
     return JS_EXCEPTION;
 }
 
-static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
-                          JSValueConst holder, JSValue val,
-                          JSValueConst indent)
+static inline uint32_t json_shape_hash(JSShape *sh)
+{
+    return (uint32_t)(((uintptr_t)sh >> 4) * 0x9e3779b1);
+}
+
+static int json_shape_keys_resize(JSContext *ctx, JSONStringifyContext *jsc)
+{
+    JSONShapeKeys **tab;
+    int i, size, h;
+
+    size = max_int(jsc->shape_keys_size * 2, 16);
+    tab = js_mallocz(ctx, sizeof(tab[0]) * size);
+    if (!tab)
+        return -1;
+    for(i = 0; i < jsc->shape_keys_size; i++) {
+        if (!jsc->shape_keys[i])
+            continue;
+        h = json_shape_hash(jsc->shape_keys[i]->sh) & (size - 1);
+        while (tab[h])
+            h = (h + 1) & (size - 1);
+        tab[h] = jsc->shape_keys[i];
+    }
+    js_free(ctx, jsc->shape_keys);
+    jsc->shape_keys = tab;
+    jsc->shape_keys_size = size;
+    return 0;
+}
+
+/* Return the quoted keys of the plain object 'p' or NULL if it must
+   be serialized with the generic code. The keys are kept until the
+   end of the JSON.stringify() call. */
+static JSONShapeKeys *json_get_shape_keys(JSContext *ctx,
+                                          JSONStringifyContext *jsc,
+                                          JSObject *p)
+{
+    JSShape *sh = p->shape;
+    JSShapeProperty *prs;
+    JSONShapeKeys *sk;
+    JSValue key;
+    uint32_t idx;
+    int i, h;
+
+    if (jsc->shape_keys_size != 0) {
+        h = json_shape_hash(sh) & (jsc->shape_keys_size - 1);
+        while ((sk = jsc->shape_keys[h]) != NULL) {
+            if (sk->sh == sh)
+                return sk;
+            h = (h + 1) & (jsc->shape_keys_size - 1);
+        }
+    }
+    if (jsc->shape_keys_count >= JSON_SHAPE_CACHE_MAX)
+        return NULL;
+    /* array index keys are enumerated first so the shape order cannot
+       be used. Accessors are called by the generic code. */
+    for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
+        if (prs->atom == JS_ATOM_NULL || !(prs->flags & JS_PROP_ENUMERABLE))
+            continue;
+        if ((prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL ||
+            JS_AtomIsArrayIndex(ctx, &idx, prs->atom))
+            return NULL;
+    }
+    if (2 * (jsc->shape_keys_count + 1) > jsc->shape_keys_size) {
+        if (json_shape_keys_resize(ctx, jsc))
+            return NULL;
+    }
+    sk = js_malloc(ctx, sizeof(*sk) + sizeof(sk->keys[0]) * sh->prop_count);
+    if (!sk)
+        return NULL;
+    sk->keys = (JSValue *)(sk + 1);
+    for(i = 0, prs = get_shape_prop(sh); i < sh->prop_count; i++, prs++) {
+        key = JS_UNDEFINED;
+        if (prs->atom != JS_ATOM_NULL && (prs->flags & JS_PROP_ENUMERABLE) &&
+            JS_AtomIsString(ctx, prs->atom)) {
+            key = JS_ToQuotedStringFree(ctx, JS_AtomToString(ctx, prs->atom));
+            if (JS_IsException(key)) {
+                while (--i >= 0)
+                    JS_FreeValue(ctx, sk->keys[i]);
+                js_free(ctx, sk);
+                return NULL;
+            }
+        }
+        sk->keys[i] = key;
+    }
+    sk->sh = js_dup_shape(sh);
+    h = json_shape_hash(sh) & (jsc->shape_keys_size - 1);
+    while (jsc->shape_keys[h])
+        h = (h + 1) & (jsc->shape_keys_size - 1);
+    jsc->shape_keys[h] = sk;
+    jsc->shape_keys_count++;
+    return sk;
+}
+
+/* return the primitive value of a Number, String, Boolean or BigInt
+   object as JSON.stringify() takes it, JS_UNINITIALIZED if 'val' is
+   not such an object. */
+JSValue JS_GetPrimitiveObjectValue(JSContext *ctx, JSValueConst val)
 {
-    JSValue indent1, sep, sep1, tab, v, prop;
+    JSObject *p;
+
+    if (JS_VALUE_GET_TAG(val) != JS_TAG_OBJECT)
+        return JS_UNINITIALIZED;
+    p = JS_VALUE_GET_OBJ(val);
+    switch(p->class_id) {
+    case JS_CLASS_NUMBER:
+        return JS_ToNumber(ctx, val);
+    case JS_CLASS_STRING:
+        return JS_ToString(ctx, val);
+    case JS_CLASS_BOOLEAN:
+#ifdef CONFIG_BIGNUM
+    case JS_CLASS_BIG_INT:
+#endif
+        return JS_DupValue(ctx, p->u.object_data);
+    default:
+        return JS_UNINITIALIZED;
+    }
+}
+
+static void js_json_pop_frame(JSContext *ctx, JSONStringifyContext *jsc)
+{
+    JSONStringifyFrame *f = &jsc->stack[--jsc->stack_len];
+
+    JS_FreeValue(ctx, f->val);
+    JS_FreeValue(ctx, f->indent);
+    JS_FreeValue(ctx, f->indent1);
+    JS_FreeValue(ctx, f->tab);
+}
+
+/* output a value which is not an array or an object, or output the
+   opening bracket of an array or object and push its frame */
+static int js_json_put(JSContext *ctx, JSONStringifyContext *jsc,
+                       JSValue val, JSValueConst indent)
+{
+    JSONStringifyFrame *f;
+    JSONShapeKeys *sk;
+    JSONFrameKindEnum kind;
+    JSValue indent1, tab;
     JSObject *p;
     int64_t i, len;
     int cl, ret;
-    BOOL has_content;
-    
+
     indent1 = JS_UNDEFINED;
-    sep = JS_UNDEFINED;
-    sep1 = JS_UNDEFINED;
     tab = JS_UNDEFINED;
-    prop = JS_UNDEFINED;
+    sk = NULL;
+
+    if (!jsc->b && jsc->dbuf.size >= JSON_WRITE_BUF_SIZE) {
+        if (json_flush(ctx, jsc))
+            goto exception;
+    }
 
     switch (JS_VALUE_GET_NORM_TAG(val)) {
     case JS_TAG_OBJECT:
@@ -42413,85 +46061,53 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
             val = JS_ToStringFree(ctx, val);
             if (JS_IsException(val))
                 goto exception;
-            val = JS_ToQuotedStringFree(ctx, val);
-            if (JS_IsException(val))
-                goto exception;
-            return string_buffer_concat_value_free(jsc->b, val);
+            goto quoted_value;
         } else if (cl == JS_CLASS_NUMBER) {
             val = JS_ToNumberFree(ctx, val);
             if (JS_IsException(val))
                 goto exception;
-            return string_buffer_concat_value_free(jsc->b, val);
+            goto number_value;
         } else if (cl == JS_CLASS_BOOLEAN) {
-            ret = string_buffer_concat_value(jsc->b, p->u.object_data);
+            ret = json_puts(jsc, JS_VALUE_GET_BOOL(p->u.object_data) ?
+                            "true" : "false");
             JS_FreeValue(ctx, val);
             return ret;
         }
 #ifdef CONFIG_BIGNUM
         else if (cl == JS_CLASS_BIG_FLOAT) {
-            return string_buffer_concat_value_free(jsc->b, val);
+            goto string_value;
         } else if (cl == JS_CLASS_BIG_INT) {
             JS_ThrowTypeError(ctx, "bigint are forbidden in JSON.stringify");
             goto exception;
         }
 #endif
-        v = js_array_includes(ctx, jsc->stack, 1, (JSValueConst *)&val);
-        if (JS_IsException(v))
-            goto exception;
-        if (JS_ToBoolFree(ctx, v)) {
-            JS_ThrowTypeError(ctx, "circular reference");
-            goto exception;
-        }
-        indent1 = JS_ConcatString(ctx, JS_DupValue(ctx, indent), JS_DupValue(ctx, jsc->gap));
-        if (JS_IsException(indent1))
-            goto exception;
-        if (!JS_IsEmptyString(jsc->gap)) {
-            sep = JS_ConcatString3(ctx, "\n", JS_DupValue(ctx, indent1), "");
-            if (JS_IsException(sep))
+        for(i = 0; i < jsc->stack_len; i++) {
+            if (JS_VALUE_GET_OBJ(jsc->stack[i].val) == p) {
+                JS_ThrowTypeError(ctx, "circular reference");
                 goto exception;
-            sep1 = JS_NewString(ctx, " ");
-            if (JS_IsException(sep1))
+            }
+        }
+        if (jsc->has_gap) {
+            indent1 = JS_ConcatString(ctx, JS_DupValue(ctx, indent), JS_DupValue(ctx, jsc->gap));
+            if (JS_IsException(indent1))
                 goto exception;
         } else {
-            sep = JS_DupValue(ctx, jsc->empty);
-            sep1 = JS_DupValue(ctx, jsc->empty);
+            indent1 = JS_DupValue(ctx, indent);
         }
-        v = js_array_push(ctx, jsc->stack, 1, (JSValueConst *)&val, 0);
-        if (check_exception_free(ctx, v))
-            goto exception;
         ret = JS_IsArray(ctx, val);
         if (ret < 0)
             goto exception;
         if (ret) {
             if (js_get_length64(ctx, &len, val))
                 goto exception;
-            string_buffer_putc8(jsc->b, '[');
-            for(i = 0; i < len; i++) {
-                if (i > 0)
-                    string_buffer_putc8(jsc->b, ',');
-                string_buffer_concat_value(jsc->b, sep);
-                v = JS_GetPropertyInt64(ctx, val, i);
-                if (JS_IsException(v))
-                    goto exception;
-                /* XXX: could do this string conversion only when needed */
-                prop = JS_ToStringFree(ctx, JS_NewInt64(ctx, i));
-                if (JS_IsException(prop))
-                    goto exception;
-                v = js_json_check(ctx, jsc, val, v, prop);
-                JS_FreeValue(ctx, prop);
-                prop = JS_UNDEFINED;
-                if (JS_IsException(v))
-                    goto exception;
-                if (JS_IsUndefined(v))
-                    v = JS_NULL;
-                if (js_json_to_str(ctx, jsc, val, v, indent1))
-                    goto exception;
-            }
-            if (len > 0 && !JS_IsEmptyString(jsc->gap)) {
-                string_buffer_putc8(jsc->b, '\n');
-                string_buffer_concat_value(jsc->b, indent);
-            }
-            string_buffer_putc8(jsc->b, ']');
+            kind = JSON_FRAME_ARRAY;
+        } else if (cl == JS_CLASS_OBJECT &&
+                   JS_IsUndefined(jsc->property_list) &&
+                   (sk = json_get_shape_keys(ctx, jsc, p)) != NULL) {
+            /* plain object: the enumerable keys are those of the
+               cached shape, in the shape order */
+            len = sk->sh->prop_count;
+            kind = JSON_FRAME_SHAPE;
         } else {
             if (!JS_IsUndefined(jsc->property_list))
                 tab = JS_DupValue(ctx, jsc->property_list);
@@ -42501,70 +46117,47 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
                 goto exception;
             if (js_get_length64(ctx, &len, tab))
                 goto exception;
-            string_buffer_putc8(jsc->b, '{');
-            has_content = FALSE;
-            for(i = 0; i < len; i++) {
-                JS_FreeValue(ctx, prop);
-                prop = JS_GetPropertyInt64(ctx, tab, i);
-                if (JS_IsException(prop))
-                    goto exception;
-                v = JS_GetPropertyValue(ctx, val, JS_DupValue(ctx, prop));
-                if (JS_IsException(v))
-                    goto exception;
-                v = js_json_check(ctx, jsc, val, v, prop);
-                if (JS_IsException(v))
-                    goto exception;
-                if (!JS_IsUndefined(v)) {
-                    if (has_content)
-                        string_buffer_putc8(jsc->b, ',');
-                    prop = JS_ToQuotedStringFree(ctx, prop);
-                    if (JS_IsException(prop)) {
-                        JS_FreeValue(ctx, v);
-                        goto exception;
-                    }
-                    string_buffer_concat_value(jsc->b, sep);
-                    string_buffer_concat_value(jsc->b, prop);
-                    string_buffer_putc8(jsc->b, ':');
-                    string_buffer_concat_value(jsc->b, sep1);
-                    if (js_json_to_str(ctx, jsc, val, v, indent1))
-                        goto exception;
-                    has_content = TRUE;
-                }
-            }
-            if (has_content && JS_VALUE_GET_STRING(jsc->gap)->len != 0) {
-                string_buffer_putc8(jsc->b, '\n');
-                string_buffer_concat_value(jsc->b, indent);
-            }
-            string_buffer_putc8(jsc->b, '}');
+            kind = JSON_FRAME_OBJECT;
         }
-        if (check_exception_free(ctx, js_array_pop(ctx, jsc->stack, 0, NULL, 0)))
+        if (js_resize_array(ctx, (void **)&jsc->stack, sizeof(jsc->stack[0]),
+                            &jsc->stack_size, &jsc->stack_len,
+                            jsc->stack_len + 1))
             goto exception;
-        JS_FreeValue(ctx, val);
-        JS_FreeValue(ctx, tab);
-        JS_FreeValue(ctx, sep);
-        JS_FreeValue(ctx, sep1);
-        JS_FreeValue(ctx, indent1);
-        JS_FreeValue(ctx, prop);
+        f = &jsc->stack[jsc->stack_len - 1];
+        f->val = val;
+        f->indent = JS_DupValue(ctx, indent);
+        f->indent1 = indent1;
+        f->tab = tab;
+        f->sk = sk;
+        f->i = 0;
+        f->len = len;
+        f->kind = kind;
+        f->has_content = FALSE;
+        json_putc(jsc, kind == JSON_FRAME_ARRAY ? '[' : '{');
         return 0;
     case JS_TAG_STRING:
-        val = JS_ToQuotedStringFree(ctx, val);
-        if (JS_IsException(val))
-            goto exception;
-        goto concat_value;
-    case JS_TAG_FLOAT64:
-        if (!isfinite(JS_VALUE_GET_FLOAT64(val))) {
-            val = JS_NULL;
-        }
-        goto concat_value;
+    case JS_TAG_STRING_ROPE:
+    quoted_value:
+        ret = json_put_quoted(ctx, jsc, val);
+        JS_FreeValue(ctx, val);
+        return ret;
     case JS_TAG_INT:
-#ifdef CONFIG_BIGNUM
-    case JS_TAG_BIG_FLOAT:
-#endif
+    case JS_TAG_FLOAT64:
+    number_value:
+        return json_put_number(jsc, val);
     case JS_TAG_BOOL:
+        return json_puts(jsc, JS_VALUE_GET_BOOL(val) ? "true" : "false");
     case JS_TAG_NULL:
-    concat_value:
-        return string_buffer_concat_value_free(jsc->b, val);
+        return json_puts(jsc, "null");
 #ifdef CONFIG_BIGNUM
+    case JS_TAG_BIG_FLOAT:
+    string_value:
+        val = JS_ToStringFree(ctx, val);
+        if (JS_IsException(val))
+            goto exception;
+        ret = json_put_value(jsc, val);
+        JS_FreeValue(ctx, val);
+        return ret;
     case JS_TAG_BIG_INT:
         JS_ThrowTypeError(ctx, "bigint are forbidden in JSON.stringify");
         goto exception;
@@ -42573,64 +46166,188 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
         JS_FreeValue(ctx, val);
         return 0;
     }
-    
+
 exception:
     JS_FreeValue(ctx, val);
     JS_FreeValue(ctx, tab);
-    JS_FreeValue(ctx, sep);
-    JS_FreeValue(ctx, sep1);
     JS_FreeValue(ctx, indent1);
-    JS_FreeValue(ctx, prop);
     return -1;
 }
 
-JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
-                         JSValueConst replacer, JSValueConst space0)
+/* check the value of an object property and output its quoted key if
+   it is serialized. Return JS_UNDEFINED if the property is skipped. */
+static JSValue js_json_put_key(JSContext *ctx, JSONStringifyContext *jsc,
+                               JSONStringifyFrame *f, JSValue v,
+                               JSAtom key, JSValueConst quoted_key)
+{
+    v = js_json_check(ctx, jsc, f->val, v, key);
+    if (JS_IsException(v) || JS_IsUndefined(v))
+        return v;
+    if (f->has_content)
+        json_putc(jsc, ',');
+    if (jsc->has_gap) {
+        json_putc(jsc, '\n');
+        json_put_value(jsc, f->indent1);
+    }
+    if (JS_IsUndefined(quoted_key)) {
+        JSValue str = JS_AtomToString(ctx, key);
+        if (JS_IsException(str)) {
+            JS_FreeValue(ctx, v);
+            return JS_EXCEPTION;
+        }
+        json_put_quoted(ctx, jsc, str);
+        JS_FreeValue(ctx, str);
+    } else {
+        json_put_value(jsc, quoted_key);
+    }
+    json_putc(jsc, ':');
+    if (jsc->has_gap)
+        json_putc(jsc, ' ');
+    f->has_content = TRUE;
+    return v;
+}
+
+/* serialize 'val' without recursion: the members of the array or
+   object on top of the frame stack are output one at a time */
+static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
+                          JSValue val, JSValueConst indent)
 {
-    StringBuffer b_s;
-    JSONStringifyContext jsc_s, *jsc = &jsc_s;
-    JSValue val, v, space, ret, wrapper;
+    JSONStringifyFrame *f;
+    JSShapeProperty *prs;
+    JSObject *p;
+    JSShape *sh;
+    JSValue v, prop;
+    JSAtom atom;
+    int64_t i;
+    int base;
+
+    base = jsc->stack_len;
+    if (js_json_put(ctx, jsc, val, indent))
+        return -1;
+    while (jsc->stack_len > base) {
+        f = &jsc->stack[jsc->stack_len - 1];
+        if (f->i >= f->len) {
+            if (jsc->has_gap &&
+                (f->kind == JSON_FRAME_ARRAY ? f->len > 0 : f->has_content)) {
+                json_putc(jsc, '\n');
+                json_put_value(jsc, f->indent);
+            }
+            json_putc(jsc, f->kind == JSON_FRAME_ARRAY ? ']' : '}');
+            js_json_pop_frame(ctx, jsc);
+            continue;
+        }
+        i = f->i++;
+        p = JS_VALUE_GET_OBJ(f->val);
+        switch(f->kind) {
+        case JSON_FRAME_ARRAY:
+            if (i > 0)
+                json_putc(jsc, ',');
+            if (jsc->has_gap) {
+                json_putc(jsc, '\n');
+                json_put_value(jsc, f->indent1);
+            }
+            /* the array may be modified by toJSON() or the replacer */
+            if (p->fast_array && i < p->u.array.count)
+                v = js_get_fast_array_element(ctx, p, i);
+            else
+                v = JS_GetPropertyInt64(ctx, f->val, i);
+            if (JS_IsException(v))
+                goto exception;
+            atom = JS_NewAtomInt64(ctx, i);
+            if (atom == JS_ATOM_NULL) {
+                JS_FreeValue(ctx, v);
+                goto exception;
+            }
+            v = js_json_check(ctx, jsc, f->val, v, atom);
+            JS_FreeAtom(ctx, atom);
+            if (JS_IsException(v))
+                goto exception;
+            if (JS_IsUndefined(v))
+                v = JS_NULL;
+            break;
+        case JSON_FRAME_SHAPE:
+            sh = f->sk->sh;
+            if (JS_IsUndefined(f->sk->keys[i]))
+                continue;
+            prs = get_shape_prop(sh) + i;
+            /* the object may be modified by toJSON() or the replacer */
+            if (likely(p->shape == sh))
+                v = JS_DupValue(ctx, p->prop[i].u.value);
+            else
+                v = JS_GetProperty(ctx, f->val, prs->atom);
+            if (JS_IsException(v))
+                goto exception;
+            v = js_json_put_key(ctx, jsc, f, v, prs->atom, f->sk->keys[i]);
+            if (JS_IsException(v))
+                goto exception;
+            if (JS_IsUndefined(v))
+                continue;
+            break;
+        default:
+            prop = JS_GetPropertyInt64(ctx, f->tab, i);
+            if (JS_IsException(prop))
+                goto exception;
+            atom = JS_ValueToAtom(ctx, prop);
+            JS_FreeValue(ctx, prop);
+            if (atom == JS_ATOM_NULL)
+                goto exception;
+            v = JS_GetProperty(ctx, f->val, atom);
+            if (!JS_IsException(v))
+                v = js_json_put_key(ctx, jsc, f, v, atom, JS_UNDEFINED);
+            JS_FreeAtom(ctx, atom);
+            if (JS_IsException(v))
+                goto exception;
+            if (JS_IsUndefined(v))
+                continue;
+            break;
+        }
+        /* may push a frame and move the frame stack */
+        if (js_json_put(ctx, jsc, v, f->indent1))
+            goto exception;
+    }
+    return 0;
+
+exception:
+    while (jsc->stack_len > base)
+        js_json_pop_frame(ctx, jsc);
+    return -1;
+}
+
+/* Serialize 'obj' to the output of 'jsc'. Return -1 if exception,
+   FALSE if 'obj' has no JSON representation and TRUE otherwise. */
+static int json_stringify(JSContext *ctx, JSONStringifyContext *jsc,
+                          JSValueConst obj, JSValueConst replacer,
+                             JSValueConst space0)
+{
+    JSValue val, v, space, wrapper;
     int res;
     int64_t i, j, n;
 
-    jsc->replacer_func = JS_UNDEFINED;
-    jsc->stack = JS_UNDEFINED;
-    jsc->property_list = JS_UNDEFINED;
-    jsc->gap = JS_UNDEFINED;
-    jsc->b = &b_s;
-    jsc->empty = JS_AtomToString(ctx, JS_ATOM_empty_string);
-    ret = JS_UNDEFINED;
-    wrapper = JS_UNDEFINED;
-
-    string_buffer_init(ctx, jsc->b, 0);
-    jsc->stack = JS_NewArray(ctx);
-    if (JS_IsException(jsc->stack))
-        goto exception;
     if (JS_IsFunction(ctx, replacer)) {
         jsc->replacer_func = replacer;
     } else {
         res = JS_IsArray(ctx, replacer);
         if (res < 0)
-            goto exception;
+            return -1;
         if (res) {
             /* XXX: enumeration is not fully correct */
             jsc->property_list = JS_NewArray(ctx);
             if (JS_IsException(jsc->property_list))
-                goto exception;
+                return -1;
             if (js_get_length64(ctx, &n, replacer))
-                goto exception;
+                return -1;
             for (i = j = 0; i < n; i++) {
                 JSValue present;
                 v = JS_GetPropertyInt64(ctx, replacer, i);
                 if (JS_IsException(v))
-                    goto exception;
+                    return -1;
                 if (JS_IsObject(v)) {
                     JSObject *p = JS_VALUE_GET_OBJ(v);
                     if (p->class_id == JS_CLASS_STRING ||
                         p->class_id == JS_CLASS_NUMBER) {
                         v = JS_ToStringFree(ctx, v);
                         if (JS_IsException(v))
-                            goto exception;
+                            return -1;
                     } else {
                         JS_FreeValue(ctx, v);
                         continue;
@@ -42638,7 +46355,7 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
                 } else if (JS_IsNumber(v)) {
                     v = JS_ToStringFree(ctx, v);
                     if (JS_IsException(v))
-                        goto exception;
+                        return -1;
                 } else if (!JS_IsString(v)) {
                     JS_FreeValue(ctx, v);
                     continue;
@@ -42647,7 +46364,7 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
                                             1, (JSValueConst *)&v);
                 if (JS_IsException(present)) {
                     JS_FreeValue(ctx, v);
-                    goto exception;
+                    return -1;
                 }
                 if (!JS_ToBoolFree(ctx, present)) {
                     JS_SetPropertyInt64(ctx, jsc->property_list, j++, v);
@@ -42667,13 +46384,17 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
         }
         if (JS_IsException(space)) {
             JS_FreeValue(ctx, space);
-            goto exception;
+            return -1;
         }
+    } else if (JS_VALUE_GET_TAG(space) == JS_TAG_STRING_ROPE) {
+        space = JS_ToStringFree(ctx, space);
+        if (JS_IsException(space))
+            return -1;
     }
     if (JS_IsNumber(space)) {
         int n;
         if (JS_ToInt32Clamp(ctx, &n, space, 0, 10, 0))
-            goto exception;
+            return -1;
         jsc->gap = JS_NewStringLen(ctx, "          ", n);
     } else if (JS_IsString(space)) {
         JSString *p = JS_VALUE_GET_STRING(space);
@@ -42683,41 +46404,79 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
     }
     JS_FreeValue(ctx, space);
     if (JS_IsException(jsc->gap))
-        goto exception;
-    wrapper = JS_NewObject(ctx);
-    if (JS_IsException(wrapper))
-        goto exception;
-    if (JS_DefinePropertyValue(ctx, wrapper, JS_ATOM_empty_string,
-                               JS_DupValue(ctx, obj), JS_PROP_C_W_E) < 0)
-        goto exception;
-    val = JS_DupValue(ctx, obj);
-                           
-    val = js_json_check(ctx, jsc, wrapper, val, jsc->empty);
+        return -1;
+    jsc->has_gap = !JS_IsEmptyString(jsc->gap);
+
+    /* the wrapper object is only visible to the replacer */
+    wrapper = JS_UNDEFINED;
+    if (!JS_IsUndefined(jsc->replacer_func)) {
+        wrapper = JS_NewObject(ctx);
+        if (JS_IsException(wrapper))
+            return -1;
+        if (JS_DefinePropertyValue(ctx, wrapper, JS_ATOM_empty_string,
+                                   JS_DupValue(ctx, obj), JS_PROP_C_W_E) < 0)
+            goto exception;
+    }
+    val = js_json_check(ctx, jsc, wrapper, JS_DupValue(ctx, obj),
+                        JS_ATOM_empty_string);
     if (JS_IsException(val))
         goto exception;
     if (JS_IsUndefined(val)) {
-        ret = JS_UNDEFINED;
-        goto done1;
+        JS_FreeValue(ctx, wrapper);
+        return FALSE;
     }
-    if (js_json_to_str(ctx, jsc, wrapper, val, jsc->empty))
+    if (js_json_to_str(ctx, jsc, val, jsc->empty))
         goto exception;
+    JS_FreeValue(ctx, wrapper);
+    return TRUE;
+ exception:
+    JS_FreeValue(ctx, wrapper);
+    return -1;
+}
 
-    ret = string_buffer_end(jsc->b);
-    goto done;
+JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
+                         JSValueConst replacer, JSValueConst space0)
+{
+    StringBuffer b_s;
+    JSONStringifyContext jsc_s, *jsc = &jsc_s;
+    JSValue ret;
+    int res;
 
-exception:
-    ret = JS_EXCEPTION;
-done1:
-    string_buffer_free(jsc->b);
-done:
-    JS_FreeValue(ctx, wrapper);
-    JS_FreeValue(ctx, jsc->empty);
-    JS_FreeValue(ctx, jsc->gap);
-    JS_FreeValue(ctx, jsc->property_list);
-    JS_FreeValue(ctx, jsc->stack);
+    json_stringify_init(ctx, jsc);
+    jsc->b = &b_s;
+    string_buffer_init(ctx, jsc->b, 0);
+    res = json_stringify(ctx, jsc, obj, replacer, space0);
+    if (res > 0) {
+        ret = string_buffer_end(jsc->b);
+    } else {
+        string_buffer_free(jsc->b);
+        ret = res < 0 ? JS_EXCEPTION : JS_UNDEFINED;
+    }
+    json_stringify_free(ctx, jsc);
     return ret;
 }
 
+/* Same as JS_JSONStringify() but the UTF-8 output is passed in chunks
+   to 'write_func' instead of building a string. Return -1 if
+   exception, FALSE if nothing was written because 'obj' has no JSON
+   representation and TRUE otherwise. */
+int JS_JSONStringifyWrite(JSContext *ctx, JSJSONWriteFunc *write_func,
+                          void *opaque, JSValueConst obj,
+                          JSValueConst replacer, JSValueConst space0)
+{
+    JSONStringifyContext jsc_s, *jsc = &jsc_s;
+    int res;
+
+    json_stringify_init(ctx, jsc);
+    jsc->write_func = write_func;
+    jsc->opaque = opaque;
+    res = json_stringify(ctx, jsc, obj, replacer, space0);
+    if (res > 0 && json_flush(ctx, jsc))
+        res = -1;
+    json_stringify_free(ctx, jsc);
+    return res;
+}
+
 static JSValue js_json_stringify(JSContext *ctx, JSValueConst this_val,
                                  int argc, JSValueConst *argv)
 {
@@ -43981,29 +47740,54 @@ static const JSCFunctionListEntry js_symbol_funcs[] = {
 /* Set/Map/WeakSet/WeakMap */
 
 typedef struct JSMapRecord {
-    int ref_count; /* used during enumeration to avoid freeing the record */
-    BOOL empty; /* TRUE if the record is deleted */
-    struct JSMapState *map;
-    struct JSMapRecord *next_weak_ref;
-    struct list_head link;
-    struct list_head hash_link;
-    JSValue key;
+    JSValue key; /* JS_UNINITIALIZED if the record is deleted */
     JSValue value;
+    uint32_t hash;
 } JSMapRecord;
 
+/* A WeakMap/WeakSet record references its key object with a
+   JSMapWeakRef so that the record is deleted when the object dies */
+typedef struct JSMapWeakRef {
+    struct JSMapState *map;
+    struct JSMapWeakRef *next_weak_ref;
+    JSValue value; /* only used by reset_weak_ref() */
+} JSMapWeakRef;
+
+typedef struct JSMapHashSlot {
+    uint32_t hash;
+    uint32_t index; /* record index + 1, 0 if the slot is empty */
+} JSMapHashSlot;
+
+/* The records are stored in insertion order in a dense array. The
+   deleted records are kept until the array is compacted so that the
+   iterators can continue from their position. The hash table is an
+   open addressing table with linear probing and backward shift
+   deletion, indexing the records. */
 typedef struct JSMapState {
     BOOL is_weak; /* TRUE if WeakSet/WeakMap */
-    struct list_head records; /* list of JSMapRecord.link */
-    uint32_t record_count;
-    struct list_head *hash_table;
-    uint32_t hash_size; /* must be a power of two */
-    uint32_t record_count_threshold; /* count at which a hash table
-                                        resize is needed */
+    uint32_t record_count; /* number of live records */
+    JSMapRecord *records;
+    uint32_t records_len; /* number of used records, including the
+                             deleted ones */
+    uint32_t records_size; /* allocated number of records */
+    JSMapHashSlot *hash_table;
+    uint32_t hash_size; /* 0 or a power of two, at least twice
+                           records_size */
+    struct list_head iterators; /* list of JSMapIteratorData.link */
 } JSMapState;
 
+typedef struct JSMapIteratorData {
+    JSValue obj;
+    JSIteratorKindEnum kind;
+    struct list_head link; /* in JSMapState.iterators while enumerating */
+    uint32_t pos; /* index of the next record to enumerate */
+} JSMapIteratorData;
+
 #define MAGIC_SET (1 << 0)
 #define MAGIC_WEAK (1 << 1)
 
+#define JS_MAP_HASH_SIZE_MAX (1 << 30)
+
 static JSValue js_map_constructor(JSContext *ctx, JSValueConst new_target,
                                   int argc, JSValueConst *argv, int magic)
 {
@@ -44020,15 +47804,9 @@ static JSValue js_map_constructor(JSContext *ctx, JSValueConst new_target,
     s = js_mallocz(ctx, sizeof(*s));
     if (!s)
         goto fail;
-    init_list_head(&s->records);
+    init_list_head(&s->iterators);
     s->is_weak = is_weak;
     JS_SetOpaque(obj, s);
-    s->hash_size = 1;
-    s->hash_table = js_malloc(ctx, sizeof(s->hash_table[0]) * s->hash_size);
-    if (!s->hash_table)
-        goto fail;
-    init_list_head(&s->hash_table[0]);
-    s->record_count_threshold = 4;
 
     arr = JS_UNDEFINED;
     if (argc > 0)
@@ -44125,8 +47903,29 @@ static JSValueConst map_normalize_key(JSContext *ctx, JSValueConst key)
     return key;
 }
 
-/* XXX: better hash ? */
-static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
+static inline uint32_t map_hash_mix32(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline uint32_t map_hash_mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53;
+    h ^= h >> 33;
+    return h;
+}
+
+/* the int and float64 keys must have the same hash if they represent
+   the same number */
+static uint32_t map_hash_key(JSValueConst key)
 {
     uint32_t tag = JS_VALUE_GET_NORM_TAG(key);
     uint32_t h;
@@ -44134,190 +47933,317 @@ static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
     JSFloat64Union u;
 
     switch(tag) {
-    case JS_TAG_BOOL:
-        h = JS_VALUE_GET_INT(key);
+    case JS_TAG_INT:
+        h = map_hash_mix32(JS_VALUE_GET_INT(key));
+        break;
+    case JS_TAG_FLOAT64:
+        d = JS_VALUE_GET_FLOAT64(key);
+        if (d >= INT32_MIN && d <= INT32_MAX && (int32_t)d == d) {
+            h = map_hash_mix32((int32_t)d);
+        } else {
+            /* normalize the NaN */
+            if (isnan(d))
+                d = JS_FLOAT64_NAN;
+            u.d = d;
+            h = map_hash_mix64(u.u64);
+        }
         break;
     case JS_TAG_STRING:
-        h = hash_string(JS_VALUE_GET_STRING(key), 0);
+        /* not used directly: strings differing by their last
+           characters have close hashes and form long clusters */
+        h = map_hash_mix32(hash_string(JS_VALUE_GET_STRING(key), 0));
+        break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSStringRopeIter it;
+            JSString *p;
+            h = 0;
+            js_string_rope_iter_init(&it, key);
+            while ((p = js_string_rope_iter_next(&it)) != NULL) {
+                if (p->is_wide_char)
+                    h = hash_string16(p->u.str16 + it.start, it.len, h);
+                else
+                    h = hash_string8(p->u.str8 + it.start, it.len, h);
+            }
+            h = map_hash_mix32(h);
+        }
         break;
     case JS_TAG_OBJECT:
     case JS_TAG_SYMBOL:
-        h = (uintptr_t)JS_VALUE_GET_PTR(key) * 3163;
+        h = map_hash_mix64((uintptr_t)JS_VALUE_GET_PTR(key));
         break;
-    case JS_TAG_INT:
-        d = JS_VALUE_GET_INT(key) * 3163;
-        goto hash_float64;
-    case JS_TAG_FLOAT64:
-        d = JS_VALUE_GET_FLOAT64(key);
-        /* normalize the NaN */
-        if (isnan(d))
-            d = JS_FLOAT64_NAN;
-    hash_float64:
-        u.d = d;
-        h = (u.u32[0] ^ u.u32[1]) * 3163;
+    case JS_TAG_BOOL:
+        h = map_hash_mix32(JS_VALUE_GET_INT(key) ^ (tag << 8));
         break;
     default:
-        h = 0; /* XXX: bignum support */
+        h = map_hash_mix32(tag); /* XXX: bignum support */
         break;
     }
-    h ^= tag;
     return h;
 }
 
+static inline BOOL map_record_is_deleted(const JSMapRecord *mr)
+{
+    return JS_VALUE_GET_TAG(mr->key) == JS_TAG_UNINITIALIZED;
+}
+
+/* return the hash table slot of 'key' or -1 if not found */
+static int map_find_slot(JSContext *ctx, JSMapState *s, JSValueConst key,
+                         uint32_t h)
+{
+    JSMapHashSlot *hs;
+    JSValueConst key1;
+    uint32_t i, mask;
+
+    if (s->record_count == 0)
+        return -1;
+    mask = s->hash_size - 1;
+    for(i = h & mask;; i = (i + 1) & mask) {
+        hs = &s->hash_table[i];
+        if (hs->index == 0)
+            return -1;
+        if (hs->hash != h)
+            continue;
+        key1 = s->records[hs->index - 1].key;
+        /* the lookups are usually done with the key string or object
+           of the record: it is found without comparing the contents */
+        if ((JS_VALUE_HAS_REF_COUNT(key) &&
+             JS_VALUE_GET_TAG(key1) == JS_VALUE_GET_TAG(key) &&
+             JS_VALUE_GET_PTR(key1) == JS_VALUE_GET_PTR(key)) ||
+            js_same_value_zero(ctx, key1, key))
+            return i;
+    }
+}
+
 static JSMapRecord *map_find_record(JSContext *ctx, JSMapState *s,
                                     JSValueConst key)
 {
-    struct list_head *el;
-    JSMapRecord *mr;
-    uint32_t h;
-    h = map_hash_key(ctx, key) & (s->hash_size - 1);
-    list_for_each(el, &s->hash_table[h]) {
-        mr = list_entry(el, JSMapRecord, hash_link);
-        if (js_same_value_zero(ctx, mr->key, key))
-            return mr;
-    }
-    return NULL;
+    int i;
+    i = map_find_slot(ctx, s, key, map_hash_key(key));
+    if (i < 0)
+        return NULL;
+    return &s->records[s->hash_table[i].index - 1];
 }
 
-static void map_hash_resize(JSContext *ctx, JSMapState *s)
+static void map_hash_insert(JSMapState *s, uint32_t h, uint32_t index)
 {
-    uint32_t new_hash_size, i, h;
-    size_t slack;
-    struct list_head *new_hash_table, *el;
-    JSMapRecord *mr;
+    uint32_t i, mask;
 
-    /* XXX: no reporting of memory allocation failure */
-    if (s->hash_size == 1)
-        new_hash_size = 4;
-    else
-        new_hash_size = s->hash_size * 2;
-    new_hash_table = js_realloc2(ctx, s->hash_table,
-                                 sizeof(new_hash_table[0]) * new_hash_size, &slack);
-    if (!new_hash_table)
-        return;
-    new_hash_size += slack / sizeof(*new_hash_table);
+    mask = s->hash_size - 1;
+    for(i = h & mask; s->hash_table[i].index != 0; i = (i + 1) & mask)
+        continue;
+    s->hash_table[i].hash = h;
+    s->hash_table[i].index = index + 1;
+}
+
+/* remove slot 'i' and move back the following slots of the same
+   cluster so that no tombstone is needed */
+static void map_hash_remove(JSMapState *s, uint32_t i)
+{
+    uint32_t j, mask;
+    JSMapHashSlot *hs;
+
+    mask = s->hash_size - 1;
+    j = i;
+    for(;;) {
+        j = (j + 1) & mask;
+        hs = &s->hash_table[j];
+        if (hs->index == 0)
+            break;
+        /* move the slot if its ideal position is not in (i, j] */
+        if (((j - hs->hash) & mask) >= ((j - i) & mask)) {
+            s->hash_table[i] = *hs;
+            i = j;
+        }
+    }
+    s->hash_table[i].index = 0;
+}
+
+static void map_hash_rebuild(JSMapState *s)
+{
+    uint32_t i;
 
-    for(i = 0; i < new_hash_size; i++)
-        init_list_head(&new_hash_table[i]);
+    memset(s->hash_table, 0, sizeof(s->hash_table[0]) * s->hash_size);
+    for(i = 0; i < s->records_len; i++) {
+        if (!map_record_is_deleted(&s->records[i]))
+            map_hash_insert(s, s->records[i].hash, i);
+    }
+}
 
-    list_for_each(el, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty) {
-            h = map_hash_key(ctx, mr->key) & (new_hash_size - 1);
-            list_add_tail(&mr->hash_link, &new_hash_table[h]);
+/* remove the deleted records */
+static void map_compact(JSMapState *s)
+{
+    struct list_head *el;
+    JSMapIteratorData *it;
+    uint32_t i, j;
+
+    /* the iterators are moved to the same live record */
+    list_for_each(el, &s->iterators) {
+        it = list_entry(el, JSMapIteratorData, link);
+        j = 0;
+        for(i = 0; i < it->pos; i++) {
+            if (!map_record_is_deleted(&s->records[i]))
+                j++;
         }
+        it->pos = j;
+    }
+    j = 0;
+    for(i = 0; i < s->records_len; i++) {
+        if (!map_record_is_deleted(&s->records[i]))
+            s->records[j++] = s->records[i];
+    }
+    s->records_len = j;
+    map_hash_rebuild(s);
+}
+
+/* make room for one more record */
+static int map_grow(JSContext *ctx, JSMapState *s)
+{
+    uint32_t new_size, new_hash_size;
+    JSMapRecord *new_records;
+    JSMapHashSlot *new_hash_table;
+
+    if (s->records_len < s->records_size)
+        return 0;
+    if (s->record_count <= s->records_len / 2 && s->records_len >= 8) {
+        /* enough deleted records: compact in place */
+        map_compact(s);
+        return 0;
+    }
+    new_size = max_int(s->records_size * 2, 4);
+    new_hash_size = new_size * 2;
+    if (new_hash_size > JS_MAP_HASH_SIZE_MAX) {
+        JS_ThrowRangeError(ctx, "Map too large");
+        return -1;
     }
+    new_hash_table = js_malloc(ctx, sizeof(new_hash_table[0]) * new_hash_size);
+    if (!new_hash_table)
+        return -1;
+    new_records = js_realloc(ctx, s->records,
+                             sizeof(new_records[0]) * new_size);
+    if (!new_records) {
+        js_free(ctx, new_hash_table);
+        return -1;
+    }
+    js_free(ctx, s->hash_table);
+    s->records = new_records;
+    s->records_size = new_size;
     s->hash_table = new_hash_table;
     s->hash_size = new_hash_size;
-    s->record_count_threshold = new_hash_size * 2;
+    if (s->record_count != s->records_len)
+        map_compact(s);
+    else
+        map_hash_rebuild(s);
+    return 0;
 }
 
+/* the returned record is valid until the next map modification */
 static JSMapRecord *map_add_record(JSContext *ctx, JSMapState *s,
-                                   JSValueConst key)
+                                   JSValueConst key, uint32_t h)
 {
-    uint32_t h;
     JSMapRecord *mr;
 
-    mr = js_malloc(ctx, sizeof(*mr));
-    if (!mr)
+    if (map_grow(ctx, s))
         return NULL;
-    mr->ref_count = 1;
-    mr->map = s;
-    mr->empty = FALSE;
     if (s->is_weak) {
         JSObject *p = JS_VALUE_GET_OBJ(key);
+        JSMapWeakRef *wr;
         /* Add the weak reference */
-        mr->next_weak_ref = p->first_weak_ref;
-        p->first_weak_ref = mr;
+        wr = js_malloc(ctx, sizeof(*wr));
+        if (!wr)
+            return NULL;
+        wr->map = s;
+        wr->next_weak_ref = p->first_weak_ref;
+        p->first_weak_ref = wr;
     } else {
         JS_DupValue(ctx, key);
     }
+    mr = &s->records[s->records_len];
     mr->key = (JSValue)key;
-    h = map_hash_key(ctx, key) & (s->hash_size - 1);
-    list_add_tail(&mr->hash_link, &s->hash_table[h]);
-    list_add_tail(&mr->link, &s->records);
+    mr->value = JS_UNDEFINED;
+    mr->hash = h;
+    map_hash_insert(s, h, s->records_len);
+    s->records_len++;
     s->record_count++;
-    if (s->record_count >= s->record_count_threshold) {
-        map_hash_resize(ctx, s);
-    }
     return mr;
 }
 
-/* Remove the weak reference from the object weak
-   reference list. we don't use a doubly linked list to
-   save space, assuming a given object has few weak
-       references to it */
-static void delete_weak_ref(JSRuntime *rt, JSMapRecord *mr)
+/* Remove the weak reference of 's' from the object weak reference
+   list. we don't use a doubly linked list to save space, assuming a
+   given object has few weak references to it */
+static void delete_weak_ref(JSRuntime *rt, JSMapState *s, JSValueConst key)
 {
-    JSMapRecord **pmr, *mr1;
+    JSMapWeakRef **pwr, *wr;
     JSObject *p;
 
-    p = JS_VALUE_GET_OBJ(mr->key);
-    pmr = &p->first_weak_ref;
+    p = JS_VALUE_GET_OBJ(key);
+    pwr = &p->first_weak_ref;
     for(;;) {
-        mr1 = *pmr;
-        assert(mr1 != NULL);
-        if (mr1 == mr)
+        wr = *pwr;
+        assert(wr != NULL);
+        if (wr->map == s)
             break;
-        pmr = &mr1->next_weak_ref;
+        pwr = &wr->next_weak_ref;
     }
-    *pmr = mr1->next_weak_ref;
+    *pwr = wr->next_weak_ref;
+    js_free_rt(rt, wr);
 }
 
-static void map_delete_record(JSRuntime *rt, JSMapState *s, JSMapRecord *mr)
+static void map_delete_record(JSRuntime *rt, JSMapState *s, int slot)
 {
-    if (mr->empty)
-        return;
-    list_del(&mr->hash_link);
-    if (s->is_weak) {
-        delete_weak_ref(rt, mr);
-    } else {
-        JS_FreeValueRT(rt, mr->key);
-    }
-    JS_FreeValueRT(rt, mr->value);
-    if (--mr->ref_count == 0) {
-        list_del(&mr->link);
-        js_free_rt(rt, mr);
-    } else {
-        /* keep a zombie record for iterators */
-        mr->empty = TRUE;
-        mr->key = JS_UNDEFINED;
-        mr->value = JS_UNDEFINED;
-    }
+    JSMapRecord *mr;
+    JSValue key, value;
+
+    mr = &s->records[s->hash_table[slot].index - 1];
+    key = mr->key;
+    value = mr->value;
+    map_hash_remove(s, slot);
+    /* keep a deleted record for the iterators */
+    mr->key = JS_UNINITIALIZED;
+    mr->value = JS_UNDEFINED;
     s->record_count--;
-}
-
-static void map_decref_record(JSRuntime *rt, JSMapRecord *mr)
-{
-    if (--mr->ref_count == 0) {
-        /* the record can be safely removed */
-        assert(mr->empty);
-        list_del(&mr->link);
-        js_free_rt(rt, mr);
-    }
+    if (s->records_len >= 32 && s->record_count < s->records_len / 4)
+        map_compact(s);
+    /* the map is consistent before freeing the values */
+    if (s->is_weak)
+        delete_weak_ref(rt, s, key);
+    else
+        JS_FreeValueRT(rt, key);
+    JS_FreeValueRT(rt, value);
 }
 
 static void reset_weak_ref(JSRuntime *rt, JSObject *p)
 {
-    JSMapRecord *mr, *mr_next;
+    JSMapWeakRef *wr, *wr_next;
     JSMapState *s;
-    
-    /* first pass to remove the records from the WeakMap/WeakSet
-       lists */
-    for(mr = p->first_weak_ref; mr != NULL; mr = mr->next_weak_ref) {
-        s = mr->map;
+    JSMapRecord *mr;
+    uint32_t h, i, mask;
+
+    /* first pass to remove the records from the WeakMap/WeakSet */
+    h = map_hash_key(JS_MKPTR(JS_TAG_OBJECT, p));
+    for(wr = p->first_weak_ref; wr != NULL; wr = wr->next_weak_ref) {
+        s = wr->map;
         assert(s->is_weak);
-        assert(!mr->empty); /* no iterator on WeakMap/WeakSet */
-        list_del(&mr->hash_link);
-        list_del(&mr->link);
+        mask = s->hash_size - 1;
+        for(i = h & mask;; i = (i + 1) & mask) {
+            assert(s->hash_table[i].index != 0);
+            mr = &s->records[s->hash_table[i].index - 1];
+            if (JS_VALUE_GET_OBJ(mr->key) == p)
+                break;
+        }
+        wr->value = mr->value;
+        map_hash_remove(s, i);
+        mr->key = JS_UNINITIALIZED;
+        mr->value = JS_UNDEFINED;
+        s->record_count--;
     }
-    
+
     /* second pass to free the values to avoid modifying the weak
        reference list while traversing it. */
-    for(mr = p->first_weak_ref; mr != NULL; mr = mr_next) {
-        mr_next = mr->next_weak_ref;
-        JS_FreeValueRT(rt, mr->value);
-        js_free_rt(rt, mr);
+    for(wr = p->first_weak_ref; wr != NULL; wr = wr_next) {
+        wr_next = wr->next_weak_ref;
+        JS_FreeValueRT(rt, wr->value);
+        js_free_rt(rt, wr);
     }
 
     p->first_weak_ref = NULL; /* fail safe */
@@ -44329,6 +48255,9 @@ static JSValue js_map_set(JSContext *ctx, JSValueConst this_val,
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
     JSMapRecord *mr;
     JSValueConst key, value;
+    JSValue old_value;
+    uint32_t h;
+    int i;
 
     if (!s)
         return JS_EXCEPTION;
@@ -44339,15 +48268,19 @@ static JSValue js_map_set(JSContext *ctx, JSValueConst this_val,
         value = JS_UNDEFINED;
     else
         value = argv[1];
-    mr = map_find_record(ctx, s, key);
-    if (mr) {
-        JS_FreeValue(ctx, mr->value);
+    h = map_hash_key(key);
+    i = map_find_slot(ctx, s, key, h);
+    if (i >= 0) {
+        mr = &s->records[s->hash_table[i].index - 1];
     } else {
-        mr = map_add_record(ctx, s, key);
+        mr = map_add_record(ctx, s, key, h);
         if (!mr)
             return JS_EXCEPTION;
     }
+    /* freeing the old value may modify the map */
+    old_value = mr->value;
     mr->value = JS_DupValue(ctx, value);
+    JS_FreeValue(ctx, old_value);
     return JS_DupValue(ctx, this_val);
 }
 
@@ -44386,16 +48319,16 @@ static JSValue js_map_delete(JSContext *ctx, JSValueConst this_val,
                              int argc, JSValueConst *argv, int magic)
 {
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
-    JSMapRecord *mr;
     JSValueConst key;
+    int i;
 
     if (!s)
         return JS_EXCEPTION;
     key = map_normalize_key(ctx, argv[0]);
-    mr = map_find_record(ctx, s, key);
-    if (!mr)
+    i = map_find_slot(ctx, s, key, map_hash_key(key));
+    if (i < 0)
         return JS_FALSE;
-    map_delete_record(ctx->rt, s, mr);
+    map_delete_record(ctx->rt, s, i);
     return JS_TRUE;
 }
 
@@ -44403,15 +48336,39 @@ static JSValue js_map_clear(JSContext *ctx, JSValueConst this_val,
                             int argc, JSValueConst *argv, int magic)
 {
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
-    struct list_head *el, *el1;
-    JSMapRecord *mr;
+    struct list_head *el;
+    JSMapIteratorData *it;
+    JSMapRecord *records, *mr;
+    uint32_t i, records_len;
 
     if (!s)
         return JS_EXCEPTION;
-    list_for_each_safe(el, el1, &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        map_delete_record(ctx->rt, s, mr);
+    /* the map is emptied before freeing the records because freeing
+       them may modify it */
+    records = s->records;
+    records_len = s->records_len;
+    list_for_each(el, &s->iterators) {
+        it = list_entry(el, JSMapIteratorData, link);
+        it->pos = 0;
+    }
+    js_free(ctx, s->hash_table);
+    s->records = NULL;
+    s->records_len = 0;
+    s->records_size = 0;
+    s->hash_table = NULL;
+    s->hash_size = 0;
+    s->record_count = 0;
+    for(i = 0; i < records_len; i++) {
+        mr = &records[i];
+        if (!map_record_is_deleted(mr)) {
+            if (s->is_weak)
+                delete_weak_ref(ctx->rt, s, mr->key);
+            else
+                JS_FreeValue(ctx, mr->key);
+            JS_FreeValue(ctx, mr->value);
+        }
     }
+    js_free(ctx, records);
     return JS_UNDEFINED;
 }
 
@@ -44429,7 +48386,7 @@ static JSValue js_map_forEach(JSContext *ctx, JSValueConst this_val,
     JSMapState *s = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP + magic);
     JSValueConst func, this_arg;
     JSValue ret, args[3];
-    struct list_head *el;
+    JSMapIteratorData it_s, *it = &it_s;
     JSMapRecord *mr;
 
     if (!s)
@@ -44441,59 +48398,76 @@ static JSValue js_map_forEach(JSContext *ctx, JSValueConst this_val,
         this_arg = JS_UNDEFINED;
     if (check_function(ctx, func))
         return JS_EXCEPTION;
-    /* Note: the list can be modified while traversing it, but the
-       current element is locked */
-    el = s->records.next;
-    while (el != &s->records) {
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty) {
-            mr->ref_count++;
-            /* must duplicate in case the record is deleted */
-            args[1] = JS_DupValue(ctx, mr->key);
-            if (magic)
-                args[0] = args[1];
-            else
-                args[0] = JS_DupValue(ctx, mr->value);
-            args[2] = (JSValue)this_val;
-            ret = JS_Call(ctx, func, this_arg, 3, (JSValueConst *)args);
-            JS_FreeValue(ctx, args[0]);
-            if (!magic)
-                JS_FreeValue(ctx, args[1]);
-            el = el->next;
-            map_decref_record(ctx->rt, mr);
-            if (JS_IsException(ret))
-                return ret;
-            JS_FreeValue(ctx, ret);
-        } else {
-            el = el->next;
-        }
+    /* Note: the map can be modified while traversing it, so the
+       position is registered as an iterator */
+    it->pos = 0;
+    list_add_tail(&it->link, &s->iterators);
+    ret = JS_UNDEFINED;
+    while (it->pos < s->records_len) {
+        mr = &s->records[it->pos++];
+        if (map_record_is_deleted(mr))
+            continue;
+        /* must duplicate in case the record is deleted */
+        args[1] = JS_DupValue(ctx, mr->key);
+        if (magic)
+            args[0] = args[1];
+        else
+            args[0] = JS_DupValue(ctx, mr->value);
+        args[2] = (JSValue)this_val;
+        ret = JS_Call(ctx, func, this_arg, 3, (JSValueConst *)args);
+        JS_FreeValue(ctx, args[0]);
+        if (!magic)
+            JS_FreeValue(ctx, args[1]);
+        if (JS_IsException(ret))
+            break;
+        JS_FreeValue(ctx, ret);
+        ret = JS_UNDEFINED;
     }
-    return JS_UNDEFINED;
+    list_del(&it->link);
+    return ret;
+}
+
+BOOL JS_IsMap(JSContext *ctx, JSValueConst val)
+{
+    JSObject *p;
+    if (JS_VALUE_GET_TAG(val) != JS_TAG_OBJECT)
+        return FALSE;
+    p = JS_VALUE_GET_OBJ(val);
+    return (p->class_id == JS_CLASS_MAP);
+}
+
+BOOL JS_IsSet(JSContext *ctx, JSValueConst val)
+{
+    JSObject *p;
+    if (JS_VALUE_GET_TAG(val) != JS_TAG_OBJECT)
+        return FALSE;
+    p = JS_VALUE_GET_OBJ(val);
+    return (p->class_id == JS_CLASS_SET);
 }
 
 static void js_map_finalizer(JSRuntime *rt, JSValue val)
 {
     JSObject *p;
     JSMapState *s;
-    struct list_head *el, *el1;
     JSMapRecord *mr;
+    uint32_t i;
 
     p = JS_VALUE_GET_OBJ(val);
     s = p->u.map_state;
     if (s) {
         /* if the object is deleted we are sure that no iterator is
            using it */
-        list_for_each_safe(el, el1, &s->records) {
-            mr = list_entry(el, JSMapRecord, link);
-            if (!mr->empty) {
+        for(i = 0; i < s->records_len; i++) {
+            mr = &s->records[i];
+            if (!map_record_is_deleted(mr)) {
                 if (s->is_weak)
-                    delete_weak_ref(rt, mr);
+                    delete_weak_ref(rt, s, mr->key);
                 else
                     JS_FreeValueRT(rt, mr->key);
                 JS_FreeValueRT(rt, mr->value);
             }
-            js_free_rt(rt, mr);
         }
+        js_free_rt(rt, s->records);
         js_free_rt(rt, s->hash_table);
         js_free_rt(rt, s);
     }
@@ -44503,13 +48477,13 @@ static void js_map_mark(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func)
 {
     JSObject *p = JS_VALUE_GET_OBJ(val);
     JSMapState *s;
-    struct list_head *el;
     JSMapRecord *mr;
+    uint32_t i;
 
     s = p->u.map_state;
     if (s) {
-        list_for_each(el, &s->records) {
-            mr = list_entry(el, JSMapRecord, link);
+        for(i = 0; i < s->records_len; i++) {
+            mr = &s->records[i];
             if (!s->is_weak)
                 JS_MarkValue(rt, mr->key, mark_func);
             JS_MarkValue(rt, mr->value, mark_func);
@@ -44519,12 +48493,6 @@ static void js_map_mark(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func)
 
 /* Map Iterator */
 
-typedef struct JSMapIteratorData {
-    JSValue obj;
-    JSIteratorKindEnum kind;
-    JSMapRecord *cur_record;
-} JSMapIteratorData;
-
 static void js_map_iterator_finalizer(JSRuntime *rt, JSValue val)
 {
     JSObject *p;
@@ -44535,8 +48503,8 @@ static void js_map_iterator_finalizer(JSRuntime *rt, JSValue val)
     if (it) {
         /* During the GC sweep phase the Map finalizer may be
            called before the Map iterator finalizer */
-        if (JS_IsLiveObject(rt, it->obj) && it->cur_record) {
-            map_decref_record(rt, it->cur_record);
+        if (JS_IsLiveObject(rt, it->obj)) {
+            list_del(&it->link);
         }
         JS_FreeValueRT(rt, it->obj);
         js_free_rt(rt, it);
@@ -44550,7 +48518,6 @@ static void js_map_iterator_mark(JSRuntime *rt, JSValueConst val,
     JSMapIteratorData *it;
     it = p->u.map_iterator_data;
     if (it) {
-        /* the record is already marked by the object */
         JS_MarkValue(rt, it->obj, mark_func);
     }
 }
@@ -44578,7 +48545,8 @@ static JSValue js_create_map_iterator(JSContext *ctx, JSValueConst this_val,
     }
     it->obj = JS_DupValue(ctx, this_val);
     it->kind = kind;
-    it->cur_record = NULL;
+    it->pos = 0;
+    list_add_tail(&it->link, &s->iterators);
     JS_SetOpaque(enum_obj, it);
     return enum_obj;
  fail:
@@ -44592,7 +48560,6 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
     JSMapIteratorData *it;
     JSMapState *s;
     JSMapRecord *mr;
-    struct list_head *el;
 
     it = JS_GetOpaque2(ctx, this_val, JS_CLASS_MAP_ITERATOR + magic);
     if (!it) {
@@ -44603,17 +48570,10 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
         goto done;
     s = JS_GetOpaque(it->obj, JS_CLASS_MAP + magic);
     assert(s != NULL);
-    if (!it->cur_record) {
-        el = s->records.next;
-    } else {
-        mr = it->cur_record;
-        el = mr->link.next;
-        map_decref_record(ctx->rt, mr); /* the record can be freed here */
-    }
     for(;;) {
-        if (el == &s->records) {
+        if (it->pos >= s->records_len) {
             /* no more record  */
-            it->cur_record = NULL;
+            list_del(&it->link);
             JS_FreeValue(ctx, it->obj);
             it->obj = JS_UNDEFINED;
         done:
@@ -44621,16 +48581,10 @@ static JSValue js_map_iterator_next(JSContext *ctx, JSValueConst this_val,
             *pdone = TRUE;
             return JS_UNDEFINED;
         }
-        mr = list_entry(el, JSMapRecord, link);
-        if (!mr->empty)
+        mr = &s->records[it->pos++];
+        if (!map_record_is_deleted(mr))
             break;
-        /* get the next record */
-        el = mr->link.next;
     }
-
-    /* lock the record so that it won't be freed */
-    mr->ref_count++;
-    it->cur_record = mr;
     *pdone = FALSE;
 
     if (it->kind == JS_ITERATOR_KIND_KEY) {
@@ -45099,18 +49053,15 @@ static void js_promise_mark(JSRuntime *rt, JSValueConst val,
     JS_MarkValue(rt, s->promise_result, mark_func);
 }
 
-static JSValue js_promise_constructor(JSContext *ctx, JSValueConst new_target,
-                                      int argc, JSValueConst *argv)
+/* return a pending promise. Its resolving functions are stored in
+   'resolving_funcs' if not NULL. */
+static JSValue js_new_promise(JSContext *ctx, JSValueConst new_target,
+                              JSValue *resolving_funcs)
 {
-    JSValueConst executor;
     JSValue obj;
     JSPromiseData *s;
-    JSValue args[2], ret;
     int i;
 
-    executor = argv[0];
-    if (check_function(ctx, executor))
-        return JS_EXCEPTION;
     obj = js_create_from_ctor(ctx, new_target, JS_CLASS_PROMISE);
     if (JS_IsException(obj))
         return JS_EXCEPTION;
@@ -45123,8 +49074,28 @@ static JSValue js_promise_constructor(JSContext *ctx, JSValueConst new_target,
         init_list_head(&s->promise_reactions[i]);
     s->promise_result = JS_UNDEFINED;
     JS_SetOpaque(obj, s);
-    if (js_create_resolving_functions(ctx, args, obj))
+    if (resolving_funcs &&
+        js_create_resolving_functions(ctx, resolving_funcs, obj))
         goto fail;
+    return obj;
+ fail:
+    JS_FreeValue(ctx, obj);
+    return JS_EXCEPTION;
+}
+
+static JSValue js_promise_constructor(JSContext *ctx, JSValueConst new_target,
+                                      int argc, JSValueConst *argv)
+{
+    JSValueConst executor;
+    JSValue obj;
+    JSValue args[2], ret;
+
+    executor = argv[0];
+    if (check_function(ctx, executor))
+        return JS_EXCEPTION;
+    obj = js_new_promise(ctx, new_target, args);
+    if (JS_IsException(obj))
+        return JS_EXCEPTION;
     ret = JS_Call(ctx, executor, JS_UNDEFINED, 2, (JSValueConst *)args);
     if (JS_IsException(ret)) {
         JSValue ret2, error;
@@ -45142,7 +49113,6 @@ static JSValue js_promise_constructor(JSContext *ctx, JSValueConst new_target,
  fail1:
     JS_FreeValue(ctx, args[0]);
     JS_FreeValue(ctx, args[1]);
- fail:
     JS_FreeValue(ctx, obj);
     return JS_EXCEPTION;
 }
@@ -45180,6 +49150,12 @@ static JSValue js_new_promise_capability(JSContext *ctx,
     JSCFunctionDataRecord *s;
     int i;
 
+    /* the built-in constructor and executor cannot be observed */
+    if (JS_IsUndefined(ctor) ||
+        (JS_VALUE_GET_TAG(ctor) == JS_TAG_OBJECT &&
+         JS_VALUE_GET_OBJ(ctor) == JS_VALUE_GET_OBJ(ctx->promise_ctor)))
+        return js_new_promise(ctx, JS_UNDEFINED, resolving_funcs);
+
     executor = js_promise_executor_new(ctx);
     if (JS_IsException(executor))
         return executor;
@@ -45592,30 +49568,31 @@ static __exception int perform_promise_then(JSContext *ctx,
     JSPromiseReactionData *rd_array[2], *rd;
     int i, j;
 
-    rd_array[0] = NULL;
-    rd_array[1] = NULL;
-    for(i = 0; i < 2; i++) {
-        JSValueConst handler;
-        rd = js_mallocz(ctx, sizeof(*rd));
-        if (!rd) {
-            if (i == 1)
-                promise_reaction_data_free(ctx->rt, rd_array[0]);
-            return -1;
-        }
-        for(j = 0; j < 2; j++)
-            rd->resolving_funcs[j] = JS_DupValue(ctx, cap_resolving_funcs[j]);
-        handler = resolve_reject[i];
-        if (!JS_IsFunction(ctx, handler))
-            handler = JS_UNDEFINED;
-        rd->handler = JS_DupValue(ctx, handler);
-        rd_array[i] = rd;
-    }
-
     if (s->promise_state == JS_PROMISE_PENDING) {
+        rd_array[0] = NULL;
+        rd_array[1] = NULL;
+        for(i = 0; i < 2; i++) {
+            JSValueConst handler;
+            rd = js_mallocz(ctx, sizeof(*rd));
+            if (!rd) {
+                if (i == 1)
+                    promise_reaction_data_free(ctx->rt, rd_array[0]);
+                return -1;
+            }
+            for(j = 0; j < 2; j++)
+                rd->resolving_funcs[j] = JS_DupValue(ctx, cap_resolving_funcs[j]);
+            handler = resolve_reject[i];
+            if (!JS_IsFunction(ctx, handler))
+                handler = JS_UNDEFINED;
+            rd->handler = JS_DupValue(ctx, handler);
+            rd_array[i] = rd;
+        }
         for(i = 0; i < 2; i++)
             list_add_tail(&rd_array[i]->link, &s->promise_reactions[i]);
     } else {
-        JSValueConst args[5];
+        /* settled promise: the reaction job is queued without
+           allocating the reaction records */
+        JSValueConst args[5], handler;
         if (s->promise_state == JS_PROMISE_REJECTED && !s->is_handled) {
             JSRuntime *rt = ctx->rt;
             if (rt->host_promise_rejection_tracker) {
@@ -45624,15 +49601,15 @@ static __exception int perform_promise_then(JSContext *ctx,
             }
         }
         i = s->promise_state - JS_PROMISE_FULFILLED;
-        rd = rd_array[i];
-        args[0] = rd->resolving_funcs[0];
-        args[1] = rd->resolving_funcs[1];
-        args[2] = rd->handler;
+        handler = resolve_reject[i];
+        if (!JS_IsFunction(ctx, handler))
+            handler = JS_UNDEFINED;
+        args[0] = cap_resolving_funcs[0];
+        args[1] = cap_resolving_funcs[1];
+        args[2] = handler;
         args[3] = JS_NewBool(ctx, i);
         args[4] = s->promise_result;
         JS_EnqueueJob(ctx, promise_reaction_job, 5, args);
-        for(i = 0; i < 2; i++)
-            promise_reaction_data_free(ctx->rt, rd_array[i]);
     }
     s->is_handled = TRUE;
     return 0;
@@ -46434,6 +50411,22 @@ static JSValue JS_SetThisTimeValue(JSContext *ctx, JSValueConst this_val, double
     return JS_ThrowTypeError(ctx, "not a Date object");
 }
 
+BOOL JS_IsDate(JSContext *ctx, JSValueConst val)
+{
+    JSObject *p;
+    if (JS_VALUE_GET_TAG(val) != JS_TAG_OBJECT)
+        return FALSE;
+    p = JS_VALUE_GET_OBJ(val);
+    return (p->class_id == JS_CLASS_DATE);
+}
+
+/* get the time value of a Date object in ms since the epoch (NAN for an
+   invalid date). Return -1 with a TypeError if 'obj' is not a Date. */
+int JS_GetDateValue(JSContext *ctx, double *pres, JSValueConst obj)
+{
+    return JS_ThisTimeValue(ctx, pres, obj);
+}
+
 static int64_t days_from_year(int64_t y) {
     return 365 * (y - 1970) + floor_div(y - 1969, 4) -
         floor_div(y - 1901, 100) + floor_div(y - 1601, 400);
@@ -46803,6 +50796,15 @@ has_val:
     return rv;
 }
 
+JSValue JS_NewDate(JSContext *ctx, double epoch_ms)
+{
+    JSValue obj;
+    obj = JS_NewObjectClass(ctx, JS_CLASS_DATE);
+    if (!JS_IsException(obj))
+        JS_SetObjectData(ctx, obj, __JS_NewFloat64(ctx, time_clip(epoch_ms)));
+    return obj;
+}
+
 static JSValue js_Date_UTC(JSContext *ctx, JSValueConst this_val,
                            int argc, JSValueConst *argv)
 {
@@ -47621,6 +51623,7 @@ static JSValue JS_ToBigIntCtorFree(JSContext *ctx, JSValue val)
             break;
         goto redo;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = JS_StringToBigIntErr(ctx, val);
         break;
     case JS_TAG_OBJECT:
@@ -48172,6 +52175,7 @@ static JSValue js_bigfloat_constructor(JSContext *ctx,
                 break;
             goto redo;
         case JS_TAG_STRING:
+        case JS_TAG_STRING_ROPE:
             {
                 const char *str, *p;
                 size_t len;
@@ -48852,6 +52856,7 @@ static JSValue JS_ToBigDecimalFree(JSContext *ctx, JSValue val,
             break;
         goto redo;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
             const char *str, *p;
             size_t len;
@@ -49777,6 +53782,16 @@ static JSArrayBuffer *js_get_array_buffer(JSContext *ctx, JSValueConst obj)
 
 /* return NULL if exception. WARNING: any JS call can detach the
    buffer and render the returned pointer invalid */
+BOOL JS_IsArrayBuffer(JSContext *ctx, JSValueConst val)
+{
+    JSObject *p;
+    if (JS_VALUE_GET_TAG(val) != JS_TAG_OBJECT)
+        return FALSE;
+    p = JS_VALUE_GET_OBJ(val);
+    return (p->class_id == JS_CLASS_ARRAY_BUFFER ||
+            p->class_id == JS_CLASS_SHARED_ARRAY_BUFFER);
+}
+
 uint8_t *JS_GetArrayBuffer(JSContext *ctx, size_t *psize, JSValueConst obj)
 {
     JSArrayBuffer *abuf = js_get_array_buffer(ctx, obj);
@@ -50018,6 +54033,42 @@ JSValue JS_GetTypedArrayBuffer(JSContext *ctx, JSValueConst obj,
     }
     return JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, ta->buffer));
 }
+
+/* TRUE if 'val' is a typed array or a DataView */
+BOOL JS_IsArrayBufferView(JSContext *ctx, JSValueConst val)
+{
+    JSObject *p;
+    if (JS_VALUE_GET_TAG(val) != JS_TAG_OBJECT)
+        return FALSE;
+    p = JS_VALUE_GET_OBJ(val);
+    return (p->class_id >= JS_CLASS_UINT8C_ARRAY &&
+            p->class_id <= JS_CLASS_DATAVIEW);
+}
+
+/* return the bytes viewed by a typed array or a DataView */
+uint8_t *JS_GetArrayBufferView(JSContext *ctx, size_t *psize, JSValueConst obj)
+{
+    JSObject *p;
+    JSTypedArray *ta;
+    JSArrayBuffer *abuf;
+
+    if (!JS_IsArrayBufferView(ctx, obj)) {
+        JS_ThrowTypeError(ctx, "not a TypedArray or DataView");
+        goto fail;
+    }
+    p = JS_VALUE_GET_OBJ(obj);
+    ta = p->u.typed_array;
+    abuf = ta->buffer->u.array_buffer;
+    if (abuf->detached) {
+        JS_ThrowTypeErrorDetachedArrayBuffer(ctx);
+        goto fail;
+    }
+    *psize = ta->length;
+    return abuf->data + ta->offset;
+ fail:
+    *psize = 0;
+    return NULL;
+}
                                
 static JSValue js_typed_array_get_toStringTag(JSContext *ctx,
                                               JSValueConst this_val)
@@ -50032,6 +54083,123 @@ static JSValue js_typed_array_get_toStringTag(JSContext *ctx,
     return JS_AtomToString(ctx, ctx->rt->class_array[p->class_id].class_name);
 }
 
+static inline BOOL typed_array_is_bigint(int class_id)
+{
+#ifdef CONFIG_BIGNUM
+    return (class_id == JS_CLASS_BIG_INT64_ARRAY ||
+            class_id == JS_CLASS_BIG_UINT64_ARRAY);
+#else
+    return FALSE;
+#endif
+}
+
+/* number of elements converted at once by typed_array_convert() */
+#define TA_CONVERT_CHUNK 256
+
+/* read 'len' elements of a non BigInt typed array as float64 */
+static void typed_array_get_float64(double *dst, const uint8_t *src,
+                                    int class_id, int len)
+{
+    int i;
+
+    switch(class_id) {
+    case JS_CLASS_UINT8C_ARRAY:
+    case JS_CLASS_UINT8_ARRAY:
+        for(i = 0; i < len; i++)
+            dst[i] = src[i];
+        break;
+    case JS_CLASS_INT8_ARRAY:
+        for(i = 0; i < len; i++)
+            dst[i] = ((const int8_t *)src)[i];
+        break;
+    case JS_CLASS_INT16_ARRAY:
+        for(i = 0; i < len; i++)
+            dst[i] = ((const int16_t *)src)[i];
+        break;
+    case JS_CLASS_UINT16_ARRAY:
+        for(i = 0; i < len; i++)
+            dst[i] = ((const uint16_t *)src)[i];
+        break;
+    case JS_CLASS_INT32_ARRAY:
+        for(i = 0; i < len; i++)
+            dst[i] = ((const int32_t *)src)[i];
+        break;
+    case JS_CLASS_UINT32_ARRAY:
+        for(i = 0; i < len; i++)
+            dst[i] = ((const uint32_t *)src)[i];
+        break;
+    case JS_CLASS_FLOAT32_ARRAY:
+        for(i = 0; i < len; i++)
+            dst[i] = ((const float *)src)[i];
+        break;
+    case JS_CLASS_FLOAT64_ARRAY:
+        memcpy(dst, src, len * sizeof(double));
+        break;
+    default:
+        abort();
+    }
+}
+
+/* store 'len' float64 values to a non BigInt typed array with the
+   same conversion as a property assignment */
+static void typed_array_put_float64(uint8_t *dst, int class_id,
+                                    const double *src, int len)
+{
+    int i;
+
+    switch(class_id) {
+    case JS_CLASS_UINT8C_ARRAY:
+        for(i = 0; i < len; i++)
+            dst[i] = js_float64_to_uint8_clamp(src[i]);
+        break;
+    case JS_CLASS_INT8_ARRAY:
+    case JS_CLASS_UINT8_ARRAY:
+        for(i = 0; i < len; i++)
+            dst[i] = js_float64_to_int32(src[i]);
+        break;
+    case JS_CLASS_INT16_ARRAY:
+    case JS_CLASS_UINT16_ARRAY:
+        for(i = 0; i < len; i++)
+            ((uint16_t *)dst)[i] = js_float64_to_int32(src[i]);
+        break;
+    case JS_CLASS_INT32_ARRAY:
+    case JS_CLASS_UINT32_ARRAY:
+        for(i = 0; i < len; i++)
+            ((uint32_t *)dst)[i] = js_float64_to_int32(src[i]);
+        break;
+    case JS_CLASS_FLOAT32_ARRAY:
+        for(i = 0; i < len; i++)
+            ((float *)dst)[i] = src[i];
+        break;
+    case JS_CLASS_FLOAT64_ARRAY:
+        memcpy(dst, src, len * sizeof(double));
+        break;
+    default:
+        abort();
+    }
+}
+
+/* copy 'len' elements between two non BigInt typed arrays of
+   different types. 'dst' and 'src' must not overlap. */
+static void typed_array_convert(uint8_t *dst, int dst_class_id,
+                                const uint8_t *src, int src_class_id,
+                                uint32_t len)
+{
+    double buf[TA_CONVERT_CHUNK];
+    int dst_shift, src_shift, n;
+
+    dst_shift = typed_array_size_log2(dst_class_id);
+    src_shift = typed_array_size_log2(src_class_id);
+    while (len > 0) {
+        n = min_uint32(len, TA_CONVERT_CHUNK);
+        typed_array_get_float64(buf, src, src_class_id, n);
+        typed_array_put_float64(dst, dst_class_id, buf, n);
+        src += n << src_shift;
+        dst += n << dst_shift;
+        len -= n;
+    }
+}
+
 static JSValue js_typed_array_set_internal(JSContext *ctx,
                                            JSValueConst dst,
                                            JSValueConst src,
@@ -50081,11 +54249,42 @@ static JSValue js_typed_array_set_internal(JSContext *ctx,
                     src_abuf->data + src_ta->offset, src_len << shift);
             goto done;
         }
-        if (dest_abuf->data == src_abuf->data) {
-            /* copying between the same buffer using different types of mappings
-               would require a temporary buffer */
+        if (typed_array_is_bigint(src_p->class_id) ||
+            typed_array_is_bigint(p->class_id)) {
+            if (typed_array_is_bigint(src_p->class_id) &&
+                typed_array_is_bigint(p->class_id)) {
+                /* BigInt64Array and BigUint64Array share the same
+                   representation */
+                memmove(dest_abuf->data + dest_ta->offset + (offset << shift),
+                        src_abuf->data + src_ta->offset, src_len << shift);
+                goto done;
+            }
+            /* mixing BigInt and Number elements throws: use the
+               generic path */
+        } else {
+            uint8_t *dst_ptr, *src_ptr, *tmp_buf;
+            size_t src_size;
+
+            dst_ptr = dest_abuf->data + dest_ta->offset + (offset << shift);
+            src_ptr = src_abuf->data + src_ta->offset;
+            src_size = src_len << typed_array_size_log2(src_p->class_id);
+            tmp_buf = NULL;
+            if (dest_abuf->data == src_abuf->data &&
+                src_ptr < dst_ptr + (src_len << shift) &&
+                dst_ptr < src_ptr + src_size) {
+                /* the source must be read entirely before it is
+                   overwritten */
+                tmp_buf = js_malloc(ctx, max_int(src_size, 1));
+                if (!tmp_buf)
+                    goto fail;
+                memcpy(tmp_buf, src_ptr, src_size);
+                src_ptr = tmp_buf;
+            }
+            typed_array_convert(dst_ptr, p->class_id, src_ptr,
+                                src_p->class_id, src_len);
+            js_free(ctx, tmp_buf);
+            goto done;
         }
-        /* otherwise, default behavior is slow but correct */
     } else {
         if (js_get_length64(ctx, &src_len, src_obj))
             goto fail;
@@ -50271,7 +54470,7 @@ static JSValue js_typed_array_from(JSContext *ctx, JSValueConst this_val,
         if (JS_IsException(arr))
             goto exception;
         stack[0] = JS_DupValue(ctx, items);
-        if (js_for_of_start(ctx, &stack[1], FALSE))
+        if (js_for_of_start(ctx, &stack[1], FALSE, FALSE))
             goto exception;
         for (k = 0;; k++) {
             v = JS_IteratorNext(ctx, stack[0], stack[1], 0, NULL, &done);
@@ -50382,6 +54581,9 @@ static JSValue js_typed_array_copyWithin(JSContext *ctx, JSValueConst this_val,
     return JS_DupValue(ctx, this_val);
 }
 
+/* maximum block size in bytes replicated by TypedArray.prototype.fill */
+#define TA_FILL_BLOCK_MAX 4096
+
 static JSValue js_typed_array_fill(JSContext *ctx, JSValueConst this_val,
                                    int argc, JSValueConst *argv)
 {
@@ -50445,29 +54647,44 @@ static JSValue js_typed_array_fill(JSContext *ctx, JSValueConst this_val,
         return JS_ThrowTypeErrorDetachedArrayBuffer(ctx);
     
     shift = typed_array_size_log2(p->class_id);
-    switch(shift) {
-    case 0:
-        if (k < final) {
-            memset(p->u.array.u.uint8_ptr + k, v64, final - k);
-        }
-        break;
-    case 1:
-        for(; k < final; k++) {
-            p->u.array.u.uint16_ptr[k] = v64;
-        }
-        break;
-    case 2:
-        for(; k < final; k++) {
-            p->u.array.u.uint32_ptr[k] = v64;
-        }
-        break;
-    case 3:
-        for(; k < final; k++) {
-            p->u.array.u.uint64_ptr[k] = v64;
+    if (k < final) {
+        uint8_t *ptr;
+        size_t size, n, l;
+
+        if (shift < 3)
+            v64 &= ((uint64_t)1 << (8 << shift)) - 1;
+        ptr = p->u.array.u.uint8_ptr + ((size_t)k << shift);
+        size = (size_t)(final - k) << shift;
+        if (v64 == (v64 & 0xff) * ((uint64_t)0x0101010101010101 >> (64 - (8 << shift)))) {
+            /* all the bytes are identical (e.g. 0 or -1) */
+            memset(ptr, v64, size);
+        } else {
+            switch(shift) {
+            case 1:
+                *(uint16_t *)ptr = v64;
+                break;
+            case 2:
+                *(uint32_t *)ptr = v64;
+                break;
+            case 3:
+                *(uint64_t *)ptr = v64;
+                break;
+            default:
+                abort();
+            }
+            /* replicate the pattern with block copies of increasing
+               size, bounded to stay in the cache */
+            n = (size_t)1 << shift;
+            while (n < size) {
+                l = n;
+                if (l > TA_FILL_BLOCK_MAX)
+                    l = TA_FILL_BLOCK_MAX;
+                if (l > size - n)
+                    l = size - n;
+                memcpy(ptr + n, ptr, l);
+                n += l;
+            }
         }
-        break;
-    default:
-        abort();
     }
     return JS_DupValue(ctx, this_val);
 }
@@ -50524,6 +54741,38 @@ exception:
     return JS_EXCEPTION;
 }
 
+/* forward search in a typed array. The inner loop of each block has
+   no early exit so that the compiler can vectorize it. */
+#define TA_SEARCH_BLOCK 16
+
+#define DEF_TA_SEARCH(name, type)                                       \
+static int name(const type *tab, int k, int len, type v)                \
+{                                                                       \
+    int i, found;                                                       \
+                                                                        \
+    while (len - k >= TA_SEARCH_BLOCK) {                                \
+        found = 0;                                                      \
+        for(i = 0; i < TA_SEARCH_BLOCK; i++)                            \
+            found |= (tab[k + i] == v);                                 \
+        if (found)                                                      \
+            break;                                                      \
+        k += TA_SEARCH_BLOCK;                                           \
+    }                                                                   \
+    for(; k < len; k++) {                                               \
+        if (tab[k] == v)                                                \
+            return k;                                                   \
+    }                                                                   \
+    return -1;                                                          \
+}
+
+DEF_TA_SEARCH(js_TA_search_u16, uint16_t)
+DEF_TA_SEARCH(js_TA_search_u32, uint32_t)
+DEF_TA_SEARCH(js_TA_search_f32, float)
+DEF_TA_SEARCH(js_TA_search_f64, double)
+#ifdef CONFIG_BIGNUM
+DEF_TA_SEARCH(js_TA_search_u64, uint64_t)
+#endif
+
 #define special_indexOf 0
 #define special_lastIndexOf 1
 #define special_includes -1
@@ -50653,10 +54902,14 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
         scan16:
             pv = p->u.array.u.uint16_ptr;
             v = v64;
-            for (; k != stop; k += inc) {
-                if (pv[k] == v) {
-                    res = k;
-                    break;
+            if (inc > 0) {
+                res = js_TA_search_u16(pv, k, len, v);
+            } else {
+                for (; k != stop; k += inc) {
+                    if (pv[k] == v) {
+                        res = k;
+                        break;
+                    }
                 }
             }
         }
@@ -50672,10 +54925,14 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
         scan32:
             pv = p->u.array.u.uint32_ptr;
             v = v64;
-            for (; k != stop; k += inc) {
-                if (pv[k] == v) {
-                    res = k;
-                    break;
+            if (inc > 0) {
+                res = js_TA_search_u32(pv, k, len, v);
+            } else {
+                for (; k != stop; k += inc) {
+                    if (pv[k] == v) {
+                        res = k;
+                        break;
+                    }
                 }
             }
         }
@@ -50696,10 +54953,14 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
             }
         } else if ((f = (float)d) == d) {
             const float *pv = p->u.array.u.float_ptr;
-            for (; k != stop; k += inc) {
-                if (pv[k] == f) {
-                    res = k;
-                    break;
+            if (inc > 0) {
+                res = js_TA_search_f32(pv, k, len, f);
+            } else {
+                for (; k != stop; k += inc) {
+                    if (pv[k] == f) {
+                        res = k;
+                        break;
+                    }
                 }
             }
         }
@@ -50720,10 +54981,14 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
             }
         } else {
             const double *pv = p->u.array.u.double_ptr;
-            for (; k != stop; k += inc) {
-                if (pv[k] == d) {
-                    res = k;
-                    break;
+            if (inc > 0) {
+                res = js_TA_search_f64(pv, k, len, d);
+            } else {
+                for (; k != stop; k += inc) {
+                    if (pv[k] == d) {
+                        res = k;
+                        break;
+                    }
                 }
             }
         }
@@ -50744,10 +55009,14 @@ static JSValue js_typed_array_indexOf(JSContext *ctx, JSValueConst this_val,
         scan64:
             pv = p->u.array.u.uint64_ptr;
             v = v64;
-            for (; k != stop; k += inc) {
-                if (pv[k] == v) {
-                    res = k;
-                    break;
+            if (inc > 0) {
+                res = js_TA_search_u64(pv, k, len, v);
+            } else {
+                for (; k != stop; k += inc) {
+                    if (pv[k] == v) {
+                        res = k;
+                        break;
+                    }
                 }
             }
         }
@@ -50991,67 +55260,6 @@ static JSValue js_typed_array_subarray(JSContext *ctx, JSValueConst this_val,
 
 /* TypedArray.prototype.sort */
 
-static int js_cmp_doubles(double x, double y)
-{
-    if (isnan(x))    return isnan(y) ? 0 : +1;
-    if (isnan(y))    return -1;
-    if (x < y)       return -1;
-    if (x > y)       return 1;
-    if (x != 0)      return 0;
-    if (signbit(x))  return signbit(y) ? 0 : -1;
-    else             return signbit(y) ? 1 : 0;
-}
-
-static int js_TA_cmp_int8(const void *a, const void *b, void *opaque) {
-    return *(const int8_t *)a - *(const int8_t *)b;
-}
-
-static int js_TA_cmp_uint8(const void *a, const void *b, void *opaque) {
-    return *(const uint8_t *)a - *(const uint8_t *)b;
-}
-
-static int js_TA_cmp_int16(const void *a, const void *b, void *opaque) {
-    return *(const int16_t *)a - *(const int16_t *)b;
-}
-
-static int js_TA_cmp_uint16(const void *a, const void *b, void *opaque) {
-    return *(const uint16_t *)a - *(const uint16_t *)b;
-}
-
-static int js_TA_cmp_int32(const void *a, const void *b, void *opaque) {
-    int32_t x = *(const int32_t *)a;
-    int32_t y = *(const int32_t *)b;
-    return (y < x) - (y > x);
-}
-
-static int js_TA_cmp_uint32(const void *a, const void *b, void *opaque) {
-    uint32_t x = *(const uint32_t *)a;
-    uint32_t y = *(const uint32_t *)b;
-    return (y < x) - (y > x);
-}
-
-#ifdef CONFIG_BIGNUM
-static int js_TA_cmp_int64(const void *a, const void *b, void *opaque) {
-    int64_t x = *(const int64_t *)a;
-    int64_t y = *(const int64_t *)b;
-    return (y < x) - (y > x);
-}
-
-static int js_TA_cmp_uint64(const void *a, const void *b, void *opaque) {
-    uint64_t x = *(const uint64_t *)a;
-    uint64_t y = *(const uint64_t *)b;
-    return (y < x) - (y > x);
-}
-#endif
-
-static int js_TA_cmp_float32(const void *a, const void *b, void *opaque) {
-    return js_cmp_doubles(*(const float *)a, *(const float *)b);
-}
-
-static int js_TA_cmp_float64(const void *a, const void *b, void *opaque) {
-    return js_cmp_doubles(*(const double *)a, *(const double *)b);
-}
-
 static JSValue js_TA_get_int8(JSContext *ctx, const void *a) {
     return JS_NewInt32(ctx, *(const int8_t *)a);
 }
@@ -51151,6 +55359,288 @@ static int js_TA_cmp_generic(const void *a, const void *b, void *opaque) {
     return cmp;
 }
 
+/* Default TypedArray sort: the elements are converted in place to
+   unsigned integers having the same order, sorted with a sorting
+   network (small arrays) or a LSD radix sort, and converted back. */
+
+/* largest array sorted with a sorting network */
+#define TA_SORT_NETWORK_MAX 16
+
+/* Batcher's odd-even merge sort network for 16 elements. Smaller
+   arrays are sorted by skipping the comparators involving the missing
+   elements (they would behave as elements larger than all the
+   others). */
+static const uint8_t js_TA_sort_network[63][2] = {
+    { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 }, { 8, 9 }, { 10, 11 }, { 12, 13 },
+    { 14, 15 }, { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 }, { 8, 10 }, { 9, 11 },
+    { 12, 14 }, { 13, 15 }, { 1, 2 }, { 5, 6 }, { 9, 10 }, { 13, 14 },
+    { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }, { 8, 12 }, { 9, 13 }, { 10, 14 },
+    { 11, 15 }, { 2, 4 }, { 3, 5 }, { 10, 12 }, { 11, 13 }, { 1, 2 },
+    { 3, 4 }, { 5, 6 }, { 9, 10 }, { 11, 12 }, { 13, 14 }, { 0, 8 }, { 1, 9 },
+    { 2, 10 }, { 3, 11 }, { 4, 12 }, { 5, 13 }, { 6, 14 }, { 7, 15 },
+    { 4, 8 }, { 5, 9 }, { 6, 10 }, { 7, 11 }, { 2, 4 }, { 3, 5 }, { 6, 8 },
+    { 7, 9 }, { 10, 12 }, { 11, 13 }, { 1, 2 }, { 3, 4 }, { 5, 6 }, { 7, 8 },
+    { 9, 10 }, { 11, 12 }, { 13, 14 }
+};
+
+#define DEF_TA_SORT_SMALL(name, type)                                   \
+static void name(type *tab, int len)                                    \
+{                                                                       \
+    int i, a, b;                                                        \
+    type x, y;                                                          \
+                                                                        \
+    for(i = 0; i < countof(js_TA_sort_network); i++) {                  \
+        a = js_TA_sort_network[i][0];                                   \
+        b = js_TA_sort_network[i][1];                                   \
+        if (b < len) {                                                  \
+            x = tab[a];                                                 \
+            y = tab[b];                                                 \
+            tab[a] = x < y ? x : y;                                     \
+            tab[b] = x < y ? y : x;                                     \
+        }                                                               \
+    }                                                                   \
+}
+
+/* 'tmp' must have room for 'len' elements and 'count' for
+   sizeof(type) tables of 256 counters. They are allocated by the
+   caller to keep the native stack small. */
+#define DEF_TA_RADIX_SORT(name, type)                                   \
+static void name(type *tab, type *tmp, uint32_t (*count)[256],          \
+                 uint32_t len)                                          \
+{                                                                       \
+    uint32_t pos, n, i;                                                 \
+    type *src, *dst, *t, v;                                             \
+    int d, c;                                                           \
+                                                                        \
+    memset(count, 0, sizeof(count[0]) * sizeof(type));                  \
+    for(i = 0; i < len; i++) {                                          \
+        v = tab[i];                                                     \
+        for(d = 0; d < sizeof(type); d++)                               \
+            count[d][(v >> (d * 8)) & 0xff]++;                          \
+    }                                                                   \
+    src = tab;                                                          \
+    dst = tmp;                                                          \
+    for(d = 0; d < sizeof(type); d++) {                                 \
+        /* skip the digits which are identical in all the elements */  \
+        if (count[d][(tab[0] >> (d * 8)) & 0xff] == len)                \
+            continue;                                                   \
+        pos = 0;                                                        \
+        for(c = 0; c < 256; c++) {                                      \
+            n = count[d][c];                                            \
+            count[d][c] = pos;                                          \
+            pos += n;                                                   \
+        }                                                               \
+        for(i = 0; i < len; i++) {                                      \
+            v = src[i];                                                 \
+            dst[count[d][(v >> (d * 8)) & 0xff]++] = v;                 \
+        }                                                               \
+        t = src;                                                        \
+        src = dst;                                                      \
+        dst = t;                                                        \
+    }                                                                   \
+    if (src != tab)                                                     \
+        memcpy(tab, src, len * sizeof(type));                           \
+}
+
+DEF_TA_SORT_SMALL(js_TA_sort_small_u8, uint8_t)
+DEF_TA_SORT_SMALL(js_TA_sort_small_u16, uint16_t)
+DEF_TA_SORT_SMALL(js_TA_sort_small_u32, uint32_t)
+DEF_TA_SORT_SMALL(js_TA_sort_small_u64, uint64_t)
+DEF_TA_RADIX_SORT(js_TA_radix_sort_u16, uint16_t)
+DEF_TA_RADIX_SORT(js_TA_radix_sort_u32, uint32_t)
+DEF_TA_RADIX_SORT(js_TA_radix_sort_u64, uint64_t)
+
+#define DEF_TA_CMP_UNSIGNED(name, type)                                 \
+static int name(const void *a, const void *b, void *opaque)             \
+{                                                                       \
+    type x = *(const type *)a, y = *(const type *)b;                    \
+    return (x > y) - (x < y);                                           \
+}
+
+DEF_TA_CMP_UNSIGNED(js_TA_cmp_u16, uint16_t)
+DEF_TA_CMP_UNSIGNED(js_TA_cmp_u32, uint32_t)
+DEF_TA_CMP_UNSIGNED(js_TA_cmp_u64, uint64_t)
+
+static void js_TA_counting_sort_u8(uint8_t *tab, uint32_t len)
+{
+    uint32_t count[256], i;
+    int c;
+
+    memset(count, 0, sizeof(count));
+    for(i = 0; i < len; i++)
+        count[tab[i]]++;
+    for(c = 0; c < 256; c++) {
+        memset(tab, c, count[c]);
+        tab += count[c];
+    }
+}
+
+/* convert the elements to (or from if 'inverse' is TRUE) unsigned
+   integers with the same ordering. For floats, -0 is sorted before +0
+   and the NaNs must have been removed. */
+static void js_TA_convert_sort_keys(void *ptr, uint32_t len, int class_id,
+                                    BOOL inverse)
+{
+    uint32_t i;
+
+    switch(class_id) {
+    case JS_CLASS_INT8_ARRAY:
+        for(i = 0; i < len; i++)
+            ((uint8_t *)ptr)[i] ^= 0x80;
+        break;
+    case JS_CLASS_INT16_ARRAY:
+        for(i = 0; i < len; i++)
+            ((uint16_t *)ptr)[i] ^= 0x8000;
+        break;
+    case JS_CLASS_INT32_ARRAY:
+        for(i = 0; i < len; i++)
+            ((uint32_t *)ptr)[i] ^= 0x80000000;
+        break;
+#ifdef CONFIG_BIGNUM
+    case JS_CLASS_BIG_INT64_ARRAY:
+        for(i = 0; i < len; i++)
+            ((uint64_t *)ptr)[i] ^= (uint64_t)1 << 63;
+        break;
+#endif
+    case JS_CLASS_FLOAT32_ARRAY:
+        {
+            uint32_t *tab = ptr, v;
+            for(i = 0; i < len; i++) {
+                v = tab[i];
+                if (inverse)
+                    tab[i] = (v >> 31) ? (v ^ 0x80000000) : ~v;
+                else
+                    tab[i] = (v >> 31) ? ~v : (v | 0x80000000);
+            }
+        }
+        break;
+    case JS_CLASS_FLOAT64_ARRAY:
+        {
+            uint64_t *tab = ptr, v;
+            for(i = 0; i < len; i++) {
+                v = tab[i];
+                if (inverse)
+                    tab[i] = (v >> 63) ? (v ^ ((uint64_t)1 << 63)) : ~v;
+                else
+                    tab[i] = (v >> 63) ? ~v : (v | ((uint64_t)1 << 63));
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* move the NaNs at the end of the array and return the number of
+   other elements */
+static uint32_t js_TA_sort_nan_last(void *ptr, uint32_t len, int class_id)
+{
+    uint32_t i, n;
+
+    n = 0;
+    if (class_id == JS_CLASS_FLOAT32_ARRAY) {
+        uint32_t *tab = ptr, v;
+        for(i = 0; i < len; i++) {
+            v = tab[i];
+            if ((v & 0x7fffffff) <= 0x7f800000) {
+                tab[i] = tab[n];
+                tab[n++] = v;
+            }
+        }
+    } else {
+        uint64_t *tab = ptr, v;
+        for(i = 0; i < len; i++) {
+            v = tab[i];
+            if ((v & (((uint64_t)1 << 63) - 1)) <= ((uint64_t)0x7ff << 52)) {
+                tab[i] = tab[n];
+                tab[n++] = v;
+            }
+        }
+    }
+    return n;
+}
+
+/* sort 'len' unsigned integers of 'elt_size' bytes. The radix sort
+   needs a temporary buffer: if it cannot be allocated, the elements
+   are sorted in place with rqsort(). */
+static void js_TA_sort_unsigned(JSContext *ctx, void *array_ptr, uint32_t len,
+                                int elt_size)
+{
+    uint32_t (*count)[256];
+    void *tmp;
+
+    if (elt_size == 1 && len > TA_SORT_NETWORK_MAX) {
+        js_TA_counting_sort_u8(array_ptr, len);
+    } else if (len <= TA_SORT_NETWORK_MAX) {
+        switch(elt_size) {
+        case 1:
+            js_TA_sort_small_u8(array_ptr, len);
+            break;
+        case 2:
+            js_TA_sort_small_u16(array_ptr, len);
+            break;
+        case 4:
+            js_TA_sort_small_u32(array_ptr, len);
+            break;
+        case 8:
+            js_TA_sort_small_u64(array_ptr, len);
+            break;
+        default:
+            abort();
+        }
+    } else {
+        /* the counters come first so that 'tmp' is aligned */
+        count = js_malloc_rt(ctx->rt, sizeof(count[0]) * elt_size +
+                             (size_t)len * elt_size);
+        if (!count) {
+            switch(elt_size) {
+            case 2:
+                rqsort(array_ptr, len, elt_size, js_TA_cmp_u16, NULL);
+                break;
+            case 4:
+                rqsort(array_ptr, len, elt_size, js_TA_cmp_u32, NULL);
+                break;
+            case 8:
+                rqsort(array_ptr, len, elt_size, js_TA_cmp_u64, NULL);
+                break;
+            default:
+                abort();
+            }
+            return;
+        }
+        tmp = count + elt_size;
+        switch(elt_size) {
+        case 2:
+            js_TA_radix_sort_u16(array_ptr, tmp, count, len);
+            break;
+        case 4:
+            js_TA_radix_sort_u32(array_ptr, tmp, count, len);
+            break;
+        case 8:
+            js_TA_radix_sort_u64(array_ptr, tmp, count, len);
+            break;
+        default:
+            abort();
+        }
+        js_free_rt(ctx->rt, count);
+    }
+}
+
+static void js_TA_sort_default(JSContext *ctx, void *array_ptr, uint32_t len,
+                               int class_id)
+{
+    if (class_id == JS_CLASS_FLOAT32_ARRAY ||
+        class_id == JS_CLASS_FLOAT64_ARRAY) {
+        len = js_TA_sort_nan_last(array_ptr, len, class_id);
+    }
+    if (len <= 1)
+        return;
+    js_TA_convert_sort_keys(array_ptr, len, class_id, FALSE);
+    js_TA_sort_unsigned(ctx, array_ptr, len,
+                        1 << typed_array_size_log2(class_id));
+    js_TA_convert_sort_keys(array_ptr, len, class_id, TRUE);
+}
+
 static JSValue js_typed_array_sort(JSContext *ctx, JSValueConst this_val,
                                    int argc, JSValueConst *argv)
 {
@@ -51159,7 +55649,6 @@ static JSValue js_typed_array_sort(JSContext *ctx, JSValueConst this_val,
     size_t elt_size;
     struct TA_sort_context tsc;
     void *array_ptr;
-    int (*cmpfun)(const void *a, const void *b, void *opaque);
 
     tsc.ctx = ctx;
     tsc.exception = 0;
@@ -51177,46 +55666,36 @@ static JSValue js_typed_array_sort(JSContext *ctx, JSValueConst this_val,
         switch (p->class_id) {
         case JS_CLASS_INT8_ARRAY:
             tsc.getfun = js_TA_get_int8;
-            cmpfun = js_TA_cmp_int8;
             break;
         case JS_CLASS_UINT8C_ARRAY:
         case JS_CLASS_UINT8_ARRAY:
             tsc.getfun = js_TA_get_uint8;
-            cmpfun = js_TA_cmp_uint8;
             break;
         case JS_CLASS_INT16_ARRAY:
             tsc.getfun = js_TA_get_int16;
-            cmpfun = js_TA_cmp_int16;
             break;
         case JS_CLASS_UINT16_ARRAY:
             tsc.getfun = js_TA_get_uint16;
-            cmpfun = js_TA_cmp_uint16;
             break;
         case JS_CLASS_INT32_ARRAY:
             tsc.getfun = js_TA_get_int32;
-            cmpfun = js_TA_cmp_int32;
             break;
         case JS_CLASS_UINT32_ARRAY:
             tsc.getfun = js_TA_get_uint32;
-            cmpfun = js_TA_cmp_uint32;
             break;
 #ifdef CONFIG_BIGNUM
         case JS_CLASS_BIG_INT64_ARRAY:
             tsc.getfun = js_TA_get_int64;
-            cmpfun = js_TA_cmp_int64;
             break;
         case JS_CLASS_BIG_UINT64_ARRAY:
             tsc.getfun = js_TA_get_uint64;
-            cmpfun = js_TA_cmp_uint64;
             break;
 #endif
         case JS_CLASS_FLOAT32_ARRAY:
             tsc.getfun = js_TA_get_float32;
-            cmpfun = js_TA_cmp_float32;
             break;
         case JS_CLASS_FLOAT64_ARRAY:
             tsc.getfun = js_TA_get_float64;
-            cmpfun = js_TA_cmp_float64;
             break;
         default:
             abort();
@@ -51278,9 +55757,7 @@ static JSValue js_typed_array_sort(JSContext *ctx, JSValueConst this_val,
             js_free(ctx, array_tmp);
             js_free(ctx, array_idx);
         } else {
-            rqsort(array_ptr, len, elt_size, cmpfun, &tsc);
-            if (tsc.exception)
-                return JS_EXCEPTION;
+            js_TA_sort_default(ctx, array_ptr, len, p->class_id);
         }
     }
     return JS_DupValue(ctx, this_val);
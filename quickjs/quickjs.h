@@ -72,6 +72,7 @@ enum {
     JS_TAG_BIG_FLOAT   = -9,
     JS_TAG_SYMBOL      = -8,
     JS_TAG_STRING      = -7,
+    JS_TAG_STRING_ROPE = -6, /* used internally */
     JS_TAG_MODULE      = -3, /* used internally */
     JS_TAG_FUNCTION_BYTECODE = -2, /* used internally */
     JS_TAG_OBJECT      = -1,
@@ -291,6 +292,7 @@ static inline JS_BOOL JS_VALUE_IS_NAN(JSValue v)
 #define JS_PROP_NO_EXOTIC        (1 << 17) /* internal use */
 
 #define JS_DEFAULT_STACK_SIZE (256 * 1024)
+#define JS_DEFAULT_REGEXP_CACHE_SIZE (64 * 1024)
 
 /* JS_Eval() flags */
 #define JS_EVAL_TYPE_GLOBAL   (0 << 0) /* global code (default) */
@@ -314,6 +316,7 @@ typedef JSValue JSCFunctionData(JSContext *ctx, JSValueConst this_val, int argc,
 
 typedef struct JSMallocState {
     size_t malloc_count;
+    size_t malloc_total_count; /* blocks allocated since the start */
     size_t malloc_size;
     size_t malloc_limit;
     void *opaque; /* user opaque */
@@ -337,6 +340,8 @@ void JS_SetRuntimeInfo(JSRuntime *rt, const char *info);
 void JS_SetMemoryLimit(JSRuntime *rt, size_t limit);
 void JS_SetGCThreshold(JSRuntime *rt, size_t gc_threshold);
 void JS_SetMaxStackSize(JSRuntime *rt, size_t stack_size);
+/* max memory used by the cache of the compiled regexps (0 to disable it) */
+void JS_SetRegExpCacheSize(JSRuntime *rt, size_t max_size);
 JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque);
 void JS_FreeRuntime(JSRuntime *rt);
 void *JS_GetRuntimeOpaque(JSRuntime *rt);
@@ -397,7 +402,7 @@ char *js_strndup(JSContext *ctx, const char *s, size_t n);
 
 typedef struct JSMemoryUsage {
     int64_t malloc_size, malloc_limit, memory_used_size;
-    int64_t malloc_count;
+    int64_t malloc_count, malloc_total_count;
     int64_t memory_used_count;
     int64_t atom_count, atom_size;
     int64_t str_count, str_size;
@@ -409,6 +414,12 @@ typedef struct JSMemoryUsage {
     int64_t c_func_count, array_count;
     int64_t fast_array_count, fast_array_elements;
     int64_t binary_object_count, binary_object_size;
+    int64_t regexp_cache_count, regexp_cache_size;
+    int64_t regexp_cache_hits, regexp_cache_misses;
+    int64_t atom_hash_size, atom_hash_count;
+    int64_t atom_probe_max, atom_probe_total;
+    int64_t nursery_chunk_count, nursery_size;
+    int64_t nursery_alloc_count, nursery_reuse_count;
 } JSMemoryUsage;
 
 void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s);
@@ -417,10 +428,13 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s);
 /* atom support */
 JSAtom JS_NewAtomLen(JSContext *ctx, const char *str, size_t len);
 JSAtom JS_NewAtom(JSContext *ctx, const char *str);
+int JS_NewAtomList(JSContext *ctx, JSAtom *atoms, const char * const *names,
+                   int count);
 JSAtom JS_NewAtomUInt32(JSContext *ctx, uint32_t n);
 JSAtom JS_DupAtom(JSContext *ctx, JSAtom v);
 void JS_FreeAtom(JSContext *ctx, JSAtom v);
 void JS_FreeAtomRT(JSRuntime *rt, JSAtom v);
+void JS_FreeAtomList(JSContext *ctx, JSAtom *atoms, int count);
 JSValue JS_AtomToValue(JSContext *ctx, JSAtom atom);
 JSValue JS_AtomToString(JSContext *ctx, JSAtom atom);
 const char *JS_AtomToCString(JSContext *ctx, JSAtom atom);
@@ -611,7 +625,8 @@ static inline JS_BOOL JS_IsUninitialized(JSValueConst v)
 
 static inline JS_BOOL JS_IsString(JSValueConst v)
 {
-    return JS_VALUE_GET_TAG(v) == JS_TAG_STRING;
+    return JS_VALUE_GET_TAG(v) == JS_TAG_STRING ||
+        JS_VALUE_GET_TAG(v) == JS_TAG_STRING_ROPE;
 }
 
 static inline JS_BOOL JS_IsSymbol(JSValueConst v)
@@ -704,6 +719,7 @@ static inline const char *JS_ToCString(JSContext *ctx, JSValueConst val1)
     return JS_ToCStringLen2(ctx, NULL, val1, 0);
 }
 void JS_FreeCString(JSContext *ctx, const char *ptr);
+const char *JS_ToCStringBorrow(JSContext *ctx, size_t *plen, JSValueConst val);
 
 JSValue JS_NewObjectProtoClass(JSContext *ctx, JSValueConst proto, JSClassID class_id);
 JSValue JS_NewObjectClass(JSContext *ctx, int class_id);
@@ -799,8 +815,29 @@ void *JS_GetOpaque2(JSContext *ctx, JSValueConst obj, JSClassID class_id);
 /* 'buf' must be zero terminated i.e. buf[buf_len] = '\0'. */
 JSValue JS_ParseJSON(JSContext *ctx, const char *buf, size_t buf_len,
                      const char *filename);
+
+/* incremental JSON parser */
+typedef struct JSJSONParser JSJSONParser;
+/* called with each complete top level value, which it must free.
+   Return -1 if exception. */
+typedef int JSJSONValueFunc(JSContext *ctx, JSValue val, void *opaque);
+JSJSONParser *JS_NewJSONParser(JSContext *ctx, JSJSONValueFunc *func,
+                               void *opaque);
+int JS_JSONParserFeed(JSJSONParser *jp, const char *buf, size_t len);
+int JS_JSONParserEnd(JSJSONParser *jp);
+void JS_ResetJSONParser(JSJSONParser *jp);
+void JS_MarkJSONParser(JSRuntime *rt, JSJSONParser *jp,
+                       JS_MarkFunc *mark_func);
+void JS_FreeJSONParser(JSJSONParser *jp);
+
 JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
                          JSValueConst replacer, JSValueConst space0);
+/* called with each chunk of the UTF-8 output. Return -1 if exception. */
+typedef int JSJSONWriteFunc(JSContext *ctx, void *opaque,
+                            const uint8_t *buf, size_t len);
+int JS_JSONStringifyWrite(JSContext *ctx, JSJSONWriteFunc *write_func,
+                          void *opaque, JSValueConst obj,
+                          JSValueConst replacer, JSValueConst space0);
 
 typedef void JSFreeArrayBufferDataFunc(JSRuntime *rt, void *opaque, void *ptr);
 JSValue JS_NewArrayBuffer(JSContext *ctx, uint8_t *buf, size_t len,
@@ -808,11 +845,21 @@ JSValue JS_NewArrayBuffer(JSContext *ctx, uint8_t *buf, size_t len,
                           JS_BOOL is_shared);
 JSValue JS_NewArrayBufferCopy(JSContext *ctx, const uint8_t *buf, size_t len);
 void JS_DetachArrayBuffer(JSContext *ctx, JSValueConst obj);
+JS_BOOL JS_IsArrayBuffer(JSContext *ctx, JSValueConst val);
 uint8_t *JS_GetArrayBuffer(JSContext *ctx, size_t *psize, JSValueConst obj);
 JSValue JS_GetTypedArrayBuffer(JSContext *ctx, JSValueConst obj,
                                size_t *pbyte_offset,
                                size_t *pbyte_length,
                                size_t *pbytes_per_element);
+JS_BOOL JS_IsArrayBufferView(JSContext *ctx, JSValueConst val);
+uint8_t *JS_GetArrayBufferView(JSContext *ctx, size_t *psize, JSValueConst obj);
+
+JSValue JS_NewDate(JSContext *ctx, double epoch_ms);
+JS_BOOL JS_IsDate(JSContext *ctx, JSValueConst val);
+int JS_GetDateValue(JSContext *ctx, double *pres, JSValueConst obj);
+JS_BOOL JS_IsMap(JSContext *ctx, JSValueConst val);
+JS_BOOL JS_IsSet(JSContext *ctx, JSValueConst val);
+JSValue JS_GetPrimitiveObjectValue(JSContext *ctx, JSValueConst val);
 
 JSValue JS_NewPromiseCapability(JSContext *ctx, JSValue *resolving_funcs);
 
@@ -0,0 +1,57 @@
+/*
+ * string concatenation micro benchmark
+ *
+ * measures the cost of accumulating a string with 's += chunk', as when
+ * the chunks read from a socket are appended to a buffer, for several
+ * chunk sizes, and the cost of then reading the accumulated string
+ * (which flattens it). Run with a shell providing print.
+ */
+"use strict";
+
+var TOTAL = 8 * 1024 * 1024;
+
+function make_chunk(size) {
+    var s = "", i;
+    for(i = 0; i < size; i++)
+        s += String.fromCharCode(97 + (i % 26));
+    return s;
+}
+
+function accumulate(chunk_size) {
+    var chunk = make_chunk(chunk_size);
+    var n = TOTAL / chunk_size, s = "", i, t0, t1, t2, c;
+
+    t0 = Date.now();
+    for(i = 0; i < n; i++)
+        s += chunk;
+    t1 = Date.now();
+    /* first access after the accumulation */
+    c = s.charCodeAt(s.length >> 1);
+    t2 = Date.now();
+    if (s.length != TOTAL || c != chunk.charCodeAt((TOTAL >> 1) % chunk_size))
+        throw new Error("bad result");
+    print("chunk " + chunk_size + ": " + n + " appends in " + (t1 - t0) +
+          " ms, " + ((t1 - t0) ? Math.round(n / (t1 - t0)) : n) +
+          " per ms, first read " + (t2 - t1) + " ms");
+}
+
+function accumulate_prefix(chunk_size) {
+    /* 'chunk + s' appends on the left, as when prepending a header */
+    var chunk = make_chunk(chunk_size);
+    var n = TOTAL / chunk_size / 8, s = "", i, t0, t1;
+
+    t0 = Date.now();
+    for(i = 0; i < n; i++)
+        s = chunk + s;
+    t1 = Date.now();
+    if (s.length != n * chunk_size)
+        throw new Error("bad result");
+    print("prefix chunk " + chunk_size + ": " + n + " prepends in " +
+          (t1 - t0) + " ms");
+}
+
+accumulate(16);
+accumulate(256);
+accumulate(4096);
+accumulate(65536);
+accumulate_prefix(256);
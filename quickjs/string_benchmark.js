@@ -0,0 +1,112 @@
+/*
+ * string primitives micro benchmark
+ *
+ * measures indexOf/lastIndexOf/includes, equality and relational
+ * comparison, and UTF-8 encoding (JS_ToCStringLen) and decoding
+ * (JS_NewStringLen) on 8 bit strings (ASCII and Latin-1) and on 16 bit
+ * strings. The UTF-8 tests encode and decode long text strings with
+ * cbor.encode/cbor.decode and are skipped without the cbor module.
+ * Run with a shell providing print.
+ */
+"use strict";
+
+var LEN = 64 * 1024;
+var BYTES = 64 * 1024 * 1024; /* characters processed by each test */
+
+/* a flat string of 'len' characters repeating 'pattern' */
+function make_string(pattern, len) {
+    var tab = [], n = 0;
+    while (n < len) {
+        tab.push(pattern);
+        n += pattern.length;
+    }
+    return tab.join("").substring(0, len);
+}
+
+function report(name, chars, t0) {
+    var ms = Date.now() - t0;
+    print(name + ": " + ms + " ms, " +
+          (ms ? Math.round(chars / ms / 1000) : "-") + " MB/s");
+}
+
+function bench_search(name, s, needle) {
+    var rounds = BYTES / s.length, i, r, t0;
+
+    r = 0;
+    t0 = Date.now();
+    for(i = 0; i < rounds; i++)
+        r += s.indexOf(needle);
+    report(name + " indexOf", rounds * s.length, t0);
+    if (r != rounds * (s.length - needle.length))
+        throw new Error("bad indexOf");
+
+    r = 0;
+    t0 = Date.now();
+    for(i = 0; i < rounds; i++)
+        r += s.lastIndexOf("!" + needle) + 1;
+    report(name + " lastIndexOf (absent)", rounds * s.length, t0);
+    if (r != 0)
+        throw new Error("bad lastIndexOf");
+
+    r = 0;
+    t0 = Date.now();
+    for(i = 0; i < rounds; i++)
+        r += s.includes(needle + "!");
+    report(name + " includes (absent)", rounds * s.length, t0);
+    if (r != 0)
+        throw new Error("bad includes");
+}
+
+function bench_compare(name, pattern, last) {
+    /* distinct strings with the same characters, then a string
+       differing only by its last character */
+    var a = make_string(pattern, LEN), b = make_string(pattern, LEN);
+    var c = [a.substring(0, LEN - 1), last].join("");
+    var rounds = BYTES / LEN, i, r, t0;
+
+    r = 0;
+    t0 = Date.now();
+    for(i = 0; i < rounds; i++)
+        r += (a === b);
+    report(name + " ===", rounds * LEN, t0);
+    if (r != rounds)
+        throw new Error("bad ===");
+
+    r = 0;
+    t0 = Date.now();
+    for(i = 0; i < rounds; i++)
+        r += (a < c);
+    report(name + " <", rounds * LEN, t0);
+    if (r != rounds)
+        throw new Error("bad <");
+}
+
+function bench_utf8(name, s) {
+    var rounds = BYTES / s.length / 4, i, b, t0, d;
+
+    t0 = Date.now();
+    for(i = 0; i < rounds; i++)
+        b = cbor.encode(s);
+    report(name + " UTF-8 encode", rounds * s.length, t0);
+
+    t0 = Date.now();
+    for(i = 0; i < rounds; i++)
+        d = cbor.decode(b);
+    report(name + " UTF-8 decode", rounds * s.length, t0);
+    if (d !== s)
+        throw new Error("bad UTF-8 round trip");
+}
+
+var ascii = make_string("GET /index.html HTTP/1.1\r\nHost: node\r\n", LEN - 6) + "needle";
+var latin1 = make_string("température 21°C; ", LEN - 6) + "needle";
+var wide = make_string("温度 21°C €; ", LEN - 6) + "needle";
+
+bench_search("ascii", ascii, "needle");
+bench_search("16 bit", wide, "needle");
+bench_compare("ascii", "abcdefgh", "i");
+bench_compare("16 bit", "abc€defg", "i");
+if (typeof cbor == "object") {
+    bench_utf8("ascii", ascii);
+    bench_utf8("latin1", latin1);
+    bench_utf8("16 bit", wide);
+}